@@ -0,0 +1,94 @@
+#include "aliasing_planner.h"
+#include <algorithm>
+#include <numeric>
+
+uint32_t AliasingPlanner::add_resource(const resource &resource_to_add) {
+	resources.push_back(resource_to_add);
+	return resources.size() - 1;
+}
+
+void AliasingPlanner::plan() {
+	placements.assign(resources.size(), {0, 0});
+	memory_blocks.clear();
+
+	// Bigger resources are placed first, so that the smaller ones fill the gaps left
+	std::vector<uint32_t> placing_order(resources.size());
+	std::iota(placing_order.begin(), placing_order.end(), 0);
+	std::stable_sort(placing_order.begin(), placing_order.end(), [&](uint32_t a, uint32_t b) { return resources[a].size > resources[b].size; });
+
+	std::vector<uint32_t> placed;
+	for (uint32_t i : placing_order) {
+		const resource &to_place = resources[i];
+
+		// We look for a block with a compatible memory type, otherwise we create a new one
+		uint32_t block_idx = 0;
+		while (block_idx < memory_blocks.size() && (memory_blocks[block_idx].memory_type_bits & to_place.memory_type_bits) == 0) {
+			block_idx++;
+		}
+		if (block_idx == memory_blocks.size()) {
+			memory_blocks.push_back({0, 1, to_place.memory_type_bits});
+		}
+
+		// Memory ranges already taken in this block by resources alive at the same time, sorted by offset
+		std::vector<std::pair<uint64_t, uint64_t>> taken_ranges;
+		for (uint32_t j : placed) {
+			if (placements[j].memory_block == block_idx && lifetimes_overlap(to_place, resources[j])) {
+				taken_ranges.emplace_back(placements[j].offset, placements[j].offset + resources[j].size);
+			}
+		}
+		std::sort(taken_ranges.begin(), taken_ranges.end());
+
+		// First fit, the candidate offset is pushed after every range it collides with
+		uint64_t offset = 0;
+		for (const auto& range : taken_ranges) {
+			if (offset + to_place.size <= range.first) {
+				break;
+			}
+			offset = std::max(offset, (range.second + to_place.alignment - 1) / to_place.alignment * to_place.alignment);
+		}
+
+		placements[i] = {block_idx, offset};
+		memory_blocks[block_idx].size = std::max(memory_blocks[block_idx].size, offset + to_place.size);
+		memory_blocks[block_idx].alignment = std::max(memory_blocks[block_idx].alignment, to_place.alignment);
+		memory_blocks[block_idx].memory_type_bits &= to_place.memory_type_bits;
+		placed.push_back(i);
+	}
+}
+
+bool AliasingPlanner::is_aliasing_barrier_needed(uint32_t stage) const {
+	for (uint32_t i = 0; i < resources.size(); i++) {
+		if (resources[i].first_stage != stage) {
+			continue;
+		}
+		for (uint32_t j = 0; j < resources.size(); j++) {
+			bool same_memory = placements[i].memory_block == placements[j].memory_block &&
+					placements[i].offset < placements[j].offset + resources[j].size && placements[j].offset < placements[i].offset + resources[i].size;
+			// The stages repeat every frame, so resources of later stages were alive before this one too
+			bool alive_at_stage = resources[j].first_stage <= stage && stage <= resources[j].last_stage;
+			if (!alive_at_stage && same_memory) {
+				return true;
+			}
+		}
+	}
+	return false;
+}
+
+uint64_t AliasingPlanner::get_unaliased_size() const {
+	uint64_t size = 0;
+	for (const auto& r : resources) {
+		size += r.size;
+	}
+	return size;
+}
+
+uint64_t AliasingPlanner::get_aliased_size() const {
+	uint64_t size = 0;
+	for (const auto& block : memory_blocks) {
+		size += block.size;
+	}
+	return size;
+}
+
+bool AliasingPlanner::lifetimes_overlap(const resource &a, const resource &b) {
+	return a.first_stage <= b.last_stage && b.first_stage <= a.last_stage;
+}
@@ -0,0 +1,47 @@
+#ifndef THEVULKANTEMPLE_ALIASING_PLANNER_H
+#define THEVULKANTEMPLE_ALIASING_PLANNER_H
+
+#include <vector>
+#include <cstdint>
+
+// Places resources with a known lifetime, expressed as a range of stages, into shared memory blocks so that resources
+// which are never alive at the same time can occupy the same memory
+class AliasingPlanner {
+	public:
+		struct resource {
+			uint64_t size;
+			uint64_t alignment;
+			uint32_t memory_type_bits;
+			uint32_t first_stage;
+			uint32_t last_stage;
+		};
+		struct placement {
+			uint32_t memory_block;
+			uint64_t offset;
+		};
+		struct memory_block {
+			uint64_t size;
+			uint64_t alignment;
+			uint32_t memory_type_bits;
+		};
+
+		// Returns the index of the resource, which is also the index of its placement
+		uint32_t add_resource(const resource &resource_to_add);
+		void plan();
+
+		const std::vector<placement>& get_placements() const { return placements; };
+		const std::vector<memory_block>& get_memory_blocks() const { return memory_blocks; };
+		// True if a resource starting at stage shares memory with a resource that is not alive in that stage
+		bool is_aliasing_barrier_needed(uint32_t stage) const;
+
+		uint64_t get_unaliased_size() const;
+		uint64_t get_aliased_size() const;
+	private:
+		std::vector<resource> resources;
+		std::vector<placement> placements;
+		std::vector<memory_block> memory_blocks;
+
+		static bool lifetimes_overlap(const resource &a, const resource &b);
+};
+
+#endif
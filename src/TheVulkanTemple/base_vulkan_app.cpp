@@ -13,7 +13,9 @@ BaseVulkanApp::BaseVulkanApp(const std::string &application_name,
 					  		 bool fullscreen,
 					  		 const std::vector<const char*> desired_device_level_extensions,
 					  		 const VkPhysicalDeviceFeatures2 *desired_physical_device_features2,
-							 VkBool32 surface_support) {
+							 VkBool32 surface_support,
+							 VkPresentModeKHR desired_present_mode,
+							 bool headless) : headless{headless}, desired_present_mode{desired_present_mode} {
 	
 	// Dynamic library loading inizialization
 	check_error(volkInitialize(), vulkan_helper::Error::VOLK_INITIALIZATION_FAILED);
@@ -64,52 +66,54 @@ BaseVulkanApp::BaseVulkanApp(const std::string &application_name,
 		check_error(vkCreateDebugUtilsMessengerEXT(instance, &debug_utils_messenger_create_info_ext, nullptr, &debug_report_callback), vulkan_helper::Error::DEBUG_UTILS_MESSANGER_CREATION_FAILED);
 	#endif
 
-	// Window Creation
-	if (glfwInit() != GLFW_TRUE) { check_error(VK_ERROR_UNKNOWN, vulkan_helper::Error::GLFW_INITIALIZATION_FAILED); }
+	// Window Creation, skipped along with the surface in headless mode
+	if (!headless) {
+		if (glfwInit() != GLFW_TRUE) { check_error(VK_ERROR_UNKNOWN, vulkan_helper::Error::GLFW_INITIALIZATION_FAILED); }
 
-	glfwWindowHint(GLFW_CLIENT_API, GLFW_NO_API);
+		glfwWindowHint(GLFW_CLIENT_API, GLFW_NO_API);
 
-	if (fullscreen) {
-		window = glfwCreateWindow(window_size.width, window_size.height, application_name.c_str(), glfwGetPrimaryMonitor(), nullptr);
-	}
-	else {
-		window = glfwCreateWindow(window_size.width, window_size.height, application_name.c_str(), nullptr, nullptr);
+		if (fullscreen) {
+			window = glfwCreateWindow(window_size.width, window_size.height, application_name.c_str(), glfwGetPrimaryMonitor(), nullptr);
+		}
+		else {
+			window = glfwCreateWindow(window_size.width, window_size.height, application_name.c_str(), nullptr, nullptr);
+		}
+		if (window == nullptr) { check_error(VK_ERROR_UNKNOWN, vulkan_helper::Error::GLFW_WINDOW_CREATION_FAILED); }
+
+		// Surface Creation
+		#ifdef _WIN64
+			VkWin32SurfaceCreateInfoKHR surface_create_info = {
+				VK_STRUCTURE_TYPE_WIN32_SURFACE_CREATE_INFO_KHR,
+				nullptr,
+				0,
+				GetModuleHandle(NULL),
+				glfwGetWin32Window(window)
+			};
+			check_error(vkCreateWin32SurfaceKHR(instance, &surface_create_info, nullptr, &surface), vulkan_helper::Error::SURFACE_CREATION_FAILED);
+	    #elif __linux__
+	        #ifdef VK_USE_PLATFORM_WAYLAND_KHR
+	            VkWaylandSurfaceCreateInfoKHR surface_create_info = {
+	                VK_STRUCTURE_TYPE_WAYLAND_SURFACE_CREATE_INFO_KHR,
+	                nullptr,
+	                0,
+	                glfwGetWaylandDisplay(),
+	                glfwGetWaylandWindow(window)
+	            };
+	            check_error(vkCreateWaylandSurfaceKHR(instance, &surface_create_info, nullptr, &surface), vulkan_helper::Error::SURFACE_CREATION_FAILED);
+	        #else
+			    VkXlibSurfaceCreateInfoKHR surface_create_info = {
+	    	        VK_STRUCTURE_TYPE_XLIB_SURFACE_CREATE_INFO_KHR,
+	        	    nullptr,
+	        	    0,
+	        	    glfwGetX11Display(),
+	    		    glfwGetX11Window(window)
+	    	    };
+			    check_error(vkCreateXlibSurfaceKHR(instance, &surface_create_info, nullptr, &surface), vulkan_helper::Error::SURFACE_CREATION_FAILED);
+	        #endif
+		#else
+			#error "Unknown compiler or not supported OS"
+		#endif
 	}
-	if (window == nullptr) { check_error(VK_ERROR_UNKNOWN, vulkan_helper::Error::GLFW_WINDOW_CREATION_FAILED); }
-
-	// Surface Creation
-	#ifdef _WIN64
-		VkWin32SurfaceCreateInfoKHR surface_create_info = {
-			VK_STRUCTURE_TYPE_WIN32_SURFACE_CREATE_INFO_KHR,
-			nullptr,
-			0,
-			GetModuleHandle(NULL),
-			glfwGetWin32Window(window)
-		};
-		check_error(vkCreateWin32SurfaceKHR(instance, &surface_create_info, nullptr, &surface), vulkan_helper::Error::SURFACE_CREATION_FAILED);
-    #elif __linux__
-        #ifdef VK_USE_PLATFORM_WAYLAND_KHR
-            VkWaylandSurfaceCreateInfoKHR surface_create_info = {
-                VK_STRUCTURE_TYPE_WAYLAND_SURFACE_CREATE_INFO_KHR,
-                nullptr,
-                0,
-                glfwGetWaylandDisplay(),
-                glfwGetWaylandWindow(window)
-            };
-            check_error(vkCreateWaylandSurfaceKHR(instance, &surface_create_info, nullptr, &surface), vulkan_helper::Error::SURFACE_CREATION_FAILED);
-        #else
-		    VkXlibSurfaceCreateInfoKHR surface_create_info = {
-    	        VK_STRUCTURE_TYPE_XLIB_SURFACE_CREATE_INFO_KHR,
-        	    nullptr,
-        	    0,
-        	    glfwGetX11Display(),
-    		    glfwGetX11Window(window)
-    	    };
-		    check_error(vkCreateXlibSurfaceKHR(instance, &surface_create_info, nullptr, &surface), vulkan_helper::Error::SURFACE_CREATION_FAILED);
-        #endif
-	#else
-		#error "Unknown compiler or not supported OS"
-	#endif
 
 	// Device selection: we first iterate through all available devices and compare their features with the requested ones,
 	// if there are more than 1 devices which can be selected then the decision is left to the user
@@ -130,9 +134,18 @@ BaseVulkanApp::BaseVulkanApp(const std::string &application_name,
 			uint32_t families_count;
 			vkGetPhysicalDeviceQueueFamilyProperties(devices[i], &families_count, nullptr);
 
+			std::vector<VkQueueFamilyProperties> families_properties(families_count);
+			vkGetPhysicalDeviceQueueFamilyProperties(devices[i], &families_count, families_properties.data());
+
+			// Without a surface any family that can draw is fine
 			VkBool32 does_queue_family_support_surface = VK_FALSE;
 			for (uint32_t y = 0; y < families_count; y++) {
-				vkGetPhysicalDeviceSurfaceSupportKHR(devices[i], y, surface, &does_queue_family_support_surface);
+				if (headless) {
+					does_queue_family_support_surface = (families_properties[y].queueFlags & VK_QUEUE_GRAPHICS_BIT) ? VK_TRUE : VK_FALSE;
+				}
+				else {
+					vkGetPhysicalDeviceSurfaceSupportKHR(devices[i], y, surface, &does_queue_family_support_surface);
+				}
 				if (surface_support == does_queue_family_support_surface) {
 					plausible_devices_d_index_qf_index.push_back(std::make_pair(i,y));
 					break;
@@ -194,7 +207,12 @@ BaseVulkanApp::BaseVulkanApp(const std::string &application_name,
 	vkGetDeviceQueue(device, main_queue_family_index, 0, &queue);
 	volkLoadDevice(device);
 
-	create_swapchain();
+	if (headless) {
+		create_headless_images(window_size);
+	}
+	else {
+		create_swapchain();
+	}
 }
 
 BaseVulkanApp::~BaseVulkanApp() {
@@ -202,10 +220,21 @@ BaseVulkanApp::~BaseVulkanApp() {
 	for (auto& image_view : swapchain_images_views) {
 		vkDestroyImageView(device, image_view, nullptr);
 	}
-    vkDestroySwapchainKHR(device, swapchain, nullptr);
+	// The swapchain and surface functions are not loaded in headless mode
+	if (headless) {
+		for (uint32_t i = 0; i < swapchain_images.size(); i++) {
+			vkDestroyImage(device, swapchain_images[i], nullptr);
+			vkFreeMemory(device, headless_images_memory[i], nullptr);
+		}
+	}
+	else {
+		vkDestroySwapchainKHR(device, swapchain, nullptr);
+	}
     vkDestroyDevice(device, nullptr);
-    vkDestroySurfaceKHR(instance, surface, nullptr);
-    glfwDestroyWindow(window);
+    if (!headless) {
+    	vkDestroySurfaceKHR(instance, surface, nullptr);
+    	glfwDestroyWindow(window);
+    }
 #ifndef NDEBUG
     vkDestroyDebugUtilsMessengerEXT(instance, debug_report_callback, nullptr);
 #endif
@@ -214,7 +243,7 @@ BaseVulkanApp::~BaseVulkanApp() {
 
 GLFWwindow* BaseVulkanApp::get_glfw_window() { return window; }
 
-void BaseVulkanApp::create_swapchain() {
+BaseVulkanApp::retired_swapchain BaseVulkanApp::create_swapchain() {
 	// Listing all available presentation
 	uint32_t presentation_modes_number;
 	vkGetPhysicalDeviceSurfacePresentModesKHR(selected_physical_device, surface, &presentation_modes_number, nullptr);
@@ -222,7 +251,7 @@ void BaseVulkanApp::create_swapchain() {
 	check_error(vkGetPhysicalDeviceSurfacePresentModesKHR(selected_physical_device, surface, &presentation_modes_number, presentation_modes.data()),
 				vulkan_helper::Error::PRESENT_MODES_RETRIEVAL_FAILED);
 
-	VkPresentModeKHR selected_present_mode = vulkan_helper::select_presentation_mode(presentation_modes, VK_PRESENT_MODE_MAILBOX_KHR);
+	VkPresentModeKHR selected_present_mode = vulkan_helper::select_presentation_mode(presentation_modes, desired_present_mode);
 
 	VkSurfaceCapabilitiesKHR surface_capabilities;
 	check_error(vkGetPhysicalDeviceSurfaceCapabilitiesKHR(selected_physical_device, surface, &surface_capabilities),
@@ -272,11 +301,63 @@ void BaseVulkanApp::create_swapchain() {
 	swapchain_images.resize(swapchain_images_count);
 	check_error(vkGetSwapchainImagesKHR(device, swapchain, &swapchain_images_count, swapchain_images.data()), vulkan_helper::Error::SWAPCHAIN_IMAGES_RETRIEVAL_FAILED);
 
-	for (auto& image_view : swapchain_images_views) {
-		vkDestroyImageView(device, image_view, nullptr);
+	retired_swapchain old_swapchain_data = { old_swapchain, std::move(swapchain_images_views) };
+	create_swapchain_images_views();
+	return old_swapchain_data;
+}
+
+void BaseVulkanApp::create_headless_images(VkExtent2D size_of_images) {
+	swapchain_create_info = {};
+	swapchain_create_info.sType = VK_STRUCTURE_TYPE_SWAPCHAIN_CREATE_INFO_KHR;
+	swapchain_create_info.minImageCount = headless_images_count;
+	swapchain_create_info.imageFormat = VK_FORMAT_B8G8R8A8_UNORM;
+	swapchain_create_info.imageColorSpace = VK_COLOR_SPACE_SRGB_NONLINEAR_KHR;
+	swapchain_create_info.imageExtent = size_of_images;
+	swapchain_create_info.imageArrayLayers = 1;
+	swapchain_create_info.imageUsage = VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT;
+	swapchain_create_info.imageSharingMode = VK_SHARING_MODE_EXCLUSIVE;
+	swapchain_create_info.presentMode = desired_present_mode;
+	// Left readable, so that the frames can be copied back to the host
+	swapchain_images_final_layout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+
+	swapchain_images.resize(headless_images_count);
+	headless_images_memory.resize(headless_images_count);
+	for (uint32_t i = 0; i < headless_images_count; i++) {
+		VkImageCreateInfo image_create_info = {
+				VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO,
+				nullptr,
+				0,
+				VK_IMAGE_TYPE_2D,
+				swapchain_create_info.imageFormat,
+				{size_of_images.width, size_of_images.height, 1},
+				1,
+				1,
+				VK_SAMPLE_COUNT_1_BIT,
+				VK_IMAGE_TILING_OPTIMAL,
+				swapchain_create_info.imageUsage,
+				VK_SHARING_MODE_EXCLUSIVE,
+				0,
+				nullptr,
+				VK_IMAGE_LAYOUT_UNDEFINED
+		};
+		check_error(vkCreateImage(device, &image_create_info, nullptr, &swapchain_images[i]), vulkan_helper::Error::IMAGE_CREATION_FAILED);
+
+		VkMemoryRequirements memory_requirements;
+		vkGetImageMemoryRequirements(device, swapchain_images[i], &memory_requirements);
+		VkMemoryAllocateInfo memory_allocate_info = {
+				VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
+				nullptr,
+				memory_requirements.size,
+				vulkan_helper::select_memory_index(physical_device_memory_properties, memory_requirements, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT)
+		};
+		check_error(vkAllocateMemory(device, &memory_allocate_info, nullptr, &headless_images_memory[i]), vulkan_helper::Error::MEMORY_ALLOCATION_FAILED);
+		check_error(vkBindImageMemory(device, swapchain_images[i], headless_images_memory[i], 0), vulkan_helper::Error::BIND_IMAGE_MEMORY_FAILED);
 	}
+	create_swapchain_images_views();
+}
 
-	swapchain_images_views.resize(swapchain_images_count);
+void BaseVulkanApp::create_swapchain_images_views() {
+	swapchain_images_views.resize(swapchain_images.size());
 	for (uint32_t i = 0; i < swapchain_images.size(); i++) {
 		VkImageViewCreateInfo image_view_create_info = {
 				VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO,
@@ -16,9 +16,13 @@ class BaseVulkanApp {
 					  bool fullscreen,
 					  const std::vector<const char*> desired_device_level_extensions,
 					  const VkPhysicalDeviceFeatures2 *desired_physical_device_features2,
-					  VkBool32 surface_support);
+					  VkBool32 surface_support,
+					  VkPresentModeKHR desired_present_mode = VK_PRESENT_MODE_MAILBOX_KHR,
+					  bool headless = false);
 		virtual ~BaseVulkanApp();
+		// nullptr in headless mode
 		GLFWwindow* get_glfw_window();
+		bool is_headless() { return headless; };
 
 	protected:
 		// Vulkan attributes
@@ -27,8 +31,13 @@ class BaseVulkanApp {
 		#ifndef NDEBUG
 			VkDebugUtilsMessengerEXT debug_report_callback;
 		#endif
-		GLFWwindow* window;
-		VkSurfaceKHR surface;
+		// Without a window, surface and swapchain the frames are rendered in a ring of images owned by the app, which take
+		// the place of the swapchain images. The swapchain extensions are not needed, so it runs on machines without a display
+		bool headless = false;
+		static constexpr uint32_t headless_images_count = 3;
+		std::vector<VkDeviceMemory> headless_images_memory;
+		GLFWwindow* window = nullptr;
+		VkSurfaceKHR surface = VK_NULL_HANDLE;
 		VkPhysicalDevice selected_physical_device = VK_NULL_HANDLE;
 		VkPhysicalDeviceMemoryProperties physical_device_memory_properties;
         VkPhysicalDeviceProperties physical_device_properties;
@@ -36,18 +45,32 @@ class BaseVulkanApp {
 		VkDevice device = VK_NULL_HANDLE;
 		VkQueue queue;
 
+		// Used when it is available, see vulkan_helper::select_presentation_mode for the fallback
+		VkPresentModeKHR desired_present_mode;
 		VkSwapchainCreateInfoKHR swapchain_create_info;
 		VkSwapchainKHR swapchain = VK_NULL_HANDLE;
 		std::vector<VkImage> swapchain_images;
 		std::vector<VkImageView> swapchain_images_views;
+		// Layout in which the swapchain images are left at the end of the frame, transfer source for the headless images
+		VkImageLayout swapchain_images_final_layout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
 
 		struct command_record_info {
 			VkCommandPool command_pool = VK_NULL_HANDLE;
 			std::vector<VkCommandBuffer> command_buffers;
 		};
 
+		// The swapchain replaced by create_swapchain, still usable by the presentation engine and by work in flight
+		struct retired_swapchain {
+			VkSwapchainKHR swapchain = VK_NULL_HANDLE;
+			std::vector<VkImageView> image_views;
+		};
+
 		// Vulkan related private methods
-		void create_swapchain();
+		// The previous swapchain is handed to the new one and returned for the caller to destroy when not in use anymore
+		retired_swapchain create_swapchain();
+		// Fills the swapchain images and create info with the ring of images of the headless mode
+		void create_headless_images(VkExtent2D size_of_images);
+		void create_swapchain_images_views();
 		void create_cmd_pool_and_buffers(uint32_t queue_family_index, VkCommandBufferLevel cb_level, uint32_t command_buffers_count, command_record_info& cr_info, uint32_t pool_flags = 0);
 		void delete_cmd_pool_and_buffers(command_record_info& cr_info);
 };
@@ -0,0 +1,167 @@
+#include "benchmark.h"
+#include <cmath>
+#include <fstream>
+#include <numeric>
+#include <algorithm>
+
+namespace {
+	nlohmann::json keyframe_to_json(const Benchmark::keyframe &keyframe) {
+		return {
+			{"time", keyframe.time},
+			{"pos", {keyframe.pos.x, keyframe.pos.y, keyframe.pos.z}},
+			{"dir", {keyframe.dir.x, keyframe.dir.y, keyframe.dir.z}}
+		};
+	}
+
+	Benchmark::keyframe keyframe_from_json(const nlohmann::json &json) {
+		return {
+			json.at("time").get<float>(),
+			{json.at("pos").at(0).get<float>(), json.at("pos").at(1).get<float>(), json.at("pos").at(2).get<float>()},
+			{json.at("dir").at(0).get<float>(), json.at("dir").at(1).get<float>(), json.at("dir").at(2).get<float>()}
+		};
+	}
+}
+
+Benchmark::Benchmark(float timestep, uint32_t warm_up_frames, uint32_t measured_frames) {
+	this->timestep = timestep;
+	this->warm_up_frames = warm_up_frames;
+	this->measured_frames = measured_frames;
+	samples.reserve(measured_frames);
+}
+
+void Benchmark::add_camera_keyframe(keyframe camera_keyframe) {
+	camera_path.push_back(camera_keyframe);
+}
+
+void Benchmark::add_light_keyframe(uint32_t light_index, keyframe light_keyframe) {
+	if (lights_paths.size() <= light_index) {
+		lights_paths.resize(light_index + 1);
+	}
+	lights_paths[light_index].push_back(light_keyframe);
+}
+
+void Benchmark::record_keyframe(GraphicsModuleVulkanApp *app) {
+	Camera *camera = app->get_camera_ptr();
+	add_camera_keyframe({recorded_time, camera->get_pos(), camera->get_dir()});
+	for (uint32_t i = 0; i < app->get_lights_count(); i++) {
+		const Light *light = app->get_light_ptr(i);
+		add_light_keyframe(i, {recorded_time, light->get_pos(), light->get_dir()});
+	}
+	recorded_time += timestep;
+}
+
+void Benchmark::save_path(const std::string &file_path) {
+	nlohmann::json path_json = {{"camera", nlohmann::json::array()}, {"lights", nlohmann::json::array()}};
+	for (const auto& camera_keyframe : camera_path) {
+		path_json["camera"].push_back(keyframe_to_json(camera_keyframe));
+	}
+	for (const auto& light_path : lights_paths) {
+		nlohmann::json light_path_json = nlohmann::json::array();
+		for (const auto& light_keyframe : light_path) {
+			light_path_json.push_back(keyframe_to_json(light_keyframe));
+		}
+		path_json["lights"].push_back(light_path_json);
+	}
+	std::ofstream file(file_path, std::ios::out | std::ios::trunc);
+	file << path_json.dump(4);
+}
+
+void Benchmark::load_path(const std::string &file_path) {
+	std::ifstream file(file_path);
+	nlohmann::json path_json = nlohmann::json::parse(file);
+	camera_path.clear();
+	lights_paths.clear();
+	for (const auto& camera_keyframe : path_json.at("camera")) {
+		add_camera_keyframe(keyframe_from_json(camera_keyframe));
+	}
+	for (uint32_t i = 0; i < path_json.at("lights").size(); i++) {
+		for (const auto& light_keyframe : path_json.at("lights").at(i)) {
+			add_light_keyframe(i, keyframe_from_json(light_keyframe));
+		}
+	}
+}
+
+void Benchmark::on_frame_start(GraphicsModuleVulkanApp *app) {
+	// The times of the previous frame are complete once the next one starts
+	std::chrono::steady_clock::time_point frame_start = std::chrono::steady_clock::now();
+	if (frame_index > warm_up_frames && samples.size() < measured_frames) {
+		samples.push_back({
+			app->get_cpu_frame_time(),
+			std::chrono::duration<float, std::milli>(frame_start - last_frame_start).count(),
+			app->get_gpu_frame_times()
+		});
+	}
+	last_frame_start = frame_start;
+	if (is_done()) {
+		app->stop_frame_loop();
+	}
+
+	// The time of the frame depends only on its index, so the same frames are rendered at any frame rate
+	float time = frame_index * timestep;
+	if (!camera_path.empty()) {
+		keyframe camera_keyframe = sample_path(camera_path, time);
+		app->get_camera_ptr()->set_pos(camera_keyframe.pos);
+		app->get_camera_ptr()->set_dir(camera_keyframe.dir);
+	}
+	for (uint32_t i = 0; i < std::min<size_t>(lights_paths.size(), app->get_lights_count()); i++) {
+		if (!lights_paths[i].empty()) {
+			keyframe light_keyframe = sample_path(lights_paths[i], time);
+			app->get_light_ptr(i)->set_pos(light_keyframe.pos);
+			app->get_light_ptr(i)->set_dir(light_keyframe.dir);
+		}
+	}
+	frame_index++;
+}
+
+std::string Benchmark::get_report_json(int indent) {
+	auto collect = [&](auto member) {
+		std::vector<float> values;
+		for (const auto& sample : samples) {
+			values.push_back(member(sample));
+		}
+		return compute_stats(values);
+	};
+	nlohmann::json report_json = {
+		{"timestep", timestep},
+		{"warm_up_frames", warm_up_frames},
+		{"measured_frames", samples.size()},
+		{"cpu_frame_time", collect([](const frame_sample &s) { return s.cpu_frame_time; })},
+		{"frame_time", collect([](const frame_sample &s) { return s.frame_time; })},
+		{"gpu_frame_time", collect([](const frame_sample &s) { return s.gpu_times.frame; })},
+		{"gpu_passes", {
+			{"shadow_maps", collect([](const frame_sample &s) { return s.gpu_times.shadow_maps; })},
+			{"pbr", collect([](const frame_sample &s) { return s.gpu_times.pbr; })},
+			{"post_processing", collect([](const frame_sample &s) { return s.gpu_times.post_processing; })},
+			{"output_copy", collect([](const frame_sample &s) { return s.gpu_times.output_copy; })}
+		}}
+	};
+	return report_json.dump(indent);
+}
+
+Benchmark::keyframe Benchmark::sample_path(const std::vector<keyframe> &path, float time) {
+	auto next = std::upper_bound(path.begin(), path.end(), time, [](float time, const keyframe &keyframe) {
+		return time < keyframe.time;
+	});
+	if (next == path.begin()) {
+		return path.front();
+	}
+	if (next == path.end()) {
+		return path.back();
+	}
+	auto previous = std::prev(next);
+	float t = (time - previous->time) / (next->time - previous->time);
+	return {time, glm::mix(previous->pos, next->pos, t), glm::normalize(glm::mix(previous->dir, next->dir, t))};
+}
+
+Benchmark::time_stats Benchmark::compute_stats(std::vector<float> values) {
+	if (values.empty()) {
+		return {0.0f, 0.0f, 0.0f, 0.0f};
+	}
+	std::sort(values.begin(), values.end());
+	auto percentile = [&](float p) {
+		size_t rank = static_cast<size_t>(std::ceil(p * values.size()));
+		return values[std::clamp<size_t>(rank, 1, values.size()) - 1];
+	};
+	float mean = std::accumulate(values.begin(), values.end(), 0.0f) / values.size();
+	return {mean, percentile(0.5f), percentile(0.95f), percentile(0.99f)};
+}
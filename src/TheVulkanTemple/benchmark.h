@@ -0,0 +1,72 @@
+#ifndef THEVULKANTEMPLE_BENCHMARK_H
+#define THEVULKANTEMPLE_BENCHMARK_H
+
+#include <string>
+#include <vector>
+#include <chrono>
+#include <cstdint>
+#include <glm/glm.hpp>
+#include "external/json.hpp"
+#include "graphics_module_vulkan_app.h"
+
+// Plays a path of the camera and of the lights at a fixed timestep, so that every run renders the same frames whatever the
+// frame rate, and measures the frames that follow a warm up. The path is either scripted with keyframes, or recorded from an
+// interactive session and saved to a file. The usage is: pass on_frame_start() in the pre submit callback of the frame loop,
+// which is stopped once all the frames are measured, then call get_report_json()
+class Benchmark {
+	public:
+		struct keyframe {
+			float time;
+			glm::vec3 pos;
+			glm::vec3 dir;
+		};
+		// In milliseconds, the percentiles are taken with the nearest rank
+		struct time_stats {
+			float mean;
+			float median;
+			float p95;
+			float p99;
+		};
+
+		Benchmark(float timestep, uint32_t warm_up_frames, uint32_t measured_frames);
+
+		// The keyframes of a path must be added in increasing time, the position and the direction are interpolated between them
+		// and held after the last one
+		void add_camera_keyframe(keyframe camera_keyframe);
+		void add_light_keyframe(uint32_t light_index, keyframe light_keyframe);
+		// Appends the camera and the lights of the app as keyframes one timestep after the last recorded ones
+		void record_keyframe(GraphicsModuleVulkanApp *app);
+		void save_path(const std::string &file_path);
+		void load_path(const std::string &file_path);
+
+		// Samples the times of the previous frame, then moves the camera and the lights to the time of the new one
+		void on_frame_start(GraphicsModuleVulkanApp *app);
+		bool is_done() { return samples.size() == measured_frames; };
+		// Stats of the cpu, wall and gpu frame times and of the gpu time of every pass. The gpu times lag behind the frames by
+		// the frames in flight, which the warm up covers
+		std::string get_report_json(int indent = 4);
+	private:
+		struct frame_sample {
+			float cpu_frame_time;
+			float frame_time;
+			GraphicsModuleVulkanApp::gpu_frame_times gpu_times;
+		};
+
+		float timestep;
+		uint32_t warm_up_frames;
+		uint32_t measured_frames;
+		uint32_t frame_index = 0;
+		std::chrono::steady_clock::time_point last_frame_start;
+		std::vector<keyframe> camera_path;
+		// Indexed by light, empty for the lights that do not move
+		std::vector<std::vector<keyframe>> lights_paths;
+		float recorded_time = 0.0f;
+		std::vector<frame_sample> samples;
+
+		static keyframe sample_path(const std::vector<keyframe> &path, float time);
+		static time_stats compute_stats(std::vector<float> values);
+};
+
+NLOHMANN_DEFINE_TYPE_NON_INTRUSIVE(Benchmark::time_stats, mean, median, p95, p99)
+
+#endif //THEVULKANTEMPLE_BENCHMARK_H
@@ -0,0 +1,242 @@
+#include "buddy_block_allocator.h"
+#include <bit>
+#include <chrono>
+#include <numeric>
+#include <algorithm>
+
+BuddyBlockAllocator::backing_unit BuddyBlockAllocator::HostMemoryBackingStore::create_unit(uint64_t size) {
+	auto unit = units.emplace(next_unit_id++, std::make_unique<uint8_t[]>(size)).first;
+	return { unit->first, unit->second.get() };
+}
+
+void BuddyBlockAllocator::HostMemoryBackingStore::destroy_unit(uint64_t unit_id) {
+	units.erase(unit_id);
+}
+
+BuddyBlockAllocator::BuddyBlockAllocator(BackingStore &backing_store, uint64_t block_initial_size, uint64_t min_allocation_size) :
+backing_store{backing_store}, block_initial_size{std::bit_ceil(block_initial_size)}, min_allocation_size{std::bit_ceil(min_allocation_size)} {
+	request_next_unit();
+}
+
+BuddyBlockAllocator::~BuddyBlockAllocator() {
+	for (auto& unit : units) {
+		backing_store.destroy_unit(unit.first);
+	}
+}
+
+BuddyBlockAllocator::block_allocation BuddyBlockAllocator::allocate(uint64_t size, uint64_t alignment) {
+	auto start_time = std::chrono::steady_clock::now();
+	uint64_t requested_size = size;
+	// The alignment is split in two parts:
+	// - the first is a power of 2 which it is used to look for suitable blocks,
+	// - the second one is a predicted residual part that becomes part of the allocation size, note however that the real
+	// residual is calculated at the moment of block allocation, this prediction is the worst case scenario and guarantees
+	// that the block has enough size to accomodate data + alignment. Since the block address is a multiple of the floored
+	// alignment, the residual is at most alignment - gcd(alignment, floored alignment)
+	uint64_t floored_alignment = std::bit_floor(alignment);
+	uint64_t predicted_alignment_increment = alignment - std::gcd(alignment, floored_alignment);
+	size = std::bit_ceil(std::max(size + predicted_alignment_increment, min_allocation_size));
+
+	auto record_allocation_time = [&]() {
+		uint64_t elapsed_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start_time).count();
+		stats.total_allocation_time_ns += elapsed_ns;
+		stats.max_allocation_time_ns = std::max(stats.max_allocation_time_ns, elapsed_ns);
+	};
+
+	auto get_allocation_return_value = [&](decltype(units)::iterator unit, std::pair<uint64_t, uint64_t> selected_block) -> block_allocation {
+		// Here the correct increment is calculated
+		uint64_t corrected_alignment_increment = (selected_block.second + alignment - 1) / alignment * alignment - selected_block.second;
+		uint64_t trace_index = trace_recording ? trace.size() : untraced_allocation;
+		unit->second.used_blocks.emplace(selected_block.second + corrected_alignment_increment,
+				unit_data::used_block{ selected_block.first, corrected_alignment_increment, requested_size, trace_index });
+		if (trace_recording) {
+			trace.push_back({ false, requested_size, alignment, 0 });
+		}
+
+		stats.live_blocks++;
+		stats.requested_bytes += requested_size;
+		stats.allocated_bytes += selected_block.first;
+		stats.allocation_count++;
+		update_peak_stats();
+		record_allocation_time();
+
+		void *allocation_ptr = nullptr;
+		if (unit->second.host_ptr != nullptr) {
+			allocation_ptr = static_cast<uint8_t*>(unit->second.host_ptr) + selected_block.second + corrected_alignment_increment;
+		}
+		return { unit->first, selected_block.second + corrected_alignment_increment, allocation_ptr };
+	};
+
+	// All the units could have been released by previous frees
+	if (units.empty()) {
+		request_next_unit(size);
+	}
+	for (auto unit = units.begin(); unit!=units.end();) {
+		auto first_block = unit->second.free_blocks.upper_bound(size-1);
+		std::pair<uint64_t, uint64_t> new_block_info;
+
+		for (auto block_it = first_block; block_it!=unit->second.free_blocks.end(); block_it++) {
+			// If the block has the same size as requested and the correct alignment then it is selected right away
+			if (block_it->first==size && block_it->second%floored_alignment==0) {
+				new_block_info = *block_it;
+				unit->second.free_blocks.erase(block_it);
+				return get_allocation_return_value(unit, new_block_info);
+			}
+			// If the block has correct alignment but not the right size it is split up and then selected
+			else if (block_it->second%floored_alignment==0) {
+				uint64_t old_block_half_size = block_it->first/2;
+				uint64_t old_address = block_it->second;
+				new_block_info = split_block_recursive(unit->second.free_blocks, unit->second.free_blocks.erase(block_it),
+						old_block_half_size, old_address, size);
+				return get_allocation_return_value(unit, new_block_info);
+			}
+		}
+
+		std::next(unit) == units.end() ? unit = this->request_next_unit(size) : unit++;
+	}
+	// allocation is not possible
+	stats.failed_allocation_count++;
+	record_allocation_time();
+	return { 0, 0, nullptr };
+}
+
+void BuddyBlockAllocator::free(uint64_t unit_id, uint64_t offset) {
+	auto block_to_free_unit = units.find(unit_id);
+	unit_data &block_to_free_unit_data = block_to_free_unit->second;
+	auto block_to_be_freed = block_to_free_unit_data.used_blocks.find(offset);
+	auto block_to_merge = std::pair<uint64_t, uint64_t>{block_to_be_freed->first - block_to_be_freed->second.po2_alignment_increment, block_to_be_freed->second.size};
+	if (trace_recording && block_to_be_freed->second.trace_index != untraced_allocation) {
+		trace.push_back({ true, block_to_be_freed->second.requested_size, 0, block_to_be_freed->second.trace_index });
+	}
+	stats.live_blocks--;
+	stats.requested_bytes -= block_to_be_freed->second.requested_size;
+	stats.allocated_bytes -= block_to_be_freed->second.size;
+	stats.free_count++;
+	block_to_free_unit_data.used_blocks.erase(block_to_be_freed);
+	merge_blocks_recursive(block_to_free_unit_data.free_blocks, block_to_merge);
+
+	if (block_to_free_unit_data.used_blocks.empty()) {
+		backing_store.destroy_unit(block_to_free_unit->first);
+		stats.buffer_units--;
+		stats.reserved_bytes -= block_to_free_unit_data.size;
+		units.erase(block_to_free_unit);
+	}
+}
+
+std::vector<uint64_t> BuddyBlockAllocator::get_unit_ids() const {
+	std::vector<uint64_t> unit_ids;
+	unit_ids.reserve(units.size());
+	for (const auto& unit : units) {
+		unit_ids.push_back(unit.first);
+	}
+	return unit_ids;
+}
+
+BuddyBlockAllocator::allocator_stats BuddyBlockAllocator::get_stats() const {
+	allocator_stats current_stats = stats;
+	for (const auto& unit : units) {
+		if (!unit.second.free_blocks.empty()) {
+			current_stats.largest_free_block = std::max(current_stats.largest_free_block, unit.second.free_blocks.rbegin()->first);
+		}
+	}
+	return current_stats;
+}
+
+void BuddyBlockAllocator::replay_trace(const std::vector<trace_event> &trace_to_replay) {
+	// For every allocation event we keep where it landed in this allocator, so that the frees can find it
+	std::vector<block_allocation> replayed_allocations(trace_to_replay.size(), { 0, 0, nullptr });
+	for (uint64_t i = 0; i < trace_to_replay.size(); i++) {
+		const trace_event &event = trace_to_replay[i];
+		if (event.is_free) {
+			// A free can only refer to an earlier allocation event, anything else is skipped
+			if (event.allocation_event_index >= i || trace_to_replay[event.allocation_event_index].is_free) {
+				continue;
+			}
+			block_allocation &to_free = replayed_allocations[event.allocation_event_index];
+			if (to_free.unit_id != 0) {
+				free(to_free.unit_id, to_free.offset);
+				// A block is freed once even if the trace frees it again
+				to_free.unit_id = 0;
+			}
+		}
+		else {
+			replayed_allocations[i] = allocate(event.size, event.alignment);
+		}
+	}
+}
+
+decltype(BuddyBlockAllocator::units)::iterator BuddyBlockAllocator::request_next_unit(uint64_t unit_size) {
+	// Round the size to the min power of 2, else that space is wasted
+	unit_size = std::bit_ceil(std::max(unit_size, block_initial_size));
+
+	backing_unit new_unit = backing_store.create_unit(unit_size);
+	unit_data unit_to_append;
+	unit_to_append.host_ptr = new_unit.host_ptr;
+	unit_to_append.size = unit_size;
+	unit_to_append.free_blocks.insert(std::pair<uint64_t, uint64_t>{unit_size, 0});
+
+	stats.buffer_units++;
+	stats.reserved_bytes += unit_size;
+	update_peak_stats();
+
+	return units.emplace(std::make_pair(new_unit.id, unit_to_append)).first;
+}
+
+std::pair<uint64_t, uint64_t> BuddyBlockAllocator::split_block_recursive(std::multimap<uint64_t, uint64_t>& unit_free_blocks,
+		std::multimap<uint64_t, uint64_t>::iterator block_insert_hint, uint64_t new_block_sizes, uint64_t old_block_address, uint64_t requested_block_size) {
+	// creating the right block
+	block_insert_hint = unit_free_blocks.emplace_hint(block_insert_hint, new_block_sizes, old_block_address + new_block_sizes);
+	if (new_block_sizes != requested_block_size) {
+		// continuing to subdivide the left block without actually creating it
+		return split_block_recursive(unit_free_blocks, block_insert_hint, new_block_sizes/2, old_block_address, requested_block_size);
+	}
+	else {
+		// on the last step we return the data of the left block, but we do not create it, since it is going to be removed shortly after
+		return {new_block_sizes, old_block_address};
+	}
+}
+
+void BuddyBlockAllocator::merge_blocks_recursive(std::multimap<uint64_t, uint64_t>& unit_free_blocks, std::pair<uint64_t, uint64_t> address_size_source_block) {
+	// Blocks are aligned to their size, so the buddy is found by flipping the bit of the size in the address
+	uint64_t buddy_block_address = address_size_source_block.first ^ address_size_source_block.second;
+	auto its = unit_free_blocks.equal_range(address_size_source_block.second);
+	for (auto it = its.first; it != its.second; it++) {
+		if (it->second == buddy_block_address) {
+			unit_free_blocks.erase(it);
+			// The merged block starts at the lowest of the two addresses
+			return merge_blocks_recursive(unit_free_blocks, {std::min(address_size_source_block.first, buddy_block_address), address_size_source_block.second*2});
+		}
+	}
+	// When there are no other blocks which can be joined, insert the merged block into the free ones
+	unit_free_blocks.emplace(address_size_source_block.second, address_size_source_block.first);
+	return;
+}
+
+void BuddyBlockAllocator::update_peak_stats() {
+	stats.peak_buffer_units = std::max(stats.peak_buffer_units, stats.buffer_units);
+	stats.peak_reserved_bytes = std::max(stats.peak_reserved_bytes, stats.reserved_bytes);
+	stats.peak_live_blocks = std::max(stats.peak_live_blocks, stats.live_blocks);
+	stats.peak_requested_bytes = std::max(stats.peak_requested_bytes, stats.requested_bytes);
+	stats.peak_allocated_bytes = std::max(stats.peak_allocated_bytes, stats.allocated_bytes);
+}
+
+BuddyBlockAllocator::allocator_stats& BuddyBlockAllocator::allocator_stats::operator+=(const allocator_stats& other) {
+	buffer_units += other.buffer_units;
+	reserved_bytes += other.reserved_bytes;
+	live_blocks += other.live_blocks;
+	requested_bytes += other.requested_bytes;
+	allocated_bytes += other.allocated_bytes;
+	largest_free_block = std::max(largest_free_block, other.largest_free_block);
+	allocation_count += other.allocation_count;
+	free_count += other.free_count;
+	failed_allocation_count += other.failed_allocation_count;
+	total_allocation_time_ns += other.total_allocation_time_ns;
+	max_allocation_time_ns = std::max(max_allocation_time_ns, other.max_allocation_time_ns);
+	// The peaks of different allocators are not simultaneous, so their sum is an upper bound
+	peak_buffer_units += other.peak_buffer_units;
+	peak_reserved_bytes += other.peak_reserved_bytes;
+	peak_live_blocks += other.peak_live_blocks;
+	peak_requested_bytes += other.peak_requested_bytes;
+	peak_allocated_bytes += other.peak_allocated_bytes;
+	return *this;
+}
@@ -0,0 +1,138 @@
+#ifndef THEVULKANTEMPLE_BUDDY_BLOCK_ALLOCATOR_H
+#define THEVULKANTEMPLE_BUDDY_BLOCK_ALLOCATOR_H
+
+#include <vector>
+#include <map>
+#include <memory>
+#include <cstdint>
+#include <utility>
+#include <unordered_map>
+#include "external/json.hpp"
+
+// Block management of the buddy suballocator, it does not know anything about what the units of memory are, these
+// are created and destroyed through a BackingStore so the allocator can be driven without a device
+class BuddyBlockAllocator {
+	public:
+		struct backing_unit {
+			uint64_t id;
+			void *host_ptr;
+		};
+		class BackingStore {
+			public:
+				virtual ~BackingStore() = default;
+				// Must return a unique id for the unit and a pointer to its memory, or nullptr if it is not host visible
+				virtual backing_unit create_unit(uint64_t size) = 0;
+				virtual void destroy_unit(uint64_t unit_id) = 0;
+		};
+
+		// Units of plain host memory, for running the allocator without a device
+		class HostMemoryBackingStore : public BackingStore {
+			public:
+				backing_unit create_unit(uint64_t size) override;
+				void destroy_unit(uint64_t unit_id) override;
+			private:
+				uint64_t next_unit_id = 1;
+				std::unordered_map<uint64_t, std::unique_ptr<uint8_t[]>> units;
+		};
+
+		BuddyBlockAllocator(BackingStore &backing_store, uint64_t block_initial_size, uint64_t min_allocation_size = 32);
+		BuddyBlockAllocator(const BuddyBlockAllocator&) = delete;
+		BuddyBlockAllocator& operator=(const BuddyBlockAllocator&) = delete;
+		~BuddyBlockAllocator();
+
+		struct block_allocation {
+			uint64_t unit_id;
+			uint64_t offset;
+			void *host_ptr;
+		};
+		// unit_id is 0 when the allocation is not possible
+		block_allocation allocate(uint64_t size, uint64_t alignment = 1);
+		void free(uint64_t unit_id, uint64_t offset);
+
+		std::vector<uint64_t> get_unit_ids() const;
+		uint64_t get_block_initial_size() const { return block_initial_size; };
+		uint64_t get_min_allocation_size() const { return min_allocation_size; };
+
+		// Counters describing the state of the allocator, the peak_ values are high-water marks since construction
+		struct allocator_stats {
+			uint64_t buffer_units = 0;
+			uint64_t reserved_bytes = 0;
+			uint64_t live_blocks = 0;
+			uint64_t requested_bytes = 0;
+			uint64_t allocated_bytes = 0;
+			uint64_t largest_free_block = 0;
+			uint64_t allocation_count = 0;
+			uint64_t free_count = 0;
+			uint64_t failed_allocation_count = 0;
+			uint64_t total_allocation_time_ns = 0;
+			uint64_t max_allocation_time_ns = 0;
+			uint64_t peak_buffer_units = 0;
+			uint64_t peak_reserved_bytes = 0;
+			uint64_t peak_live_blocks = 0;
+			uint64_t peak_requested_bytes = 0;
+			uint64_t peak_allocated_bytes = 0;
+
+			allocator_stats& operator+=(const allocator_stats& other);
+		};
+		allocator_stats get_stats() const;
+
+		// A trace is the sequence of allocate/free calls, a free refers to the index of the event that allocated the block.
+		// The frees of blocks allocated while the recording was off are not recorded, since their allocation is not in the trace
+		struct trace_event {
+			bool is_free;
+			uint64_t size;
+			uint64_t alignment;
+			uint64_t allocation_event_index;
+		};
+		void set_trace_recording(bool enabled) { trace_recording = enabled; };
+		const std::vector<trace_event>& get_trace() const { return trace; };
+		// Replays a trace on this allocator, leaves alive the blocks that the trace does not free
+		void replay_trace(const std::vector<trace_event> &trace_to_replay);
+	private:
+		BackingStore &backing_store;
+		uint64_t block_initial_size;
+		uint64_t min_allocation_size;
+
+		struct unit_data {
+			void *host_ptr;
+			uint64_t size;
+
+			// red-black binary tree to keep size|address
+			std::multimap<uint64_t, uint64_t> free_blocks;
+
+			struct used_block {
+				uint64_t size;
+				uint64_t po2_alignment_increment;
+				uint64_t requested_size;
+				// untraced_allocation if allocated while the recording was off
+				uint64_t trace_index;
+			};
+			// hashmap to keep address|used_block
+			std::unordered_map<uint64_t, used_block> used_blocks;
+		};
+		std::unordered_map<uint64_t, unit_data> units;
+
+		// largest_free_block is not kept here since it is computed on request
+		allocator_stats stats;
+		void update_peak_stats();
+
+		static constexpr uint64_t untraced_allocation = UINT64_MAX;
+		bool trace_recording = false;
+		std::vector<trace_event> trace;
+
+		decltype(BuddyBlockAllocator::units)::iterator request_next_unit(uint64_t unit_size = 0);
+
+		std::pair<uint64_t, uint64_t> split_block_recursive(std::multimap<uint64_t, uint64_t>& unit_free_blocks,
+				std::multimap<uint64_t, uint64_t>::iterator block_insert_hint, uint64_t new_block_sizes,
+				uint64_t old_block_address, uint64_t requested_block_size);
+		void merge_blocks_recursive(std::multimap<uint64_t, uint64_t>& unit_free_blocks, std::pair<uint64_t, uint64_t> address_size_source_block);
+};
+
+NLOHMANN_DEFINE_TYPE_NON_INTRUSIVE(BuddyBlockAllocator::allocator_stats, buffer_units, reserved_bytes, live_blocks,
+		requested_bytes, allocated_bytes, largest_free_block, allocation_count, free_count, failed_allocation_count,
+		total_allocation_time_ns, max_allocation_time_ns, peak_buffer_units, peak_reserved_bytes, peak_live_blocks,
+		peak_requested_bytes, peak_allocated_bytes)
+
+NLOHMANN_DEFINE_TYPE_NON_INTRUSIVE(BuddyBlockAllocator::trace_event, is_free, size, alignment, allocation_event_index)
+
+#endif
@@ -1,7 +1,7 @@
 #ifndef BASE_VULKAN_APP_CAMERA_H
 #define BASE_VULKAN_APP_CAMERA_H
+#include "frustum.h"
 #include <glm/glm.hpp>
-#include <array>
 
 class Camera {
     public:
@@ -11,10 +11,11 @@ class Camera {
         // View, Projection and camera_pos
         uint32_t copy_data_to_ptr(uint8_t *ptr) const;
         bool is_sphere_visible(glm::vec3 center, float radius) const;
+        const Frustum& get_frustum() const;
 
         // Getters
-        glm::vec3 get_pos() { return pos; }
-        glm::vec3 get_dir() { return dir; }
+        glm::vec3 get_pos() const { return pos; }
+        glm::vec3 get_dir() const { return dir; }
         float get_fov() { return fov; }
         float get_aspect() { return aspect; }
         float get_znear() { return znear; }
@@ -24,21 +25,31 @@ class Camera {
         glm::mat4 get_view_matrix() { return view_matrix; }
 
         glm::dvec2 get_prev_pos() { return this->prev_pos; };
+        // Incremented every time the view or the projection changes
+        uint64_t get_version() const { return version; };
         float get_distance() { return distance; };
 
         // Setters
-        void set_pos(glm::vec3 pos) { this->pos = pos; matrices_up_to_date = false; }
-        void set_dir(glm::vec3 dir) { this->dir = dir; matrices_up_to_date = false; }
-        void set_fov(float fov) { this->fov = fov; matrices_up_to_date = false; }
-        void set_aspect(float aspect) { this->aspect = aspect; matrices_up_to_date = false; }
-        void set_znear(float znear) { this->znear = znear; matrices_up_to_date = false; }
-        void set_zfar(float zfar) { this->zfar = zfar; matrices_up_to_date = false; }
+        void set_pos(glm::vec3 pos) { set_and_track(this->pos, pos); }
+        void set_dir(glm::vec3 dir) { set_and_track(this->dir, dir); }
+        void set_fov(float fov) { set_and_track(this->fov, fov); }
+        void set_aspect(float aspect) { set_and_track(this->aspect, aspect); }
+        void set_znear(float znear) { set_and_track(this->znear, znear); }
+        void set_zfar(float zfar) { set_and_track(this->zfar, zfar); }
 
         void set_ex_pos(glm::dvec2 new_ex_pos) { this->prev_pos = new_ex_pos; };
         void set_distance(float new_distance) { this->distance = new_distance; };
 
     private:
         void update_matrices_and_planes() const;
+        // Setting the same value again is not counted as a change
+        template<typename T> void set_and_track(T &member, const T &value) {
+            if (member != value) {
+                member = value;
+                matrices_up_to_date = false;
+                version++;
+            }
+        }
 
         glm::vec3 pos = glm::vec3(0.0f);
         glm::vec3 dir = glm::vec3(0.0f);
@@ -47,29 +58,14 @@ class Camera {
         float znear = 0.001f;
         float zfar = 1000.0f;
 
-        struct plane {
-            glm::vec3 normal;
-            float distance;
-        };
-
-        struct frustum {
-            union {
-                struct {
-                    plane p_left;
-                    plane p_right;
-                    plane p_bottom;
-                    plane p_top;
-                    plane p_near;
-                    plane p_far;
-                };
-                std::array<plane, 6> planes;
-            };
-        };
-        mutable frustum camera_frustum;
+        mutable Frustum camera_frustum;
 
+        uint64_t version = 0;
         mutable bool matrices_up_to_date = false;
         mutable glm::mat4 proj_matrix;
         mutable glm::mat4 view_matrix;
+        // Transpose of the inverse of the view matrix, computed only when the view changes
+        mutable glm::mat4 view_normal_matrix;
 
         glm::dvec2 prev_pos;
         float distance = -1;
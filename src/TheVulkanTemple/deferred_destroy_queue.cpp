@@ -0,0 +1,29 @@
+#include "deferred_destroy_queue.h"
+
+DeferredDestroyQueue::~DeferredDestroyQueue() {
+	flush();
+}
+
+void DeferredDestroyQueue::push(uint64_t frame_value, std::function<void()> &&destroy_function) {
+	pending.emplace_back(frame_value, std::move(destroy_function));
+}
+
+void DeferredDestroyQueue::collect(uint64_t completed_frame_value) {
+	// Entries are not sorted by frame, since they can be pushed with any value, so the whole queue is checked
+	for (auto it = pending.begin(); it != pending.end();) {
+		if (it->first <= completed_frame_value) {
+			it->second();
+			it = pending.erase(it);
+		}
+		else {
+			it++;
+		}
+	}
+}
+
+void DeferredDestroyQueue::flush() {
+	for (auto& entry : pending) {
+		entry.second();
+	}
+	pending.clear();
+}
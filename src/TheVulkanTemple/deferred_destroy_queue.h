@@ -0,0 +1,26 @@
+#ifndef THEVULKANTEMPLE_DEFERRED_DESTROY_QUEUE_H
+#define THEVULKANTEMPLE_DEFERRED_DESTROY_QUEUE_H
+
+#include <deque>
+#include <cstdint>
+#include <utility>
+#include <functional>
+
+// Holds the destruction of objects that may still be in use by the gpu until the frame they are tied to is completed,
+// the frames are counted by the owner which knows through its fences which ones are done
+class DeferredDestroyQueue {
+	public:
+		~DeferredDestroyQueue();
+
+		// The destroy function runs once frame_value has been completed
+		void push(uint64_t frame_value, std::function<void()> &&destroy_function);
+		void collect(uint64_t completed_frame_value);
+		// Runs all the pending destructions, the caller must make sure the gpu is idle
+		void flush();
+
+		bool empty() const { return pending.empty(); };
+	private:
+		std::deque<std::pair<uint64_t, std::function<void()>>> pending;
+};
+
+#endif
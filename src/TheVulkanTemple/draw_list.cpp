@@ -0,0 +1,43 @@
+#include "draw_list.h"
+#include <array>
+#include <cstring>
+
+void DrawList::sort() {
+	constexpr uint32_t digits_count = sizeof(uint64_t);
+	constexpr uint32_t digit_values = 256;
+
+	// The histograms of every byte are counted in a single pass over the keys
+	std::array<std::array<uint32_t, digit_values>, digits_count> histograms = {};
+	for (const auto &draw_to_sort : draws) {
+		for (uint32_t digit = 0; digit < digits_count; digit++) {
+			histograms[digit][(draw_to_sort.key >> (digit * 8)) & 0xFF]++;
+		}
+	}
+
+	sorted_draws.resize(draws.size());
+	for (uint32_t digit = 0; digit < digits_count; digit++) {
+		auto &histogram = histograms[digit];
+		// If every key has the same byte the pass would not move anything
+		if (histogram[(draws.empty() ? 0 : draws.front().key >> (digit * 8)) & 0xFF] == draws.size()) {
+			continue;
+		}
+
+		uint32_t offset = 0;
+		for (auto &count : histogram) {
+			uint32_t digit_count = count;
+			count = offset;
+			offset += digit_count;
+		}
+		for (const auto &draw_to_sort : draws) {
+			sorted_draws[histogram[(draw_to_sort.key >> (digit * 8)) & 0xFF]++] = draw_to_sort;
+		}
+		draws.swap(sorted_draws);
+	}
+}
+
+uint32_t DrawList::get_depth_key(float depth) {
+	uint32_t bits;
+	std::memcpy(&bits, &depth, sizeof(float));
+	// Positive floats keep their order with the sign bit set, negative ones need all the bits flipped to reverse theirs
+	return (bits & 0x80000000) ? ~bits : bits | 0x80000000;
+}
@@ -0,0 +1,31 @@
+#ifndef THEVULKANTEMPLE_DRAW_LIST_H
+#define THEVULKANTEMPLE_DRAW_LIST_H
+
+#include <vector>
+#include <span>
+#include <cstdint>
+
+// Draws of a pass, recorded in the order of their 64 bit keys. The key is chosen by the pass, the draws with a smaller
+// key are recorded first
+class DrawList {
+	public:
+		struct draw {
+			uint64_t key;
+			uint32_t model_index;
+			uint32_t primitive_index;
+		};
+
+		void clear() { draws.clear(); };
+		void add(uint64_t key, uint32_t model_index, uint32_t primitive_index) { draws.push_back({key, model_index, primitive_index}); };
+		// Stable radix sort on the bytes of the keys, the bytes that are the same in every key are skipped
+		void sort();
+		std::span<const draw> get_draws() const { return draws; };
+
+		// Maps a depth to a key part with the same order, also for negative depths, so that closer draws come first
+		static uint32_t get_depth_key(float depth);
+	private:
+		std::vector<draw> draws;
+		std::vector<draw> sorted_draws;
+};
+
+#endif //THEVULKANTEMPLE_DRAW_LIST_H
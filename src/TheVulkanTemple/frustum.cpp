@@ -0,0 +1,39 @@
+#include "frustum.h"
+#include <glm/glm.hpp>
+
+Frustum::Frustum(const glm::mat4 &vp_matrix) {
+    glm::vec3 col1(vp_matrix[0][0], vp_matrix[1][0], vp_matrix[2][0]);
+    glm::vec3 col2(vp_matrix[0][1], vp_matrix[1][1], vp_matrix[2][1]);
+    glm::vec3 col3(vp_matrix[0][2], vp_matrix[1][2], vp_matrix[2][2]);
+    glm::vec3 col4(vp_matrix[0][3], vp_matrix[1][3], vp_matrix[2][3]);
+
+    p_left.normal = col4 + col1;
+    p_right.normal = col4 - col1;
+    p_bottom.normal = col4 + col2;
+    p_top.normal = col4 - col2;
+    p_near.normal = col3;
+    p_far.normal = col4 - col3;
+
+    p_left.distance = vp_matrix[3][3] + vp_matrix[3][0];
+    p_right.distance = vp_matrix[3][3] - vp_matrix[3][0];
+    p_bottom.distance = vp_matrix[3][3] + vp_matrix[3][1];
+    p_top.distance = vp_matrix[3][3] - vp_matrix[3][1];
+    p_near.distance = vp_matrix[3][2];
+    p_far.distance = vp_matrix[3][3] - vp_matrix[3][2];
+
+    for (uint32_t i = 0; i < 6; i++) {
+        float mag = 1.0f / glm::length(planes[i].normal);
+        planes[i].normal *= mag;
+        planes[i].distance *= mag;
+    }
+}
+
+bool Frustum::is_sphere_visible(glm::vec3 s_center, float s_radius) const {
+    for (uint32_t i = 0; i < 6; i++) {
+        float side = glm::dot(s_center, planes[i].normal) + planes[i].distance;
+        if (side < -s_radius) {
+            return false;
+        }
+    }
+    return true;
+}
@@ -0,0 +1,34 @@
+#ifndef THEVULKANTEMPLE_FRUSTUM_H
+#define THEVULKANTEMPLE_FRUSTUM_H
+#include <glm/glm.hpp>
+#include <array>
+
+// The six planes of a perspective or orthographic view volume, with the normals pointing inside
+class Frustum {
+    public:
+        Frustum() = default;
+        // The planes are taken from the rows of the view projection matrix
+        explicit Frustum(const glm::mat4 &vp_matrix);
+
+        bool is_sphere_visible(glm::vec3 center, float radius) const;
+
+    private:
+        struct plane {
+            glm::vec3 normal;
+            float distance;
+        };
+
+        union {
+            struct {
+                plane p_left;
+                plane p_right;
+                plane p_bottom;
+                plane p_top;
+                plane p_near;
+                plane p_far;
+            };
+            std::array<plane, 6> planes;
+        };
+};
+
+#endif //THEVULKANTEMPLE_FRUSTUM_H
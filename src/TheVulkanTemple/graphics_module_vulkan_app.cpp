@@ -4,7 +4,10 @@
 #include <chrono>
 #include <iostream>
 #include <span>
+#include <algorithm>
 #include <thread>
+#include <utility>
+#include <cmath>
 #include "layers/smaa/smaa_context.h"
 #include "layers/pbr/pbr_context.h"
 #include "layers/vsm/vsm_context.h"
@@ -32,25 +35,29 @@ GraphicsModuleVulkanApp::GraphicsModuleVulkanApp(const std::string &application_
                                                  bool fullscreen,
                                                  EngineOptions options) :
 						BaseVulkanApp(application_name,
-                                      get_instance_extensions(),
+                                      get_instance_extensions(options.headless),
                                       window_size,
                                       fullscreen,
-                                      get_device_extensions(),
+                                      get_device_extensions(options.headless),
                                       get_required_physical_device_features(false, options),
-                                      VK_TRUE),
+                                      VK_TRUE,
+                                      options.present_mode,
+                                      options.headless),
 						vma_wrapper(instance, selected_physical_device, device, vulkan_api_version, VMA_ALLOCATOR_CREATE_EXT_MEMORY_BUDGET_BIT, 512000000),
-                        vsm_context(device, "resources//shaders"),
-                        pbr_context(device, physical_device_memory_properties, VK_FORMAT_D32_SFLOAT, VK_FORMAT_B10G11R11_UFLOAT_PACK32, VK_FORMAT_R8G8B8A8_UNORM),
-                        smaa_context(device, VK_FORMAT_B10G11R11_UFLOAT_PACK32, "resources//shaders", "resources//textures", physical_device_memory_properties),
-                        hbao_context(device, physical_device_memory_properties, window_size, VK_FORMAT_D32_SFLOAT, VK_FORMAT_R8_UNORM, "resources//shaders", false),
-						hdr_tonemap_context(device, VK_FORMAT_B10G11R11_UFLOAT_PACK32, VK_FORMAT_R8_UNORM, VK_FORMAT_R8G8B8A8_UNORM) {
+						pipeline_cache(device, selected_physical_device, options.pipeline_cache_path, options.shader_archive_path),
+                        vsm_context(device, pipeline_cache, "resources//shaders"),
+                        pbr_context(device, pipeline_cache, physical_device_memory_properties, VK_FORMAT_D32_SFLOAT, VK_FORMAT_B10G11R11_UFLOAT_PACK32, VK_FORMAT_R8G8B8A8_UNORM),
+                        smaa_context(device, pipeline_cache, VK_FORMAT_B10G11R11_UFLOAT_PACK32, "resources//shaders", "resources//textures", physical_device_memory_properties),
+                        hbao_context(device, pipeline_cache, physical_device_memory_properties, window_size, VK_FORMAT_D32_SFLOAT, VK_FORMAT_R8_UNORM, "resources//shaders", false),
+						hdr_tonemap_context(device, pipeline_cache, VK_FORMAT_B10G11R11_UFLOAT_PACK32, VK_FORMAT_R8_UNORM, VK_FORMAT_R8G8B8A8_UNORM),
+						gpu_culling_context(device, pipeline_cache) {
     engine_options = options;
 
 	// Deleting the physical device feature
     get_required_physical_device_features(true, options);
 
     if (engine_options.fsr_settings.preset != AmdFsr::Preset::NONE) {
-		amd_fsr = std::make_unique<AmdFsr>(device, engine_options.fsr_settings, "resources//shaders");
+		amd_fsr = std::make_unique<AmdFsr>(device, pipeline_cache, engine_options.fsr_settings, "resources//shaders");
 		rendering_resolution = amd_fsr->get_recommended_input_resolution(swapchain_create_info.imageExtent);
     }
     else {
@@ -80,35 +87,70 @@ GraphicsModuleVulkanApp::GraphicsModuleVulkanApp(const std::string &application_
     check_error(vkCreateSampler(device, &sampler_create_info, nullptr, &shadow_map_linear_sampler), vulkan_helper::Error::SAMPLER_CREATION_FAILED);
 
 	host_uniform_allocator = std::make_unique<VkBuffersBuddySubAllocator>(vma_wrapper.get_allocator(),
-			VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+			VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT,
 			VMA_MEMORY_USAGE_CPU_TO_GPU, 65536);
 
 	device_mesh_and_index_allocator = std::make_unique<VkBuffersBuddySubAllocator>(vma_wrapper.get_allocator(),
 			VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT,
 			VMA_MEMORY_USAGE_GPU_ONLY, std::exp2(29)); // close to half a GB, precisely 536870912
 
-    // We create 3 copies of frame data
-    VkSemaphoreCreateInfo semaphore_create_info = { VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO, nullptr, 0 };
-    VkFenceCreateInfo fence_create_info = { VK_STRUCTURE_TYPE_FENCE_CREATE_INFO,nullptr,VK_FENCE_CREATE_SIGNALED_BIT };
+    // The passes of the frames are chained by a single timeline semaphore, which starts at 0 since no frame has been submitted
+    VkSemaphoreTypeCreateInfoKHR semaphore_type_create_info = { VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO_KHR, nullptr, VK_SEMAPHORE_TYPE_TIMELINE_KHR, 0 };
+    VkSemaphoreCreateInfo semaphore_create_info = { VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO, &semaphore_type_create_info, 0 };
+    check_error(vkCreateSemaphore(device, &semaphore_create_info, nullptr, &frame_timeline_semaphore), vulkan_helper::Error::SEMAPHORE_CREATION_FAILED);
+
+    // We create one copy of frame data for every frame in flight, the swapchain can only work with binary semaphores
+    frames_data.resize(std::clamp(engine_options.frames_in_flight, 1u, 4u));
+    std::unordered_map<VkPresentModeKHR, std::string> present_mode_names = {
+    		{VK_PRESENT_MODE_FIFO_KHR, "FIFO"}, {VK_PRESENT_MODE_MAILBOX_KHR, "MAILBOX"}, {VK_PRESENT_MODE_IMMEDIATE_KHR, "IMMEDIATE"}
+    };
+    std::cout << "Frames in flight: " << frames_data.size() << ", present mode: "
+              << (headless ? "headless" : present_mode_names[swapchain_create_info.presentMode]) << std::endl;
+    semaphore_create_info.pNext = nullptr;
     for (auto& frame : frames_data) {
-    	vkCreateFence(device, &fence_create_info, nullptr, &frame.after_execution_fence);
-    	frame.semaphores.resize(5);
-    	for (uint32_t i = 0; i < frame.semaphores.size(); i++) {
-    		vkCreateSemaphore(device, &semaphore_create_info, nullptr, &frame.semaphores[i]);
-    	}
+    	check_error(vkCreateSemaphore(device, &semaphore_create_info, nullptr, &frame.image_acquired_semaphore), vulkan_helper::Error::SEMAPHORE_CREATION_FAILED);
+    	check_error(vkCreateSemaphore(device, &semaphore_create_info, nullptr, &frame.render_finished_semaphore), vulkan_helper::Error::SEMAPHORE_CREATION_FAILED);
     	// Creating one pool for each thread
     	create_cmd_pool_and_buffers(main_queue_family_index, VK_COMMAND_BUFFER_LEVEL_PRIMARY, 1, frame.vsm_command);
     	create_cmd_pool_and_buffers(main_queue_family_index, VK_COMMAND_BUFFER_LEVEL_PRIMARY, 1, frame.pbr_command);
     	create_cmd_pool_and_buffers(main_queue_family_index, VK_COMMAND_BUFFER_LEVEL_PRIMARY, swapchain_images.size(), frame.swapchain_copy_static_commands);
     	create_cmd_pool_and_buffers(main_queue_family_index, VK_COMMAND_BUFFER_LEVEL_PRIMARY, 1, frame.post_processing_static_command);
+    	// Every frame copies its culling stats in its own host memory, so that they can be read once the frame is done
+    	if (engine_options.gpu_driven_rendering) {
+    		frame.culling_stats_allocation_data = host_uniform_allocator->suballocate(sizeof(GpuCullingContext::culling_stats), sizeof(uint32_t));
+    	}
+    	if (physical_device_properties.limits.timestampComputeAndGraphics) {
+    		VkQueryPoolCreateInfo query_pool_create_info = {VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO, nullptr, 0, VK_QUERY_TYPE_TIMESTAMP, 2 * frame_timeline_passes, 0};
+    		vkCreateQueryPool(device, &query_pool_create_info, nullptr, &frame.timestamps_query_pool);
+    	}
     }
 
     create_cmd_pool_and_buffers(main_queue_family_index, VK_COMMAND_BUFFER_LEVEL_PRIMARY, 1, general_operation_command);
-    fence_create_info.flags = 0;
+    create_cmd_pool_and_buffers(main_queue_family_index, VK_COMMAND_BUFFER_LEVEL_PRIMARY, 1, screen_constants_update_command);
+    VkFenceCreateInfo fence_create_info = { VK_STRUCTURE_TYPE_FENCE_CREATE_INFO, nullptr, 0 };
     vkCreateFence(device, &fence_create_info, nullptr, &general_operation_fence);
 
     create_sets_layouts();
-    pbr_context.create_pipeline("resources//shaders", pbr_model_data_set_layout, camera_data_set_layout, light_data_set_layout);
+    // The pipelines of all the layers are created in parallel, sharing the shader modules through the pipeline cache
+    JobSystem::Counter pipelines_counter;
+    smaa_context.create_pipelines(job_system, pipelines_counter);
+    hbao_context.create_pipelines(job_system, pipelines_counter);
+    if (amd_fsr) {
+    	amd_fsr->create_pipelines(job_system, pipelines_counter);
+    }
+    job_system.submit(pipelines_counter, "create_pbr_pipelines", [this]() {
+    	pbr_context.create_pipeline("resources//shaders", materials_set_layout, camera_data_set_layout, light_data_set_layout, instance_data_set_layout,
+    								engine_options.depth_pre_pass);
+    });
+    if (engine_options.gpu_driven_rendering) {
+    	job_system.submit(pipelines_counter, "create_gpu_culling_pipelines", [this]() {
+    		gpu_culling_context.create_pipeline("resources//shaders", instance_data_set_layout, camera_data_set_layout, light_data_set_layout);
+    	});
+    }
+    job_system.wait(pipelines_counter);
+    std::chrono::duration<float, std::milli> layers_creation_time = std::chrono::steady_clock::now() - layers_creation_start;
+    std::cout << "Layers created in " << layers_creation_time.count() << " ms with a " << (pipeline_cache.is_warm() ? "warm" : "cold")
+              << " pipeline cache" << std::endl;
 
     // We perform allocations that are not dependent on screen resolutions
     allocate_and_bind_to_memory_buffer(hbao_uniform_allocation, hbao_context.get_permanent_device_buffer(), VMA_MEMORY_USAGE_GPU_ONLY);
@@ -126,7 +168,10 @@ GraphicsModuleVulkanApp::GraphicsModuleVulkanApp(const std::string &application_
     smaa_context.clean_copy_resources();
 }
 
-std::vector<const char*> GraphicsModuleVulkanApp::get_instance_extensions() {
+std::vector<const char*> GraphicsModuleVulkanApp::get_instance_extensions(bool headless) {
+    if (headless) {
+    	return {};
+    }
     std::vector<const char*> instance_extensions = {"VK_KHR_surface"};
     #ifdef _WIN64
         instance_extensions.push_back("VK_KHR_win32_surface");
@@ -143,8 +188,12 @@ std::vector<const char*> GraphicsModuleVulkanApp::get_instance_extensions() {
     return instance_extensions;
 }
 
-std::vector<const char*> GraphicsModuleVulkanApp::get_device_extensions() {
-    return {"VK_KHR_swapchain", "VK_EXT_descriptor_indexing", "VK_EXT_memory_budget"};
+std::vector<const char*> GraphicsModuleVulkanApp::get_device_extensions(bool headless) {
+    std::vector<const char*> device_extensions = {"VK_EXT_descriptor_indexing", "VK_EXT_memory_budget", "VK_KHR_timeline_semaphore"};
+    if (!headless) {
+    	device_extensions.push_back("VK_KHR_swapchain");
+    }
+    return device_extensions;
 }
 
 VkPhysicalDeviceFeatures2* GraphicsModuleVulkanApp::get_required_physical_device_features(bool delete_static_structure, EngineOptions engine_options) {
@@ -167,12 +216,23 @@ VkPhysicalDeviceFeatures2* GraphicsModuleVulkanApp::get_required_physical_device
 		required_physical_device_multiview_features->sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MULTIVIEW_FEATURES;
 		required_physical_device_multiview_features->multiview = VK_TRUE;
 
+		VkPhysicalDeviceTimelineSemaphoreFeaturesKHR *required_physical_device_timeline_semaphore_features = new VkPhysicalDeviceTimelineSemaphoreFeaturesKHR();
+		required_physical_device_timeline_semaphore_features->sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_TIMELINE_SEMAPHORE_FEATURES_KHR;
+		// The multi draws select the material of every draw with gl_DrawID
+		VkPhysicalDeviceShaderDrawParametersFeatures *required_physical_device_shader_draw_parameters_features = new VkPhysicalDeviceShaderDrawParametersFeatures();
+		required_physical_device_shader_draw_parameters_features->sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_SHADER_DRAW_PARAMETERS_FEATURES;
+		required_physical_device_shader_draw_parameters_features->pNext = required_physical_device_multiview_features;
+		required_physical_device_shader_draw_parameters_features->shaderDrawParameters = VK_TRUE;
+
+		required_physical_device_timeline_semaphore_features->pNext = required_physical_device_shader_draw_parameters_features;
+		required_physical_device_timeline_semaphore_features->timelineSemaphore = VK_TRUE;
+
         void* p_next;
         // AmdFsr can be run in F32 or F16, in the latter storageBuffer16BitAccess and shaderFloat16 need to be enabled
         if (engine_options.fsr_settings.preset != AmdFsr::Preset::NONE && engine_options.fsr_settings.precision == AmdFsr::Precision::FP16) {
             VkPhysicalDevice16BitStorageFeatures *physical_device_16_bit_storage_features = new VkPhysicalDevice16BitStorageFeatures();
             physical_device_16_bit_storage_features->sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_16BIT_STORAGE_FEATURES;
-            physical_device_16_bit_storage_features->pNext = required_physical_device_multiview_features;
+            physical_device_16_bit_storage_features->pNext = required_physical_device_timeline_semaphore_features;
             physical_device_16_bit_storage_features->storageBuffer16BitAccess = VK_TRUE;
 
             VkPhysicalDeviceShaderFloat16Int8FeaturesKHR *physical_device_shader_float_16_int_8_features = new VkPhysicalDeviceShaderFloat16Int8FeaturesKHR({
@@ -184,7 +244,7 @@ VkPhysicalDeviceFeatures2* GraphicsModuleVulkanApp::get_required_physical_device
             p_next = physical_device_shader_float_16_int_8_features;
         }
         else {
-            p_next = required_physical_device_multiview_features;
+            p_next = required_physical_device_timeline_semaphore_features;
         }
 
         VkPhysicalDeviceDescriptorIndexingFeaturesEXT *required_physical_device_indexing_features = new VkPhysicalDeviceDescriptorIndexingFeaturesEXT();
@@ -200,6 +260,11 @@ VkPhysicalDeviceFeatures2* GraphicsModuleVulkanApp::get_required_physical_device
         required_device_features2->sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
         required_device_features2->pNext = required_physical_device_indexing_features;
         required_device_features2->features.samplerAnisotropy = VK_TRUE;
+        // The indirect draws select the instance data of their model with firstInstance, and many primitives are drawn with one multi draw
+        if (engine_options.gpu_driven_rendering) {
+        	required_device_features2->features.drawIndirectFirstInstance = VK_TRUE;
+        	required_device_features2->features.multiDrawIndirect = VK_TRUE;
+        }
 		if (engine_options.fsr_settings.preset != AmdFsr::Preset::NONE && engine_options.fsr_settings.precision == AmdFsr::Precision::FP16) {
 			required_device_features2->features.shaderInt16 = VK_TRUE;
 		}
@@ -208,49 +273,43 @@ VkPhysicalDeviceFeatures2* GraphicsModuleVulkanApp::get_required_physical_device
 }
 
 void GraphicsModuleVulkanApp::create_sets_layouts() {
-    // Creating the descriptor set layout for the model data
     std::array<VkDescriptorSetLayoutBinding, 2> descriptor_set_layout_binding;
-    descriptor_set_layout_binding[0] = {
-            0,
-            VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,
-            1,
-            VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT,
-            nullptr
-    };
-    descriptor_set_layout_binding[1] = {
-            1,
-            VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
-            1,
-            VK_SHADER_STAGE_FRAGMENT_BIT,
-            nullptr
-    };
     VkDescriptorSetLayoutCreateInfo descriptor_set_layout_create_info = {
             VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO,
             nullptr,
             0,
-            2,
+            1,
             descriptor_set_layout_binding.data()
     };
-    vkCreateDescriptorSetLayout(device, &descriptor_set_layout_create_info, nullptr, &pbr_model_data_set_layout);
 
-    // Creating the descriptor set layout for the camera
+    // Creating the descriptor set layout for the matrices of all the models, every draw selects its own with firstInstance
+    descriptor_set_layout_binding[0] = {
+            0,
+            VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+            1,
+            VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_COMPUTE_BIT,
+            nullptr
+    };
+    vkCreateDescriptorSetLayout(device, &descriptor_set_layout_create_info, nullptr, &instance_data_set_layout);
+
+    // Creating the descriptor set layout for the camera, which is read also by the gpu culling
     descriptor_set_layout_binding[0] = {
             0,
             VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,
             1,
-            VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT,
+            VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT | VK_SHADER_STAGE_COMPUTE_BIT,
             nullptr
     };
     descriptor_set_layout_create_info.bindingCount = 1;
     descriptor_set_layout_create_info.pBindings = descriptor_set_layout_binding.data();
     vkCreateDescriptorSetLayout(device, &descriptor_set_layout_create_info, nullptr, &camera_data_set_layout);
 
-    // Creating the descriptor set layout for the light
+    // Creating the descriptor set layout for the light, whose buffer is read also by the gpu culling of the shadow casters
     descriptor_set_layout_binding[0] = {
             0,
             VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
             1,
-            VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT,
+            VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT | VK_SHADER_STAGE_COMPUTE_BIT,
             nullptr
     };
     descriptor_set_layout_binding[1] = {
@@ -278,20 +337,44 @@ void GraphicsModuleVulkanApp::create_sets_layouts() {
             descriptor_set_layout_binding.data()
     };
     vkCreateDescriptorSetLayout(device, &descriptor_set_layout_create_info, nullptr, &light_data_set_layout);
+
+    // Creating the descriptor set layout for the images of all the primitives, which is written when the models are loaded
+    // and only up to their number of primitives
+    descriptor_set_layout_binding[0] = {
+            1,
+            VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+            MAX_MATERIALS,
+            VK_SHADER_STAGE_FRAGMENT_BIT,
+            nullptr
+    };
+    descriptor_binding_flags[0] = VK_DESCRIPTOR_BINDING_UPDATE_AFTER_BIND_BIT | VK_DESCRIPTOR_BINDING_PARTIALLY_BOUND_BIT;
+    descriptor_set_layout_binding_flags_create_info.bindingCount = 1;
+    descriptor_set_layout_create_info.bindingCount = 1;
+    vkCreateDescriptorSetLayout(device, &descriptor_set_layout_create_info, nullptr, &materials_set_layout);
 }
 
 void GraphicsModuleVulkanApp::load_3d_objects(std::vector<std::pair<std::string, glm::mat4>> model_file_matrix) {
-    std::vector<GltfModel> gltf_models;
+    // The files are parsed in parallel since every model is independent from the others
+    std::vector<GltfModel> gltf_models(model_file_matrix.size());
+    std::vector<std::vector<VkModel::primitive_host_data_info>> models_infos(model_file_matrix.size());
+    job_system.parallel_for("load_gltf_model", model_file_matrix.size(), [&](uint32_t i) {
+		gltf_models[i] = GltfModel(model_file_matrix[i].first);
+		models_infos[i] = gltf_models[i].copy_model_data_in_ptr(GltfModel::v_model_attributes::V_ALL, true, true,
+                                              GltfModel::t_model_attributes::T_ALL, nullptr, true);
+    });
+
     // Get the total size of the models to allocate a buffer for it and copy them to host memory
     uint64_t models_total_size = 0;
     for (uint32_t i = 0; i < model_file_matrix.size(); i++) {
-		gltf_models.push_back(GltfModel(model_file_matrix[i].first));
-		auto infos = gltf_models.back().copy_model_data_in_ptr(GltfModel::v_model_attributes::V_ALL, true, true,
-                                              GltfModel::t_model_attributes::T_ALL, nullptr, true);
-
-		vk_models.emplace_back(VkModel(device, model_file_matrix[i].first, infos, model_file_matrix[i].second));
+		vk_models.emplace_back(VkModel(device, model_file_matrix[i].first, models_infos[i], model_file_matrix[i].second));
         models_total_size += vk_models.back().get_all_primitives_total_size();
     }
+    // Every primitive takes one element of the materials array
+    uint64_t all_primitives_count = 0;
+    for (const auto& vk_model : vk_models) {
+    	all_primitives_count += vk_model.get_primitives_count();
+    }
+    check_error(all_primitives_count > MAX_MATERIALS ? VK_ERROR_TOO_MANY_OBJECTS : VK_SUCCESS, vulkan_helper::Error::MODEL_LOADING_FAILED);
 	VkBuffersBuddySubAllocator host_model_data_allocator(this->vma_wrapper.get_allocator(),
 			VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VMA_MEMORY_USAGE_CPU_ONLY, models_total_size);
 
@@ -301,18 +384,24 @@ void GraphicsModuleVulkanApp::load_3d_objects(std::vector<std::pair<std::string,
 	device_model_mesh_and_index_allocation_data.resize(gltf_models.size());
     for (uint32_t i=0; i < gltf_models.size(); i++) {
 		host_models_sub_allocation_data[i] = host_model_data_allocator.suballocate(vk_models[i].get_all_primitives_total_size());
+		// The mesh in the device buffer needs to be aligned to the vertex size, so that the draws can address it with the vertex offset
+		device_model_mesh_and_index_allocation_data[i] = device_mesh_and_index_allocator->suballocate(vk_models[i].get_all_primitives_mesh_and_indices_size(),
+				VkModel::vertex_size);
+    }
+    // The suballocations do not overlap, so the copies can be done at the same time
+    job_system.parallel_for("copy_gltf_model_data", gltf_models.size(), [&](uint32_t i) {
         gltf_models[i].copy_model_data_in_ptr(GltfModel::v_model_attributes::V_ALL, false, true,
                                                 GltfModel::t_model_attributes::T_ALL, host_models_sub_allocation_data[i].allocation_host_ptr, false);
-		// The mesh in the device buffer needs to be aligned to the attribute first size, which is always the position hence 12
-		device_model_mesh_and_index_allocation_data[i] = device_mesh_and_index_allocator->suballocate(vk_models[i].get_all_primitives_mesh_and_indices_size(), 12);
-    }
+    });
 
-    // Suballocating the memory for the uniforms
-	model_uniform_allocation_data.resize(vk_models.size());
-	for (uint32_t i = 0; i < vk_models.size(); i++) {
-		model_uniform_allocation_data[i] = host_uniform_allocator->suballocate(vk_models[i].copy_uniform_data(nullptr),
-				physical_device_properties.limits.minUniformBufferOffsetAlignment);
+    // The instance data of all the models is packed in a single storage buffer, in the same order of vk_models
+	if (instance_allocation_data.allocation_host_ptr != nullptr) {
+		host_uniform_allocator->free(instance_allocation_data);
 	}
+	instance_allocation_data = host_uniform_allocator->suballocate(get_instance_data_size(),
+			physical_device_properties.limits.minStorageBufferOffsetAlignment);
+	uploaded_models_versions.assign(vk_models.size(), never_uploaded_version);
+	models_dynamic_until_frames.assign(vk_models.size(), 0);
 
     for (uint32_t i = 0; i < vk_models.size(); i++) {
     	vk_models[i].vk_create_images(amd_fsr ? amd_fsr->get_negative_mip_bias() : 0.0f, vma_wrapper.get_allocator());
@@ -340,6 +429,79 @@ void GraphicsModuleVulkanApp::load_3d_objects(std::vector<std::pair<std::string,
 	for (auto& sub_allocation_data : host_models_sub_allocation_data) {
 		host_model_data_allocator.free(sub_allocation_data);
 	}
+
+    // The cull data does not change after loading, so it is written only once. It needs the offsets of the meshes in the device
+    // buffer, which are known only after recording the copies
+    if (engine_options.gpu_driven_rendering) {
+    	uint64_t cull_data_size = 0;
+    	for (uint32_t i = 0; i < vk_models.size(); i++) {
+    		cull_data_size += vk_models[i].copy_cull_data(nullptr, i);
+    	}
+    	if (primitives_cull_allocation_data.allocation_host_ptr != nullptr) {
+    		host_uniform_allocator->free(primitives_cull_allocation_data);
+    	}
+    	primitives_cull_allocation_data = host_uniform_allocator->suballocate(cull_data_size, physical_device_properties.limits.minStorageBufferOffsetAlignment);
+    	for (uint32_t i = 0, cull_data_offset = 0; i < vk_models.size(); i++) {
+    		cull_data_offset += vk_models[i].copy_cull_data(static_cast<uint8_t*>(primitives_cull_allocation_data.allocation_host_ptr) + cull_data_offset, i);
+    	}
+
+    	gpu_culling_context.create_resources(cull_data_size / sizeof(VkModel::primitive_cull_data));
+    	allocate_and_bind_to_memory(device_gpu_culling_allocations, gpu_culling_context.get_device_buffers(), {}, VMA_MEMORY_USAGE_GPU_ONLY);
+
+    	start_one_time_command_submit(general_operation_command.command_buffers.front());
+    	gpu_culling_context.record_resources_init(general_operation_command.command_buffers.front());
+    	end_submit_block_and_reset_command_submit(general_operation_command.command_pool, general_operation_command.command_buffers.front(),
+    											  VK_PIPELINE_STAGE_TRANSFER_BIT, general_operation_fence);
+    }
+	// The staging allocator dies here, so we keep its counters for the telemetry
+	staging_allocators_stats += host_model_data_allocator.get_stats();
+}
+
+VkBuffersBuddySubAllocator::allocator_stats GraphicsModuleVulkanApp::get_allocators_stats() {
+	VkBuffersBuddySubAllocator::allocator_stats total_stats = host_uniform_allocator->get_stats();
+	total_stats += device_mesh_and_index_allocator->get_stats();
+	total_stats += staging_allocators_stats;
+	return total_stats;
+}
+
+std::string GraphicsModuleVulkanApp::get_job_timings_json(int indent) {
+	return nlohmann::json(job_system.collect_job_timings()).dump(indent);
+}
+
+std::string GraphicsModuleVulkanApp::get_allocators_stats_json(int indent) {
+	nlohmann::json stats_json = {
+		{"host_uniform_allocator", host_uniform_allocator->get_stats()},
+		{"device_mesh_and_index_allocator", device_mesh_and_index_allocator->get_stats()},
+		{"staging_allocators", staging_allocators_stats},
+		{"total", get_allocators_stats()},
+		{"transient_attachments", {
+			{"unaliased_size", transient_images_aliasing_planner.get_unaliased_size()},
+			{"aliased_size", transient_images_aliasing_planner.get_aliased_size()},
+			{"saved", transient_memory_saved},
+			{"saved_at_3840x2160", transient_memory_saved_4k}
+		}}
+	};
+	return stats_json.dump(indent);
+}
+
+void GraphicsModuleVulkanApp::set_allocation_trace_recording(bool enabled) {
+	host_uniform_allocator->get_block_allocator().set_trace_recording(enabled);
+	device_mesh_and_index_allocator->get_block_allocator().set_trace_recording(enabled);
+}
+
+std::string GraphicsModuleVulkanApp::get_allocation_traces_json(int indent) {
+	auto allocator_trace_json = [](const BuddyBlockAllocator &block_allocator) {
+		return nlohmann::json{
+			{"block_initial_size", block_allocator.get_block_initial_size()},
+			{"min_allocation_size", block_allocator.get_min_allocation_size()},
+			{"trace", block_allocator.get_trace()}
+		};
+	};
+	nlohmann::json traces_json = {
+		{"host_uniform_allocator", allocator_trace_json(host_uniform_allocator->get_block_allocator())},
+		{"device_mesh_and_index_allocator", allocator_trace_json(device_mesh_and_index_allocator->get_block_allocator())}
+	};
+	return traces_json.dump(indent);
 }
 
 void GraphicsModuleVulkanApp::load_lights(std::vector<Light> &&lights) {
@@ -348,6 +510,9 @@ void GraphicsModuleVulkanApp::load_lights(std::vector<Light> &&lights) {
 
 void GraphicsModuleVulkanApp::set_camera(Camera &&camera) {
     this->camera = camera;
+    // The version of the new camera is not related to the old one
+    recording_resources_version++;
+    uploaded_camera_version = never_uploaded_version;
 }
 
 void GraphicsModuleVulkanApp::init_renderer() {
@@ -359,11 +524,11 @@ void GraphicsModuleVulkanApp::init_renderer() {
 	if (lights_allocation_data.allocation_host_ptr != nullptr) {
 		host_uniform_allocator->free(lights_allocation_data);
 	}
-	lights_allocation_data = host_uniform_allocator->suballocate(lights_container.front().copy_data_to_ptr(nullptr) * lights_container.size(),
+	lights_allocation_data = host_uniform_allocator->suballocate(get_lights_data_size(),
                                                                  physical_device_properties.limits.minStorageBufferOffsetAlignment);
-
-    std::vector<VkBuffer> device_buffers_to_allocate;
-    std::vector<VkImage> device_images_to_allocate;
+	// The lights memory is new and the shadow map indices are reassigned below, so every light has to be uploaded
+	uploaded_lights_versions.assign(lights_container.size(), never_uploaded_version);
+	uploaded_camera_version = never_uploaded_version;
 
     // Iterator range that goes only through shadowed lights
     auto shadowed_lights_it_range = boost::make_iterator_range(this->lights_container.get<1>().upper_bound(0),
@@ -379,7 +544,72 @@ void GraphicsModuleVulkanApp::init_renderer() {
         j++;
     }
 
-    vsm_context.create_resources(shadow_map_resolutions, ssbo_indices, pbr_model_data_set_layout, light_data_set_layout);
+    // The shadow maps do not depend on the screen, so they are kept in their own allocations. The gpu culled draw commands
+    // do not tell static and dynamic casters apart, so only the cpu culling can cache the static ones
+    vsm_context.create_resources(shadow_map_resolutions, ssbo_indices, instance_data_set_layout, light_data_set_layout, !engine_options.gpu_driven_rendering);
+    allocate_and_bind_to_memory(device_shadow_maps_allocations, {}, vsm_context.get_device_images(), VMA_MEMORY_USAGE_GPU_ONLY);
+    vsm_context.init_resources();
+    // Every shadow map has its own culled draw commands
+    if (engine_options.gpu_driven_rendering) {
+    	gpu_culling_context.create_shadow_casters_resources(vsm_context.get_shadow_maps_count());
+    	allocate_and_bind_to_memory(device_shadow_casters_culling_allocations, {gpu_culling_context.get_shadow_casters_draw_commands_buffer()}, {},
+    								VMA_MEMORY_USAGE_GPU_ONLY);
+    }
+    // The new shadow maps have nothing cached
+    shadow_map_caches.assign(vsm_context.get_shadow_maps_count(), {});
+    light_frustums.resize(vsm_context.get_shadow_maps_count());
+    shadow_map_updates.assign(vsm_context.get_shadow_maps_count(), VSMContext::ShadowMapUpdate::NONE);
+
+    write_scene_descriptor_sets();
+    create_secondary_command_buffers();
+
+    init_screen_resources();
+}
+
+void GraphicsModuleVulkanApp::create_secondary_command_buffers() {
+    // The models are split in contiguous ranges with about the same number of primitives, one range for every worker
+    uint64_t all_primitives_count = 0;
+    for (const auto& vk_model : vk_models) {
+        all_primitives_count += vk_model.device_primitives_data_info.size();
+    }
+    uint32_t ranges_count = std::min<uint32_t>(vk_models.size(), job_system.get_workers_count());
+    pbr_recording_model_ranges.clear();
+    pbr_recording_first_primitives.clear();
+    for (uint32_t i = 0, first_model = 0, first_primitive = 0, primitives_so_far = 0; i < vk_models.size(); i++) {
+        primitives_so_far += vk_models[i].device_primitives_data_info.size();
+        bool range_full = primitives_so_far * ranges_count >= all_primitives_count * (pbr_recording_model_ranges.size() + 1);
+        if (range_full || i == vk_models.size() - 1) {
+            pbr_recording_model_ranges.emplace_back(first_model, i + 1 - first_model);
+            pbr_recording_first_primitives.push_back(first_primitive);
+            first_model = i + 1;
+            first_primitive = primitives_so_far;
+        }
+    }
+
+    for (auto& frame : frames_data) {
+        for (auto& secondary_command : frame.vsm_secondary_commands) {
+            delete_cmd_pool_and_buffers(secondary_command);
+        }
+        for (auto& secondary_command : frame.pbr_secondary_commands) {
+            delete_cmd_pool_and_buffers(secondary_command);
+        }
+        frame.vsm_secondary_commands.resize(vsm_context.get_shadow_maps_count());
+        for (auto& secondary_command : frame.vsm_secondary_commands) {
+            create_cmd_pool_and_buffers(main_queue_family_index, VK_COMMAND_BUFFER_LEVEL_SECONDARY, 2, secondary_command);
+        }
+        frame.pbr_secondary_commands.resize(pbr_recording_model_ranges.size());
+        for (auto& secondary_command : frame.pbr_secondary_commands) {
+            create_cmd_pool_and_buffers(main_queue_family_index, VK_COMMAND_BUFFER_LEVEL_SECONDARY, engine_options.depth_pre_pass ? 2 : 1, secondary_command);
+        }
+    }
+}
+
+void GraphicsModuleVulkanApp::init_screen_resources() {
+    std::vector<VkBuffer> device_buffers_to_allocate;
+    std::vector<VkImage> device_images_to_allocate;
+    // Every recorded command buffer refers to resources that are going to be recreated
+    recording_resources_version++;
+
     smaa_context.create_resources(rendering_resolution);
     hbao_context.create_resources(rendering_resolution);
     hdr_tonemap_context.create_resources(rendering_resolution, "resources//shaders");
@@ -392,6 +622,12 @@ void GraphicsModuleVulkanApp::init_renderer() {
                  1, 1,VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_INPUT_ATTACHMENT_BIT);
     device_images_to_allocate.push_back(device_depth_image);
 
+    // The depth pyramid of the occlusion culling is built from the depth image
+    if (engine_options.gpu_driven_rendering) {
+    	gpu_culling_context.create_depth_pyramid(rendering_resolution);
+    	device_images_to_allocate.push_back(gpu_culling_context.get_depth_pyramid_image());
+    }
+
     create_image(device_render_target, VK_FORMAT_B10G11R11_UFLOAT_PACK32, {rendering_resolution.width, rendering_resolution.height, 1},
                  2, 1, VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_INPUT_ATTACHMENT_BIT);
     device_images_to_allocate.push_back(device_render_target);
@@ -414,18 +650,27 @@ void GraphicsModuleVulkanApp::init_renderer() {
 		device_images_to_allocate.push_back(device_upscaled_image);
 	}
 
-    // We request information about the buffer and images we need from the contexts and store them in a vector
-    auto vec = vsm_context.get_device_images();
-    device_images_to_allocate.insert(device_images_to_allocate.end(), vec.begin(), vec.end());
-
-    auto smaa_array_images = smaa_context.get_device_images();
-    device_images_to_allocate.insert(device_images_to_allocate.end(), smaa_array_images.begin(), smaa_array_images.end());
-
-    auto hbao_array_images = hbao_context.get_device_images();
-    device_images_to_allocate.insert(device_images_to_allocate.end(), hbao_array_images.begin(), hbao_array_images.end());
-
+    // The images internal to a post-processing layer are only alive during its stage, so they can share memory
+    std::vector<std::pair<VkImage, uint32_t>> transient_images_to_allocate;
+    // Area ratio of every image between a 3840x2160 output and the current one, the fsr output follows the display
+    // resolution while the other images follow the rendering resolution
+    VkExtent2D display_resolution_4k = {3840, 2160};
+    VkExtent2D rendering_resolution_4k = amd_fsr ? amd_fsr->get_recommended_input_resolution(display_resolution_4k) : display_resolution_4k;
+    double rendering_scale_to_4k = (static_cast<double>(rendering_resolution_4k.width) * rendering_resolution_4k.height) /
+                                   (static_cast<double>(rendering_resolution.width) * rendering_resolution.height);
+    std::vector<double> transient_images_scales_to_4k;
+    for (const auto& image : smaa_context.get_device_images()) {
+        transient_images_to_allocate.emplace_back(image, SMAA_STAGE);
+        transient_images_scales_to_4k.push_back(rendering_scale_to_4k);
+    }
+    for (const auto& image : hbao_context.get_device_images()) {
+        transient_images_to_allocate.emplace_back(image, HBAO_STAGE);
+        transient_images_scales_to_4k.push_back(rendering_scale_to_4k);
+    }
 	if (engine_options.fsr_settings.preset != AmdFsr::Preset::NONE) {
-		device_images_to_allocate.push_back(amd_fsr->get_device_image());
+		transient_images_to_allocate.emplace_back(amd_fsr->get_device_image(), FSR_STAGE);
+		transient_images_scales_to_4k.push_back((static_cast<double>(display_resolution_4k.width) * display_resolution_4k.height) /
+		                                        (static_cast<double>(swapchain_create_info.imageExtent.width) * swapchain_create_info.imageExtent.height));
 	}
 
     // We then allocate all needed images and buffers in the gpu, freeing the others first
@@ -433,6 +678,11 @@ void GraphicsModuleVulkanApp::init_renderer() {
 	out_allocations.insert(out_allocations.begin(), device_attachments_allocations.begin(), device_attachments_allocations.end());
     allocate_and_bind_to_memory(out_allocations, device_buffers_to_allocate, device_images_to_allocate, VMA_MEMORY_USAGE_GPU_ONLY);
     device_attachments_allocations = std::vector<VmaAllocation>(out_allocations.begin(), out_allocations.end());
+    allocate_and_bind_to_aliased_memory(device_transient_attachments_allocations, transient_images_to_allocate, VMA_MEMORY_USAGE_GPU_ONLY);
+
+    uint64_t transient_unaliased_size = transient_images_aliasing_planner.get_unaliased_size();
+    transient_memory_saved = transient_unaliased_size - transient_images_aliasing_planner.get_aliased_size();
+    transient_memory_saved_4k = estimate_aliased_memory_saved(transient_images_to_allocate, transient_images_scales_to_4k);
 
     // We then create the image views
     create_image_view(device_depth_image_view, device_depth_image, VK_FORMAT_D32_SFLOAT, VK_IMAGE_ASPECT_DEPTH_BIT, 0,1);
@@ -445,60 +695,117 @@ void GraphicsModuleVulkanApp::init_renderer() {
 		create_image_view(device_upscaled_image_view, device_upscaled_image, VK_FORMAT_R8G8B8A8_UNORM,VK_IMAGE_ASPECT_COLOR_BIT, 0, 1);
 	}
 
-    vsm_context.init_resources();
 	smaa_context.init_resources(device_render_target_image_views[1]);
+	if (engine_options.gpu_driven_rendering) {
+		gpu_culling_context.init_depth_pyramid();
+	}
     pbr_context.set_output_images(rendering_resolution, device_depth_image_view, device_render_target_image_views[0], device_normal_g_image_view);
 
     hbao_context.init_resources();
     hbao_context.update_constants(camera.get_proj_matrix(), 0.4f, 3.0f, 0.7f, 3.0f);
 
-    start_one_time_command_submit(general_operation_command.command_buffers.front());
-    hbao_context.record_constants_update(general_operation_command.command_buffers.front());
+    // The barriers of the updates order them after the frames in flight, which still read the old constants
+    wait_for_frame(screen_constants_update_frame_value);
+    vkResetCommandPool(device, screen_constants_update_command.command_pool, 0);
+    start_one_time_command_submit(screen_constants_update_command.command_buffers.front());
+    hbao_context.record_constants_update(screen_constants_update_command.command_buffers.front());
     if (amd_fsr) {
-        amd_fsr->record_constants_update(general_operation_command.command_buffers.front());
+        amd_fsr->record_constants_update(screen_constants_update_command.command_buffers.front());
     }
-    end_submit_block_and_reset_command_submit(general_operation_command.command_pool, general_operation_command.command_buffers.front(),
-                                              VK_PIPELINE_STAGE_TRANSFER_BIT, general_operation_fence);
+    vkEndCommandBuffer(screen_constants_update_command.command_buffers.front());
+    screen_constants_update_pending = true;
 
     // After creating all resources we proceed to create the descriptor sets
-    write_descriptor_sets();
+    write_attachments_descriptor_sets();
 
-    // Then we record the command buffers that need to be recorded only one time
+    // Then we record the command buffers that need to be recorded only one time, in new pools if the old ones were retired
     for (auto& frame : frames_data) {
-    	record_static_command_buffers(frame.post_processing_static_command, frame.swapchain_copy_static_commands);
+    	if (frame.post_processing_static_command.command_pool == VK_NULL_HANDLE) {
+    		create_cmd_pool_and_buffers(main_queue_family_index, VK_COMMAND_BUFFER_LEVEL_PRIMARY, 1, frame.post_processing_static_command);
+    	}
+    	if (frame.swapchain_copy_static_commands.command_pool == VK_NULL_HANDLE) {
+    		create_cmd_pool_and_buffers(main_queue_family_index, VK_COMMAND_BUFFER_LEVEL_PRIMARY, swapchain_images.size(), frame.swapchain_copy_static_commands);
+    	}
+    	record_static_command_buffers(frame);
     }
 }
 
-void GraphicsModuleVulkanApp::write_descriptor_sets() {
-    // Then we get all the required descriptors and request a single pool
-    uint64_t all_primitives_count = 0;
-    for (uint64_t i = 0; i < vk_models.size(); i++) {
-		all_primitives_count += vk_models[i].device_primitives_data_info.size();
+void GraphicsModuleVulkanApp::retire_screen_resources() {
+    std::vector<std::function<void()>> layers_destroy_functions = {
+    		smaa_context.retire_screen_resources(),
+    		hbao_context.retire_screen_resources(),
+    		hdr_tonemap_context.retire_screen_resources(),
+    		pbr_context.retire_output_images()
+    };
+    if (amd_fsr) {
+    	layers_destroy_functions.push_back(amd_fsr->retire_screen_resources());
+    }
+    if (engine_options.gpu_driven_rendering) {
+    	layers_destroy_functions.push_back(gpu_culling_context.retire_depth_pyramid());
     }
 
-    // uniform buffer is for the camera, the storage buffer is for the lights
-    std::pair<std::unordered_map<VkDescriptorType, uint32_t>, uint32_t> sets_elements_required = {
-            {
-                    {VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 1 + all_primitives_count},
-                    {VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, MAX_SHADOWED_LIGHTS + all_primitives_count},
-                    {VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1}
-            },
-            static_cast<uint32_t>(1 + 1 + all_primitives_count)
-    };
+    std::vector<VkImage> images = {device_depth_image, device_render_target, device_normal_g_image, device_global_ao_image,
+    							   device_tonemapped_image, device_upscaled_image};
+    std::vector<VkImageView> image_views = {device_depth_image_view, device_render_target_image_views[0], device_render_target_image_views[1],
+    										device_normal_g_image_view, device_global_ao_image_view, device_tonemapped_image_view, device_upscaled_image_view};
+    std::vector<VmaAllocation> allocations = std::move(device_attachments_allocations);
+    allocations.insert(allocations.end(), device_transient_attachments_allocations.begin(), device_transient_attachments_allocations.end());
+    VkDescriptorPool descriptor_pool = attachments_descriptor_pool;
+    // The static command buffers of every frame are recorded again in new pools
+    std::vector<command_record_info> static_commands;
+    for (auto& frame : frames_data) {
+    	static_commands.push_back(std::exchange(frame.post_processing_static_command, {}));
+    	static_commands.push_back(std::exchange(frame.swapchain_copy_static_commands, {}));
+    }
 
-    vulkan_helper::insert_or_sum(sets_elements_required, vsm_context.get_required_descriptor_pool_size_and_sets());
+    device_depth_image = device_render_target = device_normal_g_image = device_global_ao_image = VK_NULL_HANDLE;
+    device_tonemapped_image = device_upscaled_image = VK_NULL_HANDLE;
+    device_depth_image_view = device_normal_g_image_view = device_global_ao_image_view = VK_NULL_HANDLE;
+    device_tonemapped_image_view = device_upscaled_image_view = VK_NULL_HANDLE;
+    device_render_target_image_views = {VK_NULL_HANDLE, VK_NULL_HANDLE};
+    device_attachments_allocations.clear();
+    device_transient_attachments_allocations.clear();
+    attachments_descriptor_pool = VK_NULL_HANDLE;
+
+    deferred_destroy_queue.push(submitted_frames_count + frames_data.size(),
+    		[this, layers_destroy_functions, images, image_views, allocations, descriptor_pool, static_commands]() mutable {
+    	for (auto& static_command : static_commands) {
+    		delete_cmd_pool_and_buffers(static_command);
+    	}
+    	vkDestroyDescriptorPool(device, descriptor_pool, nullptr);
+    	for (auto& destroy_function : layers_destroy_functions) {
+    		destroy_function();
+    	}
+    	for (auto& image_view : image_views) {
+    		vkDestroyImageView(device, image_view, nullptr);
+    	}
+    	for (auto& image : images) {
+    		vkDestroyImage(device, image, nullptr);
+    	}
+    	for (auto& allocation : allocations) {
+    		vmaFreeMemory(vma_wrapper.get_allocator(), allocation);
+    	}
+    });
+}
+
+void GraphicsModuleVulkanApp::write_attachments_descriptor_sets() {
+    // The sets of the screen sized layers live in their own pool, which is rebuilt on resize
+    std::pair<std::unordered_map<VkDescriptorType, uint32_t>, uint32_t> sets_elements_required = {{}, 0};
     vulkan_helper::insert_or_sum(sets_elements_required, smaa_context.get_required_descriptor_pool_size_and_sets());
     vulkan_helper::insert_or_sum(sets_elements_required, hbao_context.get_required_descriptor_pool_size_and_sets());
     vulkan_helper::insert_or_sum(sets_elements_required, hdr_tonemap_context.get_required_descriptor_pool_size_and_sets());
 	if (engine_options.fsr_settings.preset != AmdFsr::Preset::NONE) {
 		vulkan_helper::insert_or_sum(sets_elements_required, amd_fsr->get_required_descriptor_pool_size_and_sets());
 	}
+	if (engine_options.gpu_driven_rendering) {
+		vulkan_helper::insert_or_sum(sets_elements_required, gpu_culling_context.get_required_attachments_descriptor_pool_size_and_sets());
+	}
     std::vector<VkDescriptorPoolSize> descriptor_pool_size = vulkan_helper::convert_map_to_vector(sets_elements_required.first);
 
     VkDescriptorPoolCreateInfo descriptor_pool_create_info = {
             VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO,
             nullptr,
-            VK_DESCRIPTOR_POOL_CREATE_FREE_DESCRIPTOR_SET_BIT | VK_DESCRIPTOR_POOL_CREATE_UPDATE_AFTER_BIND_BIT,
+            VK_DESCRIPTOR_POOL_CREATE_FREE_DESCRIPTOR_SET_BIT,
             sets_elements_required.second,
             static_cast<uint32_t>(descriptor_pool_size.size()),
             descriptor_pool_size.data()
@@ -506,33 +813,74 @@ void GraphicsModuleVulkanApp::write_descriptor_sets() {
     vkDestroyDescriptorPool(device, attachments_descriptor_pool, nullptr);
     vkCreateDescriptorPool(device, &descriptor_pool_create_info, nullptr, &attachments_descriptor_pool);
 
-    // Next we allocate the descriptors of all the contextes
-    vsm_context.allocate_descriptor_sets(attachments_descriptor_pool);
     smaa_context.allocate_descriptor_sets(attachments_descriptor_pool, device_render_target_image_views[0]);
     hbao_context.allocate_descriptor_sets(attachments_descriptor_pool, device_depth_image_view, device_normal_g_image_view, device_global_ao_image_view);
     hdr_tonemap_context.allocate_descriptor_sets(attachments_descriptor_pool, device_render_target_image_views[1], device_global_ao_image_view, {device_tonemapped_image_view});
 	if (engine_options.fsr_settings.preset != AmdFsr::Preset::NONE) {
 		amd_fsr->allocate_descriptor_sets(attachments_descriptor_pool, device_tonemapped_image_view, device_upscaled_image_view);
 	}
+	if (engine_options.gpu_driven_rendering) {
+		gpu_culling_context.allocate_attachments_descriptor_sets(attachments_descriptor_pool, device_depth_image_view);
+	}
+}
+
+void GraphicsModuleVulkanApp::write_scene_descriptor_sets() {
+    // Then we get all the required descriptors and request a single pool
+    uint64_t all_primitives_count = 0;
+    for (uint64_t i = 0; i < vk_models.size(); i++) {
+		all_primitives_count += vk_models[i].device_primitives_data_info.size();
+    }
+
+    // uniform buffer is for the camera, the storage buffers are for the lights and the instance data, the images are for the
+    // shadow maps and the materials
+    std::pair<std::unordered_map<VkDescriptorType, uint32_t>, uint32_t> sets_elements_required = {
+            {
+                    {VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 1},
+                    {VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, MAX_SHADOWED_LIGHTS + MAX_MATERIALS},
+                    {VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 2}
+            },
+            1 + 1 + 1 + 1
+    };
+
+    vulkan_helper::insert_or_sum(sets_elements_required, vsm_context.get_required_descriptor_pool_size_and_sets());
+    if (engine_options.gpu_driven_rendering) {
+    	vulkan_helper::insert_or_sum(sets_elements_required, gpu_culling_context.get_required_descriptor_pool_size_and_sets());
+    }
+    std::vector<VkDescriptorPoolSize> descriptor_pool_size = vulkan_helper::convert_map_to_vector(sets_elements_required.first);
+
+    VkDescriptorPoolCreateInfo descriptor_pool_create_info = {
+            VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO,
+            nullptr,
+            VK_DESCRIPTOR_POOL_CREATE_FREE_DESCRIPTOR_SET_BIT | VK_DESCRIPTOR_POOL_CREATE_UPDATE_AFTER_BIND_BIT,
+            sets_elements_required.second,
+            static_cast<uint32_t>(descriptor_pool_size.size()),
+            descriptor_pool_size.data()
+    };
+    vkDestroyDescriptorPool(device, scene_descriptor_pool, nullptr);
+    vkCreateDescriptorPool(device, &descriptor_pool_create_info, nullptr, &scene_descriptor_pool);
+
+    // Next we allocate the descriptors of the shadow maps and of the culling
+    vsm_context.allocate_descriptor_sets(scene_descriptor_pool);
+    if (engine_options.gpu_driven_rendering) {
+    	gpu_culling_context.allocate_descriptor_sets(scene_descriptor_pool, primitives_cull_allocation_data.buffer, primitives_cull_allocation_data.buffer_offset,
+    			all_primitives_count * sizeof(VkModel::primitive_cull_data));
+    }
 
-    // then we allocate descriptor sets for camera, lights and objects
-    std::vector<VkDescriptorSetLayout> layouts_of_sets;
-    layouts_of_sets.push_back(camera_data_set_layout);
-    layouts_of_sets.push_back(light_data_set_layout);
-    layouts_of_sets.insert(layouts_of_sets.end(), all_primitives_count, pbr_model_data_set_layout);
+    // then we allocate descriptor sets for camera, lights, instance data and materials
+    std::vector<VkDescriptorSetLayout> layouts_of_sets = {camera_data_set_layout, light_data_set_layout, instance_data_set_layout, materials_set_layout};
 
     descriptor_sets.resize(layouts_of_sets.size());
     VkDescriptorSetAllocateInfo descriptor_set_allocate_info = {
             VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO,
             nullptr,
-            attachments_descriptor_pool,
+            scene_descriptor_pool,
             static_cast<uint32_t>(layouts_of_sets.size()),
             layouts_of_sets.data()
     };
     check_error(vkAllocateDescriptorSets(device, &descriptor_set_allocate_info, descriptor_sets.data()), vulkan_helper::Error::DESCRIPTOR_SET_ALLOCATION_FAILED);
 
-    // After we write the descriptor sets for camera, lights and objects
-    std::vector<VkWriteDescriptorSet> write_descriptor_set(1 + 2);
+    // After we write the descriptor sets for camera, lights, instance data and materials
+    std::array<VkWriteDescriptorSet, 1 + 2 + 1 + 1> write_descriptor_set;
 
     // First we do the camera
     VkDescriptorBufferInfo camera_descriptor_buffer_info = {
@@ -557,7 +905,7 @@ void GraphicsModuleVulkanApp::write_descriptor_sets() {
 	VkDescriptorBufferInfo light_descriptor_buffer_info = {
 			lights_allocation_data.buffer,
 			lights_allocation_data.buffer_offset,
-			lights_container.front().copy_data_to_ptr(nullptr) * lights_container.size()
+			get_lights_data_size()
 	};
 
     auto shadowed_lights_it_range = boost::make_iterator_range(this->lights_container.get<1>().upper_bound(0),
@@ -597,41 +945,74 @@ void GraphicsModuleVulkanApp::write_descriptor_sets() {
         nullptr
     };
 
-    // Lastly, the objects
-    auto it = descriptor_sets.begin() + 2;
-    for (uint32_t i = 0; i < vk_models.size(); i++) {
-    	auto vk_model_write_descriptor_sets = vk_models[i].get_descriptor_writes({ it, vk_models[i].device_primitives_data_info.size() },
-						model_uniform_allocation_data[i].buffer, model_uniform_allocation_data[i].buffer_offset);
-    	it += vk_models[i].device_primitives_data_info.size();
-    	write_descriptor_set.insert(write_descriptor_set.end(), vk_model_write_descriptor_sets.begin(), vk_model_write_descriptor_sets.end());
-    }
-    vkUpdateDescriptorSets(device, write_descriptor_set.size(), write_descriptor_set.data(), 0, nullptr);
+    // Then the matrices of all the models
+    VkDescriptorBufferInfo instance_descriptor_buffer_info = {
+    		instance_allocation_data.buffer,
+    		instance_allocation_data.buffer_offset,
+    		get_instance_data_size()
+    };
+    write_descriptor_set[3] = {
+        VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+        nullptr,
+        descriptor_sets[2],
+        0,
+        0,
+        1,
+        VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+        nullptr,
+        &instance_descriptor_buffer_info,
+        nullptr
+    };
 
-    auto it2 = write_descriptor_set.begin() + 3;
-    for (uint32_t i = 0; i < vk_models.size(); i++) {
-    	vk_models[i].clean_descriptor_writes({ it2, 2 });
-    	it2 += vk_models[i].device_primitives_data_info.size() * 2;
+    // Lastly, the materials, in the same order of the primitives in the cull data and in the draw commands
+    std::vector<VkDescriptorImageInfo> materials_descriptor_image_infos;
+    materials_descriptor_image_infos.reserve(all_primitives_count);
+    for (const auto& vk_model : vk_models) {
+    	auto vk_model_descriptor_image_infos = vk_model.get_descriptor_image_infos();
+    	materials_descriptor_image_infos.insert(materials_descriptor_image_infos.end(), vk_model_descriptor_image_infos.begin(), vk_model_descriptor_image_infos.end());
     }
+    write_descriptor_set[4] = {
+        VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+        nullptr,
+        descriptor_sets[3],
+        1,
+        0,
+        static_cast<uint32_t>(materials_descriptor_image_infos.size()),
+        VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+        materials_descriptor_image_infos.data(),
+        nullptr,
+        nullptr
+    };
+    vkUpdateDescriptorSets(device, write_descriptor_set.size(), write_descriptor_set.data(), 0, nullptr);
 }
 
-void GraphicsModuleVulkanApp::record_static_command_buffers(command_record_info post_processing, command_record_info swapchain_copy_commands) {
+void GraphicsModuleVulkanApp::record_static_command_buffers(frame_data &frame) {
+	command_record_info &post_processing = frame.post_processing_static_command;
+	command_record_info &swapchain_copy_commands = frame.swapchain_copy_static_commands;
 	vkResetCommandPool(device, post_processing.command_pool, 0);
 	VkCommandBufferBeginInfo command_buffer_begin_info = { VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO, nullptr, 0, nullptr};
 
 	// command buffer for recording image post-processing
 	vkBeginCommandBuffer(post_processing.command_buffers[0], &command_buffer_begin_info);
+	record_pass_start_timestamp(post_processing.command_buffers[0], frame, 2);
+	record_aliasing_barrier(post_processing.command_buffers[0], SMAA_STAGE);
 	smaa_context.record_into_command_buffer(post_processing.command_buffers[0]);
+	record_aliasing_barrier(post_processing.command_buffers[0], HBAO_STAGE);
 	hbao_context.record_into_command_buffer(post_processing.command_buffers[0], rendering_resolution, camera.get_znear(), camera.get_zfar(), true);
+	record_aliasing_barrier(post_processing.command_buffers[0], TONEMAP_STAGE);
 	hdr_tonemap_context.record_into_command_buffer(post_processing.command_buffers[0], 0, rendering_resolution);
 	if (engine_options.fsr_settings.preset != AmdFsr::Preset::NONE) {
+		record_aliasing_barrier(post_processing.command_buffers[0], FSR_STAGE);
 		amd_fsr->record_into_command_buffer(post_processing.command_buffers[0], device_tonemapped_image, device_upscaled_image);
 	}
+	record_pass_end_timestamp(post_processing.command_buffers[0], frame, 2);
 	vkEndCommandBuffer(post_processing.command_buffers[0]);
 
 	// command buffers for each swapchain image, in which it registers the copy
 	vkResetCommandPool(device, swapchain_copy_commands.command_pool, 0);
 	for(uint32_t i = 0; i < swapchain_copy_commands.command_buffers.size(); i++) {
 		vkBeginCommandBuffer(swapchain_copy_commands.command_buffers[i], &command_buffer_begin_info);
+		record_pass_start_timestamp(swapchain_copy_commands.command_buffers[i], frame, 3);
 
 		VkImage image_to_copy = amd_fsr ? device_upscaled_image : device_tonemapped_image;
 		// Copying output image to the swapchain one
@@ -660,29 +1041,130 @@ void GraphicsModuleVulkanApp::record_static_command_buffers(command_record_info
 		image_memory_barrier.srcAccessMask = VK_ACCESS_MEMORY_WRITE_BIT;
 		image_memory_barrier.srcAccessMask = VK_ACCESS_MEMORY_READ_BIT;
 		image_memory_barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
-		image_memory_barrier.newLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+		image_memory_barrier.newLayout = swapchain_images_final_layout;
 		vkCmdPipelineBarrier(swapchain_copy_commands.command_buffers[i], VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, 0, nullptr, 0, nullptr, 1, &image_memory_barrier);
+		record_pass_end_timestamp(swapchain_copy_commands.command_buffers[i], frame, 3);
 		vkEndCommandBuffer(swapchain_copy_commands.command_buffers[i]);
 	}
 }
 
-void GraphicsModuleVulkanApp::record_vsm_command_buffer(command_record_info vsm_to_record) {
+void GraphicsModuleVulkanApp::record_pass_start_timestamp(VkCommandBuffer command_buffer, const frame_data &frame, uint32_t pass) {
+	if (frame.timestamps_query_pool != VK_NULL_HANDLE) {
+		vkCmdResetQueryPool(command_buffer, frame.timestamps_query_pool, 2 * pass, 2);
+		vkCmdWriteTimestamp(command_buffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, frame.timestamps_query_pool, 2 * pass);
+	}
+}
+
+void GraphicsModuleVulkanApp::record_pass_end_timestamp(VkCommandBuffer command_buffer, const frame_data &frame, uint32_t pass) {
+	if (frame.timestamps_query_pool != VK_NULL_HANDLE) {
+		vkCmdWriteTimestamp(command_buffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, frame.timestamps_query_pool, 2 * pass + 1);
+	}
+}
+
+void GraphicsModuleVulkanApp::record_vsm_command_buffer(frame_data &frame) {
+	// The draws of every shadow map that is updated are recorded in parallel in secondary command buffers. Without the gpu
+	// culling, the shadow casters are culled on the cpu against the frustum of their light
+	JobSystem::Counter secondary_recording_counter;
+	for (uint32_t i = 0; i < frame.vsm_secondary_commands.size(); i++) {
+		if (shadow_map_updates[i] == VSMContext::ShadowMapUpdate::NONE) {
+			continue;
+		}
+		job_system.submit(secondary_recording_counter, "record_shadow_map_draws", [this, &frame, i]() {
+			vkResetCommandPool(device, frame.vsm_secondary_commands[i].command_pool, 0);
+			const auto& command_buffers = frame.vsm_secondary_commands[i].command_buffers;
+			switch (shadow_map_updates[i]) {
+				case VSMContext::ShadowMapUpdate::ALL_CASTERS:
+					if (engine_options.gpu_driven_rendering) {
+						vsm_context.record_shadow_map_draws(command_buffers[0], i, descriptor_sets[2], descriptor_sets[1], vk_models, nullptr, nullptr,
+								gpu_culling_context.get_shadow_casters_draw_commands_buffer(), gpu_culling_context.get_shadow_casters_draw_commands_offset(i));
+					}
+					else {
+						vsm_context.record_shadow_map_draws(command_buffers[0], i, descriptor_sets[2], descriptor_sets[1], vk_models, &light_frustums[i], nullptr);
+					}
+					break;
+				case VSMContext::ShadowMapUpdate::STATIC_AND_DYNAMIC_CASTERS:
+					vsm_context.record_shadow_map_draws(command_buffers[0], i, descriptor_sets[2], descriptor_sets[1], vk_models, &light_frustums[i], &static_models_mask);
+					[[fallthrough]];
+				case VSMContext::ShadowMapUpdate::DYNAMIC_CASTERS:
+					vsm_context.record_shadow_map_draws(command_buffers[1], i, descriptor_sets[2], descriptor_sets[1], vk_models, &light_frustums[i], &dynamic_models_mask);
+					break;
+				default:
+					break;
+			}
+		});
+	}
+	std::vector<VkCommandBuffer> secondary_command_buffers;
+	std::vector<VkCommandBuffer> dynamic_casters_command_buffers;
+	for (const auto& secondary_command : frame.vsm_secondary_commands) {
+		secondary_command_buffers.push_back(secondary_command.command_buffers[0]);
+		dynamic_casters_command_buffers.push_back(secondary_command.command_buffers[1]);
+	}
+	job_system.wait(secondary_recording_counter);
+
 	// command buffer for the vsm draw commands
-	vkResetCommandPool(device, vsm_to_record.command_pool, 0);
-	VkCommandBufferBeginInfo command_buffer_begin_info = { VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO, nullptr, VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT, nullptr};
-	vkBeginCommandBuffer(vsm_to_record.command_buffers[0], &command_buffer_begin_info);
-	std::vector<VkDescriptorSet> object_descriptor_sets(descriptor_sets.begin() + 2, descriptor_sets.end());
-	vsm_context.record_into_command_buffer(vsm_to_record.command_buffers[0], descriptor_sets[1], vk_models);
-	vkEndCommandBuffer(vsm_to_record.command_buffers[0]);
+	vkResetCommandPool(device, frame.vsm_command.command_pool, 0);
+	// Not one time submit, since the command buffer is submitted again as long as the scene does not change
+	VkCommandBufferBeginInfo command_buffer_begin_info = { VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO, nullptr, 0, nullptr};
+	vkBeginCommandBuffer(frame.vsm_command.command_buffers[0], &command_buffer_begin_info);
+	record_pass_start_timestamp(frame.vsm_command.command_buffers[0], frame, 0);
+	bool any_update = std::any_of(shadow_map_updates.begin(), shadow_map_updates.end(), [](auto update) {
+		return update != VSMContext::ShadowMapUpdate::NONE;
+	});
+	if (engine_options.gpu_driven_rendering && any_update) {
+		gpu_culling_context.record_shadow_casters_culling(frame.vsm_command.command_buffers[0], descriptor_sets[2], descriptor_sets[1], lights_container.size());
+	}
+	vsm_context.record_into_command_buffer(frame.vsm_command.command_buffers[0], secondary_command_buffers, dynamic_casters_command_buffers, shadow_map_updates);
+	record_pass_end_timestamp(frame.vsm_command.command_buffers[0], frame, 0);
+	vkEndCommandBuffer(frame.vsm_command.command_buffers[0]);
 }
 
-void GraphicsModuleVulkanApp::record_pbr_command_buffer(command_record_info pbr_to_record) {
+void GraphicsModuleVulkanApp::record_pbr_command_buffer(frame_data &frame) {
+	// Every range of models is recorded in parallel in a secondary command buffer
+	JobSystem::Counter secondary_recording_counter;
+	for (uint32_t i = 0; i < frame.pbr_secondary_commands.size(); i++) {
+		job_system.submit(secondary_recording_counter, "record_pbr_draws", [this, &frame, i]() {
+			vkResetCommandPool(device, frame.pbr_secondary_commands[i].command_pool, 0);
+			std::span<const VkModel> models_range(vk_models.data() + pbr_recording_model_ranges[i].first, pbr_recording_model_ranges[i].second);
+			VkBuffer draw_commands_buffer = engine_options.gpu_driven_rendering ? gpu_culling_context.get_draw_commands_buffer() : VK_NULL_HANDLE;
+			pbr_context.record_draws(frame.pbr_secondary_commands[i].command_buffers[0], descriptor_sets[3], descriptor_sets[0], descriptor_sets[1], descriptor_sets[2],
+					models_range, pbr_recording_model_ranges[i].first, camera, draw_commands_buffer, pbr_recording_first_primitives[i]);
+			if (engine_options.depth_pre_pass) {
+				pbr_context.record_draws(frame.pbr_secondary_commands[i].command_buffers[1], descriptor_sets[3], descriptor_sets[0], descriptor_sets[1], descriptor_sets[2],
+						models_range, pbr_recording_model_ranges[i].first, camera, draw_commands_buffer, pbr_recording_first_primitives[i], true);
+			}
+		});
+	}
+	std::vector<VkCommandBuffer> secondary_command_buffers;
+	std::vector<VkCommandBuffer> depth_pre_pass_command_buffers;
+	for (const auto& secondary_command : frame.pbr_secondary_commands) {
+		secondary_command_buffers.push_back(secondary_command.command_buffers[0]);
+		if (engine_options.depth_pre_pass) {
+			depth_pre_pass_command_buffers.push_back(secondary_command.command_buffers[1]);
+		}
+	}
+	job_system.wait(secondary_recording_counter);
+
 	// command buffer for the pbr draw commands
-	vkResetCommandPool(device, pbr_to_record.command_pool, 0);
-	VkCommandBufferBeginInfo command_buffer_begin_info = { VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO, nullptr, VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT, nullptr};
-	vkBeginCommandBuffer(pbr_to_record.command_buffers[0], &command_buffer_begin_info);
-	pbr_context.record_into_command_buffer(pbr_to_record.command_buffers[0], descriptor_sets[0], descriptor_sets[1], vk_models, camera);
-	vkEndCommandBuffer(pbr_to_record.command_buffers[0]);
+	vkResetCommandPool(device, frame.pbr_command.command_pool, 0);
+	// Not one time submit, since the command buffer is submitted again as long as the scene does not change
+	VkCommandBufferBeginInfo command_buffer_begin_info = { VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO, nullptr, 0, nullptr};
+	vkBeginCommandBuffer(frame.pbr_command.command_buffers[0], &command_buffer_begin_info);
+	record_pass_start_timestamp(frame.pbr_command.command_buffers[0], frame, 1);
+	if (engine_options.gpu_driven_rendering) {
+		gpu_culling_context.record_into_command_buffer(frame.pbr_command.command_buffers[0], descriptor_sets[2], descriptor_sets[0],
+				GpuCullingContext::Phase::PREVIOUSLY_VISIBLE);
+	}
+	pbr_context.record_into_command_buffer(frame.pbr_command.command_buffers[0], secondary_command_buffers, false, depth_pre_pass_command_buffers);
+	// The same draws are executed again with the commands of the primitives that the first phase has missed
+	if (engine_options.gpu_driven_rendering) {
+		gpu_culling_context.record_into_command_buffer(frame.pbr_command.command_buffers[0], descriptor_sets[2], descriptor_sets[0],
+				GpuCullingContext::Phase::NEWLY_VISIBLE);
+		pbr_context.record_into_command_buffer(frame.pbr_command.command_buffers[0], secondary_command_buffers, true, depth_pre_pass_command_buffers);
+		gpu_culling_context.record_stats_copy(frame.pbr_command.command_buffers[0], frame.culling_stats_allocation_data.buffer,
+				frame.culling_stats_allocation_data.buffer_offset);
+	}
+	record_pass_end_timestamp(frame.pbr_command.command_buffers[0], frame, 1);
+	vkEndCommandBuffer(frame.pbr_command.command_buffers[0]);
 }
 
 void GraphicsModuleVulkanApp::start_frame_loop(std::function<void(GraphicsModuleVulkanApp*)> resize_callback,
@@ -694,170 +1176,437 @@ void GraphicsModuleVulkanApp::start_frame_loop(std::function<void(GraphicsModule
 
     frame_data* current_frame_data = &frames_data[all_rendered_frames % frames_data.size()];
     frame_data* next_frame_data = &frames_data[(all_rendered_frames + 1) % frames_data.size()];
-    vkResetFences(device, 1, &current_frame_data->after_execution_fence);
-    std::thread vsm_record_thread = std::thread(&GraphicsModuleVulkanApp::record_vsm_command_buffer, this, current_frame_data->vsm_command);
-    std::thread pbr_record_thread = std::thread(&GraphicsModuleVulkanApp::record_pbr_command_buffer, this, current_frame_data->pbr_command);
+    // The command buffers of a frame are recorded by the job system while the previous one is being presented
+    JobSystem::Counter recording_jobs_counter;
+    // The command buffers of a slot are recorded again only if what they were recorded with has changed
+    // The vsm command buffer is recorded with the frame, since it depends on what the shadow maps contain
+    auto submit_recording_jobs = [&](frame_data *frame_data_to_record) {
+    	recording_state pbr_recording_state = get_pbr_recording_state();
+    	if (frame_data_to_record->pbr_recorded_state != pbr_recording_state) {
+    		frame_data_to_record->pbr_recorded_state = std::move(pbr_recording_state);
+    		job_system.submit(recording_jobs_counter, "record_pbr_command_buffer", [this, frame_data_to_record]() {
+    			record_pbr_command_buffer(*frame_data_to_record);
+    		});
+    	}
+    };
+    submit_recording_jobs(current_frame_data);
 
+    // The recording jobs read the resources that get recreated, so they must be done before the resize
     auto resize_lambda = [&](frame_data *frame_data_to_record) {
+    	job_system.wait(recording_jobs_counter);
     	on_window_resize(resize_callback);
-    	vsm_record_thread.join();
-    	pbr_record_thread.join();
-    	vsm_record_thread = std::thread(&GraphicsModuleVulkanApp::record_vsm_command_buffer, this, frame_data_to_record->vsm_command);
-    	pbr_record_thread = std::thread(&GraphicsModuleVulkanApp::record_pbr_command_buffer, this, frame_data_to_record->pbr_command);
+    	submit_recording_jobs(frame_data_to_record);
+    };
+
+    // With a limit every frame starts one period after the previous one
+    std::chrono::steady_clock::duration frame_period = std::chrono::steady_clock::duration::zero();
+    if (engine_options.frame_rate_limit > 0.0f) {
+    	frame_period = std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(1.0 / engine_options.frame_rate_limit));
+    }
+    std::chrono::steady_clock::time_point next_frame_start = std::chrono::steady_clock::now();
+
+    auto frame_loop_running = [&]() {
+    	return !frame_loop_stop_requested && (engine_options.frames_to_render == 0 || all_rendered_frames < engine_options.frames_to_render) &&
+    		   (headless || !glfwWindowShouldClose(window));
     };
 
-    while (!glfwWindowShouldClose(window)) {
+    while (frame_loop_running()) {
+    	if (frame_period != std::chrono::steady_clock::duration::zero()) {
+    		wait_until(next_frame_start);
+    		// If we fell behind by more than a frame we do not try to catch up
+    		next_frame_start = std::max(next_frame_start + frame_period, std::chrono::steady_clock::now());
+    	}
+
     	// Pre submit work
         current_frame = std::chrono::steady_clock::now();
         delta_time = std::chrono::duration_cast<std::chrono::milliseconds>(current_frame - last_frame).count();
         last_frame = current_frame;
+        // The waits for the gpu and the presentation engine are taken out of the cpu frame time
+        std::chrono::steady_clock::duration blocked_time = std::chrono::steady_clock::duration::zero();
 
-        glfwPollEvents();
-        pre_submit_callback(this, delta_time);
-
-        camera.copy_data_to_ptr(static_cast<uint8_t*>(camera_allocation_data.allocation_host_ptr));
-        for(uint32_t i = 0, offset = 0; i < lights_container.size(); i++) {
-            offset += lights_container[i].copy_data_to_ptr(static_cast<uint8_t*>(lights_allocation_data.allocation_host_ptr) + offset);
+        if (!headless) {
+        	glfwPollEvents();
         }
+        pre_submit_callback(this, delta_time);
 
-        for(uint32_t i = 0; i < vk_models.size(); i++) {
-            vk_models[i].copy_uniform_data(static_cast<uint8_t*>(model_uniform_allocation_data[i].allocation_host_ptr));
-        }
+        upload_uniform_data();
 
         // Start of frame submission
         current_frame_data = &frames_data[all_rendered_frames % frames_data.size()];
         next_frame_data = &frames_data[(all_rendered_frames + 1) % frames_data.size()];
 
+        // When the swapchain is out of date no image is acquired and the semaphore is left untouched, so the frame can
+        // be skipped, while a suboptimal swapchain still gives an image which is rendered before recreating it. The headless
+        // images are used in turn, the submission order already keeps a frame from writing one still being written
         uint32_t image_index = 0;
-        VkResult res = vkAcquireNextImageKHR(device, swapchain, UINT64_MAX, current_frame_data->semaphores[0], VK_NULL_HANDLE, &image_index);
-        if (res == VK_SUBOPTIMAL_KHR || res == VK_ERROR_OUT_OF_DATE_KHR) {
-			/* TODO: if vkAcquireNextImageKHR fails, current_frame_data->semaphores[0] is still signaled so when the loop resets,
-			vkAcquireNextImageKHR will be met by a signaled semaphore and vulkan will complain. Either solve this with a timeline semaphore or
-			just ignore this until it becomes a serious issue. */
+        VkResult acquire_res = VK_SUCCESS;
+        if (headless) {
+        	image_index = all_rendered_frames % swapchain_images.size();
+        }
+        else {
+        	std::chrono::steady_clock::time_point acquire_start = std::chrono::steady_clock::now();
+        	acquire_res = vkAcquireNextImageKHR(device, swapchain, UINT64_MAX, current_frame_data->image_acquired_semaphore, VK_NULL_HANDLE, &image_index);
+        	blocked_time += std::chrono::steady_clock::now() - acquire_start;
+        }
+        if (acquire_res == VK_ERROR_OUT_OF_DATE_KHR) {
             resize_lambda(current_frame_data);
             continue;
         }
-        else if (res != VK_SUCCESS) {
-            check_error(res, vulkan_helper::Error::ACQUIRE_NEXT_IMAGE_FAILED);
+        else if (acquire_res != VK_SUCCESS && acquire_res != VK_SUBOPTIMAL_KHR) {
+            check_error(acquire_res, vulkan_helper::Error::ACQUIRE_NEXT_IMAGE_FAILED);
+        }
+
+        // The shadow maps are shared by all the frames, so their updates are scheduled only once the frame is sure to be submitted
+        schedule_shadow_map_updates();
+        recording_state vsm_recording_state = get_vsm_recording_state();
+        if (current_frame_data->vsm_recorded_state != vsm_recording_state) {
+        	current_frame_data->vsm_recorded_state = std::move(vsm_recording_state);
+        	job_system.submit(recording_jobs_counter, "record_vsm_command_buffer", [this, current_frame_data]() {
+        		record_vsm_command_buffer(*current_frame_data);
+        	});
+        }
+
+        // Every pass of the frame signals its own value of the timeline, and waits for the value of the previous pass
+        uint64_t frame_value = submitted_frames_count + 1;
+        std::array<uint64_t, frame_timeline_passes + 1> pass_values;
+        for (uint32_t i = 0; i < pass_values.size(); i++) {
+        	pass_values[i] = (frame_value - 1) * frame_timeline_passes + i;
         }
 
-        std::array<VkSubmitInfo, 4> submit_infos;
+        std::array<VkTimelineSemaphoreSubmitInfoKHR, frame_timeline_passes> timeline_submit_infos;
+        std::array<VkSubmitInfo, frame_timeline_passes> submit_infos;
+        timeline_submit_infos[0] = { VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO_KHR, nullptr, 0, nullptr, 1, &pass_values[1] };
         submit_infos[0] = {
         		VK_STRUCTURE_TYPE_SUBMIT_INFO,
-        		nullptr,
+        		&timeline_submit_infos[0],
         		0,
         		nullptr,
         		nullptr,
         		1,
         		&current_frame_data->vsm_command.command_buffers[0],
         		1,
-        		&current_frame_data->semaphores[1]
+        		&frame_timeline_semaphore
         };
         VkPipelineStageFlags fragment_flag = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
+        timeline_submit_infos[1] = { VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO_KHR, nullptr, 1, &pass_values[1], 1, &pass_values[2] };
         submit_infos[1] = {
         		VK_STRUCTURE_TYPE_SUBMIT_INFO,
-        		nullptr,
+        		&timeline_submit_infos[1],
         		1,
-        		&current_frame_data->semaphores[1],
+        		&frame_timeline_semaphore,
         		&fragment_flag,
         		1,
         		&current_frame_data->pbr_command.command_buffers[0],
         		1,
-        		&current_frame_data->semaphores[2]
+        		&frame_timeline_semaphore
         };
         VkPipelineStageFlags color_attachment_stage_flag = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+        timeline_submit_infos[2] = { VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO_KHR, nullptr, 1, &pass_values[2], 1, &pass_values[3] };
         submit_infos[2] = {
         		VK_STRUCTURE_TYPE_SUBMIT_INFO,
-        		nullptr,
+        		&timeline_submit_infos[2],
         		1,
-        		&current_frame_data->semaphores[2],
+        		&frame_timeline_semaphore,
         		&color_attachment_stage_flag,
         		1,
         		&current_frame_data->post_processing_static_command.command_buffers[0],
         		1,
-        		&current_frame_data->semaphores[3]
+        		&frame_timeline_semaphore
         };
+        // The last pass also waits for the swapchain image and signals the binary semaphore for the present, the values of
+        // binary semaphores are ignored. In headless mode there is nothing to acquire nor present, so only the timeline is used
+        uint32_t last_pass_semaphores_count = headless ? 1 : 2;
         std::array<VkPipelineStageFlags, 2> stage_flags = {VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT};
-        std::array<VkSemaphore, 2> semaphores_to_wait = {current_frame_data->semaphores[3], current_frame_data->semaphores[0]};
+        std::array<VkSemaphore, 2> semaphores_to_wait = {frame_timeline_semaphore, current_frame_data->image_acquired_semaphore};
+        std::array<uint64_t, 2> values_to_wait = {pass_values[3], 0};
+        std::array<VkSemaphore, 2> semaphores_to_signal = {frame_timeline_semaphore, current_frame_data->render_finished_semaphore};
+        std::array<uint64_t, 2> values_to_signal = {pass_values[4], 0};
+        timeline_submit_infos[3] = { VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO_KHR, nullptr, last_pass_semaphores_count, values_to_wait.data(),
+        		last_pass_semaphores_count, values_to_signal.data() };
         submit_infos[3] = {
         		VK_STRUCTURE_TYPE_SUBMIT_INFO,
-        		nullptr,
-        		semaphores_to_wait.size(),
+        		&timeline_submit_infos[3],
+        		last_pass_semaphores_count,
         		semaphores_to_wait.data(),
         		stage_flags.data(),
         		1,
         		&current_frame_data->swapchain_copy_static_commands.command_buffers[image_index],
-        		1,
-        		&current_frame_data->semaphores[4]
+        		last_pass_semaphores_count,
+        		semaphores_to_signal.data()
         };
-        vsm_record_thread.join();
-        pbr_record_thread.join();
-        check_error(vkQueueSubmit(queue, submit_infos.size(), submit_infos.data(), current_frame_data->after_execution_fence), vulkan_helper::Error::QUEUE_SUBMIT_FAILED);
-
-        // Start of current frame post-submit work for next frame
-        vkWaitForFences(device, 1, &next_frame_data->after_execution_fence, VK_TRUE, std::numeric_limits<uint64_t>::max());
-        vkResetFences(device, 1, &next_frame_data->after_execution_fence);
-        vsm_record_thread = std::thread(&GraphicsModuleVulkanApp::record_vsm_command_buffer, this, next_frame_data->vsm_command);
-        pbr_record_thread = std::thread(&GraphicsModuleVulkanApp::record_pbr_command_buffer, this, next_frame_data->pbr_command);
-
-        // Start of frame present
-        VkPresentInfoKHR present_info = {
-                VK_STRUCTURE_TYPE_PRESENT_INFO_KHR,
-                nullptr,
-                1,
-                &current_frame_data->semaphores[4],
-                1,
-                &swapchain,
-                &image_index,
-                nullptr
-        };
-        res = vkQueuePresentKHR(queue, &present_info);
+        job_system.wait(recording_jobs_counter);
+        // Submitted before the frame, so the frame reads the new constants and it is done once the frame is
+        if (screen_constants_update_pending) {
+        	VkSubmitInfo submit_info = {VK_STRUCTURE_TYPE_SUBMIT_INFO, nullptr, 0, nullptr, nullptr, 1, &screen_constants_update_command.command_buffers[0], 0, nullptr};
+        	check_error(vkQueueSubmit(queue, 1, &submit_info, VK_NULL_HANDLE), vulkan_helper::Error::QUEUE_SUBMIT_FAILED);
+        	screen_constants_update_pending = false;
+        	screen_constants_update_frame_value = frame_value;
+        }
+        check_error(vkQueueSubmit(queue, submit_infos.size(), submit_infos.data(), VK_NULL_HANDLE), vulkan_helper::Error::QUEUE_SUBMIT_FAILED);
+        current_frame_data->frame_value = frame_value;
+        submitted_frames_count = frame_value;
+
+        // Start of current frame post-submit work for next frame, which can start once the last frame of its slot is done
+        std::chrono::steady_clock::time_point wait_start = std::chrono::steady_clock::now();
+        wait_for_frame(next_frame_data->frame_value);
+        blocked_time += std::chrono::steady_clock::now() - wait_start;
+        if (engine_options.gpu_driven_rendering && next_frame_data->frame_value != 0) {
+        	memcpy(&culling_stats, next_frame_data->culling_stats_allocation_data.allocation_host_ptr, sizeof(GpuCullingContext::culling_stats));
+        }
+        std::array<uint64_t, 2 * frame_timeline_passes> timestamps;
+        if (next_frame_data->timestamps_query_pool != VK_NULL_HANDLE && next_frame_data->frame_value != 0 &&
+        	vkGetQueryPoolResults(device, next_frame_data->timestamps_query_pool, 0, timestamps.size(), sizeof(timestamps), timestamps.data(),
+        						  sizeof(uint64_t), VK_QUERY_RESULT_64_BIT) == VK_SUCCESS) {
+        	auto to_ms = [&](uint64_t start, uint64_t end) { return (end - start) * physical_device_properties.limits.timestampPeriod / 1e6f; };
+        	gpu_times = {
+        			to_ms(timestamps[0], timestamps[7]),
+        			to_ms(timestamps[0], timestamps[1]),
+        			to_ms(timestamps[2], timestamps[3]),
+        			to_ms(timestamps[4], timestamps[5]),
+        			to_ms(timestamps[6], timestamps[7])
+        	};
+        }
+        deferred_destroy_queue.collect(get_completed_frame_value());
+        submit_recording_jobs(next_frame_data);
+
+        // Start of frame present, the headless image is just left in its layout
         rendered_frames++;
         all_rendered_frames++;
-        if (res == VK_SUBOPTIMAL_KHR || res == VK_ERROR_OUT_OF_DATE_KHR) {
-            resize_lambda(next_frame_data);
-            continue;
+        VkResult present_res = VK_SUCCESS;
+        if (!headless) {
+        	VkPresentInfoKHR present_info = {
+        			VK_STRUCTURE_TYPE_PRESENT_INFO_KHR,
+        			nullptr,
+        			1,
+        			&current_frame_data->render_finished_semaphore,
+        			1,
+        			&swapchain,
+        			&image_index,
+        			nullptr
+        	};
+        	std::chrono::steady_clock::time_point present_start = std::chrono::steady_clock::now();
+        	present_res = vkQueuePresentKHR(queue, &present_info);
+        	blocked_time += std::chrono::steady_clock::now() - present_start;
+        }
+        cpu_frame_time = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - current_frame - blocked_time).count();
+        if (!headless) {
+        	if (present_res == VK_SUBOPTIMAL_KHR || present_res == VK_ERROR_OUT_OF_DATE_KHR || acquire_res == VK_SUBOPTIMAL_KHR) {
+        		resize_lambda(next_frame_data);
+        		continue;
+        	}
+        	else if (present_res != VK_SUCCESS) {
+        		check_error(present_res, vulkan_helper::Error::QUEUE_PRESENT_FAILED);
+        	}
         }
-        else if (res != VK_SUCCESS) {
-			check_error(res, vulkan_helper::Error::QUEUE_PRESENT_FAILED);
-		}
 
         uint32_t time_diff = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - frames_time).count();
-        if ( time_diff > 1000) {
+        if (engine_options.print_frame_times && time_diff > 1000) {
             std::cout << "Msec/frame: " << ( time_diff / static_cast<float>(rendered_frames)) << std::endl;
             rendered_frames = 0;
             frames_time = std::chrono::steady_clock::now();
         }
     }
-    // The thread need to be waited upon before exiting the function
-    vsm_record_thread.join();
-    pbr_record_thread.join();
+    // The jobs need to be waited upon before exiting the function
+    job_system.wait(recording_jobs_counter);
 }
 
 void GraphicsModuleVulkanApp::on_window_resize(std::function<void(GraphicsModuleVulkanApp*)> resize_callback) {
-    vkDeviceWaitIdle(device);
-    create_swapchain();
+    // Only the screen sized resources are recreated, the shadow maps, models and scene descriptors are left untouched. Nothing
+    // waits for the frames in flight, the old resources are retired and destroyed once they are done
+    BaseVulkanApp::retired_swapchain old_swapchain = create_swapchain();
+    // The presentation engine could still be using the old swapchain, so it is destroyed once enough frames have gone through
+    deferred_destroy_queue.push(submitted_frames_count + frames_data.size(), [this, old_swapchain]() {
+    	for (auto& image_view : old_swapchain.image_views) {
+    		vkDestroyImageView(device, image_view, nullptr);
+    	}
+    	vkDestroySwapchainKHR(device, old_swapchain.swapchain, nullptr);
+    });
+
     rendering_resolution = amd_fsr ? amd_fsr->get_recommended_input_resolution(swapchain_create_info.imageExtent) : swapchain_create_info.imageExtent;
-    init_renderer();
+    retire_screen_resources();
+    init_screen_resources();
     resize_callback(this);
 }
 
+void GraphicsModuleVulkanApp::upload_uniform_data() {
+    if (uploaded_camera_version != camera.get_version()) {
+    	camera.copy_data_to_ptr(static_cast<uint8_t*>(camera_allocation_data.allocation_host_ptr));
+    	uploaded_camera_version = camera.get_version();
+    }
+
+    // Every light takes the same space, so the ones that did not change are simply skipped
+    for (uint32_t i = 0; i < lights_container.size(); i++) {
+    	if (uploaded_lights_versions[i] != lights_container[i].get_version()) {
+    		lights_container[i].copy_data_to_ptr(static_cast<uint8_t*>(lights_allocation_data.allocation_host_ptr) + i * Light::get_data_size());
+    		uploaded_lights_versions[i] = lights_container[i].get_version();
+    	}
+    }
+
+    // Same for the models, whose row in the instance data is their index
+    for (uint32_t i = 0; i < vk_models.size(); i++) {
+    	if (uploaded_models_versions[i] != vk_models[i].get_version()) {
+    		// A model that moves stays dynamic for a while, the first upload is only its placement
+    		if (uploaded_models_versions[i] != never_uploaded_version) {
+    			models_dynamic_until_frames[i] = submitted_frames_count + frames_to_become_static;
+    		}
+    		vk_models[i].copy_uniform_data(static_cast<uint8_t*>(instance_allocation_data.allocation_host_ptr) + i * VkModel::uniform_data_size);
+    		uploaded_models_versions[i] = vk_models[i].get_version();
+    	}
+    }
+}
+
+GraphicsModuleVulkanApp::recording_state GraphicsModuleVulkanApp::get_vsm_recording_state() {
+    return {recording_resources_version, shadow_map_updates_version};
+}
+
+void GraphicsModuleVulkanApp::schedule_shadow_map_updates() {
+    static_models_mask.resize(vk_models.size());
+    dynamic_models_mask.resize(vk_models.size());
+    for (uint32_t i = 0; i < vk_models.size(); i++) {
+    	dynamic_models_mask[i] = models_dynamic_until_frames[i] > submitted_frames_count;
+    	static_models_mask[i] = !dynamic_models_mask[i];
+    }
+
+    std::vector<VSMContext::ShadowMapUpdate> updates(shadow_map_updates.size(), VSMContext::ShadowMapUpdate::NONE);
+    std::vector<float> priorities(shadow_map_updates.size(), 0.0f);
+    // The caches are changed only for the updates that are kept
+    std::vector<shadow_map_cache_info> new_caches(shadow_map_updates.size());
+    for (const auto& light : lights_container) {
+    	if (light.light_params.shadow_map_index < 0) {
+    		continue;
+    	}
+    	uint32_t shadow_map_index = light.light_params.shadow_map_index;
+    	light_frustums[shadow_map_index] = light.get_frustum();
+
+    	auto& [valid, light_version, static_casters, dynamic_casters] = new_caches[shadow_map_index];
+    	valid = true;
+    	light_version = light.get_version();
+    	for (uint32_t i = 0; i < vk_models.size(); i++) {
+    		if (vk_models[i].is_visible(light_frustums[shadow_map_index])) {
+    			if (dynamic_models_mask[i]) {
+    				dynamic_casters.emplace_back(i, vk_models[i].get_version());
+    			}
+    			else {
+    				static_casters.push_back(i);
+    			}
+    		}
+    	}
+
+    	// The static casters are drawn again only when they change, since they did not move they are identified by their index
+    	auto& cache = shadow_map_caches[shadow_map_index];
+    	if (!cache.valid || cache.light_version != light.get_version() || cache.static_casters != static_casters) {
+    		updates[shadow_map_index] = VSMContext::ShadowMapUpdate::STATIC_AND_DYNAMIC_CASTERS;
+    	}
+    	else if (cache.dynamic_casters != dynamic_casters) {
+    		updates[shadow_map_index] = VSMContext::ShadowMapUpdate::DYNAMIC_CASTERS;
+    	}
+
+    	// The lights that cover more of the screen are more noticeable, as are the ones that moved
+    	if (light.get_type() == Light::LightType::DIRECTIONAL) {
+    		priorities[shadow_map_index] = 1.0f;
+    	}
+    	else if (camera.is_sphere_visible(light.get_pos(), light.get_falloff_distance())) {
+    		float camera_distance = glm::distance(camera.get_pos(), light.get_pos());
+    		priorities[shadow_map_index] = std::min(1.0f, light.get_falloff_distance() / std::max(camera_distance, 0.001f));
+    	}
+    	else {
+    		priorities[shadow_map_index] = 0.01f;
+    	}
+    	if (cache.light_version != light.get_version()) {
+    		priorities[shadow_map_index] *= 2.0f;
+    	}
+
+    	if (engine_options.gpu_driven_rendering && updates[shadow_map_index] != VSMContext::ShadowMapUpdate::NONE) {
+    		updates[shadow_map_index] = VSMContext::ShadowMapUpdate::ALL_CASTERS;
+    	}
+    }
+    vsm_context.schedule_updates(updates, priorities, engine_options.max_shadow_map_updates_per_frame);
+    for (uint32_t i = 0; i < updates.size(); i++) {
+    	if (updates[i] != VSMContext::ShadowMapUpdate::NONE) {
+    		shadow_map_caches[i] = std::move(new_caches[i]);
+    	}
+    }
+
+    // Without the gpu culling the draws are culled when recorded, so every update needs a new recording
+    bool any_update = std::any_of(updates.begin(), updates.end(), [](auto update) {
+    	return update != VSMContext::ShadowMapUpdate::NONE;
+    });
+    if (updates != shadow_map_updates || (any_update && !engine_options.gpu_driven_rendering)) {
+    	shadow_map_updates_version++;
+    }
+    shadow_map_updates = std::move(updates);
+}
+
+GraphicsModuleVulkanApp::recording_state GraphicsModuleVulkanApp::get_pbr_recording_state() {
+    // With the gpu culling the camera and the models are read only on the gpu, so moving them does not need a new recording
+    if (engine_options.gpu_driven_rendering) {
+    	return {recording_resources_version};
+    }
+    // A replaced camera starts again from version 0, but it comes with a new resources version
+    recording_state state = {recording_resources_version, camera.get_version()};
+    for (const auto& vk_model : vk_models) {
+    	state.push_back(vk_model.get_version());
+    }
+    return state;
+}
+
+void GraphicsModuleVulkanApp::wait_for_frame(uint64_t frame_value) {
+    // A frame is done when its last pass has signaled the timeline
+    uint64_t last_pass_value = frame_value * frame_timeline_passes;
+    VkSemaphoreWaitInfoKHR semaphore_wait_info = {
+            VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO_KHR,
+            nullptr,
+            0,
+            1,
+            &frame_timeline_semaphore,
+            &last_pass_value
+    };
+    vkWaitSemaphoresKHR(device, &semaphore_wait_info, std::numeric_limits<uint64_t>::max());
+}
+
+void GraphicsModuleVulkanApp::wait_until(std::chrono::steady_clock::time_point time_point) {
+    const std::chrono::steady_clock::duration spin_duration = std::chrono::milliseconds(2);
+    if (time_point - std::chrono::steady_clock::now() > spin_duration) {
+    	std::this_thread::sleep_until(time_point - spin_duration);
+    }
+    while (std::chrono::steady_clock::now() < time_point) {
+    	std::this_thread::yield();
+    }
+}
+
+uint64_t GraphicsModuleVulkanApp::get_completed_frame_value() {
+    uint64_t timeline_value;
+    vkGetSemaphoreCounterValueKHR(device, frame_timeline_semaphore, &timeline_value);
+    return timeline_value / frame_timeline_passes;
+}
+
 GraphicsModuleVulkanApp::~GraphicsModuleVulkanApp() {
     vkDeviceWaitIdle(device);
+    deferred_destroy_queue.flush();
 
     for (auto& frame : frames_data) {
-    	for (auto & semaphore : frame.semaphores) {
-    		vkDestroySemaphore(device, semaphore, nullptr);
-    	}
-    	vkDestroyFence(device, frame.after_execution_fence, nullptr);
+    	vkDestroySemaphore(device, frame.image_acquired_semaphore, nullptr);
+    	vkDestroySemaphore(device, frame.render_finished_semaphore, nullptr);
         delete_cmd_pool_and_buffers(frame.swapchain_copy_static_commands);
         delete_cmd_pool_and_buffers(frame.post_processing_static_command);
         delete_cmd_pool_and_buffers(frame.vsm_command);
         delete_cmd_pool_and_buffers(frame.pbr_command);
+        for (auto& secondary_command : frame.vsm_secondary_commands) {
+            delete_cmd_pool_and_buffers(secondary_command);
+        }
+        for (auto& secondary_command : frame.pbr_secondary_commands) {
+            delete_cmd_pool_and_buffers(secondary_command);
+        }
+        if (frame.culling_stats_allocation_data.allocation_host_ptr != nullptr) {
+        	host_uniform_allocator->free(frame.culling_stats_allocation_data);
+        }
+        vkDestroyQueryPool(device, frame.timestamps_query_pool, nullptr);
     }
+    vkDestroySemaphore(device, frame_timeline_semaphore, nullptr);
     vkDestroySampler(device, shadow_map_linear_sampler, nullptr);
 
     delete_cmd_pool_and_buffers(general_operation_command);
+    delete_cmd_pool_and_buffers(screen_constants_update_command);
 	vkDestroyFence(device, general_operation_fence, nullptr);
 
 	// camera and lights uniform freed
@@ -865,8 +1614,9 @@ GraphicsModuleVulkanApp::~GraphicsModuleVulkanApp() {
 	host_uniform_allocator->free(lights_allocation_data);
 
     // Model related things freed
-    for (auto& allocation_data : model_uniform_allocation_data) {
-		host_uniform_allocator->free(allocation_data);
+	host_uniform_allocator->free(instance_allocation_data);
+	if (primitives_cull_allocation_data.allocation_host_ptr != nullptr) {
+		host_uniform_allocator->free(primitives_cull_allocation_data);
 	}
 	for (auto& allocation_data : device_model_mesh_and_index_allocation_data) {
 		device_mesh_and_index_allocator->free(allocation_data);
@@ -892,17 +1642,31 @@ GraphicsModuleVulkanApp::~GraphicsModuleVulkanApp() {
     for (const auto& allocation : device_attachments_allocations) {
         vmaFreeMemory(this->vma_wrapper.get_allocator(), allocation);
     }
+    for (const auto& allocation : device_transient_attachments_allocations) {
+        vmaFreeMemory(this->vma_wrapper.get_allocator(), allocation);
+    }
+    for (const auto& allocation : device_shadow_maps_allocations) {
+        vmaFreeMemory(this->vma_wrapper.get_allocator(), allocation);
+    }
 
-    vkDestroyDescriptorSetLayout(device, pbr_model_data_set_layout, nullptr);
+    vkDestroyDescriptorSetLayout(device, materials_set_layout, nullptr);
+    vkDestroyDescriptorSetLayout(device, instance_data_set_layout, nullptr);
     vkDestroyDescriptorSetLayout(device, light_data_set_layout, nullptr);
     vkDestroyDescriptorSetLayout(device, camera_data_set_layout, nullptr);
     vkDestroyDescriptorPool(device, attachments_descriptor_pool, nullptr);
+    vkDestroyDescriptorPool(device, scene_descriptor_pool, nullptr);
 
     for (auto& allocation : smaa_static_images_allocations) {
         vmaFreeMemory(vma_wrapper.get_allocator(), allocation);
     }
 	vmaFreeMemory(vma_wrapper.get_allocator(), amd_fsr_uniform_allocation);
     vmaFreeMemory(vma_wrapper.get_allocator(), hbao_uniform_allocation);
+    for (auto& allocation : device_gpu_culling_allocations) {
+    	vmaFreeMemory(vma_wrapper.get_allocator(), allocation);
+    }
+    for (auto& allocation : device_shadow_casters_culling_allocations) {
+    	vmaFreeMemory(vma_wrapper.get_allocator(), allocation);
+    }
 }
 
 // ----------------- Helper methods -----------------
@@ -992,6 +1756,69 @@ void GraphicsModuleVulkanApp::allocate_and_bind_to_memory_image(VmaAllocation &o
     check_error(vmaBindImageMemory(this->vma_wrapper.get_allocator(), out_allocation, image), vulkan_helper::Error::BIND_IMAGE_MEMORY_FAILED);
 }
 
+void GraphicsModuleVulkanApp::allocate_and_bind_to_aliased_memory(std::vector<VmaAllocation> &out_allocations, const std::vector<std::pair<VkImage, uint32_t>> &images_and_stages, VmaMemoryUsage vma_memory_usage) {
+    for (auto& allocation : out_allocations) {
+        vmaFreeMemory(vma_wrapper.get_allocator(), allocation);
+    }
+
+    // Every image is alive only during the stage it belongs to
+    transient_images_aliasing_planner = AliasingPlanner();
+    for (const auto& [image, stage] : images_and_stages) {
+        VkMemoryRequirements memory_requirements;
+        vkGetImageMemoryRequirements(device, image, &memory_requirements);
+        transient_images_aliasing_planner.add_resource({memory_requirements.size, memory_requirements.alignment, memory_requirements.memoryTypeBits, stage, stage});
+    }
+    transient_images_aliasing_planner.plan();
+
+    // One allocation for every memory block of the plan, in which the images get bound at their offsets
+    out_allocations.resize(transient_images_aliasing_planner.get_memory_blocks().size());
+    for (uint32_t i = 0; i < out_allocations.size(); i++) {
+        const auto& memory_block = transient_images_aliasing_planner.get_memory_blocks()[i];
+        VkMemoryRequirements memory_requirements = {memory_block.size, memory_block.alignment, memory_block.memory_type_bits};
+        VmaAllocationCreateInfo vma_allocation_create_info = {0};
+        vma_allocation_create_info.usage = vma_memory_usage;
+        check_error(vmaAllocateMemory(vma_wrapper.get_allocator(), &memory_requirements, &vma_allocation_create_info, &out_allocations[i], nullptr),
+                    vulkan_helper::Error::MEMORY_ALLOCATION_FAILED);
+    }
+    for (uint32_t i = 0; i < images_and_stages.size(); i++) {
+        const auto& placement = transient_images_aliasing_planner.get_placements()[i];
+        check_error(vmaBindImageMemory2(vma_wrapper.get_allocator(), out_allocations[placement.memory_block], placement.offset, images_and_stages[i].first, nullptr),
+                    vulkan_helper::Error::BIND_IMAGE_MEMORY_FAILED);
+    }
+}
+
+uint64_t GraphicsModuleVulkanApp::estimate_aliased_memory_saved(const std::vector<std::pair<VkImage, uint32_t>> &images_and_stages, const std::vector<double> &images_area_scales) {
+    // The scaled sizes ignore the padding of the driver, but every image keeps its own alignment, memory types and stage
+    AliasingPlanner scaled_planner;
+    for (uint32_t i = 0; i < images_and_stages.size(); i++) {
+        VkMemoryRequirements memory_requirements;
+        vkGetImageMemoryRequirements(device, images_and_stages[i].first, &memory_requirements);
+        uint64_t scaled_size = static_cast<uint64_t>(std::ceil(memory_requirements.size * images_area_scales[i]));
+        scaled_size = (scaled_size + memory_requirements.alignment - 1) / memory_requirements.alignment * memory_requirements.alignment;
+        scaled_planner.add_resource({scaled_size, memory_requirements.alignment, memory_requirements.memoryTypeBits, images_and_stages[i].second, images_and_stages[i].second});
+    }
+    scaled_planner.plan();
+    return scaled_planner.get_unaliased_size() - scaled_planner.get_aliased_size();
+}
+
+void GraphicsModuleVulkanApp::record_aliasing_barrier(VkCommandBuffer cb, uint32_t stage) {
+    if (!transient_images_aliasing_planner.is_aliasing_barrier_needed(stage)) {
+        return;
+    }
+    // The images of the previous stages must be done with the memory before the ones of this stage start writing it,
+    // the new images start from VK_IMAGE_LAYOUT_UNDEFINED in their first render pass or barrier
+    VkMemoryBarrier memory_barrier = {
+            VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+            nullptr,
+            VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT | VK_ACCESS_SHADER_WRITE_BIT,
+            VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT |
+            VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT | VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT
+    };
+    VkPipelineStageFlags stages = VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT |
+            VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
+    vkCmdPipelineBarrier(cb, stages, stages, 0, 1, &memory_barrier, 0, nullptr, 0, nullptr);
+}
+
 void GraphicsModuleVulkanApp::start_one_time_command_submit(VkCommandBuffer cb) {
     VkCommandBufferBeginInfo command_buffer_begin_info = {
             VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
@@ -2,9 +2,12 @@
 #define BASE_VULKAN_APP_GRAPHICS_MODULE_VULKAN_APP_H
 
 #include <vector>
+#include <algorithm>
 #include <array>
+#include <chrono>
 #include <functional>
 #include <optional>
+#include <atomic>
 #include "base_vulkan_app.h"
 #include "layers/smaa/smaa_context.h"
 #include "layers/vsm/vsm_context.h"
@@ -12,6 +15,7 @@
 #include "layers/pbr/pbr_context.h"
 #include "layers/hdr_tonemap/hdr_tonemap_context.h"
 #include "layers/amd_fsr/amd_fsr.h"
+#include "layers/gpu_culling/gpu_culling_context.h"
 #include "vulkan_helper.h"
 #include "vma_wrapper.h"
 #include <glm/glm.hpp>
@@ -19,6 +23,10 @@
 #include "light.h"
 #include "gltf_model.h"
 #include "vk_buffers_suballocator.h"
+#include "aliasing_planner.h"
+#include "deferred_destroy_queue.h"
+#include "pipeline_cache.h"
+#include "job_system.h"
 
 #include <boost/multi_index_container.hpp>
 #include <boost/multi_index/random_access_index.hpp>
@@ -28,6 +36,33 @@
 
 struct EngineOptions {
     AmdFsr::Settings fsr_settings;
+    // Clamped between 1 and 4, more frames in flight give more throughput at the cost of latency
+    uint32_t frames_in_flight = 3;
+    // FIFO, MAILBOX or IMMEDIATE, if not supported IMMEDIATE falls back to MAILBOX and then to FIFO
+    VkPresentModeKHR present_mode = VK_PRESENT_MODE_MAILBOX_KHR;
+    // Maximum frames per second, 0 for no limit
+    float frame_rate_limit = 0.0f;
+    // Culls the primitives against the camera frustum and the depth of the last frame visible set in compute passes,
+    // and draws them with multi draw indirect
+    bool gpu_driven_rendering = false;
+    // Shadow maps drawn at most in a frame, 0 for no limit. The others reuse their last shadow map and are drawn in the next
+    // frames, starting from the lights closer to the camera and the ones that moved
+    uint32_t max_shadow_map_updates_per_frame = 0;
+    // Draws the depth with a position only pipeline before the pbr pass, which then shades only the visible fragments. It pays
+    // off when the pbr pass is bound by the fragment shading of the overdraw, compare get_pbr_gpu_time() with and without
+    bool depth_pre_pass = false;
+    // File in which the pipeline cache is kept between runs, empty to not persist it
+    std::string pipeline_cache_path = "pipeline_cache.bin";
+    // Archive of all the shaders made by the shaders target, mapped once at startup. The shaders missing from it are read from
+    // their own files in the shaders directory
+    std::string shader_archive_path = "resources//shaders//shaders.pak";
+    // Renders without a window, surface and swapchain in a ring of offscreen images of the window size, so that the engine runs
+    // on machines without a display or on software implementations. There is no input and no resize
+    bool headless = false;
+    // Frames after which start_frame_loop returns, 0 to run until the window is closed or stop_frame_loop() is called
+    uint64_t frames_to_render = 0;
+    // Prints the mean frame time once per second, turned off when the frame times are reported in another way like the benchmark
+    bool print_frame_times = true;
 };
 
 class GraphicsModuleVulkanApp : public BaseVulkanApp {
@@ -48,39 +83,112 @@ class GraphicsModuleVulkanApp : public BaseVulkanApp {
 
         void start_frame_loop(std::function<void(GraphicsModuleVulkanApp*)> resize_callback,
                               std::function<void(GraphicsModuleVulkanApp*, uint32_t)> pre_submit_callback);
+        // Makes start_frame_loop return after the current frame, it can be called from any thread
+        void stop_frame_loop() { frame_loop_stop_requested = true; };
 
         // Methods to manage the scene objects
         Camera* get_camera_ptr() { return &camera; };
         const Light* get_light_ptr(uint32_t idx) { return &lights_container.at(idx); };
         VkModel* get_gltf_model_ptr(uint32_t idx) { return &vk_models.at(idx); };
+
+        // Statistics of the buffer suballocators owned by the engine, summed or dumped as json per allocator. The json also has
+        // the memory of the transient attachments and the part of it spared by aliasing
+        VkBuffersBuddySubAllocator::allocator_stats get_allocators_stats();
+        std::string get_allocators_stats_json(int indent = 4);
+        // Allocate and free calls of the persistent suballocators, recorded only when enabled. The json has the trace and the
+        // sizes of every allocator, so that the session can be replayed without a device by the buddy allocator tests and bench
+        void set_allocation_trace_recording(bool enabled);
+        std::string get_allocation_traces_json(int indent = 4);
+        // Device memory spared by aliasing the transient attachments, at the current rendering resolution
+        uint64_t get_transient_memory_saved() { return transient_memory_saved; };
+        // Estimate of the same saving with a 3840x2160 output
+        uint64_t get_transient_memory_saved_4k() { return transient_memory_saved_4k; };
+        // Timings of the jobs run by the engine since the last call, recorded only when enabled
+        void set_job_timing_recording(bool enabled) { job_system.set_timing_recording(enabled); };
+        std::string get_job_timings_json(int indent = 4);
+        // Primitives drawn and culled in the last completed frame, only counted with the gpu driven rendering
+        GpuCullingContext::culling_stats get_culling_stats() { return culling_stats; };
+        // Milliseconds spent by the gpu in the last completed frame and in each of its passes, the pbr one with its culling and
+        // depth pre-pass. All 0 if the device has no timestamps on the graphics queue
+        struct gpu_frame_times {
+        	float frame;
+        	float shadow_maps;
+        	float pbr;
+        	float post_processing;
+        	float output_copy;
+        };
+        gpu_frame_times get_gpu_frame_times() { return gpu_times; };
+        float get_pbr_gpu_time() { return gpu_times.pbr; };
+        // Milliseconds spent by the cpu in the last frame, without the time blocked waiting for the gpu or the presentation engine
+        float get_cpu_frame_time() { return cpu_frame_time; };
+        uint32_t get_lights_count() { return lights_container.size(); };
     private:
 		VmaWrapper vma_wrapper;
+		// Start of the creation of the layers, to report how long their pipelines take with a cold or warm cache
+		std::chrono::steady_clock::time_point layers_creation_start = std::chrono::steady_clock::now();
+		// Shared by all the layers, so they must be declared after it
+		PipelineCache pipeline_cache;
+		// Objects that can be destroyed only after the frames which were using them have completed
+		DeferredDestroyQueue deferred_destroy_queue;
+		uint64_t submitted_frames_count = 0;
+		// Workers used for the command buffers recording and for the loading
+		JobSystem job_system;
         EngineOptions engine_options;
 		VkExtent2D rendering_resolution;
 		std::unique_ptr<VkBuffersBuddySubAllocator> host_uniform_allocator;
 		std::unique_ptr<VkBuffersBuddySubAllocator> device_mesh_and_index_allocator;
+		// Accumulated stats of the temporary allocators used for uploads
+		VkBuffersBuddySubAllocator::allocator_stats staging_allocators_stats;
 
         VkSampler shadow_map_linear_sampler;
 
         command_record_info general_operation_command;
         VkFence general_operation_fence;
 
+        // The passes of frame n signal the values from (n-1)*frame_timeline_passes+1 to n*frame_timeline_passes
+        static constexpr uint32_t frame_timeline_passes = 4;
+        VkSemaphore frame_timeline_semaphore = VK_NULL_HANDLE;
+
+        // Versions of the resources and of the objects read by a recording, compared element by element since the versions of a
+        // replaced object start again from 0
+        using recording_state = std::vector<uint64_t>;
         struct frame_data {
-        	std::vector<VkSemaphore> semaphores;
-        	VkFence after_execution_fence;
+        	VkSemaphore image_acquired_semaphore;
+        	VkSemaphore render_finished_semaphore;
+        	// Value of the last frame submitted with this data, 0 if none
+        	uint64_t frame_value = 0;
+        	// States of the scene with which the command buffers have been recorded, empty if never recorded
+        	recording_state vsm_recorded_state;
+        	recording_state pbr_recorded_state;
         	command_record_info vsm_command;
         	command_record_info pbr_command;
         	command_record_info post_processing_static_command;
         	command_record_info swapchain_copy_static_commands;
+        	// One pool for every secondary command buffer, since their recording jobs can run on any worker. Every shadow map
+        	// has the draws of all or of the static casters in the first buffer, and the draws of the dynamic casters in the second.
+        	// Every range of the pbr has its draws in the first buffer, and its depth pre-pass draws in the second
+        	std::vector<command_record_info> vsm_secondary_commands;
+        	std::vector<command_record_info> pbr_secondary_commands;
+        	// Host copy of the culling stats of the frame
+        	VkBuffersBuddySubAllocator::sub_allocation_data culling_stats_allocation_data = {VK_NULL_HANDLE, 0, nullptr};
+        	// Timestamps at the start and at the end of the command buffer of every pass, in the order of the timeline
+        	VkQueryPool timestamps_query_pool = VK_NULL_HANDLE;
         };
-        // Using 3 copies of command pool, fences and semaphores for multithreaded cb recording
-        std::array<frame_data, 3> frames_data;
+        // One copy of command pools and semaphores for every frame in flight for multithreaded cb recording
+        std::vector<frame_data> frames_data;
 
         std::vector<VkModel> vk_models;
-        // Model uniform data
-		std::vector<VkBuffersBuddySubAllocator::sub_allocation_data> model_uniform_allocation_data;
+        // Model and normal matrices of every model, packed in the order of vk_models
+		VkBuffersBuddySubAllocator::sub_allocation_data instance_allocation_data = {VK_NULL_HANDLE, 0, nullptr};
+		// Size of the instance data, it holds at least one row so that the buffer and its descriptor stay valid in an empty scene
+		uint64_t get_instance_data_size() const { return VkModel::uniform_data_size * std::max<uint64_t>(vk_models.size(), 1); };
         // Models mesh and index
 		std::vector<VkBuffersBuddySubAllocator::sub_allocation_data> device_model_mesh_and_index_allocation_data;
+		// First model and models count of the ranges recorded in parallel by the pbr, and first primitive of every range
+		std::vector<std::pair<uint32_t, uint32_t>> pbr_recording_model_ranges;
+		std::vector<uint32_t> pbr_recording_first_primitives;
+		// Bounding sphere and index count of every primitive, read by the gpu culling
+		VkBuffersBuddySubAllocator::sub_allocation_data primitives_cull_allocation_data = {VK_NULL_HANDLE, 0, nullptr};
 
         // Conteiner that makes possible to iterate through shadowed and non-shadowed lights separately while also indexing them randomly
         typedef boost::multi_index_container<
@@ -93,11 +201,15 @@ class GraphicsModuleVulkanApp : public BaseVulkanApp {
         LightsContainer lights_container;
 
         const uint32_t MAX_SHADOWED_LIGHTS = 8;
+        // Primitives of all the loaded models, since every primitive has its own material
+        const uint32_t MAX_MATERIALS = 4096;
         Camera camera;
 
 		// suballocation data for the camera and the lights
 		VkBuffersBuddySubAllocator::sub_allocation_data camera_allocation_data = {VK_NULL_HANDLE, 0, nullptr};
 		VkBuffersBuddySubAllocator::sub_allocation_data lights_allocation_data = {VK_NULL_HANDLE, 0, nullptr};
+		// Size of the lights data, it holds at least one light so that the buffer and its descriptor stay valid without lights
+		uint64_t get_lights_data_size() const { return Light::get_data_size() * std::max<uint64_t>(lights_container.size(), 1); };
 
         // Image for depth comparison
         VkImage device_depth_image = VK_NULL_HANDLE;
@@ -125,32 +237,105 @@ class GraphicsModuleVulkanApp : public BaseVulkanApp {
         HbaoContext hbao_context;
         HDRTonemapContext hdr_tonemap_context;
         std::unique_ptr<AmdFsr> amd_fsr = nullptr;
+        GpuCullingContext gpu_culling_context;
 
         // Static allocations for the layers
         VmaAllocation hbao_uniform_allocation = VK_NULL_HANDLE;
         std::vector<VmaAllocation> smaa_static_images_allocations;
         VmaAllocation amd_fsr_uniform_allocation = VK_NULL_HANDLE;
+        std::vector<VmaAllocation> device_gpu_culling_allocations;
+        std::vector<VmaAllocation> device_shadow_casters_culling_allocations;
+        GpuCullingContext::culling_stats culling_stats = {0, 0, 0};
+        gpu_frame_times gpu_times = {0.0f, 0.0f, 0.0f, 0.0f, 0.0f};
+        float cpu_frame_time = 0.0f;
+        std::atomic<bool> frame_loop_stop_requested = false;
 
         // Allocations in which all attachment reside
         std::vector<VmaAllocation> device_attachments_allocations;
+        // Allocations of the shadow maps, which do not change on resize
+        std::vector<VmaAllocation> device_shadow_maps_allocations;
+
+        // Stages of the post-processing command buffer, used as lifetimes of the transient attachments
+        enum PostProcessingStage : uint32_t { SMAA_STAGE, HBAO_STAGE, TONEMAP_STAGE, FSR_STAGE };
+        // Allocations shared by the attachments which live only inside one post-processing stage
+        std::vector<VmaAllocation> device_transient_attachments_allocations;
+        AliasingPlanner transient_images_aliasing_planner;
+        uint64_t transient_memory_saved = 0;
+        uint64_t transient_memory_saved_4k = 0;
 
         // Descriptor things
-        VkDescriptorSetLayout pbr_model_data_set_layout = VK_NULL_HANDLE;
+        // The images of all the primitives in one array, each primitive reads its own with its material index
+        VkDescriptorSetLayout materials_set_layout = VK_NULL_HANDLE;
         VkDescriptorSetLayout light_data_set_layout = VK_NULL_HANDLE;
         VkDescriptorSetLayout camera_data_set_layout = VK_NULL_HANDLE;
+        VkDescriptorSetLayout instance_data_set_layout = VK_NULL_HANDLE;
 
         std::vector<VkDescriptorSet> descriptor_sets;
+        // Pool for the sets of the scene, which survive a resize, and pool for the sets of the screen sized attachments
+        VkDescriptorPool scene_descriptor_pool = VK_NULL_HANDLE;
         VkDescriptorPool attachments_descriptor_pool = VK_NULL_HANDLE;
 
         // Vulkan methods
         void create_sets_layouts();
-        void write_descriptor_sets();
+        void write_scene_descriptor_sets();
+        void write_attachments_descriptor_sets();
+        // Creates everything that depends on the rendering resolution or on the swapchain
+        void init_screen_resources();
+        // Hands the screen sized resources to the deferred destroy queue, since the frames in flight still use them
+        void retire_screen_resources();
+        // The constants of the screen sized layers are read by every frame, so their update is submitted before the next frame
+        // instead of waiting for the ones in flight. Its command buffer can be recorded again once the frame after it is done
+        command_record_info screen_constants_update_command;
+        bool screen_constants_update_pending = false;
+        uint64_t screen_constants_update_frame_value = 0;
+
+        void record_static_command_buffers(frame_data &frame);
+        // Resets the two queries of the pass and writes the first one, which must be at the start of its command buffer
+        void record_pass_start_timestamp(VkCommandBuffer command_buffer, const frame_data &frame, uint32_t pass);
+        void record_pass_end_timestamp(VkCommandBuffer command_buffer, const frame_data &frame, uint32_t pass);
+        void create_secondary_command_buffers();
+        // Versions of the camera, lights and models whose data is currently in the uniform memory
+        static constexpr uint64_t never_uploaded_version = UINT64_MAX;
+        uint64_t uploaded_camera_version = never_uploaded_version;
+        std::vector<uint64_t> uploaded_lights_versions;
+        std::vector<uint64_t> uploaded_models_versions;
+        // Copies to the uniform memory only the data that changed since the last upload
+        void upload_uniform_data();
+        // Incremented when the resources referenced by the recorded command buffers change
+        uint64_t recording_resources_version = 0;
+        // Everything the recording depends on, if it is the same as last time the command buffers can be reused
+        recording_state get_vsm_recording_state();
+        recording_state get_pbr_recording_state();
 
-        void record_static_command_buffers(command_record_info post_processing, command_record_info swapchain_copy_commands);
-        void record_vsm_command_buffer(command_record_info vsm_to_record);
-        void record_pbr_command_buffer(command_record_info pbr_to_record);
+        // A model is dynamic if it has moved in the last frames, otherwise it is drawn in the cache of the static casters
+        const uint64_t frames_to_become_static = 60;
+        std::vector<uint64_t> models_dynamic_until_frames;
+        std::vector<bool> static_models_mask;
+        std::vector<bool> dynamic_models_mask;
+        // What the shadow map of every light contains after the last submitted frame
+        struct shadow_map_cache_info {
+        	bool valid = false;
+        	uint64_t light_version = 0;
+        	std::vector<uint32_t> static_casters;
+        	// Index and version of the dynamic casters
+        	std::vector<std::pair<uint32_t, uint64_t>> dynamic_casters;
+        };
+        std::vector<shadow_map_cache_info> shadow_map_caches;
+        std::vector<Frustum> light_frustums;
+        std::vector<VSMContext::ShadowMapUpdate> shadow_map_updates;
+        // Incremented when the scheduled updates need a new recording
+        uint64_t shadow_map_updates_version = 0;
+        // Decides which shadow maps are drawn again in the frame, by comparing their casters with the ones in their cache,
+        // within the budget of the engine options
+        void schedule_shadow_map_updates();
+        void record_vsm_command_buffer(frame_data &frame);
+        void record_pbr_command_buffer(frame_data &frame);
 
         void on_window_resize(std::function<void(GraphicsModuleVulkanApp*)> resize_callback);
+        void wait_for_frame(uint64_t frame_value);
+        // Sleeps for most of the time and spins for the last part, since sleeps can oversleep by more than a millisecond
+        void wait_until(std::chrono::steady_clock::time_point time_point);
+        uint64_t get_completed_frame_value();
 
         // Helper methods
         void create_buffer(VkBuffer &buffer, uint64_t size, VkBufferUsageFlags usage);
@@ -159,12 +344,16 @@ class GraphicsModuleVulkanApp : public BaseVulkanApp {
         void allocate_and_bind_to_memory(std::vector<VmaAllocation> &out_allocations, const std::vector<VkBuffer> &buffers, const std::vector<VkImage> &images, VmaMemoryUsage vma_memory_usage);
         void allocate_and_bind_to_memory_buffer(VmaAllocation &out_allocation, VkBuffer buffer, VmaMemoryUsage vma_memory_usage);
         void allocate_and_bind_to_memory_image(VmaAllocation &out_allocation, VkImage image, VmaMemoryUsage vma_memory_usage);
+        void allocate_and_bind_to_aliased_memory(std::vector<VmaAllocation> &out_allocations, const std::vector<std::pair<VkImage, uint32_t>> &images_and_stages, VmaMemoryUsage vma_memory_usage);
+        // Plans the images again with their sizes scaled by the given area ratios, and returns the memory the aliasing would save
+        uint64_t estimate_aliased_memory_saved(const std::vector<std::pair<VkImage, uint32_t>> &images_and_stages, const std::vector<double> &images_area_scales);
+        void record_aliasing_barrier(VkCommandBuffer cb, uint32_t stage);
         void start_one_time_command_submit(VkCommandBuffer cb);
         void end_submit_block_and_reset_command_submit(VkCommandPool cp, VkCommandBuffer cb, VkPipelineStageFlags pipeline_stage_flags, VkFence fence);
 
         // Static methods used for filling the BaseVulkanApp structure
-        static std::vector<const char*> get_instance_extensions();
-        static std::vector<const char*> get_device_extensions();
+        static std::vector<const char*> get_instance_extensions(bool headless);
+        static std::vector<const char*> get_device_extensions(bool headless);
         static VkPhysicalDeviceFeatures2* get_required_physical_device_features(bool delete_static_structure, EngineOptions engine_options);
 };
 
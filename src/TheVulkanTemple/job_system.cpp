@@ -0,0 +1,176 @@
+#include "job_system.h"
+#include <chrono>
+#include <algorithm>
+
+namespace {
+	// Set on the worker threads so that the jobs they submit go to their own queue
+	thread_local const JobSystem *current_job_system = nullptr;
+	thread_local uint32_t current_worker_index = 0;
+}
+
+JobSystem::JobSystem(uint32_t workers_count) : creation_time{std::chrono::steady_clock::now()} {
+	if (workers_count == 0) {
+		workers_count = std::max(std::thread::hardware_concurrency(), 1u);
+	}
+	for (uint32_t i = 0; i < workers_count; i++) {
+		queues.push_back(std::make_unique<worker_queue>());
+	}
+	for (uint32_t i = 0; i < workers_count; i++) {
+		workers.emplace_back(&JobSystem::worker_loop, this, i);
+	}
+}
+
+JobSystem::~JobSystem() {
+	{
+		std::lock_guard<std::mutex> lock(sleep_mutex);
+		stopping = true;
+	}
+	sleep_condition.notify_all();
+	for (auto& worker : workers) {
+		worker.join();
+	}
+}
+
+void JobSystem::submit(Counter &counter, const char *name, std::function<void()> &&job) {
+	counter.pending.fetch_add(1, std::memory_order_relaxed);
+
+	// Workers push to their own queue, other threads spread their jobs between all the queues
+	uint32_t queue_index = get_current_worker_index();
+	if (queue_index == workers.size()) {
+		queue_index = next_external_queue.fetch_add(1, std::memory_order_relaxed) % queues.size();
+	}
+	{
+		// Counted under the queue lock, so that the job can not be popped and subtracted before being counted
+		std::lock_guard<std::mutex> lock(queues[queue_index]->mutex);
+		queues[queue_index]->jobs.push_back({name, std::move(job), &counter});
+		queued_jobs_count.fetch_add(1, std::memory_order_release);
+	}
+	wake_sleepers(false);
+}
+
+void JobSystem::wait(Counter &counter) {
+	uint32_t worker_index = get_current_worker_index();
+	uint32_t preferred_queue = worker_index == workers.size() ? 0 : worker_index;
+
+	while (!counter.is_done()) {
+		job job_to_run;
+		if (try_pop_job(preferred_queue, job_to_run)) {
+			run_job(job_to_run, worker_index);
+		}
+		else {
+			std::unique_lock<std::mutex> lock(sleep_mutex);
+			sleep_condition.wait(lock, [&]() { return counter.is_done() || queued_jobs_count.load(std::memory_order_acquire) > 0; });
+		}
+	}
+
+	if (counter.exception) {
+		std::exception_ptr exception = counter.exception;
+		counter.exception = nullptr;
+		std::rethrow_exception(exception);
+	}
+}
+
+void JobSystem::parallel_for(const char *name, uint32_t count, const std::function<void(uint32_t)> &job) {
+	Counter counter;
+	for (uint32_t i = 0; i < count; i++) {
+		submit(counter, name, [&job, i]() { job(i); });
+	}
+	wait(counter);
+}
+
+std::vector<JobSystem::job_timing> JobSystem::collect_job_timings() {
+	std::lock_guard<std::mutex> lock(timings_mutex);
+	std::vector<job_timing> collected_timings(std::make_move_iterator(timings.begin()), std::make_move_iterator(timings.end()));
+	timings.clear();
+	return collected_timings;
+}
+
+void JobSystem::worker_loop(uint32_t worker_index) {
+	current_job_system = this;
+	current_worker_index = worker_index;
+
+	while (true) {
+		job job_to_run;
+		if (try_pop_job(worker_index, job_to_run)) {
+			run_job(job_to_run, worker_index);
+			continue;
+		}
+		std::unique_lock<std::mutex> lock(sleep_mutex);
+		sleep_condition.wait(lock, [&]() { return stopping || queued_jobs_count.load(std::memory_order_acquire) > 0; });
+		if (stopping) {
+			return;
+		}
+	}
+}
+
+bool JobSystem::try_pop_job(uint32_t preferred_queue, job &out_job) {
+	if (queued_jobs_count.load(std::memory_order_acquire) == 0) {
+		return false;
+	}
+	// The newest job of the own queue is the one with the warmest data, while stealing takes the oldest
+	{
+		std::lock_guard<std::mutex> lock(queues[preferred_queue]->mutex);
+		if (!queues[preferred_queue]->jobs.empty()) {
+			out_job = std::move(queues[preferred_queue]->jobs.back());
+			queues[preferred_queue]->jobs.pop_back();
+			queued_jobs_count.fetch_sub(1, std::memory_order_relaxed);
+			return true;
+		}
+	}
+	for (uint32_t i = 1; i < queues.size(); i++) {
+		worker_queue &victim = *queues[(preferred_queue + i) % queues.size()];
+		std::lock_guard<std::mutex> lock(victim.mutex);
+		if (!victim.jobs.empty()) {
+			out_job = std::move(victim.jobs.front());
+			victim.jobs.pop_front();
+			queued_jobs_count.fetch_sub(1, std::memory_order_relaxed);
+			return true;
+		}
+	}
+	return false;
+}
+
+void JobSystem::run_job(job &job_to_run, uint32_t worker_index) {
+	auto start_time = std::chrono::steady_clock::now();
+	try {
+		job_to_run.function();
+	}
+	catch (...) {
+		std::lock_guard<std::mutex> lock(job_to_run.counter->exception_mutex);
+		if (!job_to_run.counter->exception) {
+			job_to_run.counter->exception = std::current_exception();
+		}
+	}
+
+	if (timing_recording.load(std::memory_order_relaxed)) {
+		auto end_time = std::chrono::steady_clock::now();
+		job_timing timing = {
+			job_to_run.name,
+			worker_index,
+			static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(start_time - creation_time).count()),
+			static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(end_time - start_time).count())
+		};
+		std::lock_guard<std::mutex> lock(timings_mutex);
+		if (timings.size() == max_recorded_timings) {
+			timings.pop_front();
+		}
+		timings.push_back(std::move(timing));
+	}
+
+	// The last job of a counter wakes the threads waiting on it
+	if (job_to_run.counter->pending.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+		wake_sleepers(true);
+	}
+}
+
+void JobSystem::wake_sleepers(bool all) {
+	// Taking the lock makes sure that a thread about to sleep has either seen the new state or is already waiting
+	{
+		std::lock_guard<std::mutex> lock(sleep_mutex);
+	}
+	all ? sleep_condition.notify_all() : sleep_condition.notify_one();
+}
+
+uint32_t JobSystem::get_current_worker_index() const {
+	return current_job_system == this ? current_worker_index : static_cast<uint32_t>(workers.size());
+}
@@ -0,0 +1,97 @@
+#ifndef THEVULKANTEMPLE_JOB_SYSTEM_H
+#define THEVULKANTEMPLE_JOB_SYSTEM_H
+
+#include <deque>
+#include <mutex>
+#include <atomic>
+#include <memory>
+#include <string>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <condition_variable>
+#include "external/json.hpp"
+
+// Persistent pool of workers, one per core, each with its own queue of jobs. A worker takes the newest job of its queue
+// and, when it is empty, steals the oldest one from the queues of the others
+class JobSystem {
+	public:
+		// Keeps track of a group of jobs which is waited as a whole, it must outlive the jobs submitted with it
+		class Counter {
+			public:
+				bool is_done() const { return pending.load(std::memory_order_acquire) == 0; };
+			private:
+				friend class JobSystem;
+				std::atomic<uint32_t> pending = 0;
+				std::mutex exception_mutex;
+				std::exception_ptr exception;
+		};
+
+		struct job_timing {
+			std::string name;
+			// Equal to the number of workers when the job has been run by a thread waiting on a counter
+			uint32_t worker_index;
+			// Since the creation of the job system
+			uint64_t start_ns;
+			uint64_t duration_ns;
+		};
+
+		// With 0 workers one for every core is created
+		explicit JobSystem(uint32_t workers_count = 0);
+		JobSystem(const JobSystem&) = delete;
+		JobSystem& operator=(const JobSystem&) = delete;
+		~JobSystem();
+
+		// The name must be a string that lives as long as the job system, it is used only for the timings
+		void submit(Counter &counter, const char *name, std::function<void()> &&job);
+		// The calling thread runs jobs until the ones of the counter are done, then rethrows the first exception thrown by them
+		void wait(Counter &counter);
+		// Runs job for every index in [0, count) and waits for all of them
+		void parallel_for(const char *name, uint32_t count, const std::function<void(uint32_t)> &job);
+
+		uint32_t get_workers_count() const { return workers.size(); };
+
+		// Only the last max_recorded_timings jobs are kept
+		void set_timing_recording(bool enabled) { timing_recording.store(enabled, std::memory_order_relaxed); };
+		// Returns the timings recorded since the last call
+		std::vector<job_timing> collect_job_timings();
+	private:
+		struct job {
+			const char *name;
+			std::function<void()> function;
+			Counter *counter;
+		};
+		struct worker_queue {
+			std::mutex mutex;
+			std::deque<job> jobs;
+		};
+		std::vector<std::unique_ptr<worker_queue>> queues;
+		std::vector<std::thread> workers;
+		std::atomic<uint32_t> queued_jobs_count = 0;
+		std::atomic<uint32_t> next_external_queue = 0;
+
+		// Workers and waiting threads sleep here when there is nothing to run
+		std::mutex sleep_mutex;
+		std::condition_variable sleep_condition;
+		bool stopping = false;
+
+		static constexpr uint32_t max_recorded_timings = 4096;
+		std::atomic<bool> timing_recording = false;
+		std::mutex timings_mutex;
+		std::deque<job_timing> timings;
+		std::chrono::steady_clock::time_point creation_time;
+
+		void worker_loop(uint32_t worker_index);
+		bool try_pop_job(uint32_t preferred_queue, job &out_job);
+		void run_job(job &job_to_run, uint32_t worker_index);
+		void wake_sleepers(bool all);
+		// Index of the queue owned by the calling thread, or the number of workers if it is not a worker of this system
+		uint32_t get_current_worker_index() const;
+};
+
+NLOHMANN_DEFINE_TYPE_NON_INTRUSIVE(JobSystem::job_timing, name, worker_index, start_ns, duration_ns)
+
+#endif
@@ -6,8 +6,9 @@
 #include "ffx_a.h"
 #include "ffx_fsr1.h"
 
-AmdFsr::AmdFsr(VkDevice device, Settings fsr_settings, std::string shader_dir_path) {
+AmdFsr::AmdFsr(VkDevice device, PipelineCache &pipeline_cache, Settings fsr_settings, std::string shader_dir_path) {
     this->device = device;
+    this->pipeline_cache = &pipeline_cache;
     this->fsr_settings = fsr_settings;
 
     VkSamplerCreateInfo sampler_create_info = {
@@ -72,7 +73,7 @@ AmdFsr::AmdFsr(VkDevice device, Settings fsr_settings, std::string shader_dir_pa
     };
     check_error(vkCreateDescriptorSetLayout(device, &descriptor_set_layout_create_info, nullptr, &common_fsr_descriptor_set_layout), vulkan_helper::Error::DESCRIPTOR_SET_LAYOUT_CREATION_FAILED);
 
-    create_pipelines(shader_dir_path);
+    this->shader_dir_path = shader_dir_path;
 
     // Creation for the device buffer that holds the fsr constants
     VkBufferCreateInfo buffer_create_info {
@@ -98,6 +99,12 @@ float AmdFsr::get_negative_mip_bias() {
 	return negative_mip_biases[static_cast<uint32_t>(fsr_settings.preset)];
 }
 
+void AmdFsr::create_pipelines(JobSystem &job_system, JobSystem::Counter &counter) {
+    job_system.submit(counter, "create_fsr_pipelines", [this]() {
+        create_pipelines(shader_dir_path);
+    });
+}
+
 void AmdFsr::create_pipelines(std::string shader_dir_path) {
     std::string shader_precision_postfix;
     if (fsr_settings.precision == Precision::FP32) {
@@ -107,22 +114,10 @@ void AmdFsr::create_pipelines(std::string shader_dir_path) {
         shader_precision_postfix = "_half.comp.spv";
     }
 
-    std::vector<uint8_t> shader_contents;
-    vulkan_helper::get_binary_file_content(shader_dir_path + "//fsr_easu" + shader_precision_postfix, shader_contents);
-    VkShaderModuleCreateInfo shader_module_create_info = {
-            VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO,
-            nullptr,
-            0,
-            shader_contents.size(),
-            reinterpret_cast<uint32_t*>(shader_contents.data())
+    std::array<VkShaderModule,2> shader_modules = {
+        pipeline_cache->get_shader_module(shader_dir_path + "//fsr_easu" + shader_precision_postfix),
+        pipeline_cache->get_shader_module(shader_dir_path + "//fsr_rcas" + shader_precision_postfix)
     };
-    std::array<VkShaderModule,2> shader_modules;
-    check_error(vkCreateShaderModule(device, &shader_module_create_info, nullptr, &shader_modules[0]), vulkan_helper::Error::SHADER_MODULE_CREATION_FAILED);
-
-    vulkan_helper::get_binary_file_content(shader_dir_path + "//fsr_rcas" + shader_precision_postfix, shader_contents);
-    shader_module_create_info.codeSize = shader_contents.size();
-    shader_module_create_info.pCode = reinterpret_cast<uint32_t*>(shader_contents.data());
-    check_error(vkCreateShaderModule(device, &shader_module_create_info, nullptr, &shader_modules[1]), vulkan_helper::Error::SHADER_MODULE_CREATION_FAILED);
 
     std::array<VkPipelineShaderStageCreateInfo,2> pipeline_shaders_stage_create_infos {{
         {
@@ -177,11 +172,7 @@ void AmdFsr::create_pipelines(std::string shader_dir_path) {
             -1
     }
     }};
-    vkCreateComputePipelines(device, VK_NULL_HANDLE, compute_pipeline_create_infos.size(), compute_pipeline_create_infos.data(), nullptr, fsr_pipelines.data());
-
-    for (auto& shader_module : shader_modules) {
-        vkDestroyShaderModule(device, shader_module, nullptr);
-    }
+    vkCreateComputePipelines(device, pipeline_cache->get(), compute_pipeline_create_infos.size(), compute_pipeline_create_infos.data(), nullptr, fsr_pipelines.data());
 }
 
 void AmdFsr::create_resources(VkExtent2D input_image_size, VkExtent2D output_image_size) {
@@ -223,6 +214,17 @@ void AmdFsr::create_resources(VkExtent2D input_image_size, VkExtent2D output_ima
 	dispatch_size.z = 1;
 }
 
+std::function<void()> AmdFsr::retire_screen_resources() {
+    VkImage image = device_out_easu_image;
+    VkImageView image_view = device_out_easu_image_view;
+    device_out_easu_image = VK_NULL_HANDLE;
+    device_out_easu_image_view = VK_NULL_HANDLE;
+    return [device = device, image, image_view]() {
+        vkDestroyImageView(device, image_view, nullptr);
+        vkDestroyImage(device, image, nullptr);
+    };
+}
+
 void AmdFsr::set_rcas_sharpness(float sharpness) {
 	FsrRcasCon(reinterpret_cast<AU1*>(&fsr_constants[4]), sharpness);
 }
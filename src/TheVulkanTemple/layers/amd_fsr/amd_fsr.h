@@ -2,10 +2,13 @@
 #define THEVULKANTEMPLE_AMD_FSR_H
 
 #include "../../external/volk.h"
+#include "../../pipeline_cache.h"
+#include "../../job_system.h"
 #include "../../vulkan_helper.h"
 #include <unordered_map>
 #include <array>
 #include <string>
+#include <functional>
 
 class AmdFsr {
     public:
@@ -27,8 +30,10 @@ class AmdFsr {
             Precision precision;
         };
 
-    AmdFsr(VkDevice device, Settings fsr_settings, std::string shader_dir_path);
+    AmdFsr(VkDevice device, PipelineCache &pipeline_cache, Settings fsr_settings, std::string shader_dir_path);
     ~AmdFsr();
+    // Submits the creation of the pipelines as a job of the counter, which must be waited before recording
+    void create_pipelines(JobSystem &job_system, JobSystem::Counter &counter);
 
 	VkExtent2D get_recommended_input_resolution(VkExtent2D display_image_size);
 	float get_negative_mip_bias();
@@ -37,6 +42,9 @@ class AmdFsr {
     std::pair<std::unordered_map<VkDescriptorType, uint32_t>, uint32_t> get_required_descriptor_pool_size_and_sets();
 
     void create_resources(VkExtent2D input_image_size, VkExtent2D output_image_size);
+    // Hands over the output image, which the returned function destroys once the frames using it are done. The next
+    // create_resources() makes a new one instead of destroying it in place
+    std::function<void()> retire_screen_resources();
     void set_rcas_sharpness(float sharpness); // If not called, 0.2 value is put by default
     void allocate_descriptor_sets(VkDescriptorPool descriptor_pool, VkImageView input_image_view, VkImageView out_image_view);
     void record_constants_update(VkCommandBuffer cb);
@@ -51,7 +59,9 @@ class AmdFsr {
 											-0.58f, -0.38f};
 
         VkDevice device;
+        PipelineCache *pipeline_cache = nullptr;
         Settings fsr_settings;
+        std::string shader_dir_path;
         VkSampler common_fsr_sampler;
         VkDescriptorSetLayout common_fsr_descriptor_set_layout;
         VkBuffer device_fsr_constants_buffer = VK_NULL_HANDLE;
@@ -0,0 +1,532 @@
+#include "gpu_culling_context.h"
+#include "../../vulkan_helper.h"
+#include <array>
+#include <algorithm>
+#include <cmath>
+
+GpuCullingContext::GpuCullingContext(VkDevice device, PipelineCache &pipeline_cache) {
+    this->device = device;
+    this->pipeline_cache = &pipeline_cache;
+
+    // The cull data is read, the draw commands are written, the visibility and the stats are both read and written
+    std::array<VkDescriptorSetLayoutBinding, 4> descriptor_set_layout_binding;
+    for (uint32_t i = 0; i < descriptor_set_layout_binding.size(); i++) {
+        descriptor_set_layout_binding[i] = {
+                i,
+                VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+                1,
+                VK_SHADER_STAGE_COMPUTE_BIT,
+                nullptr
+        };
+    }
+    VkDescriptorSetLayoutCreateInfo descriptor_set_layout_create_info = {
+            VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO,
+            nullptr,
+            0,
+            descriptor_set_layout_binding.size(),
+            descriptor_set_layout_binding.data()
+    };
+    check_error(vkCreateDescriptorSetLayout(device, &descriptor_set_layout_create_info, nullptr, &gpu_culling_set_layout), vulkan_helper::Error::DESCRIPTOR_SET_LAYOUT_CREATION_FAILED);
+
+    // The shadow casters culling reads the same cull data and writes its own draw commands
+    descriptor_set_layout_create_info.bindingCount = 2;
+    check_error(vkCreateDescriptorSetLayout(device, &descriptor_set_layout_create_info, nullptr, &shadow_casters_set_layout), vulkan_helper::Error::DESCRIPTOR_SET_LAYOUT_CREATION_FAILED);
+
+    // The second phase reads the whole depth pyramid
+    descriptor_set_layout_binding[0] = {
+            0,
+            VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+            1,
+            VK_SHADER_STAGE_COMPUTE_BIT,
+            nullptr
+    };
+    descriptor_set_layout_create_info.bindingCount = 1;
+    check_error(vkCreateDescriptorSetLayout(device, &descriptor_set_layout_create_info, nullptr, &depth_pyramid_read_set_layout), vulkan_helper::Error::DESCRIPTOR_SET_LAYOUT_CREATION_FAILED);
+
+    // Every level of the pyramid is built reading the level below and writing its own
+    descriptor_set_layout_binding[1] = {
+            1,
+            VK_DESCRIPTOR_TYPE_STORAGE_IMAGE,
+            1,
+            VK_SHADER_STAGE_COMPUTE_BIT,
+            nullptr
+    };
+    descriptor_set_layout_create_info.bindingCount = 2;
+    check_error(vkCreateDescriptorSetLayout(device, &descriptor_set_layout_create_info, nullptr, &depth_pyramid_build_set_layout), vulkan_helper::Error::DESCRIPTOR_SET_LAYOUT_CREATION_FAILED);
+
+    // The depth is only read with texelFetch
+    VkSamplerCreateInfo sampler_create_info = {
+            VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO,
+            nullptr,
+            0,
+            VK_FILTER_NEAREST,
+            VK_FILTER_NEAREST,
+            VK_SAMPLER_MIPMAP_MODE_NEAREST,
+            VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE,
+            VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE,
+            VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE,
+            0.0f,
+            VK_FALSE,
+            0.0f,
+            VK_FALSE,
+            VK_COMPARE_OP_ALWAYS,
+            0.0f,
+            VK_LOD_CLAMP_NONE,
+            VK_BORDER_COLOR_FLOAT_TRANSPARENT_BLACK,
+            VK_FALSE,
+    };
+    check_error(vkCreateSampler(device, &sampler_create_info, nullptr, &nearest_sampler), vulkan_helper::Error::SAMPLER_CREATION_FAILED);
+}
+
+void GpuCullingContext::create_pipeline(std::string shader_dir_path, VkDescriptorSetLayout instance_data_set_layout, VkDescriptorSetLayout camera_data_set_layout,
+                                        VkDescriptorSetLayout light_data_set_layout) {
+    VkShaderModule shader_module = pipeline_cache->get_shader_module(shader_dir_path + "//primitives_cull.comp.spv");
+
+    VkPipelineShaderStageCreateInfo pipeline_shader_stage_create_info = {
+            VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
+            nullptr,
+            0,
+            VK_SHADER_STAGE_COMPUTE_BIT,
+            shader_module,
+            "main",
+            nullptr
+    };
+
+    // The number of primitives, the phase and the size of the depth image are passed as push constants
+    VkPushConstantRange push_constant_range = {
+            VK_SHADER_STAGE_COMPUTE_BIT,
+            0,
+            sizeof(push_constants)
+    };
+    std::array<VkDescriptorSetLayout,4> descriptor_set_layouts = {gpu_culling_set_layout, instance_data_set_layout, camera_data_set_layout,
+                                                                  depth_pyramid_read_set_layout};
+    VkPipelineLayoutCreateInfo pipeline_layout_create_info = {
+            VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
+            nullptr,
+            0,
+            descriptor_set_layouts.size(),
+            descriptor_set_layouts.data(),
+            1,
+            &push_constant_range
+    };
+    vkDestroyPipelineLayout(device, gpu_culling_pipeline_layout, nullptr);
+    vkCreatePipelineLayout(device, &pipeline_layout_create_info, nullptr, &gpu_culling_pipeline_layout);
+
+    VkComputePipelineCreateInfo compute_pipeline_create_info = {
+            VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO,
+            nullptr,
+            0,
+            pipeline_shader_stage_create_info,
+            gpu_culling_pipeline_layout,
+            VK_NULL_HANDLE,
+            -1
+    };
+    vkDestroyPipeline(device, gpu_culling_pipeline, nullptr);
+    vkCreateComputePipelines(device, pipeline_cache->get(), 1, &compute_pipeline_create_info, nullptr, &gpu_culling_pipeline);
+
+    // Then the pipeline that builds a level of the depth pyramid
+    shader_module = pipeline_cache->get_shader_module(shader_dir_path + "//depth_pyramid.comp.spv");
+    compute_pipeline_create_info.stage.module = shader_module;
+
+    pipeline_layout_create_info.setLayoutCount = 1;
+    pipeline_layout_create_info.pSetLayouts = &depth_pyramid_build_set_layout;
+    pipeline_layout_create_info.pushConstantRangeCount = 0;
+    pipeline_layout_create_info.pPushConstantRanges = nullptr;
+    vkDestroyPipelineLayout(device, depth_pyramid_pipeline_layout, nullptr);
+    vkCreatePipelineLayout(device, &pipeline_layout_create_info, nullptr, &depth_pyramid_pipeline_layout);
+    compute_pipeline_create_info.layout = depth_pyramid_pipeline_layout;
+
+    vkDestroyPipeline(device, depth_pyramid_pipeline, nullptr);
+    vkCreateComputePipelines(device, pipeline_cache->get(), 1, &compute_pipeline_create_info, nullptr, &depth_pyramid_pipeline);
+
+    // Then the pipeline that culls the shadow casters, which only needs the number of primitives
+    shader_module = pipeline_cache->get_shader_module(shader_dir_path + "//shadow_casters_cull.comp.spv");
+    compute_pipeline_create_info.stage.module = shader_module;
+
+    push_constant_range.size = sizeof(uint32_t);
+    std::array<VkDescriptorSetLayout,3> shadow_casters_set_layouts = {shadow_casters_set_layout, instance_data_set_layout, light_data_set_layout};
+    pipeline_layout_create_info.setLayoutCount = shadow_casters_set_layouts.size();
+    pipeline_layout_create_info.pSetLayouts = shadow_casters_set_layouts.data();
+    pipeline_layout_create_info.pushConstantRangeCount = 1;
+    pipeline_layout_create_info.pPushConstantRanges = &push_constant_range;
+    vkDestroyPipelineLayout(device, shadow_casters_pipeline_layout, nullptr);
+    vkCreatePipelineLayout(device, &pipeline_layout_create_info, nullptr, &shadow_casters_pipeline_layout);
+    compute_pipeline_create_info.layout = shadow_casters_pipeline_layout;
+
+    vkDestroyPipeline(device, shadow_casters_pipeline, nullptr);
+    vkCreateComputePipelines(device, pipeline_cache->get(), 1, &compute_pipeline_create_info, nullptr, &shadow_casters_pipeline);
+}
+
+void GpuCullingContext::create_resources(uint32_t primitives_count) {
+    this->primitives_count = primitives_count;
+
+    VkBufferCreateInfo buffer_create_info = {
+            VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+            nullptr,
+            0,
+            sizeof(VkDrawIndexedIndirectCommand) * primitives_count,
+            VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT,
+            VK_SHARING_MODE_EXCLUSIVE,
+            0,
+            nullptr
+    };
+    vkDestroyBuffer(device, device_draw_commands_buffer, nullptr);
+    check_error(vkCreateBuffer(device, &buffer_create_info, nullptr, &device_draw_commands_buffer), vulkan_helper::Error::BUFFER_CREATION_FAILED);
+
+    // The visibility is cleared once with a fill
+    buffer_create_info.size = sizeof(uint32_t) * primitives_count;
+    buffer_create_info.usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+    vkDestroyBuffer(device, device_visibility_buffer, nullptr);
+    check_error(vkCreateBuffer(device, &buffer_create_info, nullptr, &device_visibility_buffer), vulkan_helper::Error::BUFFER_CREATION_FAILED);
+
+    // The stats are cleared every frame and copied to the host
+    buffer_create_info.size = sizeof(culling_stats);
+    buffer_create_info.usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+    vkDestroyBuffer(device, device_stats_buffer, nullptr);
+    check_error(vkCreateBuffer(device, &buffer_create_info, nullptr, &device_stats_buffer), vulkan_helper::Error::BUFFER_CREATION_FAILED);
+}
+
+void GpuCullingContext::create_shadow_casters_resources(uint32_t shadow_maps_count) {
+    // Without shadowed lights the buffer keeps the size of one shadow map, since it cannot be empty
+    VkBufferCreateInfo buffer_create_info = {
+            VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+            nullptr,
+            0,
+            sizeof(VkDrawIndexedIndirectCommand) * primitives_count * std::max(shadow_maps_count, 1u),
+            VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT,
+            VK_SHARING_MODE_EXCLUSIVE,
+            0,
+            nullptr
+    };
+    vkDestroyBuffer(device, device_shadow_casters_draw_commands_buffer, nullptr);
+    check_error(vkCreateBuffer(device, &buffer_create_info, nullptr, &device_shadow_casters_draw_commands_buffer), vulkan_helper::Error::BUFFER_CREATION_FAILED);
+}
+
+std::vector<VkBuffer> GpuCullingContext::get_device_buffers() {
+    return {device_draw_commands_buffer, device_visibility_buffer, device_stats_buffer};
+}
+
+void GpuCullingContext::record_resources_init(VkCommandBuffer command_buffer) {
+    vkCmdFillBuffer(command_buffer, device_visibility_buffer, 0, VK_WHOLE_SIZE, 0);
+    VkBufferMemoryBarrier buffer_memory_barrier = {
+            VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER,
+            nullptr,
+            VK_ACCESS_TRANSFER_WRITE_BIT,
+            VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT,
+            VK_QUEUE_FAMILY_IGNORED,
+            VK_QUEUE_FAMILY_IGNORED,
+            device_visibility_buffer,
+            0,
+            VK_WHOLE_SIZE
+    };
+    vkCmdPipelineBarrier(command_buffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 0, nullptr, 1, &buffer_memory_barrier, 0, nullptr);
+}
+
+void GpuCullingContext::create_depth_pyramid(VkExtent2D depth_image_res) {
+    // The first level is half the size of the depth image, rounded down
+    this->depth_image_res = depth_image_res;
+    depth_pyramid_res = {std::max(depth_image_res.width / 2, 1u), std::max(depth_image_res.height / 2, 1u)};
+    depth_pyramid_levels = vulkan_helper::get_mipmap_count({depth_pyramid_res.width, depth_pyramid_res.height, 1});
+
+    VkImageCreateInfo image_create_info = {
+            VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO,
+            nullptr,
+            0,
+            VK_IMAGE_TYPE_2D,
+            VK_FORMAT_R32_SFLOAT,
+            {depth_pyramid_res.width, depth_pyramid_res.height, 1},
+            depth_pyramid_levels,
+            1,
+            VK_SAMPLE_COUNT_1_BIT,
+            VK_IMAGE_TILING_OPTIMAL,
+            VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
+            VK_SHARING_MODE_EXCLUSIVE,
+            0,
+            nullptr,
+            VK_IMAGE_LAYOUT_UNDEFINED
+    };
+    vkDestroyImage(device, device_depth_pyramid_image, nullptr);
+    check_error(vkCreateImage(device, &image_create_info, nullptr, &device_depth_pyramid_image), vulkan_helper::Error::IMAGE_CREATION_FAILED);
+}
+
+void GpuCullingContext::init_depth_pyramid() {
+    // One view for reading the whole pyramid and one for writing every level
+    VkImageViewCreateInfo image_view_create_info = {
+            VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO,
+            nullptr,
+            0,
+            device_depth_pyramid_image,
+            VK_IMAGE_VIEW_TYPE_2D,
+            VK_FORMAT_R32_SFLOAT,
+            {VK_COMPONENT_SWIZZLE_IDENTITY, VK_COMPONENT_SWIZZLE_IDENTITY, VK_COMPONENT_SWIZZLE_IDENTITY, VK_COMPONENT_SWIZZLE_IDENTITY},
+            {VK_IMAGE_ASPECT_COLOR_BIT, 0, depth_pyramid_levels, 0, 1}
+    };
+    vkDestroyImageView(device, device_depth_pyramid_image_view, nullptr);
+    check_error(vkCreateImageView(device, &image_view_create_info, nullptr, &device_depth_pyramid_image_view), vulkan_helper::Error::IMAGE_VIEW_CREATION_FAILED);
+
+    for (auto &image_view : device_depth_pyramid_level_image_views) {
+        vkDestroyImageView(device, image_view, nullptr);
+    }
+    device_depth_pyramid_level_image_views.resize(depth_pyramid_levels);
+    for (uint32_t i = 0; i < depth_pyramid_levels; i++) {
+        image_view_create_info.subresourceRange.baseMipLevel = i;
+        image_view_create_info.subresourceRange.levelCount = 1;
+        check_error(vkCreateImageView(device, &image_view_create_info, nullptr, &device_depth_pyramid_level_image_views[i]), vulkan_helper::Error::IMAGE_VIEW_CREATION_FAILED);
+    }
+}
+
+std::function<void()> GpuCullingContext::retire_depth_pyramid() {
+    VkImage image = device_depth_pyramid_image;
+    std::vector<VkImageView> image_views = std::move(device_depth_pyramid_level_image_views);
+    image_views.push_back(device_depth_pyramid_image_view);
+    device_depth_pyramid_image = VK_NULL_HANDLE;
+    device_depth_pyramid_image_view = VK_NULL_HANDLE;
+    device_depth_pyramid_level_image_views.clear();
+    return [device = device, image, image_views]() {
+        for (auto& image_view : image_views) {
+            vkDestroyImageView(device, image_view, nullptr);
+        }
+        vkDestroyImage(device, image, nullptr);
+    };
+}
+
+std::pair<std::unordered_map<VkDescriptorType, uint32_t>, uint32_t> GpuCullingContext::get_required_descriptor_pool_size_and_sets() {
+    return {{{VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 4 + 2}}, 2};
+}
+
+void GpuCullingContext::allocate_descriptor_sets(VkDescriptorPool descriptor_pool, VkBuffer cull_data_buffer, uint64_t cull_data_offset, uint64_t cull_data_size) {
+    std::array<VkDescriptorSetLayout, 2> layouts = {gpu_culling_set_layout, shadow_casters_set_layout};
+    std::array<VkDescriptorSet, 2> descriptor_sets;
+    VkDescriptorSetAllocateInfo descriptor_set_allocate_info = {
+            VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO,
+            nullptr,
+            descriptor_pool,
+            layouts.size(),
+            layouts.data()
+    };
+    check_error(vkAllocateDescriptorSets(device, &descriptor_set_allocate_info, descriptor_sets.data()), vulkan_helper::Error::DESCRIPTOR_SET_ALLOCATION_FAILED);
+    gpu_culling_descriptor_set = descriptor_sets[0];
+    shadow_casters_descriptor_set = descriptor_sets[1];
+
+    std::array<VkDescriptorBufferInfo, 5> descriptor_buffer_infos;
+    descriptor_buffer_infos[0] = {
+            cull_data_buffer,
+            cull_data_offset,
+            cull_data_size
+    };
+    descriptor_buffer_infos[1] = {
+            device_draw_commands_buffer,
+            0,
+            VK_WHOLE_SIZE
+    };
+    descriptor_buffer_infos[2] = {
+            device_visibility_buffer,
+            0,
+            VK_WHOLE_SIZE
+    };
+    descriptor_buffer_infos[3] = {
+            device_stats_buffer,
+            0,
+            VK_WHOLE_SIZE
+    };
+    descriptor_buffer_infos[4] = {
+            device_shadow_casters_draw_commands_buffer,
+            0,
+            VK_WHOLE_SIZE
+    };
+
+    // The set of the shadow casters shares the cull data and has its own draw commands as second binding
+    std::array<VkWriteDescriptorSet, 6> write_descriptor_sets;
+    for (uint32_t i = 0; i < write_descriptor_sets.size(); i++) {
+        write_descriptor_sets[i] = {
+                VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+                nullptr,
+                i < 4 ? gpu_culling_descriptor_set : shadow_casters_descriptor_set,
+                i < 4 ? i : i - 4,
+                0,
+                1,
+                VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+                nullptr,
+                i < 4 ? &descriptor_buffer_infos[i] : &descriptor_buffer_infos[i == 4 ? 0 : 4],
+                nullptr
+        };
+    }
+    vkUpdateDescriptorSets(device, write_descriptor_sets.size(), write_descriptor_sets.data(), 0, nullptr);
+}
+
+std::pair<std::unordered_map<VkDescriptorType, uint32_t>, uint32_t> GpuCullingContext::get_required_attachments_descriptor_pool_size_and_sets() {
+    return {{{VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, depth_pyramid_levels + 1}, {VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, depth_pyramid_levels}}, depth_pyramid_levels + 1};
+}
+
+void GpuCullingContext::allocate_attachments_descriptor_sets(VkDescriptorPool descriptor_pool, VkImageView depth_image_view) {
+    std::vector<VkDescriptorSetLayout> layouts(depth_pyramid_levels, depth_pyramid_build_set_layout);
+    layouts.push_back(depth_pyramid_read_set_layout);
+    std::vector<VkDescriptorSet> descriptor_sets(layouts.size());
+    VkDescriptorSetAllocateInfo descriptor_set_allocate_info = {
+            VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO,
+            nullptr,
+            descriptor_pool,
+            static_cast<uint32_t>(layouts.size()),
+            layouts.data()
+    };
+    check_error(vkAllocateDescriptorSets(device, &descriptor_set_allocate_info, descriptor_sets.data()), vulkan_helper::Error::DESCRIPTOR_SET_ALLOCATION_FAILED);
+    depth_pyramid_build_descriptor_sets.assign(descriptor_sets.begin(), descriptor_sets.end() - 1);
+    depth_pyramid_read_descriptor_set = descriptor_sets.back();
+
+    // The first level reads the depth image, the others the level below, the last write reads the whole pyramid
+    std::vector<VkDescriptorImageInfo> descriptor_image_infos(2 * depth_pyramid_levels + 1);
+    std::vector<VkWriteDescriptorSet> write_descriptor_sets(2 * depth_pyramid_levels + 1);
+    for (uint32_t i = 0; i < depth_pyramid_levels; i++) {
+        descriptor_image_infos[2 * i] = {
+                nearest_sampler,
+                i == 0 ? depth_image_view : device_depth_pyramid_level_image_views[i - 1],
+                i == 0 ? VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL : VK_IMAGE_LAYOUT_GENERAL
+        };
+        descriptor_image_infos[2 * i + 1] = {
+                VK_NULL_HANDLE,
+                device_depth_pyramid_level_image_views[i],
+                VK_IMAGE_LAYOUT_GENERAL
+        };
+        for (uint32_t j = 0; j < 2; j++) {
+            write_descriptor_sets[2 * i + j] = {
+                    VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+                    nullptr,
+                    depth_pyramid_build_descriptor_sets[i],
+                    j,
+                    0,
+                    1,
+                    j == 0 ? VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER : VK_DESCRIPTOR_TYPE_STORAGE_IMAGE,
+                    &descriptor_image_infos[2 * i + j],
+                    nullptr,
+                    nullptr
+            };
+        }
+    }
+    descriptor_image_infos.back() = {
+            nearest_sampler,
+            device_depth_pyramid_image_view,
+            VK_IMAGE_LAYOUT_GENERAL
+    };
+    write_descriptor_sets.back() = {
+            VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+            nullptr,
+            depth_pyramid_read_descriptor_set,
+            0,
+            0,
+            1,
+            VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+            &descriptor_image_infos.back(),
+            nullptr,
+            nullptr
+    };
+    vkUpdateDescriptorSets(device, write_descriptor_sets.size(), write_descriptor_sets.data(), 0, nullptr);
+}
+
+void GpuCullingContext::record_into_command_buffer(VkCommandBuffer command_buffer, VkDescriptorSet instance_data_set, VkDescriptorSet camera_data_set, Phase phase) {
+    VkMemoryBarrier memory_barrier = { VK_STRUCTURE_TYPE_MEMORY_BARRIER, nullptr, 0, 0 };
+    if (phase == Phase::PREVIOUSLY_VISIBLE) {
+        // The last frame must have read the commands and the stats, and its visibility must be visible, before they are overwritten
+        memory_barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+        memory_barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_TRANSFER_WRITE_BIT;
+        vkCmdPipelineBarrier(command_buffer, VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT,
+                             VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 1, &memory_barrier, 0, nullptr, 0, nullptr);
+        // The stats are counted by the second phase
+        vkCmdFillBuffer(command_buffer, device_stats_buffer, 0, VK_WHOLE_SIZE, 0);
+    }
+    else {
+        record_depth_pyramid_build(command_buffer);
+        // The pyramid and the cleared stats are read, and the draws of the first phase must have read the commands
+        memory_barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_TRANSFER_WRITE_BIT;
+        memory_barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+        vkCmdPipelineBarrier(command_buffer, VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT,
+                             VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &memory_barrier, 0, nullptr, 0, nullptr);
+    }
+
+    std::array<VkDescriptorSet, 4> to_bind = {gpu_culling_descriptor_set, instance_data_set, camera_data_set, depth_pyramid_read_descriptor_set};
+    push_constants constants = {primitives_count, static_cast<uint32_t>(phase), depth_image_res};
+    vkCmdBindPipeline(command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE, gpu_culling_pipeline);
+    vkCmdBindDescriptorSets(command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE, gpu_culling_pipeline_layout, 0, to_bind.size(), to_bind.data(), 0, nullptr);
+    vkCmdPushConstants(command_buffer, gpu_culling_pipeline_layout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(push_constants), &constants);
+    vkCmdDispatch(command_buffer, std::ceil(primitives_count / static_cast<float>(workgroup_size)), 1, 1);
+
+    memory_barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+    memory_barrier.dstAccessMask = VK_ACCESS_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_TRANSFER_READ_BIT;
+    vkCmdPipelineBarrier(command_buffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT,
+                         0, 1, &memory_barrier, 0, nullptr, 0, nullptr);
+}
+
+void GpuCullingContext::record_shadow_casters_culling(VkCommandBuffer command_buffer, VkDescriptorSet instance_data_set, VkDescriptorSet light_data_set,
+                                                      uint32_t lights_count) {
+    // The shadow map draws of the last frame must have read the commands before they are overwritten
+    VkMemoryBarrier memory_barrier = { VK_STRUCTURE_TYPE_MEMORY_BARRIER, nullptr, 0, 0 };
+    vkCmdPipelineBarrier(command_buffer, VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &memory_barrier, 0, nullptr, 0, nullptr);
+
+    std::array<VkDescriptorSet, 3> to_bind = {shadow_casters_descriptor_set, instance_data_set, light_data_set};
+    vkCmdBindPipeline(command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE, shadow_casters_pipeline);
+    vkCmdBindDescriptorSets(command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE, shadow_casters_pipeline_layout, 0, to_bind.size(), to_bind.data(), 0, nullptr);
+    vkCmdPushConstants(command_buffer, shadow_casters_pipeline_layout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(uint32_t), &primitives_count);
+    vkCmdDispatch(command_buffer, std::ceil(primitives_count / static_cast<float>(workgroup_size)), lights_count, 1);
+
+    memory_barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+    memory_barrier.dstAccessMask = VK_ACCESS_INDIRECT_COMMAND_READ_BIT;
+    vkCmdPipelineBarrier(command_buffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT, 0, 1, &memory_barrier, 0, nullptr, 0, nullptr);
+}
+
+void GpuCullingContext::record_depth_pyramid_build(VkCommandBuffer command_buffer) {
+    // The content of the last frame is discarded, the reads of its second phase must be done
+    VkImageMemoryBarrier image_memory_barrier = {
+            VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+            nullptr,
+            0,
+            VK_ACCESS_SHADER_WRITE_BIT,
+            VK_IMAGE_LAYOUT_UNDEFINED,
+            VK_IMAGE_LAYOUT_GENERAL,
+            VK_QUEUE_FAMILY_IGNORED,
+            VK_QUEUE_FAMILY_IGNORED,
+            device_depth_pyramid_image,
+            {VK_IMAGE_ASPECT_COLOR_BIT, 0, VK_REMAINING_MIP_LEVELS, 0, 1}
+    };
+    vkCmdPipelineBarrier(command_buffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 0, nullptr, 0, nullptr, 1, &image_memory_barrier);
+
+    vkCmdBindPipeline(command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE, depth_pyramid_pipeline);
+    VkMemoryBarrier memory_barrier = { VK_STRUCTURE_TYPE_MEMORY_BARRIER, nullptr, VK_ACCESS_SHADER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT };
+    for (uint32_t i = 0; i < depth_pyramid_levels; i++) {
+        vkCmdBindDescriptorSets(command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE, depth_pyramid_pipeline_layout, 0, 1, &depth_pyramid_build_descriptor_sets[i], 0, nullptr);
+        uint32_t level_width = std::max(depth_pyramid_res.width >> i, 1u);
+        uint32_t level_height = std::max(depth_pyramid_res.height >> i, 1u);
+        vkCmdDispatch(command_buffer, std::ceil(level_width / static_cast<float>(depth_pyramid_workgroup_size)),
+                      std::ceil(level_height / static_cast<float>(depth_pyramid_workgroup_size)), 1);
+        // Every level is read by the next one, the last by the culling
+        vkCmdPipelineBarrier(command_buffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &memory_barrier, 0, nullptr, 0, nullptr);
+    }
+}
+
+void GpuCullingContext::record_stats_copy(VkCommandBuffer command_buffer, VkBuffer dst_buffer, uint64_t dst_offset) {
+    VkBufferCopy buffer_copy = {0, dst_offset, sizeof(culling_stats)};
+    vkCmdCopyBuffer(command_buffer, device_stats_buffer, dst_buffer, 1, &buffer_copy);
+    VkMemoryBarrier memory_barrier = { VK_STRUCTURE_TYPE_MEMORY_BARRIER, nullptr, VK_ACCESS_TRANSFER_WRITE_BIT, VK_ACCESS_HOST_READ_BIT };
+    vkCmdPipelineBarrier(command_buffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_HOST_BIT, 0, 1, &memory_barrier, 0, nullptr, 0, nullptr);
+}
+
+GpuCullingContext::~GpuCullingContext() {
+    for (auto &image_view : device_depth_pyramid_level_image_views) {
+        vkDestroyImageView(device, image_view, nullptr);
+    }
+    vkDestroyImageView(device, device_depth_pyramid_image_view, nullptr);
+    vkDestroyImage(device, device_depth_pyramid_image, nullptr);
+    vkDestroyBuffer(device, device_draw_commands_buffer, nullptr);
+    vkDestroyBuffer(device, device_visibility_buffer, nullptr);
+    vkDestroyBuffer(device, device_stats_buffer, nullptr);
+    vkDestroyBuffer(device, device_shadow_casters_draw_commands_buffer, nullptr);
+    vkDestroyPipeline(device, gpu_culling_pipeline, nullptr);
+    vkDestroyPipelineLayout(device, gpu_culling_pipeline_layout, nullptr);
+    vkDestroyPipeline(device, depth_pyramid_pipeline, nullptr);
+    vkDestroyPipelineLayout(device, depth_pyramid_pipeline_layout, nullptr);
+    vkDestroyPipeline(device, shadow_casters_pipeline, nullptr);
+    vkDestroyPipelineLayout(device, shadow_casters_pipeline_layout, nullptr);
+    vkDestroySampler(device, nearest_sampler, nullptr);
+    vkDestroyDescriptorSetLayout(device, gpu_culling_set_layout, nullptr);
+    vkDestroyDescriptorSetLayout(device, shadow_casters_set_layout, nullptr);
+    vkDestroyDescriptorSetLayout(device, depth_pyramid_read_set_layout, nullptr);
+    vkDestroyDescriptorSetLayout(device, depth_pyramid_build_set_layout, nullptr);
+}
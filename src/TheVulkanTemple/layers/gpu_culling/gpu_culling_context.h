@@ -0,0 +1,122 @@
+#ifndef THEVULKANTEMPLE_GPU_CULLING_CONTEXT_H
+#define THEVULKANTEMPLE_GPU_CULLING_CONTEXT_H
+
+#include <utility>
+#include <string>
+#include <vector>
+#include <functional>
+#include <unordered_map>
+#include "../../external/volk.h"
+#include "../../pipeline_cache.h"
+
+/* Culls every primitive of the scene in two compute phases, writing one VkDrawIndexedIndirectCommand for each of them
+ * in a device buffer, with 0 instances if the primitive is not to be drawn. The first phase selects the primitives that
+ * were visible in the last frame and are still in the camera frustum. After they are drawn, a depth pyramid is built from
+ * the depth image and the second phase selects the primitives that have become visible, testing them against it.
+ * The shadow casters are culled separately against the frustum of every shadowed light, in their own commands buffer.
+ * The camera, the lights and the models are read from their buffers, so the recorded dispatches stay valid when they move.
+ * The usage is: create_pipeline() once, then create_resources() for every scene, bind get_device_buffers() to memory and
+ * call record_resources_init(). Then create_shadow_casters_resources() for every set of lights, bind
+ * get_shadow_casters_draw_commands_buffer() to memory and call allocate_descriptor_sets(). For every screen size call
+ * create_depth_pyramid(), bind get_depth_pyramid_image() to memory, then call init_depth_pyramid() and
+ * allocate_attachments_descriptor_sets().
+ */
+class GpuCullingContext {
+    public:
+        // Counters of the primitives of the last culled frame, the shader has the same layout
+        struct culling_stats {
+            uint32_t drawn_primitives;
+            uint32_t frustum_culled_primitives;
+            uint32_t occlusion_culled_primitives;
+        };
+        enum class Phase {
+            PREVIOUSLY_VISIBLE,
+            NEWLY_VISIBLE
+        };
+
+        GpuCullingContext(VkDevice device, PipelineCache &pipeline_cache);
+        ~GpuCullingContext();
+
+        void create_pipeline(std::string shader_dir_path, VkDescriptorSetLayout instance_data_set_layout, VkDescriptorSetLayout camera_data_set_layout,
+                             VkDescriptorSetLayout light_data_set_layout);
+        void create_resources(uint32_t primitives_count);
+        void create_shadow_casters_resources(uint32_t shadow_maps_count);
+        // The draw commands, the visibility of the primitives and the stats
+        std::vector<VkBuffer> get_device_buffers();
+        VkBuffer get_draw_commands_buffer() { return device_draw_commands_buffer; };
+        VkBuffer get_shadow_casters_draw_commands_buffer() { return device_shadow_casters_draw_commands_buffer; };
+        // The commands of a shadow map start at this offset, with one command for every primitive
+        uint64_t get_shadow_casters_draw_commands_offset(uint32_t shadow_map_index) {
+            return static_cast<uint64_t>(shadow_map_index) * primitives_count * sizeof(VkDrawIndexedIndirectCommand);
+        };
+        // Sets all the primitives as not visible, so that the first frame draws everything in the second phase
+        void record_resources_init(VkCommandBuffer command_buffer);
+
+        void create_depth_pyramid(VkExtent2D depth_image_res);
+        VkImage get_depth_pyramid_image() { return device_depth_pyramid_image; };
+        void init_depth_pyramid();
+        // Hands over the depth pyramid, which the returned function destroys once the frames using it are done. The next
+        // create_depth_pyramid() makes a new one instead of destroying it in place
+        std::function<void()> retire_depth_pyramid();
+
+        std::pair<std::unordered_map<VkDescriptorType, uint32_t>, uint32_t> get_required_descriptor_pool_size_and_sets();
+        // The cull data buffer contains a VkModel::primitive_cull_data for every primitive
+        void allocate_descriptor_sets(VkDescriptorPool descriptor_pool, VkBuffer cull_data_buffer, uint64_t cull_data_offset, uint64_t cull_data_size);
+        std::pair<std::unordered_map<VkDescriptorType, uint32_t>, uint32_t> get_required_attachments_descriptor_pool_size_and_sets();
+        // The depth image must be in SHADER_READ_ONLY_OPTIMAL layout when the second phase is recorded
+        void allocate_attachments_descriptor_sets(VkDescriptorPool descriptor_pool, VkImageView depth_image_view);
+
+        // Writes the draw commands of the phase, which then can be consumed by the indirect draws of the same command buffer.
+        // The newly visible phase also builds the depth pyramid, so it must be recorded after the draws of the first one
+        void record_into_command_buffer(VkCommandBuffer command_buffer, VkDescriptorSet instance_data_set, VkDescriptorSet camera_data_set, Phase phase);
+        // Writes the draw commands of the shadow casters of every shadowed light, which then can be consumed by the indirect draws
+        // of the same command buffer. The lights count is the number of lights in the light buffer, shadowed or not
+        void record_shadow_casters_culling(VkCommandBuffer command_buffer, VkDescriptorSet instance_data_set, VkDescriptorSet light_data_set, uint32_t lights_count);
+        // Copies the stats written by the second phase to a host visible buffer
+        void record_stats_copy(VkCommandBuffer command_buffer, VkBuffer dst_buffer, uint64_t dst_offset);
+    private:
+        VkDevice device;
+        PipelineCache *pipeline_cache = nullptr;
+        VkDescriptorSetLayout gpu_culling_set_layout = VK_NULL_HANDLE;
+        VkDescriptorSet gpu_culling_descriptor_set = VK_NULL_HANDLE;
+        VkDescriptorSetLayout shadow_casters_set_layout = VK_NULL_HANDLE;
+        VkDescriptorSet shadow_casters_descriptor_set = VK_NULL_HANDLE;
+        VkDescriptorSetLayout depth_pyramid_read_set_layout = VK_NULL_HANDLE;
+        VkDescriptorSet depth_pyramid_read_descriptor_set = VK_NULL_HANDLE;
+        VkDescriptorSetLayout depth_pyramid_build_set_layout = VK_NULL_HANDLE;
+        std::vector<VkDescriptorSet> depth_pyramid_build_descriptor_sets;
+        VkSampler nearest_sampler = VK_NULL_HANDLE;
+
+        VkPipelineLayout gpu_culling_pipeline_layout = VK_NULL_HANDLE;
+        VkPipeline gpu_culling_pipeline = VK_NULL_HANDLE;
+        VkPipelineLayout depth_pyramid_pipeline_layout = VK_NULL_HANDLE;
+        VkPipeline depth_pyramid_pipeline = VK_NULL_HANDLE;
+        VkPipelineLayout shadow_casters_pipeline_layout = VK_NULL_HANDLE;
+        VkPipeline shadow_casters_pipeline = VK_NULL_HANDLE;
+
+        uint32_t primitives_count = 0;
+        VkBuffer device_draw_commands_buffer = VK_NULL_HANDLE;
+        VkBuffer device_visibility_buffer = VK_NULL_HANDLE;
+        VkBuffer device_stats_buffer = VK_NULL_HANDLE;
+        VkBuffer device_shadow_casters_draw_commands_buffer = VK_NULL_HANDLE;
+
+        VkExtent2D depth_image_res = {0, 0};
+        VkExtent2D depth_pyramid_res = {0, 0};
+        uint32_t depth_pyramid_levels = 0;
+        VkImage device_depth_pyramid_image = VK_NULL_HANDLE;
+        VkImageView device_depth_pyramid_image_view = VK_NULL_HANDLE;
+        std::vector<VkImageView> device_depth_pyramid_level_image_views;
+
+        struct push_constants {
+            uint32_t primitives_count;
+            uint32_t phase;
+            VkExtent2D depth_image_res;
+        };
+
+        const uint32_t workgroup_size = 64;
+        const uint32_t depth_pyramid_workgroup_size = 8;
+
+        void record_depth_pyramid_build(VkCommandBuffer command_buffer);
+};
+
+#endif //THEVULKANTEMPLE_GPU_CULLING_CONTEXT_H
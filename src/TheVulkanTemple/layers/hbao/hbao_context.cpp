@@ -1,9 +1,10 @@
 #include "hbao_context.h"
 
-HbaoContext::HbaoContext(VkDevice device, VkPhysicalDeviceMemoryProperties memory_properties, VkExtent2D screen_res,
+HbaoContext::HbaoContext(VkDevice device, PipelineCache &pipeline_cache, VkPhysicalDeviceMemoryProperties memory_properties, VkExtent2D screen_res,
                          VkFormat depth_image_format, VkFormat out_ao_image_format, std::string shader_dir_path, bool generate_normals) :
                         distribution(0.0f, 1.0f) {
     this->device = device;
+    this->pipeline_cache = &pipeline_cache;
     this->physical_device_memory_properties = memory_properties;
     this->generate_normals = generate_normals;
 
@@ -431,40 +432,38 @@ HbaoContext::HbaoContext(VkDevice device, VkPhysicalDeviceMemoryProperties memor
     stages[HBAO_BLUR].descriptor_set_layout = &hbao_descriptor_set_layouts[2];
     stages[HBAO_BLUR_2].descriptor_set_layout = &hbao_descriptor_set_layouts[2];
 
-    // Then we start creating the pipelines, by creating the structures that are common for all the pipelines
-    pipeline_common_structures structures;
-    fill_full_screen_pipeline_common_structures(shader_dir_path + "//fullscreen_tri.vert.spv", structures);
-
-    // Creating the pipelines
-    create_linearize_depth_pipeline(structures, screen_res,  shader_dir_path + "//depth_linearize.frag.spv");
-    if (generate_normals) {
-        create_view_normal_pipeline(structures, screen_res, shader_dir_path + "//view_normal.frag.spv");
-    }
-    create_deinterleave_pipeline(structures, screen_res, shader_dir_path + "//hbao_deinterleave.frag.spv");
-    create_hbao_calc_pipeline(structures, screen_res, shader_dir_path + "//hbao_calc.frag.spv");
-    create_reinterleave_pipeline(structures, screen_res, shader_dir_path  + "//hbao_reinterleave.frag.spv");
-    create_hbao_blur_pipeline(structures, screen_res, shader_dir_path  + "//hbao_blur.frag.spv");
-    create_hbao_blur_2_pipeline(structures, screen_res, shader_dir_path  + "//hbao_blur_2.frag.spv");
-
-    // We don't need the vertex shader module anymore
-    vkDestroyShaderModule(device, structures.vertex_shader_stage.module, nullptr);
+    // The structures that are common for all the pipelines, which are then created by create_pipelines
+    this->shader_dir_path = shader_dir_path;
+    this->screen_extent = screen_res;
+    fill_full_screen_pipeline_common_structures(shader_dir_path + "//fullscreen_tri.vert.spv", full_screen_pipeline_structures);
 
     hbao_data = std::make_unique<HbaoData>();
     create_hbao_device_buffer();
 }
 
-void HbaoContext::fill_full_screen_pipeline_common_structures(std::string vertex_shader_path, pipeline_common_structures &structures) {
-    std::vector<uint8_t> shader_contents;
-    vulkan_helper::get_binary_file_content(vertex_shader_path, shader_contents);
-    VkShaderModuleCreateInfo shader_module_create_info = {
-            VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO,
-            nullptr,
-            0,
-            shader_contents.size(),
-            reinterpret_cast<uint32_t*>(shader_contents.data())
+void HbaoContext::create_pipelines(JobSystem &job_system, JobSystem::Counter &counter) {
+    // Every pipeline writes only the objects of its stage, so they can be created in parallel
+    using create_pipeline_function = void (HbaoContext::*)(const pipeline_common_structures&, VkExtent2D, std::string);
+    std::vector<std::pair<create_pipeline_function, std::string>> pipelines = {
+        {&HbaoContext::create_linearize_depth_pipeline, "//depth_linearize.frag.spv"},
+        {&HbaoContext::create_deinterleave_pipeline, "//hbao_deinterleave.frag.spv"},
+        {&HbaoContext::create_hbao_calc_pipeline, "//hbao_calc.frag.spv"},
+        {&HbaoContext::create_reinterleave_pipeline, "//hbao_reinterleave.frag.spv"},
+        {&HbaoContext::create_hbao_blur_pipeline, "//hbao_blur.frag.spv"},
+        {&HbaoContext::create_hbao_blur_2_pipeline, "//hbao_blur_2.frag.spv"}
     };
-    VkShaderModule vertex_shader_module;
-    check_error(vkCreateShaderModule(device, &shader_module_create_info, nullptr, &vertex_shader_module), vulkan_helper::Error::SHADER_MODULE_CREATION_FAILED );
+    if (generate_normals) {
+        pipelines.emplace_back(&HbaoContext::create_view_normal_pipeline, "//view_normal.frag.spv");
+    }
+    for (const auto& pipeline : pipelines) {
+        job_system.submit(counter, "create_hbao_pipeline", [this, create_pipeline = pipeline.first, frag_shader_path = shader_dir_path + pipeline.second]() {
+            (this->*create_pipeline)(full_screen_pipeline_structures, screen_extent, frag_shader_path);
+        });
+    }
+}
+
+void HbaoContext::fill_full_screen_pipeline_common_structures(std::string vertex_shader_path, pipeline_common_structures &structures) {
+    VkShaderModule vertex_shader_module = pipeline_cache->get_shader_module(vertex_shader_path);
 
     structures.vertex_shader_stage = {
         VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
@@ -550,17 +549,7 @@ void HbaoContext::fill_full_screen_pipeline_common_structures(std::string vertex
 }
 
 void HbaoContext::create_linearize_depth_pipeline(const pipeline_common_structures &structures, VkExtent2D render_target_extent, std::string frag_shader_path) {
-    std::vector<uint8_t> shader_contents;
-    vulkan_helper::get_binary_file_content(frag_shader_path, shader_contents);
-    VkShaderModuleCreateInfo shader_module_create_info = {
-            VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO,
-            nullptr,
-            0,
-            shader_contents.size(),
-            reinterpret_cast<uint32_t*>(shader_contents.data())
-    };
-    VkShaderModule fragment_shader_module;
-    check_error(vkCreateShaderModule(device, &shader_module_create_info, nullptr, &fragment_shader_module), vulkan_helper::Error::SHADER_MODULE_CREATION_FAILED );
+    VkShaderModule fragment_shader_module = pipeline_cache->get_shader_module(frag_shader_path);
 
     std::array<VkPipelineShaderStageCreateInfo, 2> pipeline_shaders_stage_create_info;
     pipeline_shaders_stage_create_info[0] = structures.vertex_shader_stage;
@@ -655,22 +644,11 @@ void HbaoContext::create_linearize_depth_pipeline(const pipeline_common_structur
             VK_NULL_HANDLE,
             -1
     };
-    vkCreateGraphicsPipelines(device, VK_NULL_HANDLE, 1, &graphics_pipeline_create_info, nullptr, &stages[DEPTH_LINEARIZE].pipeline);
-    vkDestroyShaderModule(device, fragment_shader_module, nullptr);
+    vkCreateGraphicsPipelines(device, pipeline_cache->get(), 1, &graphics_pipeline_create_info, nullptr, &stages[DEPTH_LINEARIZE].pipeline);
 }
 
 void HbaoContext::create_view_normal_pipeline(const pipeline_common_structures &structures, VkExtent2D render_target_extent, std::string frag_shader_path) {
-    std::vector<uint8_t> shader_contents;
-    vulkan_helper::get_binary_file_content(frag_shader_path, shader_contents);
-    VkShaderModuleCreateInfo shader_module_create_info = {
-            VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO,
-            nullptr,
-            0,
-            shader_contents.size(),
-            reinterpret_cast<uint32_t*>(shader_contents.data())
-    };
-    VkShaderModule fragment_shader_module;
-    check_error(vkCreateShaderModule(device, &shader_module_create_info, nullptr, &fragment_shader_module), vulkan_helper::Error::SHADER_MODULE_CREATION_FAILED );
+    VkShaderModule fragment_shader_module = pipeline_cache->get_shader_module(frag_shader_path);
 
     std::array<VkPipelineShaderStageCreateInfo, 2> pipeline_shaders_stage_create_info;
     pipeline_shaders_stage_create_info[0] = structures.vertex_shader_stage;
@@ -759,22 +737,11 @@ void HbaoContext::create_view_normal_pipeline(const pipeline_common_structures &
             VK_NULL_HANDLE,
             -1
     };
-    vkCreateGraphicsPipelines(device, VK_NULL_HANDLE, 1, &graphics_pipeline_create_info, nullptr, &stages[VIEW_NORMAL].pipeline);
-    vkDestroyShaderModule(device, fragment_shader_module, nullptr);
+    vkCreateGraphicsPipelines(device, pipeline_cache->get(), 1, &graphics_pipeline_create_info, nullptr, &stages[VIEW_NORMAL].pipeline);
 }
 
 void HbaoContext::create_deinterleave_pipeline(const pipeline_common_structures &structures, VkExtent2D render_target_extent, std::string frag_shader_path) {
-    std::vector<uint8_t> shader_contents;
-    vulkan_helper::get_binary_file_content(frag_shader_path, shader_contents);
-    VkShaderModuleCreateInfo shader_module_create_info = {
-            VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO,
-            nullptr,
-            0,
-            shader_contents.size(),
-            reinterpret_cast<uint32_t*>(shader_contents.data())
-    };
-    VkShaderModule fragment_shader_module;
-    check_error(vkCreateShaderModule(device, &shader_module_create_info, nullptr, &fragment_shader_module), vulkan_helper::Error::SHADER_MODULE_CREATION_FAILED );
+    VkShaderModule fragment_shader_module = pipeline_cache->get_shader_module(frag_shader_path);
 
     std::array<VkPipelineShaderStageCreateInfo, 2> pipeline_shaders_stage_create_info;
     pipeline_shaders_stage_create_info[0] = structures.vertex_shader_stage;
@@ -871,22 +838,11 @@ void HbaoContext::create_deinterleave_pipeline(const pipeline_common_structures
             VK_NULL_HANDLE,
             -1
     };
-    vkCreateGraphicsPipelines(device, VK_NULL_HANDLE, 1, &graphics_pipeline_create_info, nullptr, &stages[DEPTH_DEINTERLEAVE].pipeline);
-    vkDestroyShaderModule(device, fragment_shader_module, nullptr);
+    vkCreateGraphicsPipelines(device, pipeline_cache->get(), 1, &graphics_pipeline_create_info, nullptr, &stages[DEPTH_DEINTERLEAVE].pipeline);
 }
 
 void HbaoContext::create_hbao_calc_pipeline(const pipeline_common_structures &structures, VkExtent2D render_target_extent, std::string frag_shader_path) {
-    std::vector<uint8_t> shader_contents;
-    vulkan_helper::get_binary_file_content(frag_shader_path, shader_contents);
-    VkShaderModuleCreateInfo shader_module_create_info = {
-            VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO,
-            nullptr,
-            0,
-            shader_contents.size(),
-            reinterpret_cast<uint32_t *>(shader_contents.data())
-    };
-    VkShaderModule fragment_shader_module;
-    check_error(vkCreateShaderModule(device, &shader_module_create_info, nullptr, &fragment_shader_module),vulkan_helper::Error::SHADER_MODULE_CREATION_FAILED);
+    VkShaderModule fragment_shader_module = pipeline_cache->get_shader_module(frag_shader_path);
 
     std::array<VkPipelineShaderStageCreateInfo, 2> pipeline_shaders_stage_create_info;
     pipeline_shaders_stage_create_info[0] = structures.vertex_shader_stage;
@@ -975,22 +931,11 @@ void HbaoContext::create_hbao_calc_pipeline(const pipeline_common_structures &st
             VK_NULL_HANDLE,
             -1
     };
-    vkCreateGraphicsPipelines(device, VK_NULL_HANDLE, 1, &graphics_pipeline_create_info, nullptr, &stages[HBAO_CALC].pipeline);
-    vkDestroyShaderModule(device, fragment_shader_module, nullptr);
+    vkCreateGraphicsPipelines(device, pipeline_cache->get(), 1, &graphics_pipeline_create_info, nullptr, &stages[HBAO_CALC].pipeline);
 }
 
 void HbaoContext::create_reinterleave_pipeline(const pipeline_common_structures &structures, VkExtent2D render_target_extent, std::string frag_shader_path) {
-    std::vector<uint8_t> shader_contents;
-    vulkan_helper::get_binary_file_content(frag_shader_path, shader_contents);
-    VkShaderModuleCreateInfo shader_module_create_info = {
-            VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO,
-            nullptr,
-            0,
-            shader_contents.size(),
-            reinterpret_cast<uint32_t*>(shader_contents.data())
-    };
-    VkShaderModule fragment_shader_module;
-    check_error(vkCreateShaderModule(device, &shader_module_create_info, nullptr, &fragment_shader_module), vulkan_helper::Error::SHADER_MODULE_CREATION_FAILED );
+    VkShaderModule fragment_shader_module = pipeline_cache->get_shader_module(frag_shader_path);
 
     std::array<VkPipelineShaderStageCreateInfo, 2> pipeline_shaders_stage_create_info;
     pipeline_shaders_stage_create_info[0] = structures.vertex_shader_stage;
@@ -1079,22 +1024,11 @@ void HbaoContext::create_reinterleave_pipeline(const pipeline_common_structures
             VK_NULL_HANDLE,
             -1
     };
-    vkCreateGraphicsPipelines(device, VK_NULL_HANDLE, 1, &graphics_pipeline_create_info, nullptr, &stages[HBAO_REINTERLEAVE].pipeline);
-    vkDestroyShaderModule(device, fragment_shader_module, nullptr);
+    vkCreateGraphicsPipelines(device, pipeline_cache->get(), 1, &graphics_pipeline_create_info, nullptr, &stages[HBAO_REINTERLEAVE].pipeline);
 }
 
 void HbaoContext::create_hbao_blur_pipeline(const pipeline_common_structures &structures, VkExtent2D render_target_extent, std::string frag_shader_path) {
-    std::vector<uint8_t> shader_contents;
-    vulkan_helper::get_binary_file_content(frag_shader_path, shader_contents);
-    VkShaderModuleCreateInfo shader_module_create_info = {
-            VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO,
-            nullptr,
-            0,
-            shader_contents.size(),
-            reinterpret_cast<uint32_t*>(shader_contents.data())
-    };
-    VkShaderModule fragment_shader_module;
-    check_error(vkCreateShaderModule(device, &shader_module_create_info, nullptr, &fragment_shader_module), vulkan_helper::Error::SHADER_MODULE_CREATION_FAILED );
+    VkShaderModule fragment_shader_module = pipeline_cache->get_shader_module(frag_shader_path);
 
     std::array<VkPipelineShaderStageCreateInfo, 2> pipeline_shaders_stage_create_info;
     pipeline_shaders_stage_create_info[0] = structures.vertex_shader_stage;
@@ -1189,22 +1123,11 @@ void HbaoContext::create_hbao_blur_pipeline(const pipeline_common_structures &st
             VK_NULL_HANDLE,
             -1
     };
-    vkCreateGraphicsPipelines(device, VK_NULL_HANDLE, 1, &graphics_pipeline_create_info, nullptr, &stages[HBAO_BLUR].pipeline);
-    vkDestroyShaderModule(device, fragment_shader_module, nullptr);
+    vkCreateGraphicsPipelines(device, pipeline_cache->get(), 1, &graphics_pipeline_create_info, nullptr, &stages[HBAO_BLUR].pipeline);
 }
 
 void HbaoContext::create_hbao_blur_2_pipeline(const pipeline_common_structures &structures, VkExtent2D render_target_extent, std::string frag_shader_path) {
-    std::vector<uint8_t> shader_contents;
-    vulkan_helper::get_binary_file_content(frag_shader_path, shader_contents);
-    VkShaderModuleCreateInfo shader_module_create_info = {
-            VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO,
-            nullptr,
-            0,
-            shader_contents.size(),
-            reinterpret_cast<uint32_t*>(shader_contents.data())
-    };
-    VkShaderModule fragment_shader_module;
-    check_error(vkCreateShaderModule(device, &shader_module_create_info, nullptr, &fragment_shader_module), vulkan_helper::Error::SHADER_MODULE_CREATION_FAILED);
+    VkShaderModule fragment_shader_module = pipeline_cache->get_shader_module(frag_shader_path);
 
     std::array<VkPipelineShaderStageCreateInfo, 2> pipeline_shaders_stage_create_info;
     pipeline_shaders_stage_create_info[0] = structures.vertex_shader_stage;
@@ -1299,8 +1222,7 @@ void HbaoContext::create_hbao_blur_2_pipeline(const pipeline_common_structures &
             VK_NULL_HANDLE,
             -1
     };
-    vkCreateGraphicsPipelines(device, VK_NULL_HANDLE, 1, &graphics_pipeline_create_info, nullptr, &stages[HBAO_BLUR_2].pipeline);
-    vkDestroyShaderModule(device, fragment_shader_module, nullptr);
+    vkCreateGraphicsPipelines(device, pipeline_cache->get(), 1, &graphics_pipeline_create_info, nullptr, &stages[HBAO_BLUR_2].pipeline);
 }
 
 void HbaoContext::create_hbao_device_buffer() {
@@ -1451,6 +1373,39 @@ void HbaoContext::init_resources() {
     create_image_views();
 }
 
+std::function<void()> HbaoContext::retire_screen_resources() {
+    std::vector<VkImage> images = {device_linearized_depth_image, device_view_space_normal_image, device_deinterleaved_depth_image,
+                                   device_hbao_calc_image, device_reinterleaved_hbao_image};
+    std::vector<VkImageView> image_views = {device_linearized_depth_image_view, device_view_space_normal_image_view,
+                                            device_deinterleaved_depth_16_layers_image_view, device_hbao_calc_16_layers_image_view};
+    image_views.insert(image_views.end(), device_deinterleaved_depth_image_views.begin(), device_deinterleaved_depth_image_views.end());
+    image_views.insert(image_views.end(), device_reinterleaved_hbao_image_view.begin(), device_reinterleaved_hbao_image_view.end());
+    std::vector<VkFramebuffer> framebuffers = {depth_linearize_framebuffer, view_normal_framebuffer, hbao_calc_framebuffer, reinterleave_framebuffer};
+    framebuffers.insert(framebuffers.end(), deinterleave_framebuffers.begin(), deinterleave_framebuffers.end());
+    framebuffers.insert(framebuffers.end(), hbao_blur_framebuffers.begin(), hbao_blur_framebuffers.end());
+
+    device_linearized_depth_image = device_view_space_normal_image = device_deinterleaved_depth_image = VK_NULL_HANDLE;
+    device_hbao_calc_image = device_reinterleaved_hbao_image = VK_NULL_HANDLE;
+    device_linearized_depth_image_view = device_view_space_normal_image_view = VK_NULL_HANDLE;
+    device_deinterleaved_depth_16_layers_image_view = device_hbao_calc_16_layers_image_view = VK_NULL_HANDLE;
+    device_deinterleaved_depth_image_views.fill(VK_NULL_HANDLE);
+    device_reinterleaved_hbao_image_view.fill(VK_NULL_HANDLE);
+    depth_linearize_framebuffer = view_normal_framebuffer = hbao_calc_framebuffer = reinterleave_framebuffer = VK_NULL_HANDLE;
+    deinterleave_framebuffers.fill(VK_NULL_HANDLE);
+    hbao_blur_framebuffers.fill(VK_NULL_HANDLE);
+    return [device = device, images, image_views, framebuffers]() {
+        for (auto& framebuffer : framebuffers) {
+            vkDestroyFramebuffer(device, framebuffer, nullptr);
+        }
+        for (auto& image_view : image_views) {
+            vkDestroyImageView(device, image_view, nullptr);
+        }
+        for (auto& image : images) {
+            vkDestroyImage(device, image, nullptr);
+        }
+    };
+}
+
 void HbaoContext::create_image_views() {
     VkImageViewCreateInfo image_view_create_info = {
         VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO,
@@ -1924,19 +1879,24 @@ void HbaoContext::allocate_descriptor_sets(VkDescriptorPool descriptor_pool, VkI
 }
 
 void HbaoContext::record_constants_update(VkCommandBuffer command_buffer) {
-    vkCmdUpdateBuffer(command_buffer, device_hbao_data_buffer, 0, sizeof(HbaoData), hbao_data.get());
-    // Transitioning layout from write to shader read
+    // The frames submitted before the update could still be reading the buffer
     VkBufferMemoryBarrier buffer_memory_barrier = {
             VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER,
             nullptr,
+            0,
             VK_ACCESS_TRANSFER_WRITE_BIT,
-            VK_ACCESS_UNIFORM_READ_BIT,
             VK_QUEUE_FAMILY_IGNORED,
             VK_QUEUE_FAMILY_IGNORED,
             device_hbao_data_buffer,
             0,
             VK_WHOLE_SIZE
     };
+    vkCmdPipelineBarrier(command_buffer, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 1, &buffer_memory_barrier, 0, nullptr);
+
+    vkCmdUpdateBuffer(command_buffer, device_hbao_data_buffer, 0, sizeof(HbaoData), hbao_data.get());
+    // Transitioning layout from write to shader read
+    buffer_memory_barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    buffer_memory_barrier.dstAccessMask = VK_ACCESS_UNIFORM_READ_BIT;
     vkCmdPipelineBarrier(command_buffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0, 0, nullptr, 1, &buffer_memory_barrier, 0, nullptr);
 }
 
@@ -1,26 +1,35 @@
 #ifndef THEVULKANTEMPLE_HBAO_CONTEXT_H
 #define THEVULKANTEMPLE_HBAO_CONTEXT_H
 #include "../../external/volk.h"
+#include "../../pipeline_cache.h"
 #include "../../vulkan_helper.h"
+#include "../../job_system.h"
 #include <string>
 #include <array>
 #include <utility>
 #include <unordered_map>
 #include <random>
 #include <memory>
+#include <functional>
 
 class HbaoContext {
     public:
-        HbaoContext(VkDevice device, VkPhysicalDeviceMemoryProperties memory_properties, VkExtent2D screen_res,
+        HbaoContext(VkDevice device, PipelineCache &pipeline_cache, VkPhysicalDeviceMemoryProperties memory_properties, VkExtent2D screen_res,
                     VkFormat depth_image_format, VkFormat out_ao_image_format, std::string shader_dir_path, bool generate_normals);
         ~HbaoContext();
 
+        // Submits the creation of every pipeline as a job of the counter, which must be waited before recording
+        void create_pipelines(JobSystem &job_system, JobSystem::Counter &counter);
+
         VkBuffer get_permanent_device_buffer();
         std::vector<VkImage> get_device_images();
         std::pair<std::unordered_map<VkDescriptorType, uint32_t>, uint32_t> get_required_descriptor_pool_size_and_sets();
 
         void create_resources(VkExtent2D screen_res);
         void init_resources();
+        // Hands over the screen sized resources, which the returned function destroys once the frames using them are done.
+        // The next create_resources() makes new ones instead of destroying them in place
+        std::function<void()> retire_screen_resources();
 
         void update_constants(glm::mat4 proj, float radius, float intensity, float bias, float blur_sharpness);
 
@@ -63,11 +72,14 @@ class HbaoContext {
             VkPipelineDepthStencilStateCreateInfo depth_stencil;
             VkPipelineColorBlendAttachmentState color_blend_attachment;
         };
+        pipeline_common_structures full_screen_pipeline_structures;
+        std::string shader_dir_path;
 
         std::mt19937 random_engine;
         std::uniform_real_distribution<float> distribution;
 
         VkDevice device;
+        PipelineCache *pipeline_cache = nullptr;
         VkExtent2D screen_extent;
         VkPhysicalDeviceMemoryProperties physical_device_memory_properties;
         bool generate_normals;
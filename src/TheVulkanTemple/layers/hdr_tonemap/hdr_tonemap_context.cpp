@@ -6,8 +6,9 @@
 #include "../../vulkan_helper.h"
 #include "../../external/volk.h"
 
-HDRTonemapContext::HDRTonemapContext(VkDevice device, VkFormat input_image_format, VkFormat global_ao_image_format, VkFormat out_format) {
+HDRTonemapContext::HDRTonemapContext(VkDevice device, PipelineCache &pipeline_cache, VkFormat input_image_format, VkFormat global_ao_image_format, VkFormat out_format) {
     this->device = device;
+    this->pipeline_cache = &pipeline_cache;
 
     std::array<VkAttachmentDescription, 3> attachment_descriptions {{
     {
@@ -118,23 +119,9 @@ void HDRTonemapContext::create_resources(VkExtent2D screen_res, std::string shad
     // We get the output images count in the resources method
     this->out_image_res = screen_res;
 
-    std::vector<uint8_t> shader_contents;
-    vulkan_helper::get_binary_file_content(shader_dir_path + "//tonemap.vert.spv", shader_contents);
-    VkShaderModuleCreateInfo shader_module_create_info = {
-            VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO,
-            nullptr,
-            0,
-            shader_contents.size(),
-            reinterpret_cast<uint32_t*>(shader_contents.data())
-    };
-    VkShaderModule vertex_shader_module;
-    check_error(vkCreateShaderModule(device, &shader_module_create_info, nullptr, &vertex_shader_module), vulkan_helper::Error::SHADER_MODULE_CREATION_FAILED);
+    VkShaderModule vertex_shader_module = pipeline_cache->get_shader_module(shader_dir_path + "//tonemap.vert.spv");
 
-    vulkan_helper::get_binary_file_content(shader_dir_path + "//tonemap.frag.spv", shader_contents);
-    shader_module_create_info.codeSize = shader_contents.size();
-    shader_module_create_info.pCode = reinterpret_cast<uint32_t*>(shader_contents.data());
-    VkShaderModule fragment_shader_module;
-    check_error(vkCreateShaderModule(device, &shader_module_create_info, nullptr, &fragment_shader_module), vulkan_helper::Error::SHADER_MODULE_CREATION_FAILED);
+    VkShaderModule fragment_shader_module = pipeline_cache->get_shader_module(shader_dir_path + "//tonemap.frag.spv");
 
     std::array<VkPipelineShaderStageCreateInfo, 2> pipeline_shaders_stage_create_info {{
     {
@@ -306,10 +293,24 @@ void HDRTonemapContext::create_resources(VkExtent2D screen_res, std::string shad
             -1
     };
     vkDestroyPipeline(device, hdr_tonemap_pipeline, nullptr);
-    vkCreateGraphicsPipelines(device, VK_NULL_HANDLE, 1, &graphics_pipeline_create_info, nullptr, &hdr_tonemap_pipeline);
+    vkCreateGraphicsPipelines(device, pipeline_cache->get(), 1, &graphics_pipeline_create_info, nullptr, &hdr_tonemap_pipeline);
+}
 
-    vkDestroyShaderModule(device, vertex_shader_module, nullptr);
-    vkDestroyShaderModule(device, fragment_shader_module, nullptr);
+std::function<void()> HDRTonemapContext::retire_screen_resources() {
+    // The pipeline is created with the resources, so it goes with them
+    std::vector<VkFramebuffer> framebuffers = std::move(hdr_tonemap_framebuffers);
+    VkPipelineLayout pipeline_layout = hdr_tonemap_pipeline_layout;
+    VkPipeline pipeline = hdr_tonemap_pipeline;
+    hdr_tonemap_framebuffers.clear();
+    hdr_tonemap_pipeline_layout = VK_NULL_HANDLE;
+    hdr_tonemap_pipeline = VK_NULL_HANDLE;
+    return [device = device, framebuffers, pipeline_layout, pipeline]() {
+        for (auto& framebuffer : framebuffers) {
+            vkDestroyFramebuffer(device, framebuffer, nullptr);
+        }
+        vkDestroyPipeline(device, pipeline, nullptr);
+        vkDestroyPipelineLayout(device, pipeline_layout, nullptr);
+    };
 }
 
 std::pair<std::unordered_map<VkDescriptorType, uint32_t>, uint32_t> HDRTonemapContext::get_required_descriptor_pool_size_and_sets() {
@@ -4,15 +4,20 @@
 #include <utility>
 #include <vector>
 #include <string>
+#include <functional>
 #include <unordered_map>
 #include "../../external/volk.h"
+#include "../../pipeline_cache.h"
 
 class HDRTonemapContext {
     public:
-        HDRTonemapContext(VkDevice device, VkFormat input_image_format, VkFormat global_ao_image_format, VkFormat out_format);
+        HDRTonemapContext(VkDevice device, PipelineCache &pipeline_cache, VkFormat input_image_format, VkFormat global_ao_image_format, VkFormat out_format);
         ~HDRTonemapContext();
 
         void create_resources(VkExtent2D screen_res, std::string shader_dir_path);
+        // Hands over the screen sized resources, which the returned function destroys once the frames using them are done.
+        // The next create_resources() and allocate_descriptor_sets() make new ones instead of destroying them in place
+        std::function<void()> retire_screen_resources();
 
         std::pair<std::unordered_map<VkDescriptorType, uint32_t>, uint32_t> get_required_descriptor_pool_size_and_sets();
 
@@ -20,6 +25,7 @@ class HDRTonemapContext {
         void record_into_command_buffer(VkCommandBuffer command_buffer, uint32_t out_image_index, VkExtent2D out_image_size);
     private:
         VkDevice device;
+        PipelineCache *pipeline_cache = nullptr;
         VkDescriptorSetLayout hdr_tonemap_set_layout;
 
         VkDescriptorSet hdr_tonemap_descriptor_set = VK_NULL_HANDLE;
@@ -1,8 +1,10 @@
 #include "pbr_context.h"
+#include "../../draw_list.h"
 
-PbrContext::PbrContext(VkDevice device, VkPhysicalDeviceMemoryProperties memory_properties, VkFormat out_depth_image_format,
+PbrContext::PbrContext(VkDevice device, PipelineCache &pipeline_cache, VkPhysicalDeviceMemoryProperties memory_properties, VkFormat out_depth_image_format,
                        VkFormat out_color_image_format, VkFormat out_normal_image_format) {
     this->device = device;
+    this->pipeline_cache = &pipeline_cache;
     this->physical_device_memory_properties = memory_properties;
     // Creating the renderpass with 3 outputs: depth, color and normal
     std::array<VkAttachmentDescription, 3> attachment_descriptions {{{
@@ -54,6 +56,27 @@ PbrContext::PbrContext(VkDevice device, VkPhysicalDeviceMemoryProperties memory_
         0,
         nullptr
     };
+    // The outputs are read by the shaders of the next passes, and the attachments can be written again by the load render pass
+    std::array<VkSubpassDependency, 2> subpass_dependencies {{
+        {
+            VK_SUBPASS_EXTERNAL,
+            0,
+            VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+            VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+            VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
+            VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT | VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
+            0
+        },
+        {
+            0,
+            VK_SUBPASS_EXTERNAL,
+            VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+            VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+            VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
+            VK_ACCESS_SHADER_READ_BIT,
+            0
+        }
+    }};
     VkRenderPassCreateInfo render_pass_create_info = {
         VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO,
         nullptr,
@@ -62,38 +85,66 @@ PbrContext::PbrContext(VkDevice device, VkPhysicalDeviceMemoryProperties memory_
         attachment_descriptions.data(),
         1,
         &subpass_description,
-        0,
-        nullptr
+        subpass_dependencies.size(),
+        subpass_dependencies.data()
     };
     check_error(vkCreateRenderPass(device, &render_pass_create_info, nullptr, &pbr_render_pass), vulkan_helper::Error::RENDER_PASS_CREATION_FAILED);
+
+    // The load render pass draws on top of what the first one has drawn, being compatible it uses the same framebuffer and pipeline
+    for (auto &attachment_description : attachment_descriptions) {
+        attachment_description.loadOp = VK_ATTACHMENT_LOAD_OP_LOAD;
+        attachment_description.initialLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+    }
+    check_error(vkCreateRenderPass(device, &render_pass_create_info, nullptr, &pbr_load_render_pass), vulkan_helper::Error::RENDER_PASS_CREATION_FAILED);
+
+    // After the depth pre-pass only the colors are cleared
+    for (uint32_t i=1; i<attachment_descriptions.size(); i++) {
+        attachment_descriptions[i].loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+        attachment_descriptions[i].initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    }
+    check_error(vkCreateRenderPass(device, &render_pass_create_info, nullptr, &pbr_after_depth_pre_pass_render_pass), vulkan_helper::Error::RENDER_PASS_CREATION_FAILED);
+
+    // The depth pre-pass writes only the depth, which is left in the same layout as after the pbr pass
+    attachment_descriptions[0].loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+    attachment_descriptions[0].initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    subpass_description.colorAttachmentCount = 0;
+    subpass_description.pColorAttachments = nullptr;
+    subpass_dependencies[0].srcStageMask = VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+    subpass_dependencies[0].dstStageMask = VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+    subpass_dependencies[0].srcAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+    subpass_dependencies[0].dstAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+    subpass_dependencies[1].srcStageMask = VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+    subpass_dependencies[1].dstStageMask = VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+    subpass_dependencies[1].srcAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+    subpass_dependencies[1].dstAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT;
+    render_pass_create_info.attachmentCount = 1;
+    check_error(vkCreateRenderPass(device, &render_pass_create_info, nullptr, &depth_pre_pass_render_pass), vulkan_helper::Error::RENDER_PASS_CREATION_FAILED);
+
+    attachment_descriptions[0].loadOp = VK_ATTACHMENT_LOAD_OP_LOAD;
+    attachment_descriptions[0].initialLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+    check_error(vkCreateRenderPass(device, &render_pass_create_info, nullptr, &depth_pre_pass_load_render_pass), vulkan_helper::Error::RENDER_PASS_CREATION_FAILED);
 }
 
 PbrContext::~PbrContext() {
     vkDestroyRenderPass(device, pbr_render_pass, nullptr);
+    vkDestroyRenderPass(device, pbr_load_render_pass, nullptr);
+    vkDestroyRenderPass(device, pbr_after_depth_pre_pass_render_pass, nullptr);
+    vkDestroyRenderPass(device, depth_pre_pass_render_pass, nullptr);
+    vkDestroyRenderPass(device, depth_pre_pass_load_render_pass, nullptr);
     vkDestroyPipelineLayout(device, pbr_pipeline_layout, nullptr);
     vkDestroyPipeline(device, pbr_pipeline, nullptr);
+    vkDestroyPipeline(device, depth_pre_pass_pipeline, nullptr);
     vkDestroyFramebuffer(device, pbr_framebuffer, nullptr);
+    vkDestroyFramebuffer(device, depth_pre_pass_framebuffer, nullptr);
 }
 
-void PbrContext::create_pipeline(std::string shader_dir_path, VkDescriptorSetLayout pbr_model_data_set_layout,
-                                     VkDescriptorSetLayout camera_data_set_layout, VkDescriptorSetLayout light_data_set_layout) {
-    std::vector<uint8_t> shader_contents;
-    vulkan_helper::get_binary_file_content(shader_dir_path + "//pbr.vert.spv", shader_contents);
-    VkShaderModuleCreateInfo shader_module_create_info = {
-            VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO,
-            nullptr,
-            0,
-            shader_contents.size(),
-            reinterpret_cast<uint32_t*>(shader_contents.data())
-    };
-    VkShaderModule vertex_shader_module;
-    check_error(vkCreateShaderModule(device, &shader_module_create_info, nullptr, &vertex_shader_module), vulkan_helper::Error::SHADER_MODULE_CREATION_FAILED);
+void PbrContext::create_pipeline(std::string shader_dir_path, VkDescriptorSetLayout materials_set_layout,
+                                     VkDescriptorSetLayout camera_data_set_layout, VkDescriptorSetLayout light_data_set_layout,
+                                     VkDescriptorSetLayout instance_data_set_layout, bool depth_pre_pass) {
+    this->depth_pre_pass = depth_pre_pass;
+    VkShaderModule vertex_shader_module = pipeline_cache->get_shader_module(shader_dir_path + "//pbr.vert.spv");
 
-    vulkan_helper::get_binary_file_content(shader_dir_path + "//pbr.frag.spv", shader_contents);
-    shader_module_create_info.codeSize = shader_contents.size();
-    shader_module_create_info.pCode = reinterpret_cast<uint32_t*>(shader_contents.data());
-    VkShaderModule fragment_shader_module;
-    check_error(vkCreateShaderModule(device, &shader_module_create_info, nullptr, &fragment_shader_module), vulkan_helper::Error::SHADER_MODULE_CREATION_FAILED);
+    VkShaderModule fragment_shader_module = pipeline_cache->get_shader_module(shader_dir_path + "//pbr.frag.spv");
 
     std::array<VkPipelineShaderStageCreateInfo, 2> pipeline_shaders_stage_create_info {{
         {
@@ -220,8 +271,8 @@ void PbrContext::create_pipeline(std::string shader_dir_path, VkDescriptorSetLay
             nullptr,
             0,
             VK_TRUE,
-            VK_TRUE,
-            VK_COMPARE_OP_LESS,
+            depth_pre_pass ? VK_FALSE : VK_TRUE,
+            depth_pre_pass ? VK_COMPARE_OP_EQUAL : VK_COMPARE_OP_LESS,
             VK_FALSE,
             VK_FALSE,
             {},
@@ -271,15 +322,21 @@ void PbrContext::create_pipeline(std::string shader_dir_path, VkDescriptorSetLay
             dynamic_states.data()
     };
 
-    std::array<VkDescriptorSetLayout,3> descriptor_set_layouts = {pbr_model_data_set_layout, light_data_set_layout, camera_data_set_layout};
+    std::array<VkDescriptorSetLayout,4> descriptor_set_layouts = {materials_set_layout, light_data_set_layout, camera_data_set_layout, instance_data_set_layout};
+    // The material index of the draw, or of the first draw of a multi draw
+    VkPushConstantRange push_constant_range = {
+            VK_SHADER_STAGE_VERTEX_BIT,
+            0,
+            sizeof(uint32_t)
+    };
     VkPipelineLayoutCreateInfo pipeline_layout_create_info = {
             VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
             nullptr,
             0,
             descriptor_set_layouts.size(),
             descriptor_set_layouts.data(),
-            0,
-            nullptr
+            1,
+            &push_constant_range
     };
     vkDestroyPipelineLayout(device, pbr_pipeline_layout, nullptr);
     vkCreatePipelineLayout(device, &pipeline_layout_create_info, nullptr, &pbr_pipeline_layout);
@@ -306,10 +363,23 @@ void PbrContext::create_pipeline(std::string shader_dir_path, VkDescriptorSetLay
             -1
     };
     vkDestroyPipeline(device, pbr_pipeline, nullptr);
-    vkCreateGraphicsPipelines(device, VK_NULL_HANDLE, 1, &graphics_pipeline_create_info, nullptr, &pbr_pipeline);
+    vkCreateGraphicsPipelines(device, pipeline_cache->get(), 1, &graphics_pipeline_create_info, nullptr, &pbr_pipeline);
 
-    vkDestroyShaderModule(device, vertex_shader_module, nullptr);
-    vkDestroyShaderModule(device, fragment_shader_module, nullptr);
+    vkDestroyPipeline(device, depth_pre_pass_pipeline, nullptr);
+    depth_pre_pass_pipeline = VK_NULL_HANDLE;
+    if (depth_pre_pass) {
+        // The pre-pass reads only the positions, with the same pipeline layout so that the draws are recorded in the same way
+        vertex_shader_module = pipeline_cache->get_shader_module(shader_dir_path + "//depth_pre_pass.vert.spv");
+        pipeline_shaders_stage_create_info[0].module = vertex_shader_module;
+        pipeline_vertex_input_state_create_info.vertexAttributeDescriptionCount = 1;
+        pipeline_depth_stencil_state_create_info.depthWriteEnable = VK_TRUE;
+        pipeline_depth_stencil_state_create_info.depthCompareOp = VK_COMPARE_OP_LESS;
+        pipeline_color_blend_state_create_info.attachmentCount = 0;
+        pipeline_color_blend_state_create_info.pAttachments = nullptr;
+        graphics_pipeline_create_info.stageCount = 1;
+        graphics_pipeline_create_info.renderPass = depth_pre_pass_render_pass;
+        vkCreateGraphicsPipelines(device, pipeline_cache->get(), 1, &graphics_pipeline_create_info, nullptr, &depth_pre_pass_pipeline);
+    }
 }
 
 void PbrContext::set_output_images(VkExtent2D screen_res, VkImageView out_depth_image, VkImageView out_color_image, VkImageView out_normal_image) {
@@ -328,27 +398,51 @@ void PbrContext::set_output_images(VkExtent2D screen_res, VkImageView out_depth_
     };
     vkDestroyFramebuffer(device, pbr_framebuffer, nullptr);
     check_error(vkCreateFramebuffer(device, &framebuffer_create_info, nullptr, &pbr_framebuffer), vulkan_helper::Error::FRAMEBUFFER_CREATION_FAILED);
+
+    framebuffer_create_info.renderPass = depth_pre_pass_render_pass;
+    framebuffer_create_info.attachmentCount = 1;
+    vkDestroyFramebuffer(device, depth_pre_pass_framebuffer, nullptr);
+    check_error(vkCreateFramebuffer(device, &framebuffer_create_info, nullptr, &depth_pre_pass_framebuffer), vulkan_helper::Error::FRAMEBUFFER_CREATION_FAILED);
 }
 
-void PbrContext::record_into_command_buffer(VkCommandBuffer command_buffer, VkDescriptorSet camera_descriptor_set, VkDescriptorSet light_descriptor_set,
-		const std::vector<VkModel> &vk_models, const Camera &camera) {
-    std::array<VkClearValue,3> clear_values;
-    clear_values[0].depthStencil = {1.0f, 0};
-    clear_values[1].color = {0.0f, 0.0f, 0.0f, 0.0f};
-    clear_values[2].color = {0.0f, 0.0f, 0.0f, 0.0f};
+std::function<void()> PbrContext::retire_output_images() {
+    std::array<VkFramebuffer, 2> framebuffers = {pbr_framebuffer, depth_pre_pass_framebuffer};
+    pbr_framebuffer = VK_NULL_HANDLE;
+    depth_pre_pass_framebuffer = VK_NULL_HANDLE;
+    return [device = device, framebuffers]() {
+        for (auto& framebuffer : framebuffers) {
+            vkDestroyFramebuffer(device, framebuffer, nullptr);
+        }
+    };
+}
 
-    VkRenderPassBeginInfo render_pass_begin_info = {
-            VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO,
+void PbrContext::record_draws(VkCommandBuffer secondary_command_buffer, VkDescriptorSet materials_descriptor_set, VkDescriptorSet camera_descriptor_set,
+		VkDescriptorSet light_descriptor_set, VkDescriptorSet instance_descriptor_set, std::span<const VkModel> vk_models, uint32_t first_model_index, const Camera &camera,
+		VkBuffer draw_commands_buffer, uint32_t first_primitive_index, bool depth_pre_pass_draws) {
+    // Every secondary command buffer draws a range of the models, so that the ranges can be recorded in parallel
+    VkCommandBufferInheritanceInfo command_buffer_inheritance_info = {
+            VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO,
             nullptr,
-            pbr_render_pass,
-            pbr_framebuffer,
-            {{0,0},{this->screen_res.width, this->screen_res.height}},
-            clear_values.size(),
-            clear_values.data()
+            depth_pre_pass_draws ? depth_pre_pass_render_pass : pbr_render_pass,
+            0,
+            depth_pre_pass_draws ? depth_pre_pass_framebuffer : pbr_framebuffer,
+            VK_FALSE,
+            0,
+            0
+    };
+    // With the gpu culling the draws are executed by both culling phases, reading the commands written by each
+    VkCommandBufferBeginInfo command_buffer_begin_info = {
+            VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+            nullptr,
+            VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT,
+            &command_buffer_inheritance_info
     };
-    vkCmdBeginRenderPass(command_buffer, &render_pass_begin_info, VK_SUBPASS_CONTENTS_INLINE);
+    if (draw_commands_buffer != VK_NULL_HANDLE) {
+        command_buffer_begin_info.flags |= VK_COMMAND_BUFFER_USAGE_SIMULTANEOUS_USE_BIT;
+    }
+    vkBeginCommandBuffer(secondary_command_buffer, &command_buffer_begin_info);
 
-    vkCmdBindPipeline(command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pbr_pipeline);
+    vkCmdBindPipeline(secondary_command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, depth_pre_pass_draws ? depth_pre_pass_pipeline : pbr_pipeline);
     VkViewport viewport = {
             0.0f,
             0.0f,
@@ -357,18 +451,79 @@ void PbrContext::record_into_command_buffer(VkCommandBuffer command_buffer, VkDe
             0.0f,
             1.0f
     };
-    vkCmdSetViewport(command_buffer, 0, 1, &viewport);
+    vkCmdSetViewport(secondary_command_buffer, 0, 1, &viewport);
 
     VkRect2D scissor = {
             {0,0},
             {screen_res.width, screen_res.height}
     };
-    vkCmdSetScissor(command_buffer, 0, 1, &scissor);
+    vkCmdSetScissor(secondary_command_buffer, 0, 1, &scissor);
+
+    // The sets are bound once, the models are selected with the instance index and their images with the material index
+    std::array<VkDescriptorSet, 4> to_bind = { materials_descriptor_set, light_descriptor_set, camera_descriptor_set, instance_descriptor_set };
+    vkCmdBindDescriptorSets(secondary_command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pbr_pipeline_layout, 0, to_bind.size(), to_bind.data(), 0, nullptr);
+    if (draw_commands_buffer != VK_NULL_HANDLE) {
+        std::vector<VkModel::draw_batch> batches = VkModel::get_draw_batches(vk_models);
+        VkModel::vk_record_batched_indirect_draws(secondary_command_buffer, batches, draw_commands_buffer, first_primitive_index * sizeof(VkDrawIndexedIndirectCommand),
+                                                  pbr_pipeline_layout, first_primitive_index);
+    }
+    else {
+        // The visible primitives are drawn front to back, so that the early depth test discards most of the hidden fragments
+        DrawList draw_list;
+        std::vector<uint32_t> first_material_indices(vk_models.size());
+        for (uint32_t j=0, material_index = first_primitive_index; j<vk_models.size(); j++) {
+            first_material_indices[j] = material_index;
+            for (uint32_t k=0; k<vk_models[j].get_primitives_count(); k++) {
+                if (vk_models[j].is_primitive_visible(k, camera.get_frustum())) {
+                    float depth = glm::dot(vk_models[j].get_primitive_center(k) - camera.get_pos(), camera.get_dir());
+                    draw_list.add((static_cast<uint64_t>(DrawList::get_depth_key(depth)) << 32) | (material_index + k), j, k);
+                }
+            }
+            material_index += vk_models[j].get_primitives_count();
+        }
+        draw_list.sort();
+
+        VkBuffer bound_buffer = VK_NULL_HANDLE;
+        VkIndexType bound_index_type = VK_INDEX_TYPE_MAX_ENUM;
+        for (const auto& draw : draw_list.get_draws()) {
+            vk_models[draw.model_index].vk_record_primitive_draw(secondary_command_buffer, draw.primitive_index, first_model_index + draw.model_index,
+                                                                 bound_buffer, bound_index_type, pbr_pipeline_layout,
+                                                                 first_material_indices[draw.model_index] + draw.primitive_index);
+        }
+    }
+    vkEndCommandBuffer(secondary_command_buffer);
+}
+
+void PbrContext::record_into_command_buffer(VkCommandBuffer command_buffer, const std::vector<VkCommandBuffer> &draws_command_buffers, bool load_attachments,
+                                            const std::vector<VkCommandBuffer> &depth_pre_pass_draws_command_buffers) {
+    std::array<VkClearValue,3> clear_values;
+    clear_values[0].depthStencil = {1.0f, 0};
+    clear_values[1].color = {0.0f, 0.0f, 0.0f, 0.0f};
+    clear_values[2].color = {0.0f, 0.0f, 0.0f, 0.0f};
+
+    VkRenderPassBeginInfo render_pass_begin_info = {
+            VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO,
+            nullptr,
+            load_attachments ? depth_pre_pass_load_render_pass : depth_pre_pass_render_pass,
+            depth_pre_pass_framebuffer,
+            {{0,0},{this->screen_res.width, this->screen_res.height}},
+            1,
+            clear_values.data()
+    };
+    if (depth_pre_pass) {
+        vkCmdBeginRenderPass(command_buffer, &render_pass_begin_info, VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS);
+        if (!depth_pre_pass_draws_command_buffers.empty()) {
+            vkCmdExecuteCommands(command_buffer, depth_pre_pass_draws_command_buffers.size(), depth_pre_pass_draws_command_buffers.data());
+        }
+        vkCmdEndRenderPass(command_buffer);
+    }
 
-    std::vector<VkDescriptorSet> to_bind = { light_descriptor_set, camera_descriptor_set };
-    for (uint32_t j=0; j<vk_models.size(); j++) {
-        vkCmdBindDescriptorSets(command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pbr_pipeline_layout, 1, to_bind.size(), to_bind.data(), 0, nullptr);
-        vk_models[j].vk_record_draw(command_buffer, pbr_pipeline_layout, 0, &camera);
+    render_pass_begin_info.renderPass = load_attachments ? pbr_load_render_pass : (depth_pre_pass ? pbr_after_depth_pre_pass_render_pass : pbr_render_pass);
+    render_pass_begin_info.framebuffer = pbr_framebuffer;
+    render_pass_begin_info.clearValueCount = clear_values.size();
+    vkCmdBeginRenderPass(command_buffer, &render_pass_begin_info, VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS);
+    if (!draws_command_buffers.empty()) {
+        vkCmdExecuteCommands(command_buffer, draws_command_buffers.size(), draws_command_buffers.data());
     }
     vkCmdEndRenderPass(command_buffer);
 }
@@ -1,35 +1,64 @@
 #ifndef THEVULKANTEMPLE_PBR_CONTEXT_H
 #define THEVULKANTEMPLE_PBR_CONTEXT_H
 
+#include <span>
+#include <functional>
 #include "../../external/volk.h"
+#include "../../pipeline_cache.h"
 #include "../../camera.h"
 #include "../../vulkan_helper.h"
 #include "../../gltf_model.h"
 
 class PbrContext {
     public:
-        PbrContext(VkDevice device, VkPhysicalDeviceMemoryProperties memory_properties, VkFormat out_depth_image_format,
+        PbrContext(VkDevice device, PipelineCache &pipeline_cache, VkPhysicalDeviceMemoryProperties memory_properties, VkFormat out_depth_image_format,
                    VkFormat out_color_image_format, VkFormat out_normal_image_format);
         ~PbrContext();
 
-        void create_pipeline(std::string shader_dir_path, VkDescriptorSetLayout pbr_model_data_set_layout,
-                             VkDescriptorSetLayout camera_data_set_layout, VkDescriptorSetLayout light_data_set_layout);
+        // The materials set has the images of every primitive in one array, indexed by the global index of the primitive.
+        // With the depth pre-pass the depth is first written by a position only pipeline, then the pbr pipeline shades only
+        // the fragments with the same depth, so that every pixel is shaded once
+        void create_pipeline(std::string shader_dir_path, VkDescriptorSetLayout materials_set_layout,
+                             VkDescriptorSetLayout camera_data_set_layout, VkDescriptorSetLayout light_data_set_layout,
+                             VkDescriptorSetLayout instance_data_set_layout, bool depth_pre_pass = false);
 
         void set_output_images(VkExtent2D screen_res, VkImageView out_depth_image, VkImageView out_color_image, VkImageView out_normal_image);
-        void record_into_command_buffer(VkCommandBuffer command_buffer, VkDescriptorSet camera_descriptor_set, VkDescriptorSet light_descriptor_set,
-				const std::vector<VkModel> &vk_models, const Camera &camera);
+        // Hands over the framebuffers of the output images, which the returned function destroys once the frames using them are
+        // done. The next set_output_images() makes new ones instead of destroying them in place
+        std::function<void()> retire_output_images();
+        // Records the draws of a range of models into a secondary command buffer, the buffers of all the ranges are then passed to record_into_command_buffer.
+        // first_model_index is the index of the first model of the range in the instance data, first_primitive_index the index of its first
+        // primitive in the materials. With a draw commands buffer the primitives are culled on the gpu, so their draws are read from it
+        // starting from the command of first_primitive_index
+        void record_draws(VkCommandBuffer secondary_command_buffer, VkDescriptorSet materials_descriptor_set, VkDescriptorSet camera_descriptor_set,
+				VkDescriptorSet light_descriptor_set, VkDescriptorSet instance_descriptor_set, std::span<const VkModel> vk_models, uint32_t first_model_index, const Camera &camera,
+				VkBuffer draw_commands_buffer = VK_NULL_HANDLE, uint32_t first_primitive_index = 0, bool depth_pre_pass_draws = false);
+        // With load_attachments the draws are added to the outputs of the last recording instead of clearing them. With the depth
+        // pre-pass the draws recorded with depth_pre_pass_draws are executed before, in their own render pass
+        void record_into_command_buffer(VkCommandBuffer command_buffer, const std::vector<VkCommandBuffer> &draws_command_buffers, bool load_attachments = false,
+                                        const std::vector<VkCommandBuffer> &depth_pre_pass_draws_command_buffers = {});
+        bool has_depth_pre_pass() { return depth_pre_pass; };
 
     private:
         VkDevice device = VK_NULL_HANDLE;
+        PipelineCache *pipeline_cache = nullptr;
         VkPhysicalDeviceMemoryProperties physical_device_memory_properties;
         VkRenderPass pbr_render_pass = VK_NULL_HANDLE;
+        VkRenderPass pbr_load_render_pass = VK_NULL_HANDLE;
+        // Loads the depth of the pre-pass and clears the colors
+        VkRenderPass pbr_after_depth_pre_pass_render_pass = VK_NULL_HANDLE;
+        VkRenderPass depth_pre_pass_render_pass = VK_NULL_HANDLE;
+        VkRenderPass depth_pre_pass_load_render_pass = VK_NULL_HANDLE;
 
         VkPipelineLayout pbr_pipeline_layout = VK_NULL_HANDLE;
         VkPipeline pbr_pipeline = VK_NULL_HANDLE;
+        bool depth_pre_pass = false;
+        VkPipeline depth_pre_pass_pipeline = VK_NULL_HANDLE;
 
         //default value set for creating the dynamic pipeline and then set in set_output_images
         VkExtent2D screen_res = {500, 500};
         VkFramebuffer pbr_framebuffer = VK_NULL_HANDLE;
+        VkFramebuffer depth_pre_pass_framebuffer = VK_NULL_HANDLE;
 };
 
 
@@ -3,9 +3,10 @@
 #include "../../external/volk.h"
 #include "../../vulkan_helper.h"
 
-SmaaContext::SmaaContext(VkDevice device, VkFormat out_image_format, std::string shader_dir_path,
+SmaaContext::SmaaContext(VkDevice device, PipelineCache &pipeline_cache, VkFormat out_image_format, std::string shader_dir_path,
                          std::string resource_images_dir_path, const VkPhysicalDeviceMemoryProperties &memory_properties) {
     this->device = device;
+    this->pipeline_cache = &pipeline_cache;
 
     // Sampler we will use with the smaa images
     VkSamplerCreateInfo sampler_create_info = {
@@ -219,8 +220,8 @@ SmaaContext::SmaaContext(VkDevice device, VkFormat out_image_format, std::string
     };
     vkCreateRenderPass(device, &render_pass_create_info, nullptr, &render_passes[2]);
 
-    // filling the structure that contains all the common pipeline structures
-    pipeline_common_structures common_structures;
+    // filling the structure that contains all the common pipeline structures, kept for create_pipelines
+    this->shader_dir_path = shader_dir_path;
     common_structures.vertex_input = {
             VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO,
             nullptr,
@@ -321,10 +322,6 @@ SmaaContext::SmaaContext(VkDevice device, VkFormat out_image_format, std::string
             common_structures.dynamic_states.data()
     };
 
-    create_edge_pipeline(common_structures, shader_dir_path);
-    create_weight_pipeline(common_structures, shader_dir_path);
-    create_blend_pipeline(common_structures, shader_dir_path);
-
     // reading the resources images from the disk and uploading them to a host buffer
     this->load_resource_images_to_host_memory(resource_images_dir_path, memory_properties);
 
@@ -354,24 +351,23 @@ SmaaContext::SmaaContext(VkDevice device, VkFormat out_image_format, std::string
     check_error(vkCreateImage(device, &image_create_info, nullptr, &device_smaa_search_image), vulkan_helper::Error::IMAGE_CREATION_FAILED);
 }
 
+void SmaaContext::create_pipelines(JobSystem &job_system, JobSystem::Counter &counter) {
+    // The pipelines only read the common structures, so they can be created in parallel
+    job_system.submit(counter, "create_smaa_pipeline", [this]() {
+        create_edge_pipeline(common_structures, shader_dir_path);
+    });
+    job_system.submit(counter, "create_smaa_pipeline", [this]() {
+        create_weight_pipeline(common_structures, shader_dir_path);
+    });
+    job_system.submit(counter, "create_smaa_pipeline", [this]() {
+        create_blend_pipeline(common_structures, shader_dir_path);
+    });
+}
+
 void SmaaContext::create_edge_pipeline(const pipeline_common_structures &common_structures, std::string shader_dir_path) {
-    std::vector<uint8_t> shader_contents;
-    vulkan_helper::get_binary_file_content(shader_dir_path + "//smaa_edge.vert.spv", shader_contents);
-    VkShaderModuleCreateInfo shader_module_create_info = {
-            VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO,
-            nullptr,
-            0,
-            shader_contents.size(),
-            reinterpret_cast<uint32_t*>(shader_contents.data())
-    };
-    VkShaderModule vertex_shader_module;
-    check_error(vkCreateShaderModule(device, &shader_module_create_info, nullptr, &vertex_shader_module), vulkan_helper::Error::SHADER_MODULE_CREATION_FAILED );
+    VkShaderModule vertex_shader_module = pipeline_cache->get_shader_module(shader_dir_path + "//smaa_edge.vert.spv");
 
-    vulkan_helper::get_binary_file_content(shader_dir_path + "//smaa_edge.frag.spv", shader_contents);
-    shader_module_create_info.codeSize = shader_contents.size();
-    shader_module_create_info.pCode = reinterpret_cast<uint32_t*>(shader_contents.data());
-    VkShaderModule fragment_shader_module;
-    check_error(vkCreateShaderModule(device, &shader_module_create_info, nullptr, &fragment_shader_module), vulkan_helper::Error::SHADER_MODULE_CREATION_FAILED );
+    VkShaderModule fragment_shader_module = pipeline_cache->get_shader_module(shader_dir_path + "//smaa_edge.frag.spv");
 
     std::array<VkPipelineShaderStageCreateInfo, 2> pipeline_shaders_stage_create_info {{
         {
@@ -443,29 +439,13 @@ void SmaaContext::create_edge_pipeline(const pipeline_common_structures &common_
             -1
     };
     vkDestroyPipeline(device, smaa_pipelines[0], nullptr);
-    vkCreateGraphicsPipelines(device, VK_NULL_HANDLE, 1, &graphics_pipeline_create_info, nullptr, &smaa_pipelines[0]);
-    vkDestroyShaderModule(device, vertex_shader_module, nullptr);
-    vkDestroyShaderModule(device, fragment_shader_module, nullptr);
+    vkCreateGraphicsPipelines(device, pipeline_cache->get(), 1, &graphics_pipeline_create_info, nullptr, &smaa_pipelines[0]);
 }
 
 void SmaaContext::create_weight_pipeline(const pipeline_common_structures &common_structures, std::string shader_dir_path) {
-    std::vector<uint8_t> shader_contents;
-    vulkan_helper::get_binary_file_content(shader_dir_path + "//smaa_weight.vert.spv", shader_contents);
-    VkShaderModuleCreateInfo shader_module_create_info = {
-            VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO,
-            nullptr,
-            0,
-            shader_contents.size(),
-            reinterpret_cast<uint32_t*>(shader_contents.data())
-    };
-    VkShaderModule vertex_shader_module;
-    check_error(vkCreateShaderModule(device, &shader_module_create_info, nullptr, &vertex_shader_module), vulkan_helper::Error::SHADER_MODULE_CREATION_FAILED);
+    VkShaderModule vertex_shader_module = pipeline_cache->get_shader_module(shader_dir_path + "//smaa_weight.vert.spv");
 
-    vulkan_helper::get_binary_file_content(shader_dir_path + "//smaa_weight.frag.spv", shader_contents);
-    shader_module_create_info.codeSize = shader_contents.size();
-    shader_module_create_info.pCode = reinterpret_cast<uint32_t*>(shader_contents.data());
-    VkShaderModule fragment_shader_module;
-    check_error(vkCreateShaderModule(device, &shader_module_create_info, nullptr, &fragment_shader_module), vulkan_helper::Error::SHADER_MODULE_CREATION_FAILED);
+    VkShaderModule fragment_shader_module = pipeline_cache->get_shader_module(shader_dir_path + "//smaa_weight.frag.spv");
 
     std::array<VkPipelineShaderStageCreateInfo, 2> pipeline_shaders_stage_create_info {{
         {
@@ -537,30 +517,13 @@ void SmaaContext::create_weight_pipeline(const pipeline_common_structures &commo
             -1
     };
     vkDestroyPipeline(device, smaa_pipelines[1], nullptr);
-    vkCreateGraphicsPipelines(device, VK_NULL_HANDLE, 1, &graphics_pipeline_create_info, nullptr, &smaa_pipelines[1]);
-
-    vkDestroyShaderModule(device, vertex_shader_module, nullptr);
-    vkDestroyShaderModule(device, fragment_shader_module, nullptr);
+    vkCreateGraphicsPipelines(device, pipeline_cache->get(), 1, &graphics_pipeline_create_info, nullptr, &smaa_pipelines[1]);
 }
 
 void SmaaContext::create_blend_pipeline(const pipeline_common_structures &common_structures, std::string shader_dir_path) {
-    std::vector<uint8_t> shader_contents;
-    vulkan_helper::get_binary_file_content(shader_dir_path + "//smaa_blend.vert.spv", shader_contents);
-    VkShaderModuleCreateInfo shader_module_create_info = {
-            VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO,
-            nullptr,
-            0,
-            shader_contents.size(),
-            reinterpret_cast<uint32_t*>(shader_contents.data())
-    };
-    VkShaderModule vertex_shader_module;
-    check_error(vkCreateShaderModule(device, &shader_module_create_info, nullptr, &vertex_shader_module), vulkan_helper::Error::SHADER_MODULE_CREATION_FAILED);
+    VkShaderModule vertex_shader_module = pipeline_cache->get_shader_module(shader_dir_path + "//smaa_blend.vert.spv");
 
-    vulkan_helper::get_binary_file_content(shader_dir_path + "//smaa_blend.frag.spv", shader_contents);
-    shader_module_create_info.codeSize = shader_contents.size();
-    shader_module_create_info.pCode = reinterpret_cast<uint32_t*>(shader_contents.data());
-    VkShaderModule fragment_shader_module;
-    check_error(vkCreateShaderModule(device, &shader_module_create_info, nullptr, &fragment_shader_module), vulkan_helper::Error::SHADER_MODULE_CREATION_FAILED);
+    VkShaderModule fragment_shader_module = pipeline_cache->get_shader_module(shader_dir_path + "//smaa_blend.frag.spv");
 
     std::array<VkPipelineShaderStageCreateInfo, 2> pipeline_shaders_stage_create_info {{
         {
@@ -632,10 +595,7 @@ void SmaaContext::create_blend_pipeline(const pipeline_common_structures &common
             -1
     };
     vkDestroyPipeline(device, smaa_pipelines[2], nullptr);
-    vkCreateGraphicsPipelines(device, VK_NULL_HANDLE, 1, &graphics_pipeline_create_info, nullptr, &smaa_pipelines[2]);
-
-    vkDestroyShaderModule(device, vertex_shader_module, nullptr);
-    vkDestroyShaderModule(device, fragment_shader_module, nullptr);
+    vkCreateGraphicsPipelines(device, pipeline_cache->get(), 1, &graphics_pipeline_create_info, nullptr, &smaa_pipelines[2]);
 }
 
 void SmaaContext::load_resource_images_to_host_memory(std::string resource_images_dir_path, const VkPhysicalDeviceMemoryProperties &memory_properties) {
@@ -923,6 +883,26 @@ void SmaaContext::init_resources(VkImageView out_image_view) {
     create_framebuffers(out_image_view);
 }
 
+std::function<void()> SmaaContext::retire_screen_resources() {
+    std::array<VkImage, 2> images = {device_smaa_stencil_image, device_smaa_data_image};
+    std::array<VkImageView, 3> image_views = {device_smaa_stencil_image_view, device_smaa_data_edge_image_view, device_smaa_data_weight_image_view};
+    std::array<VkFramebuffer, 3> retired_framebuffers = framebuffers;
+    device_smaa_stencil_image = device_smaa_data_image = VK_NULL_HANDLE;
+    device_smaa_stencil_image_view = device_smaa_data_edge_image_view = device_smaa_data_weight_image_view = VK_NULL_HANDLE;
+    framebuffers.fill(VK_NULL_HANDLE);
+    return [device = device, images, image_views, retired_framebuffers]() {
+        for (auto& framebuffer : retired_framebuffers) {
+            vkDestroyFramebuffer(device, framebuffer, nullptr);
+        }
+        for (auto& image_view : image_views) {
+            vkDestroyImageView(device, image_view, nullptr);
+        }
+        for (auto& image : images) {
+            vkDestroyImage(device, image, nullptr);
+        }
+    };
+}
+
 void SmaaContext::allocate_descriptor_sets(VkDescriptorPool descriptor_pool, VkImageView input_image_view) {
     VkDescriptorSetAllocateInfo descriptor_set_allocate_info = {
             VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO,
@@ -1,23 +1,31 @@
 #ifndef BASE_VULKAN_APP_SMAA_CONTEXT_H
 #define BASE_VULKAN_APP_SMAA_CONTEXT_H
 #include "../../external/volk.h"
+#include "../../pipeline_cache.h"
+#include "../../job_system.h"
 #include <array>
+#include <functional>
 #include <string>
 #include <unordered_map>
 
 class SmaaContext {
     public:
-        SmaaContext(VkDevice device, VkFormat out_image_format, std::string shader_dir_path, std::string resource_images_dir_path, const VkPhysicalDeviceMemoryProperties &memory_properties);
+        SmaaContext(VkDevice device, PipelineCache &pipeline_cache, VkFormat out_image_format, std::string shader_dir_path, std::string resource_images_dir_path, const VkPhysicalDeviceMemoryProperties &memory_properties);
         std::array<VkImage, 2> get_permanent_device_images();
         void record_permanent_resources_copy_to_device_memory(VkCommandBuffer cb);
         void clean_copy_resources();
         ~SmaaContext();
+        // Submits the creation of every pipeline as a job of the counter, which must be waited before recording
+        void create_pipelines(JobSystem &job_system, JobSystem::Counter &counter);
 
         std::array<VkImage, 2> get_device_images();
         std::pair<std::unordered_map<VkDescriptorType, uint32_t>, uint32_t> get_required_descriptor_pool_size_and_sets();
 
         void create_resources(VkExtent2D screen_res);
         void init_resources(VkImageView out_image_view);
+        // Hands over the screen sized resources, which the returned function destroys once the frames using them are done.
+        // The next create_resources() makes new ones instead of destroying them in place
+        std::function<void()> retire_screen_resources();
 
         void allocate_descriptor_sets(VkDescriptorPool descriptor_pool, VkImageView input_image_view);
 
@@ -25,6 +33,7 @@ class SmaaContext {
 
     private:
         VkDevice device = VK_NULL_HANDLE;
+        PipelineCache *pipeline_cache = nullptr;
         VkSampler device_render_target_sampler = VK_NULL_HANDLE;
         std::array<VkDescriptorSetLayout, 3> smaa_descriptor_sets_layout = {VK_NULL_HANDLE, VK_NULL_HANDLE, VK_NULL_HANDLE};
         std::array<VkRenderPass, 3> render_passes = {VK_NULL_HANDLE, VK_NULL_HANDLE, VK_NULL_HANDLE};
@@ -42,6 +51,9 @@ class SmaaContext {
             std::array<VkDynamicState,2> dynamic_states;
             VkPipelineDynamicStateCreateInfo pipeline_dynamic_state_create_info;
         };
+        // Filled in place since it points to itself
+        pipeline_common_structures common_structures;
+        std::string shader_dir_path;
         VkExtent3D screen_extent;
 
         uint64_t area_tex_size, search_tex_size;
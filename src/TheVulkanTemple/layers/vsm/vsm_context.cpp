@@ -1,12 +1,17 @@
 #include "vsm_context.h"
 #include "../../vulkan_helper.h"
 #include "../../gltf_model.h"
+#include "../../draw_list.h"
 #include <unordered_map>
 #include <utility>
 #include <iostream>
+#include <algorithm>
+#include <functional>
+#include <limits>
 
-VSMContext::VSMContext(VkDevice device, std::string shader_dir_path) {
+VSMContext::VSMContext(VkDevice device, PipelineCache &pipeline_cache, std::string shader_dir_path) {
     this->device = device;
+    this->pipeline_cache = &pipeline_cache;
     this->shader_dir_path = shader_dir_path;
 
     // Creation of the sampler used to sample from the vsm images
@@ -110,6 +115,22 @@ VSMContext::VSMContext(VkDevice device, std::string shader_dir_path) {
             nullptr
     };
     check_error(vkCreateRenderPass(device, &render_pass_create_info, nullptr, &shadow_map_render_pass), vulkan_helper::Error::RENDER_PASS_CREATION_FAILED);
+
+    // The static casters are stored and left ready to be copied in the shadow map
+    attachment_descriptions[0].storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+    attachment_descriptions[0].finalLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+    attachment_descriptions[1].finalLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+    check_error(vkCreateRenderPass(device, &render_pass_create_info, nullptr, &static_casters_render_pass), vulkan_helper::Error::RENDER_PASS_CREATION_FAILED);
+
+    // The dynamic casters are drawn over the copied static ones, and the shadow map ends as with the first render pass
+    attachment_descriptions[0].loadOp = VK_ATTACHMENT_LOAD_OP_LOAD;
+    attachment_descriptions[0].storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+    attachment_descriptions[0].initialLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+    attachment_descriptions[0].finalLayout = VK_IMAGE_LAYOUT_DEPTH_READ_ONLY_STENCIL_ATTACHMENT_OPTIMAL;
+    attachment_descriptions[1].loadOp = VK_ATTACHMENT_LOAD_OP_LOAD;
+    attachment_descriptions[1].initialLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+    attachment_descriptions[1].finalLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+    check_error(vkCreateRenderPass(device, &render_pass_create_info, nullptr, &dynamic_casters_render_pass), vulkan_helper::Error::RENDER_PASS_CREATION_FAILED);
 }
 
 VSMContext::~VSMContext() {
@@ -125,28 +146,48 @@ VSMContext::~VSMContext() {
 
     for (auto& light_vsm : lights_vsm) {
         vkDestroyFramebuffer(device, light_vsm.framebuffer, nullptr);
+        vkDestroyFramebuffer(device, light_vsm.static_framebuffer, nullptr);
     }
     vkDestroyRenderPass(device, shadow_map_render_pass, nullptr);
+    vkDestroyRenderPass(device, static_casters_render_pass, nullptr);
+    vkDestroyRenderPass(device, dynamic_casters_render_pass, nullptr);
     vkDestroyDescriptorSetLayout(device, vsm_descriptor_set_layout, nullptr);
     vkDestroySampler(device, device_render_target_sampler, nullptr);
 
     for (auto& light_vsm : lights_vsm) {
-        vkDestroyImageView(device, light_vsm.device_vsm_depth_image_views[0], nullptr);
-        vkDestroyImageView(device, light_vsm.device_vsm_depth_image_views[1], nullptr);
+        for (auto& image_view : light_vsm.device_vsm_depth_image_views) {
+            vkDestroyImageView(device, image_view, nullptr);
+        }
         vkDestroyImage(device, light_vsm.device_vsm_depth_image, nullptr);
 
         vkDestroyImageView(device, light_vsm.device_light_depth_image_view, nullptr);
         vkDestroyImage(device, light_vsm.device_light_depth_image, nullptr);
+
+        vkDestroyImageView(device, light_vsm.device_static_light_depth_image_view, nullptr);
+        vkDestroyImage(device, light_vsm.device_static_light_depth_image, nullptr);
     }
 }
 
 void VSMContext::create_resources(std::vector<VkExtent2D> depth_images_res, std::vector<uint32_t> ssbo_indices,
-                                  VkDescriptorSetLayout pbr_model_set_layout, VkDescriptorSetLayout light_set_layout) {
+                                  VkDescriptorSetLayout instance_set_layout, VkDescriptorSetLayout light_set_layout, bool cache_static_casters) {
+    // Every old light is destroyed, including the ones that are not there anymore, and the new ones start from scratch
     for (auto& light_vsm : lights_vsm) {
+        vkDestroyFramebuffer(device, light_vsm.framebuffer, nullptr);
+        vkDestroyFramebuffer(device, light_vsm.static_framebuffer, nullptr);
+        for (auto& image_view : light_vsm.device_vsm_depth_image_views) {
+            vkDestroyImageView(device, image_view, nullptr);
+        }
+        vkDestroyImageView(device, light_vsm.device_light_depth_image_view, nullptr);
+        vkDestroyImageView(device, light_vsm.device_static_light_depth_image_view, nullptr);
         vkDestroyImage(device, light_vsm.device_vsm_depth_image, nullptr);
         vkDestroyImage(device, light_vsm.device_light_depth_image, nullptr);
+        vkDestroyImage(device, light_vsm.device_static_light_depth_image, nullptr);
     }
+    lights_vsm.clear();
     lights_vsm.resize(depth_images_res.size());
+    this->cache_static_casters = cache_static_casters;
+    // The cache is copied to the shadow map, which needs a third layer to keep the static casters
+    VkImageUsageFlags transfer_usage = cache_static_casters ? VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT : 0;
 
     // We create two vsm depth images for every light
     for (uint32_t i=0; i < lights_vsm.size(); i++) {
@@ -161,10 +202,10 @@ void VSMContext::create_resources(std::vector<VkExtent2D> depth_images_res, std:
                 VK_FORMAT_R32G32_SFLOAT,
                 {lights_vsm[i].depth_image_res.width, lights_vsm[i].depth_image_res.height, 1},
                 1,
-                2,
+                cache_static_casters ? 3u : 2u,
                 VK_SAMPLE_COUNT_1_BIT,
                 VK_IMAGE_TILING_OPTIMAL,
-                VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_STORAGE_BIT,
+                VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_STORAGE_BIT | transfer_usage,
                 VK_SHARING_MODE_EXCLUSIVE,
                 0,
                 nullptr,
@@ -174,35 +215,26 @@ void VSMContext::create_resources(std::vector<VkExtent2D> depth_images_res, std:
 
         image_create_info.format = VK_FORMAT_D32_SFLOAT;
         image_create_info.arrayLayers = 1;
-        image_create_info.usage = VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT;
+        image_create_info.usage = VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT | (transfer_usage & VK_IMAGE_USAGE_TRANSFER_DST_BIT);
         check_error(vkCreateImage(device, &image_create_info, nullptr, &lights_vsm[i].device_light_depth_image), vulkan_helper::Error::IMAGE_CREATION_FAILED);
+
+        if (cache_static_casters) {
+            image_create_info.usage = VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+            check_error(vkCreateImage(device, &image_create_info, nullptr, &lights_vsm[i].device_static_light_depth_image), vulkan_helper::Error::IMAGE_CREATION_FAILED);
+        }
     }
 
-    create_shadow_map_pipeline(pbr_model_set_layout, light_set_layout);
+    create_shadow_map_pipeline(instance_set_layout, light_set_layout);
 
     if (gaussian_blur_xy_pipelines[0] == VK_NULL_HANDLE || gaussian_blur_xy_pipelines[1] == VK_NULL_HANDLE) {
         create_gaussian_blur_pipelines(shader_dir_path);
     }
 }
 
-void VSMContext::create_shadow_map_pipeline(VkDescriptorSetLayout pbr_model_set_layout, VkDescriptorSetLayout light_set_layout) {
-    std::vector<uint8_t> shader_contents;
-    vulkan_helper::get_binary_file_content(shader_dir_path + "//shadow_map.vert.spv", shader_contents);
-    VkShaderModuleCreateInfo shader_module_create_info = {
-            VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO,
-            nullptr,
-            0,
-            shader_contents.size(),
-            reinterpret_cast<uint32_t*>(shader_contents.data())
-    };
-    VkShaderModule vertex_shader_module;
-    check_error(vkCreateShaderModule(device, &shader_module_create_info, nullptr, &vertex_shader_module), vulkan_helper::Error::SHADER_MODULE_CREATION_FAILED);
+void VSMContext::create_shadow_map_pipeline(VkDescriptorSetLayout instance_set_layout, VkDescriptorSetLayout light_set_layout) {
+    VkShaderModule vertex_shader_module = pipeline_cache->get_shader_module(shader_dir_path + "//shadow_map.vert.spv");
 
-    vulkan_helper::get_binary_file_content(shader_dir_path + "//shadow_map.frag.spv", shader_contents);
-    shader_module_create_info.codeSize = shader_contents.size();
-    shader_module_create_info.pCode = reinterpret_cast<uint32_t*>(shader_contents.data());
-    VkShaderModule fragment_shader_module;
-    check_error(vkCreateShaderModule(device, &shader_module_create_info, nullptr, &fragment_shader_module), vulkan_helper::Error::SHADER_MODULE_CREATION_FAILED);
+    VkShaderModule fragment_shader_module = pipeline_cache->get_shader_module(shader_dir_path + "//shadow_map.frag.spv");
 
     std::array<VkPipelineShaderStageCreateInfo,2> pipeline_shaders_stage_create_infos {{
         {
@@ -376,7 +408,7 @@ void VSMContext::create_shadow_map_pipeline(VkDescriptorSetLayout pbr_model_set_
         0,
         sizeof(uint32_t)
     };
-    std::array<VkDescriptorSetLayout,2> descriptor_set_layouts = { pbr_model_set_layout, light_set_layout};
+    std::array<VkDescriptorSetLayout,2> descriptor_set_layouts = { instance_set_layout, light_set_layout};
     VkPipelineLayoutCreateInfo pipeline_layout_create_info = {
             VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
             nullptr,
@@ -411,29 +443,14 @@ void VSMContext::create_shadow_map_pipeline(VkDescriptorSetLayout pbr_model_set_
             -1
     };
     vkDestroyPipeline(device, shadow_map_pipeline, nullptr);
-    vkCreateGraphicsPipelines(device, VK_NULL_HANDLE, 1, &graphics_pipeline_create_info, nullptr, &shadow_map_pipeline);
-
-    vkDestroyShaderModule(device, vertex_shader_module, nullptr);
-    vkDestroyShaderModule(device, fragment_shader_module, nullptr);
+    vkCreateGraphicsPipelines(device, pipeline_cache->get(), 1, &graphics_pipeline_create_info, nullptr, &shadow_map_pipeline);
 }
 
 void VSMContext::create_gaussian_blur_pipelines(std::string shader_dir_path) {
-    std::vector<uint8_t> shader_contents;
-    vulkan_helper::get_binary_file_content(shader_dir_path + "//gaussian_blur_x.comp.spv", shader_contents);
-    VkShaderModuleCreateInfo shader_module_create_info = {
-            VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO,
-            nullptr,
-            0,
-            shader_contents.size(),
-            reinterpret_cast<uint32_t*>(shader_contents.data())
+    std::array<VkShaderModule,2> shader_modules = {
+        pipeline_cache->get_shader_module(shader_dir_path + "//gaussian_blur_x.comp.spv"),
+        pipeline_cache->get_shader_module(shader_dir_path + "//gaussian_blur_y.comp.spv")
     };
-    std::array<VkShaderModule,2> shader_modules;
-    check_error(vkCreateShaderModule(device, &shader_module_create_info, nullptr, &shader_modules[0]), vulkan_helper::Error::SHADER_MODULE_CREATION_FAILED);
-
-    vulkan_helper::get_binary_file_content(shader_dir_path + "//gaussian_blur_y.comp.spv", shader_contents);
-    shader_module_create_info.codeSize = shader_contents.size();
-    shader_module_create_info.pCode = reinterpret_cast<uint32_t*>(shader_contents.data());
-    check_error(vkCreateShaderModule(device, &shader_module_create_info, nullptr, &shader_modules[1]), vulkan_helper::Error::SHADER_MODULE_CREATION_FAILED);
 
     std::array<VkPipelineShaderStageCreateInfo,2> pipeline_shaders_stage_create_infos {{
         {
@@ -489,19 +506,18 @@ void VSMContext::create_gaussian_blur_pipelines(std::string shader_dir_path) {
         }
     }};
 
-    vkCreateComputePipelines(device, VK_NULL_HANDLE, compute_pipeline_create_infos.size(), compute_pipeline_create_infos.data(), nullptr, gaussian_blur_xy_pipelines.data());
-
-    for (auto& shader_module : shader_modules) {
-        vkDestroyShaderModule(device, shader_module, nullptr);
-    }
+    vkCreateComputePipelines(device, pipeline_cache->get(), compute_pipeline_create_infos.size(), compute_pipeline_create_infos.data(), nullptr, gaussian_blur_xy_pipelines.data());
 }
 
 std::vector<VkImage> VSMContext::get_device_images() {
     std::vector<VkImage> out_images;
-    out_images.reserve(lights_vsm.size()*2);
+    out_images.reserve(lights_vsm.size()*3);
     for (const auto& light_vsm : lights_vsm) {
         out_images.push_back(light_vsm.device_vsm_depth_image);
         out_images.push_back(light_vsm.device_light_depth_image);
+        if (cache_static_casters) {
+            out_images.push_back(light_vsm.device_static_light_depth_image);
+        }
     }
     return out_images;
 }
@@ -515,9 +531,13 @@ std::pair<std::unordered_map<VkDescriptorType, uint32_t>, uint32_t> VSMContext::
 
 void VSMContext::create_image_views() {
     for (auto& light_vsm : lights_vsm) {
-        vkDestroyImageView(device, light_vsm.device_vsm_depth_image_views[0], nullptr);
-        vkDestroyImageView(device, light_vsm.device_vsm_depth_image_views[1], nullptr);
+        for (auto& image_view : light_vsm.device_vsm_depth_image_views) {
+            vkDestroyImageView(device, image_view, nullptr);
+            image_view = VK_NULL_HANDLE;
+        }
         vkDestroyImageView(device, light_vsm.device_light_depth_image_view, nullptr);
+        vkDestroyImageView(device, light_vsm.device_static_light_depth_image_view, nullptr);
+        light_vsm.device_static_light_depth_image_view = VK_NULL_HANDLE;
 
         VkImageViewCreateInfo image_view_create_info = {
                 VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO,
@@ -532,11 +552,19 @@ void VSMContext::create_image_views() {
         check_error(vkCreateImageView(device, &image_view_create_info, nullptr, &light_vsm.device_vsm_depth_image_views[0]), vulkan_helper::Error::IMAGE_VIEW_CREATION_FAILED);
         image_view_create_info.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 1, 1 };
         check_error(vkCreateImageView(device, &image_view_create_info, nullptr, &light_vsm.device_vsm_depth_image_views[1]), vulkan_helper::Error::IMAGE_VIEW_CREATION_FAILED);
+        if (cache_static_casters) {
+            image_view_create_info.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 2, 1 };
+            check_error(vkCreateImageView(device, &image_view_create_info, nullptr, &light_vsm.device_vsm_depth_image_views[2]), vulkan_helper::Error::IMAGE_VIEW_CREATION_FAILED);
+        }
 
         image_view_create_info.image = light_vsm.device_light_depth_image;
         image_view_create_info.format = VK_FORMAT_D32_SFLOAT;
         image_view_create_info.subresourceRange = {VK_IMAGE_ASPECT_DEPTH_BIT, 0, 1, 0, 1};
         check_error(vkCreateImageView(device, &image_view_create_info, nullptr, &light_vsm.device_light_depth_image_view), vulkan_helper::Error::IMAGE_VIEW_CREATION_FAILED);
+        if (cache_static_casters) {
+            image_view_create_info.image = light_vsm.device_static_light_depth_image;
+            check_error(vkCreateImageView(device, &image_view_create_info, nullptr, &light_vsm.device_static_light_depth_image_view), vulkan_helper::Error::IMAGE_VIEW_CREATION_FAILED);
+        }
     }
 }
 
@@ -557,6 +585,15 @@ void VSMContext::create_framebuffers() {
                 1
         };
         check_error(vkCreateFramebuffer(device, &framebuffer_create_info, nullptr, &light_vsm.framebuffer), vulkan_helper::Error::FRAMEBUFFER_CREATION_FAILED);
+
+        // The static casters are drawn in the cache with a compatible render pass
+        vkDestroyFramebuffer(device, light_vsm.static_framebuffer, nullptr);
+        light_vsm.static_framebuffer = VK_NULL_HANDLE;
+        if (cache_static_casters) {
+            attachments = {light_vsm.device_static_light_depth_image_view, light_vsm.device_vsm_depth_image_views[2]};
+            framebuffer_create_info.renderPass = static_casters_render_pass;
+            check_error(vkCreateFramebuffer(device, &framebuffer_create_info, nullptr, &light_vsm.static_framebuffer), vulkan_helper::Error::FRAMEBUFFER_CREATION_FAILED);
+        }
     }
 }
 
@@ -641,13 +678,90 @@ void VSMContext::allocate_descriptor_sets(VkDescriptorPool descriptor_pool) {
     vkUpdateDescriptorSets(device, write_descriptor_set.size(), write_descriptor_set.data(), 0, nullptr);
 }
 
-void VSMContext::record_into_command_buffer(VkCommandBuffer command_buffer, VkDescriptorSet light_data_set, const std::vector<VkModel> &vk_models) {
+void VSMContext::record_shadow_map_draws(VkCommandBuffer secondary_command_buffer, uint32_t light_index, VkDescriptorSet instance_data_set, VkDescriptorSet light_data_set,
+                                         const std::vector<VkModel> &vk_models, const Frustum *light_frustum, const std::vector<bool> *models_mask,
+                                         VkBuffer draw_commands_buffer, uint64_t draw_commands_offset) {
+    // The draws of every light are recorded in their own secondary command buffer, so that the lights can be recorded in parallel
+    VkCommandBufferInheritanceInfo command_buffer_inheritance_info = {
+            VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO,
+            nullptr,
+            shadow_map_render_pass,
+            0,
+            // The same draws are executed in the framebuffer of the shadow map or of the cache
+            VK_NULL_HANDLE,
+            VK_FALSE,
+            0,
+            0
+    };
+    VkCommandBufferBeginInfo command_buffer_begin_info = {
+            VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+            nullptr,
+            VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT,
+            &command_buffer_inheritance_info
+    };
+    vkBeginCommandBuffer(secondary_command_buffer, &command_buffer_begin_info);
+
+    vkCmdBindPipeline(secondary_command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, shadow_map_pipeline);
+
+    VkViewport viewport = {
+            0.0f,
+            0.0f,
+            static_cast<float>(lights_vsm[light_index].depth_image_res.width),
+            static_cast<float>(lights_vsm[light_index].depth_image_res.height),
+            0.0f,
+            1.0f
+    };
+    vkCmdSetViewport(secondary_command_buffer, 0, 1, &viewport);
+
+    VkRect2D scissor = {
+            {0,0},
+            lights_vsm[light_index].depth_image_res
+    };
+    vkCmdSetScissor(secondary_command_buffer, 0, 1, &scissor);
+    vkCmdPushConstants(secondary_command_buffer, shadow_map_pipeline_layout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(uint32_t), &lights_vsm[light_index].ssbo_index);
+
+    // The sets are the same for every draw, since the models are selected with the instance index
+    std::array<VkDescriptorSet, 2> to_bind = { instance_data_set, light_data_set };
+    vkCmdBindDescriptorSets(secondary_command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, shadow_map_pipeline_layout, 0, to_bind.size(), to_bind.data(), 0, nullptr);
+    if (draw_commands_buffer != VK_NULL_HANDLE) {
+        // The shadow map does not use the images, so all the primitives sharing the buffer are drawn together
+        std::vector<VkModel::draw_batch> batches = VkModel::get_draw_batches(vk_models);
+        VkModel::vk_record_batched_indirect_draws(secondary_command_buffer, batches, draw_commands_buffer, draw_commands_offset);
+    }
+    else {
+        // The draws are sorted by index type, so that the buffers are bound again as few times as possible
+        DrawList draw_list;
+        for (uint32_t j=0, draw_index=0; j<vk_models.size(); j++) {
+            if (models_mask == nullptr || (*models_mask)[j]) {
+                for (uint32_t k=0; k<vk_models[j].get_primitives_count(); k++) {
+                    if (light_frustum == nullptr || vk_models[j].is_primitive_visible(k, *light_frustum)) {
+                        draw_list.add((static_cast<uint64_t>(vk_models[j].get_primitive_index_type(k)) << 32) | draw_index++, j, k);
+                    }
+                }
+            }
+        }
+        draw_list.sort();
+
+        VkBuffer bound_buffer = VK_NULL_HANDLE;
+        VkIndexType bound_index_type = VK_INDEX_TYPE_MAX_ENUM;
+        for (const auto& draw : draw_list.get_draws()) {
+            vk_models[draw.model_index].vk_record_primitive_draw(secondary_command_buffer, draw.primitive_index, draw.model_index, bound_buffer, bound_index_type);
+        }
+    }
+    vkEndCommandBuffer(secondary_command_buffer);
+}
+
+void VSMContext::record_into_command_buffer(VkCommandBuffer command_buffer, const std::vector<VkCommandBuffer> &shadow_map_draws_command_buffers,
+                                            const std::vector<VkCommandBuffer> &dynamic_casters_draws_command_buffers, const std::vector<ShadowMapUpdate> &updates) {
     std::array<VkClearValue,2> clear_values;
     clear_values[0].depthStencil = {1.0f, 0};
     clear_values[1].color = {-40.0f, 1600.0f, 1.0f, 1.0f};
 
     for (uint32_t i=0; i < lights_vsm.size(); i++) {
-        // We first render the shadowmap
+        if (updates[i] == ShadowMapUpdate::NONE) {
+            continue;
+        }
+
         VkRenderPassBeginInfo render_pass_begin_info = {
             VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO,
             nullptr,
@@ -657,98 +771,190 @@ void VSMContext::record_into_command_buffer(VkCommandBuffer command_buffer, VkDe
             clear_values.size(),
             clear_values.data()
         };
-        vkCmdBeginRenderPass(command_buffer, &render_pass_begin_info, VK_SUBPASS_CONTENTS_INLINE);
-
-        vkCmdBindPipeline(command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, shadow_map_pipeline);
-
-        VkViewport viewport = {
-                0.0f,
-                0.0f,
-                static_cast<float>(lights_vsm[i].depth_image_res.width),
-                static_cast<float>(lights_vsm[i].depth_image_res.height),
-                0.0f,
-                1.0f
-        };
-        vkCmdSetViewport(command_buffer, 0, 1, &viewport);
+        if (updates[i] == ShadowMapUpdate::ALL_CASTERS) {
+            // We first render the shadowmap with the draws recorded by record_shadow_map_draws
+            vkCmdBeginRenderPass(command_buffer, &render_pass_begin_info, VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS);
+            vkCmdExecuteCommands(command_buffer, 1, &shadow_map_draws_command_buffers[i]);
+            vkCmdEndRenderPass(command_buffer);
+        }
+        else {
+            if (updates[i] == ShadowMapUpdate::STATIC_AND_DYNAMIC_CASTERS) {
+                // The copies of the last frames must have read the cache before it is drawn again
+                vkCmdPipelineBarrier(command_buffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+                                     0, 0, nullptr, 0, nullptr, 0, nullptr);
+                render_pass_begin_info.renderPass = static_casters_render_pass;
+                render_pass_begin_info.framebuffer = lights_vsm[i].static_framebuffer;
+                vkCmdBeginRenderPass(command_buffer, &render_pass_begin_info, VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS);
+                vkCmdExecuteCommands(command_buffer, 1, &shadow_map_draws_command_buffers[i]);
+                vkCmdEndRenderPass(command_buffer);
+            }
+            record_static_casters_copy(command_buffer, i);
+
+            // The dynamic casters are drawn over the static ones
+            render_pass_begin_info.renderPass = dynamic_casters_render_pass;
+            render_pass_begin_info.framebuffer = lights_vsm[i].framebuffer;
+            render_pass_begin_info.clearValueCount = 0;
+            render_pass_begin_info.pClearValues = nullptr;
+            vkCmdBeginRenderPass(command_buffer, &render_pass_begin_info, VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS);
+            vkCmdExecuteCommands(command_buffer, 1, &dynamic_casters_draws_command_buffers[i]);
+            vkCmdEndRenderPass(command_buffer);
+        }
+        record_blur(command_buffer, i);
+    }
+}
 
-        VkRect2D scissor = {
-                {0,0},
-                lights_vsm[i].depth_image_res
-        };
-        vkCmdSetScissor(command_buffer, 0, 1, &scissor);
-        vkCmdPushConstants(command_buffer, shadow_map_pipeline_layout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(uint32_t), &lights_vsm[i].ssbo_index);
+void VSMContext::schedule_updates(std::vector<ShadowMapUpdate> &updates, const std::vector<float> &priorities, uint32_t max_updates) {
+    std::vector<std::pair<float, uint32_t>> candidates;
+    for (uint32_t i=0; i < lights_vsm.size(); i++) {
+        if (updates[i] != ShadowMapUpdate::NONE) {
+            // A shadow map that was never drawn has no content to reuse
+            float priority = lights_vsm[i].ever_updated ? priorities[i] * (lights_vsm[i].frames_waited + 1) : std::numeric_limits<float>::infinity();
+            candidates.emplace_back(priority, i);
+        }
+    }
+    std::sort(candidates.begin(), candidates.end(), std::greater<>());
 
-        for (uint32_t j=0; j<vk_models.size(); j++) {
-            vkCmdBindDescriptorSets(command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, shadow_map_pipeline_layout, 1, 1, &light_data_set, 0, nullptr);
-            vk_models[j].vk_record_draw(command_buffer, shadow_map_pipeline_layout, 0);
+    for (uint32_t i=0; i < candidates.size(); i++) {
+        auto& light_vsm = lights_vsm[candidates[i].second];
+        if (max_updates == 0 || i < max_updates || !light_vsm.ever_updated) {
+            light_vsm.ever_updated = true;
+            light_vsm.frames_waited = 0;
+        }
+        else {
+            updates[candidates[i].second] = ShadowMapUpdate::NONE;
+            light_vsm.frames_waited++;
         }
-        vkCmdEndRenderPass(command_buffer);
+    }
+}
 
-        // Then we blur the shadow_map in the x dimension
-        std::array<VkImageMemoryBarrier,2> image_memory_barriers;
-        image_memory_barriers[0] = {
-                VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
-                nullptr,
-                0,
-                VK_ACCESS_SHADER_WRITE_BIT,
-                VK_IMAGE_LAYOUT_UNDEFINED,
-                VK_IMAGE_LAYOUT_GENERAL,
-                VK_QUEUE_FAMILY_IGNORED,
-                VK_QUEUE_FAMILY_IGNORED,
-                lights_vsm[i].device_vsm_depth_image,
-                { VK_IMAGE_ASPECT_COLOR_BIT, 0, VK_REMAINING_MIP_LEVELS, 1, 1 }
-        };
-        vkCmdPipelineBarrier(command_buffer, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 0, nullptr, 0, nullptr, 1, image_memory_barriers.data());
+void VSMContext::record_static_casters_copy(VkCommandBuffer command_buffer, uint32_t light_index) {
+    // The cache may have just been drawn, and the shadow map may still be read by the last frame
+    VkMemoryBarrier memory_barrier = {
+            VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+            nullptr,
+            VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT,
+            VK_ACCESS_TRANSFER_READ_BIT
+    };
+    std::array<VkImageMemoryBarrier,2> image_memory_barriers;
+    image_memory_barriers[0] = {
+            VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+            nullptr,
+            0,
+            VK_ACCESS_TRANSFER_WRITE_BIT,
+            VK_IMAGE_LAYOUT_UNDEFINED,
+            VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+            VK_QUEUE_FAMILY_IGNORED,
+            VK_QUEUE_FAMILY_IGNORED,
+            lights_vsm[light_index].device_vsm_depth_image,
+            { VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 }
+    };
+    image_memory_barriers[1] = {
+            VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+            nullptr,
+            0,
+            VK_ACCESS_TRANSFER_WRITE_BIT,
+            VK_IMAGE_LAYOUT_UNDEFINED,
+            VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+            VK_QUEUE_FAMILY_IGNORED,
+            VK_QUEUE_FAMILY_IGNORED,
+            lights_vsm[light_index].device_light_depth_image,
+            { VK_IMAGE_ASPECT_DEPTH_BIT, 0, 1, 0, 1 }
+    };
+    vkCmdPipelineBarrier(command_buffer, VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+                         VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 1, &memory_barrier, 0, nullptr, image_memory_barriers.size(), image_memory_barriers.data());
+
+    VkImageCopy image_copy = {
+            { VK_IMAGE_ASPECT_COLOR_BIT, 0, 2, 1 },
+            {0, 0, 0},
+            { VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1 },
+            {0, 0, 0},
+            {lights_vsm[light_index].depth_image_res.width, lights_vsm[light_index].depth_image_res.height, 1}
+    };
+    vkCmdCopyImage(command_buffer, lights_vsm[light_index].device_vsm_depth_image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                   lights_vsm[light_index].device_vsm_depth_image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &image_copy);
+    image_copy.srcSubresource = { VK_IMAGE_ASPECT_DEPTH_BIT, 0, 0, 1 };
+    image_copy.dstSubresource = { VK_IMAGE_ASPECT_DEPTH_BIT, 0, 0, 1 };
+    vkCmdCopyImage(command_buffer, lights_vsm[light_index].device_static_light_depth_image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                   lights_vsm[light_index].device_light_depth_image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &image_copy);
+
+    // Then the copies are used as the attachments of the dynamic casters
+    image_memory_barriers[0].srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    image_memory_barriers[0].dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+    image_memory_barriers[0].oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+    image_memory_barriers[0].newLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+    image_memory_barriers[1].srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    image_memory_barriers[1].dstAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+    image_memory_barriers[1].oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+    image_memory_barriers[1].newLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+    vkCmdPipelineBarrier(command_buffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+                         0, 0, nullptr, 0, nullptr, image_memory_barriers.size(), image_memory_barriers.data());
+}
 
-        vkCmdBindPipeline(command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE, gaussian_blur_xy_pipelines[0]);
-        vkCmdBindDescriptorSets(command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE, gaussian_blur_pipeline_layout, 0, 1, &vsm_descriptor_sets[2*i+0], 0, nullptr);
-        vkCmdDispatch(command_buffer, std::ceil(lights_vsm[i].depth_image_res.width/32.0f), std::ceil(lights_vsm[i].depth_image_res.height/32.0f), 1);
+void VSMContext::record_blur(VkCommandBuffer command_buffer, uint32_t light_index) {
+    // We blur the shadow_map in the x dimension
+    std::array<VkImageMemoryBarrier,2> image_memory_barriers;
+    image_memory_barriers[0] = {
+            VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+            nullptr,
+            0,
+            VK_ACCESS_SHADER_WRITE_BIT,
+            VK_IMAGE_LAYOUT_UNDEFINED,
+            VK_IMAGE_LAYOUT_GENERAL,
+            VK_QUEUE_FAMILY_IGNORED,
+            VK_QUEUE_FAMILY_IGNORED,
+            lights_vsm[light_index].device_vsm_depth_image,
+            { VK_IMAGE_ASPECT_COLOR_BIT, 0, VK_REMAINING_MIP_LEVELS, 1, 1 }
+    };
+    vkCmdPipelineBarrier(command_buffer, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 0, nullptr, 0, nullptr, 1, image_memory_barriers.data());
 
-        // Then we blur in the y dimension
-        image_memory_barriers[0] = {
-                VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
-                nullptr,
-                VK_ACCESS_SHADER_READ_BIT,
-                VK_ACCESS_SHADER_WRITE_BIT,
-                VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
-                VK_IMAGE_LAYOUT_GENERAL,
-                VK_QUEUE_FAMILY_IGNORED,
-                VK_QUEUE_FAMILY_IGNORED,
-                lights_vsm[i].device_vsm_depth_image,
-                { VK_IMAGE_ASPECT_COLOR_BIT, 0, VK_REMAINING_MIP_LEVELS, 0, 1 }
-        };
-        image_memory_barriers[1] = {
-                VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
-                nullptr,
-                VK_ACCESS_SHADER_WRITE_BIT,
-                VK_ACCESS_SHADER_READ_BIT,
-                VK_IMAGE_LAYOUT_GENERAL,
-                VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
-                VK_QUEUE_FAMILY_IGNORED,
-                VK_QUEUE_FAMILY_IGNORED,
-                lights_vsm[i].device_vsm_depth_image,
-                { VK_IMAGE_ASPECT_COLOR_BIT, 0, VK_REMAINING_MIP_LEVELS, 1, 1 }
-        };
-        vkCmdPipelineBarrier(command_buffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 0, nullptr, 0, nullptr, 2, image_memory_barriers.data());
+    vkCmdBindPipeline(command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE, gaussian_blur_xy_pipelines[0]);
+    vkCmdBindDescriptorSets(command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE, gaussian_blur_pipeline_layout, 0, 1, &vsm_descriptor_sets[2*light_index+0], 0, nullptr);
+    vkCmdDispatch(command_buffer, std::ceil(lights_vsm[light_index].depth_image_res.width/32.0f), std::ceil(lights_vsm[light_index].depth_image_res.height/32.0f), 1);
+
+    // Then we blur in the y dimension
+    image_memory_barriers[0] = {
+            VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+            nullptr,
+            VK_ACCESS_SHADER_READ_BIT,
+            VK_ACCESS_SHADER_WRITE_BIT,
+            VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+            VK_IMAGE_LAYOUT_GENERAL,
+            VK_QUEUE_FAMILY_IGNORED,
+            VK_QUEUE_FAMILY_IGNORED,
+            lights_vsm[light_index].device_vsm_depth_image,
+            { VK_IMAGE_ASPECT_COLOR_BIT, 0, VK_REMAINING_MIP_LEVELS, 0, 1 }
+    };
+    image_memory_barriers[1] = {
+            VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+            nullptr,
+            VK_ACCESS_SHADER_WRITE_BIT,
+            VK_ACCESS_SHADER_READ_BIT,
+            VK_IMAGE_LAYOUT_GENERAL,
+            VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+            VK_QUEUE_FAMILY_IGNORED,
+            VK_QUEUE_FAMILY_IGNORED,
+            lights_vsm[light_index].device_vsm_depth_image,
+            { VK_IMAGE_ASPECT_COLOR_BIT, 0, VK_REMAINING_MIP_LEVELS, 1, 1 }
+    };
+    vkCmdPipelineBarrier(command_buffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 0, nullptr, 0, nullptr, 2, image_memory_barriers.data());
 
-        vkCmdBindPipeline(command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE, gaussian_blur_xy_pipelines[1]);
-        vkCmdBindDescriptorSets(command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE, gaussian_blur_pipeline_layout, 0, 1, &vsm_descriptor_sets[2*i+1], 0, nullptr);
-        vkCmdDispatch(command_buffer, std::ceil(lights_vsm[i].depth_image_res.width/32.0f), std::ceil(lights_vsm[i].depth_image_res.height/32.0f), 1);
+    vkCmdBindPipeline(command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE, gaussian_blur_xy_pipelines[1]);
+    vkCmdBindDescriptorSets(command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE, gaussian_blur_pipeline_layout, 0, 1, &vsm_descriptor_sets[2*light_index+1], 0, nullptr);
+    vkCmdDispatch(command_buffer, std::ceil(lights_vsm[light_index].depth_image_res.width/32.0f), std::ceil(lights_vsm[light_index].depth_image_res.height/32.0f), 1);
 
-        image_memory_barriers[0] = {
-                VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
-                nullptr,
-                VK_ACCESS_SHADER_WRITE_BIT,
-                VK_ACCESS_SHADER_READ_BIT,
-                VK_IMAGE_LAYOUT_GENERAL,
-                VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
-                VK_QUEUE_FAMILY_IGNORED,
-                VK_QUEUE_FAMILY_IGNORED,
-                lights_vsm[i].device_vsm_depth_image,
-                { VK_IMAGE_ASPECT_COLOR_BIT, 0, VK_REMAINING_MIP_LEVELS, 0, 1 }
-        };
-        vkCmdPipelineBarrier(command_buffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0, 0, nullptr, 0, nullptr, 1, image_memory_barriers.data());
-    }
+    image_memory_barriers[0] = {
+            VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+            nullptr,
+            VK_ACCESS_SHADER_WRITE_BIT,
+            VK_ACCESS_SHADER_READ_BIT,
+            VK_IMAGE_LAYOUT_GENERAL,
+            VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+            VK_QUEUE_FAMILY_IGNORED,
+            VK_QUEUE_FAMILY_IGNORED,
+            lights_vsm[light_index].device_vsm_depth_image,
+            { VK_IMAGE_ASPECT_COLOR_BIT, 0, VK_REMAINING_MIP_LEVELS, 0, 1 }
+    };
+    vkCmdPipelineBarrier(command_buffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0, 0, nullptr, 0, nullptr, 1, image_memory_barriers.data());
 }
 
 VkImageView VSMContext::get_image_view(int index) {
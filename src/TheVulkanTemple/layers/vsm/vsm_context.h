@@ -1,6 +1,7 @@
 #ifndef BASE_VULKAN_APP_VSM_CONTEXT_H
 #define BASE_VULKAN_APP_VSM_CONTEXT_H
 #include "../../external/volk.h"
+#include "../../pipeline_cache.h"
 #include <array>
 #include <unordered_map>
 #include <utility>
@@ -8,6 +9,7 @@
 #include <string>
 #include "../../vulkan_helper.h"
 #include "../../gltf_model.h"
+#include "../../frustum.h"
 
 /* To use this class, it is required to call the correct sequence of calls, first the
  * constructor VSMContext, then you need to allocate a VkDevice memory big enough for
@@ -15,40 +17,87 @@
  * performance reasons. Then you can safely call create_image_views(). For the descriptor
  * sets you first need to query how many elements you need to allocate, then pass the
  * pool to allocate_descriptor_sets.
+ * The shadow maps keep their content between frames, so every frame only the ones that
+ * changed are drawn again. With the cache of the static casters, the static casters of a
+ * light are drawn once in their own images, which are then copied under the dynamic ones.
+ * With many lights the updates of a frame can be limited with schedule_updates(), the ones left
+ * out wait for the next frames while their shadow map is reused.
  */
 
 class VSMContext {
 public:
-    VSMContext(VkDevice device, std::string shader_dir_path);
+    // What is done to a shadow map in a frame
+    enum class ShadowMapUpdate : uint32_t {
+        // The shadow map of the last update is kept
+        NONE,
+        // The cached static casters are copied and the dynamic casters are drawn over them
+        DYNAMIC_CASTERS,
+        // The static casters are drawn in the cache first, then it is the same as DYNAMIC_CASTERS
+        STATIC_AND_DYNAMIC_CASTERS,
+        // Every caster is drawn in a cleared shadow map, without using the cache
+        ALL_CASTERS
+    };
+
+    VSMContext(VkDevice device, PipelineCache &pipeline_cache, std::string shader_dir_path);
     ~VSMContext();
 
     std::vector<VkImage> get_device_images();
     std::pair<std::unordered_map<VkDescriptorType, uint32_t>, uint32_t> get_required_descriptor_pool_size_and_sets();
     VkImageView get_image_view(int index);
 
+    // Without the static casters cache only the NONE and ALL_CASTERS updates can be used
     void create_resources(std::vector<VkExtent2D> depth_images_res, std::vector<uint32_t> ssbo_indices,
-                          VkDescriptorSetLayout pbr_model_set_layout, VkDescriptorSetLayout light_set_layout);
+                          VkDescriptorSetLayout instance_set_layout, VkDescriptorSetLayout light_set_layout, bool cache_static_casters);
     void init_resources();
     void allocate_descriptor_sets(VkDescriptorPool descriptor_pool);
-    void record_into_command_buffer(VkCommandBuffer command_buffer, VkDescriptorSet light_data_set, const std::vector<VkModel> &vk_models);
+    uint32_t get_shadow_maps_count() { return lights_vsm.size(); };
+    // Records the draws of a shadow map into a secondary command buffer, which then is passed to record_into_command_buffer.
+    // The primitives outside of the light frustum are not drawn, and with a mask only the models set in it are drawn. If a draw
+    // commands buffer is given, the primitives are drawn with multi draws reading one command each from draw_commands_offset,
+    // and the culling is left to whoever writes the commands
+    void record_shadow_map_draws(VkCommandBuffer secondary_command_buffer, uint32_t light_index, VkDescriptorSet instance_data_set, VkDescriptorSet light_data_set,
+                                 const std::vector<VkModel> &vk_models, const Frustum *light_frustum, const std::vector<bool> *models_mask,
+                                 VkBuffer draw_commands_buffer = VK_NULL_HANDLE, uint64_t draw_commands_offset = 0);
+    // The draws of every shadow map are the static casters for STATIC_AND_DYNAMIC_CASTERS and every caster for ALL_CASTERS, the
+    // dynamic draws are the dynamic casters. The draws of the shadow maps that do not need them are not read
+    void record_into_command_buffer(VkCommandBuffer command_buffer, const std::vector<VkCommandBuffer> &shadow_map_draws_command_buffers,
+                                    const std::vector<VkCommandBuffer> &dynamic_casters_draws_command_buffers, const std::vector<ShadowMapUpdate> &updates);
+    // Keeps at most max_updates of the updates, 0 for no limit, and sets the others to NONE. The shadow maps never drawn are
+    // always kept, then the ones with the highest priority, which is multiplied by the frames they have been waiting for.
+    // It must be called once for every frame recorded with the updates
+    void schedule_updates(std::vector<ShadowMapUpdate> &updates, const std::vector<float> &priorities, uint32_t max_updates);
 private:
     VkDevice device = VK_NULL_HANDLE;
+    PipelineCache *pipeline_cache = nullptr;
     VkSampler device_render_target_sampler = VK_NULL_HANDLE;
     VkDescriptorSetLayout vsm_descriptor_set_layout = VK_NULL_HANDLE;
     VkRenderPass shadow_map_render_pass = VK_NULL_HANDLE;
+    // Compatible with shadow_map_render_pass, the first stores the static casters for the copies and the second loads them
+    VkRenderPass static_casters_render_pass = VK_NULL_HANDLE;
+    VkRenderPass dynamic_casters_render_pass = VK_NULL_HANDLE;
+    bool cache_static_casters = false;
     std::string shader_dir_path;
 
     struct light_vsm_data {
         VkExtent2D depth_image_res;
         uint32_t ssbo_index;
 
-        VkImage device_vsm_depth_image;
-        std::array<VkImageView, 2> device_vsm_depth_image_views;
+        // The first layer is the shadow map, the second is used by the blur and the third has the cached static casters
+        VkImage device_vsm_depth_image = VK_NULL_HANDLE;
+        std::array<VkImageView, 3> device_vsm_depth_image_views = {VK_NULL_HANDLE, VK_NULL_HANDLE, VK_NULL_HANDLE};
+
+        VkImage device_light_depth_image = VK_NULL_HANDLE;
+        VkImageView device_light_depth_image_view = VK_NULL_HANDLE;
+
+        VkFramebuffer framebuffer = VK_NULL_HANDLE;
 
-        VkImage device_light_depth_image;
-        VkImageView device_light_depth_image_view;
+        // Only with the static casters cache
+        VkImage device_static_light_depth_image = VK_NULL_HANDLE;
+        VkImageView device_static_light_depth_image_view = VK_NULL_HANDLE;
+        VkFramebuffer static_framebuffer = VK_NULL_HANDLE;
 
-        VkFramebuffer framebuffer;
+        bool ever_updated = false;
+        uint32_t frames_waited = 0;
     };
     std::vector<light_vsm_data> lights_vsm;
 
@@ -66,7 +115,9 @@ private:
     // Vulkan methods
     void create_image_views();
     void create_framebuffers();
-    void create_shadow_map_pipeline(VkDescriptorSetLayout pbr_model_set_layout, VkDescriptorSetLayout light_set_layout);
+    void create_shadow_map_pipeline(VkDescriptorSetLayout instance_set_layout, VkDescriptorSetLayout light_set_layout);
     void create_gaussian_blur_pipelines(std::string shader_dir_path);
+    void record_static_casters_copy(VkCommandBuffer command_buffer, uint32_t light_index);
+    void record_blur(VkCommandBuffer command_buffer, uint32_t light_index);
 };
 #endif //BASE_VULKAN_APP_VSM_CONTEXT_H
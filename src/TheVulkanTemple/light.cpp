@@ -32,11 +32,15 @@ glm::mat4 Light::get_view_matrix() const {
     return glm::lookAt(light_params.position, light_params.position + light_params.direction, glm::vec3(0.0f, -1.0f, 0.0f));
 }
 
+Frustum Light::get_frustum() const {
+    return Frustum(get_proj_matrix() * get_view_matrix());
+}
+
 uint32_t Light::copy_data_to_ptr(uint8_t *ptr) const {
     if (ptr != nullptr) {
         memcpy(ptr, &light_params, sizeof(LightParams));
         memcpy(ptr+sizeof(LightParams), glm::value_ptr(this->get_view_matrix()), sizeof(glm::mat4));
         memcpy(ptr+sizeof(glm::mat4)+sizeof(LightParams), glm::value_ptr(this->get_proj_matrix()), sizeof(glm::mat4));
     }
-    return sizeof(glm::mat4)*2+sizeof(LightParams);
+    return get_data_size();
 }
\ No newline at end of file
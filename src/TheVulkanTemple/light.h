@@ -1,6 +1,7 @@
 #ifndef BASE_VULKAN_APP_LIGHT_H
 #define BASE_VULKAN_APP_LIGHT_H
 #include "camera.h"
+#include "frustum.h"
 #include <glm/glm.hpp>
 
 class Light {
@@ -29,12 +30,17 @@ class Light {
         glm::uvec2 get_shadow_map_resolution() const;
         glm::mat4 get_proj_matrix() const;
         glm::mat4 get_view_matrix() const;
+        // Cone of the spot lights and box of the directional ones, computed on every call
+        Frustum get_frustum() const;
 
-        inline void set_pos(glm::vec3 pos) const { light_params.position = pos; };
-        inline void set_dir(glm::vec3 dir) const { light_params.direction = dir; };
-        inline void set_falloff_distance(float distance) const { light_params.falloff_distance = distance; };
-        inline void set_color(glm::vec3 color) const { light_params.color = color; };
-        inline void set_penumbra_umbra_angles(glm::vec2 penumbra_umbra_angles) const { light_params.penumbra_umbra_angles = penumbra_umbra_angles; };
+        inline void set_pos(glm::vec3 pos) const { set_and_track(light_params.position, pos); };
+        inline void set_dir(glm::vec3 dir) const { set_and_track(light_params.direction, dir); };
+        inline void set_falloff_distance(float distance) const { set_and_track(light_params.falloff_distance, distance); };
+        inline void set_color(glm::vec3 color) const { set_and_track(light_params.color, color); };
+        inline void set_penumbra_umbra_angles(glm::vec2 penumbra_umbra_angles) const { set_and_track(light_params.penumbra_umbra_angles, penumbra_umbra_angles); };
+
+        // Incremented every time the data copied by copy_data_to_ptr changes
+        inline uint64_t get_version() const { return version; };
 
         inline float set_fov() const {return fov; };
         inline float set_aspect() const {return aspect; };
@@ -42,8 +48,18 @@ class Light {
         inline float set_zfar() const {return zfar; };
 
         uint32_t copy_data_to_ptr(uint8_t *ptr) const;
+        // Size of the data written by copy_data_to_ptr, the same for every light
+        static constexpr uint32_t get_data_size() { return sizeof(glm::mat4)*2+sizeof(LightParams); };
 
 private:
+        // Setting the same value again is not counted as a change
+        template<typename T> void set_and_track(T &member, const T &value) const {
+            if (member != value) {
+                member = value;
+                version++;
+            }
+        }
+
         // tight packed struct aligned to 16 bytes
         struct LightParams {
             glm::vec3 position;
@@ -56,6 +72,7 @@ private:
             glm::vec2 dummy;
         };
         mutable LightParams light_params;
+        mutable uint64_t version = 0;
 
 		uint32_t shadow_map_height;
 
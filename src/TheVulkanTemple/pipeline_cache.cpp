@@ -0,0 +1,122 @@
+#include "pipeline_cache.h"
+#include <cstring>
+#include <vector>
+#include <fstream>
+#include <filesystem>
+#include "vulkan_helper.h"
+
+PipelineCache::PipelineCache(VkDevice device, VkPhysicalDevice physical_device, std::string file_path, const std::string &shader_archive_path) :
+		shader_archive(shader_archive_path) {
+	this->device = device;
+	this->file_path = file_path;
+
+	// The driver UUID is core in Vulkan 1.1, and tells apart driver builds that report the same version
+	VkPhysicalDeviceIDProperties id_properties = {VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_ID_PROPERTIES, nullptr};
+	VkPhysicalDeviceProperties2 physical_device_properties = {VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2, &id_properties};
+	vkGetPhysicalDeviceProperties2(physical_device, &physical_device_properties);
+	const VkPhysicalDeviceProperties &properties = physical_device_properties.properties;
+	expected_header = {file_magic, properties.vendorID, properties.deviceID, properties.driverVersion, {}, {}, 0};
+	memcpy(expected_header.pipeline_cache_uuid, properties.pipelineCacheUUID, VK_UUID_SIZE);
+	memcpy(expected_header.driver_uuid, id_properties.driverUUID, VK_UUID_SIZE);
+
+	std::vector<uint8_t> file_content;
+	if (!file_path.empty() && std::filesystem::exists(file_path)) {
+		vulkan_helper::get_binary_file_content(file_path, file_content);
+	}
+	// The data is used only if the header matches this device and driver and the file is complete
+	file_header header;
+	if (file_content.size() >= sizeof(file_header)) {
+		memcpy(&header, file_content.data(), sizeof(file_header));
+		warm = header.magic == expected_header.magic && header.vendor_id == expected_header.vendor_id && header.device_id == expected_header.device_id &&
+			   header.driver_version == expected_header.driver_version &&
+			   memcmp(header.pipeline_cache_uuid, expected_header.pipeline_cache_uuid, VK_UUID_SIZE) == 0 &&
+			   memcmp(header.driver_uuid, expected_header.driver_uuid, VK_UUID_SIZE) == 0 &&
+			   header.data_size == file_content.size() - sizeof(file_header);
+	}
+
+	VkPipelineCacheCreateInfo pipeline_cache_create_info = {
+			VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO,
+			nullptr,
+			0,
+			warm ? header.data_size : 0,
+			warm ? file_content.data() + sizeof(file_header) : nullptr
+	};
+	check_error(vkCreatePipelineCache(device, &pipeline_cache_create_info, nullptr, &pipeline_cache), vulkan_helper::Error::PIPELINE_CACHE_CREATION_FAILED);
+}
+
+PipelineCache::~PipelineCache() {
+	save();
+	vkDestroyPipelineCache(device, pipeline_cache, nullptr);
+	for (auto shader_module : created_shader_modules) {
+		vkDestroyShaderModule(device, shader_module, nullptr);
+	}
+}
+
+VkShaderModule PipelineCache::get_shader_module(const std::string &file_path) {
+	std::promise<VkShaderModule> shader_module_promise;
+	std::unique_lock<std::mutex> lock(shader_modules_mutex);
+	auto it = shader_modules.find(file_path);
+	if (it != shader_modules.end()) {
+		// Created or being created by another thread
+		std::shared_future<VkShaderModule> shader_module_future = it->second;
+		lock.unlock();
+		return shader_module_future.get();
+	}
+	shader_modules.emplace(file_path, shader_module_promise.get_future().share());
+	lock.unlock();
+
+	try {
+		// The code is taken from the mapped archive when it is there, and read from its own file otherwise
+		std::span<const uint32_t> archived_code = shader_archive.get(std::filesystem::path(file_path).filename().string());
+		std::vector<uint8_t> shader_contents;
+		if (archived_code.empty()) {
+			vulkan_helper::get_binary_file_content(file_path, shader_contents);
+		}
+		VkShaderModuleCreateInfo shader_module_create_info = {
+				VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO,
+				nullptr,
+				0,
+				archived_code.empty() ? shader_contents.size() : archived_code.size_bytes(),
+				archived_code.empty() ? reinterpret_cast<uint32_t*>(shader_contents.data()) : archived_code.data()
+		};
+		VkShaderModule shader_module;
+		check_error(vkCreateShaderModule(device, &shader_module_create_info, nullptr, &shader_module), vulkan_helper::Error::SHADER_MODULE_CREATION_FAILED);
+
+		lock.lock();
+		created_shader_modules.push_back(shader_module);
+		lock.unlock();
+		shader_module_promise.set_value(shader_module);
+		return shader_module;
+	}
+	catch (...) {
+		// The threads waiting for the module get the same error
+		shader_module_promise.set_exception(std::current_exception());
+		throw;
+	}
+}
+
+void PipelineCache::save() {
+	if (file_path.empty()) {
+		return;
+	}
+	size_t data_size = 0;
+	vkGetPipelineCacheData(device, pipeline_cache, &data_size, nullptr);
+	std::vector<uint8_t> file_content(sizeof(file_header) + data_size);
+	if (vkGetPipelineCacheData(device, pipeline_cache, &data_size, file_content.data() + sizeof(file_header)) != VK_SUCCESS) {
+		return;
+	}
+	file_header header = expected_header;
+	header.data_size = data_size;
+	memcpy(file_content.data(), &header, sizeof(file_header));
+
+	// Written to a temporary file first, so that an interrupted write does not leave a truncated cache
+	std::string tmp_file_path = file_path + ".tmp";
+	std::ofstream file(tmp_file_path, std::ios::out | std::ios::binary | std::ios::trunc);
+	if (!file.is_open()) {
+		return;
+	}
+	file.write(reinterpret_cast<const char*>(file_content.data()), file_content.size());
+	file.close();
+	std::error_code error_code;
+	std::filesystem::rename(tmp_file_path, file_path, error_code);
+}
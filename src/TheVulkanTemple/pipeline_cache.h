@@ -0,0 +1,55 @@
+#ifndef THEVULKANTEMPLE_PIPELINE_CACHE_H
+#define THEVULKANTEMPLE_PIPELINE_CACHE_H
+
+#include <string>
+#include <cstdint>
+#include <vector>
+#include <mutex>
+#include <future>
+#include <unordered_map>
+#include "external/volk.h"
+#include "shader_archive.h"
+
+// Pipeline cache shared by all the layers, loaded from a file at creation and written back at destruction. The file is
+// discarded when it was written by another device or driver, in which case the cache starts empty. It also keeps the shader
+// modules, so that every SPIR-V file is read and compiled once even when used by more pipelines. The SPIR-V is taken from
+// the shader archive when it has the file, which avoids opening every file on its own
+class PipelineCache {
+	public:
+		// With an empty file path the cache is not persisted. Without a shader archive the shaders are read from their files
+		PipelineCache(VkDevice device, VkPhysicalDevice physical_device, std::string file_path, const std::string &shader_archive_path);
+		~PipelineCache();
+
+		VkPipelineCache get() { return pipeline_cache; };
+		// Whether the cache was created with the data of a previous run
+		bool is_warm() { return warm; };
+		void save();
+		// Thread safe, the module of a file requested by more threads at the same time is created once. The modules are
+		// destroyed with the cache
+		VkShaderModule get_shader_module(const std::string &file_path);
+	private:
+		// Written before the data returned by vkGetPipelineCacheData
+		struct file_header {
+			uint32_t magic;
+			uint32_t vendor_id;
+			uint32_t device_id;
+			uint32_t driver_version;
+			uint8_t pipeline_cache_uuid[VK_UUID_SIZE];
+			uint8_t driver_uuid[VK_UUID_SIZE];
+			uint64_t data_size;
+		};
+		static constexpr uint32_t file_magic = 0x43505654;
+
+		VkDevice device;
+		file_header expected_header;
+		std::string file_path;
+		VkPipelineCache pipeline_cache = VK_NULL_HANDLE;
+		bool warm = false;
+		ShaderArchive shader_archive;
+
+		std::mutex shader_modules_mutex;
+		std::unordered_map<std::string, std::shared_future<VkShaderModule>> shader_modules;
+		std::vector<VkShaderModule> created_shader_modules;
+};
+
+#endif //THEVULKANTEMPLE_PIPELINE_CACHE_H
@@ -0,0 +1,117 @@
+#include "shader_archive.h"
+#include <cstring>
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+ShaderArchive::ShaderArchive(const std::string &file_path) {
+#ifdef _WIN32
+	file_handle = CreateFileA(file_path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (file_handle == INVALID_HANDLE_VALUE) {
+		file_handle = nullptr;
+		return;
+	}
+	LARGE_INTEGER file_size;
+	if (!GetFileSizeEx(file_handle, &file_size) || file_size.QuadPart == 0) {
+		unmap();
+		return;
+	}
+	mapping_handle = CreateFileMappingA(file_handle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if (mapping_handle == nullptr) {
+		unmap();
+		return;
+	}
+	mapped_data = static_cast<const uint8_t*>(MapViewOfFile(mapping_handle, FILE_MAP_READ, 0, 0, 0));
+	mapped_size = file_size.QuadPart;
+#else
+	int file_descriptor = open(file_path.c_str(), O_RDONLY);
+	if (file_descriptor == -1) {
+		return;
+	}
+	struct stat file_stat;
+	if (fstat(file_descriptor, &file_stat) == 0 && file_stat.st_size > 0) {
+		void *data = mmap(nullptr, file_stat.st_size, PROT_READ, MAP_PRIVATE, file_descriptor, 0);
+		if (data != MAP_FAILED) {
+			mapped_data = static_cast<const uint8_t*>(data);
+			mapped_size = file_stat.st_size;
+		}
+	}
+	// The mapping stays valid after the descriptor is closed
+	close(file_descriptor);
+#endif
+	if (mapped_data == nullptr) {
+		unmap();
+		return;
+	}
+
+	// The index and the codes must lie in the file, otherwise the archive is not used at all
+	header archive_header;
+	bool valid = mapped_size >= sizeof(header);
+	if (valid) {
+		memcpy(&archive_header, mapped_data, sizeof(header));
+		valid = archive_header.magic == file_magic && archive_header.version == file_version &&
+				archive_header.entries_count <= (mapped_size - sizeof(header)) / sizeof(entry);
+	}
+	for (uint32_t i = 0; valid && i < archive_header.entries_count; i++) {
+		entry archive_entry;
+		memcpy(&archive_entry, mapped_data + sizeof(header) + i * sizeof(entry), sizeof(entry));
+		valid = archive_entry.offset % code_alignment == 0 && archive_entry.size % sizeof(uint32_t) == 0 &&
+				archive_entry.offset <= mapped_size && archive_entry.size <= mapped_size - archive_entry.offset;
+	}
+	if (!valid) {
+		unmap();
+	}
+}
+
+ShaderArchive::~ShaderArchive() {
+	unmap();
+}
+
+std::span<const uint32_t> ShaderArchive::get(const std::string &name) const {
+	if (mapped_data == nullptr) {
+		return {};
+	}
+	header archive_header;
+	memcpy(&archive_header, mapped_data, sizeof(header));
+	for (uint32_t i = 0; i < archive_header.entries_count; i++) {
+		entry archive_entry;
+		memcpy(&archive_entry, mapped_data + sizeof(header) + i * sizeof(entry), sizeof(entry));
+		if (strncmp(archive_entry.name, name.c_str(), sizeof(archive_entry.name)) != 0) {
+			continue;
+		}
+		const uint8_t *code = mapped_data + archive_entry.offset;
+		if (hash(code, archive_entry.size) != archive_entry.hash) {
+			return {};
+		}
+		return {reinterpret_cast<const uint32_t*>(code), archive_entry.size / sizeof(uint32_t)};
+	}
+	return {};
+}
+
+void ShaderArchive::unmap() {
+#ifdef _WIN32
+	if (mapped_data != nullptr) {
+		UnmapViewOfFile(mapped_data);
+	}
+	if (mapping_handle != nullptr) {
+		CloseHandle(mapping_handle);
+	}
+	if (file_handle != nullptr) {
+		CloseHandle(file_handle);
+	}
+	mapping_handle = nullptr;
+	file_handle = nullptr;
+#else
+	if (mapped_data != nullptr) {
+		munmap(const_cast<uint8_t*>(mapped_data), mapped_size);
+	}
+#endif
+	mapped_data = nullptr;
+	mapped_size = 0;
+}
@@ -0,0 +1,61 @@
+#ifndef THEVULKANTEMPLE_SHADER_ARCHIVE_H
+#define THEVULKANTEMPLE_SHADER_ARCHIVE_H
+
+#include <string>
+#include <cstdint>
+#include <cstddef>
+#include <span>
+
+// Read only view of the archive in which the shaders target packs all the SPIR-V files. The file is mapped in memory once
+// and the code of a shader is handed out without copies, an index after the header tells the name, offset, size and hash
+// of every shader. The format is shared with the shader_packer tool
+class ShaderArchive {
+	public:
+		struct header {
+			uint32_t magic;
+			uint32_t version;
+			uint32_t entries_count;
+			uint32_t reserved;
+		};
+		struct entry {
+			char name[64];
+			uint64_t offset;
+			uint64_t size;
+			uint64_t hash;
+		};
+		static constexpr uint32_t file_magic = 0x52415354;
+		static constexpr uint32_t file_version = 1;
+		// SPIR-V is made of 32 bit words, so every code starts at a multiple of it from the page aligned mapping
+		static constexpr uint64_t code_alignment = 4;
+
+		// FNV-1a of the code, checked every time a shader is requested
+		static uint64_t hash(const uint8_t *data, uint64_t size) {
+			uint64_t value = 0xcbf29ce484222325;
+			for (uint64_t i = 0; i < size; i++) {
+				value = (value ^ data[i]) * 0x100000001b3;
+			}
+			return value;
+		};
+
+		// A missing or malformed file leaves the archive empty, so that the shaders are read one by one
+		explicit ShaderArchive(const std::string &file_path);
+		~ShaderArchive();
+		ShaderArchive(const ShaderArchive&) = delete;
+		ShaderArchive& operator=(const ShaderArchive&) = delete;
+
+		bool is_open() { return mapped_data != nullptr; };
+		// Looks up the shader by its file name, e.g. "pbr.vert.spv". Empty if it is not in the archive or its hash does not
+		// match, the span is valid as long as the archive
+		std::span<const uint32_t> get(const std::string &name) const;
+	private:
+		const uint8_t *mapped_data = nullptr;
+		size_t mapped_size = 0;
+#ifdef _WIN32
+		void *file_handle = nullptr;
+		void *mapping_handle = nullptr;
+#endif
+
+		void unmap();
+};
+
+#endif //THEVULKANTEMPLE_SHADER_ARCHIVE_H
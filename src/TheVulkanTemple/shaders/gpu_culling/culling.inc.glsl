@@ -0,0 +1,48 @@
+#ifndef INCLUDE_GUARD_CULLING
+#define INCLUDE_GUARD_CULLING
+
+// Same layout of VkModel::primitive_cull_data
+struct PrimitiveCullData {
+	vec4 bounding_sphere;
+	uint model_index;
+	uint index_count;
+	uint first_index;
+	int vertex_offset;
+};
+
+struct ModelInstance {
+	mat4 model;
+	mat4 normal_model;
+};
+
+// Same layout of VkDrawIndexedIndirectCommand
+struct DrawIndexedCommand {
+	uint index_count;
+	uint instance_count;
+	uint first_index;
+	int vertex_offset;
+	uint first_instance;
+};
+
+// The sphere is scaled by the biggest scale of the model, as in VkModel::is_primitive_visible
+vec4 get_world_bounding_sphere(vec4 bounding_sphere, mat4 model) {
+	vec3 scale = vec3(dot(model[0].xyz, model[0].xyz), dot(model[1].xyz, model[1].xyz), dot(model[2].xyz, model[2].xyz));
+	float radius = sqrt(max(scale.x, max(scale.y, scale.z))) * bounding_sphere.w;
+	return vec4(vec3(model * vec4(bounding_sphere.xyz, 1.0f)), radius);
+}
+
+// Frustum planes taken from the rows of the view projection matrix, as in the Frustum class
+bool is_sphere_in_frustum(mat4 view_projection, vec3 center, float radius) {
+	mat4 vp_rows = transpose(view_projection);
+	vec4 planes[6] = vec4[](vp_rows[3] + vp_rows[0], vp_rows[3] - vp_rows[0],
+							vp_rows[3] + vp_rows[1], vp_rows[3] - vp_rows[1],
+							vp_rows[2], vp_rows[3] - vp_rows[2]);
+	bool is_visible = true;
+	for (int j = 0; j < 6; j++) {
+		float side = (dot(center, planes[j].xyz) + planes[j].w) / length(planes[j].xyz);
+		is_visible = is_visible && side >= -radius;
+	}
+	return is_visible;
+}
+
+#endif // #define INCLUDE_GUARD_CULLING
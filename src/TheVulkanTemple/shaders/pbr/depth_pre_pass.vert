@@ -0,0 +1,28 @@
+#version 460
+
+layout(location = 0) in vec3 position;
+
+struct ModelInstance {
+	mat4 model;
+	mat4 normal_model;
+};
+
+layout (set = 2, binding = 0) uniform uniform_buffer3 {
+    mat4 view;
+	mat4 normal_view;
+    mat4 projection;
+	vec4 camera_pos;
+};
+
+// Every draw selects the matrices of its model with firstInstance
+layout (set = 3, binding = 0) readonly buffer instance_buffer {
+	ModelInstance instances[];
+};
+
+// Computed as in pbr.vert, so that the depth passes the equal test of the pbr pass
+invariant gl_Position;
+
+void main() {
+	mat4 model = instances[gl_InstanceIndex].model;
+	gl_Position = projection * view * model * vec4(position,1.0f);
+}
\ No newline at end of file
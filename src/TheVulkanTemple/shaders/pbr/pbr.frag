@@ -4,7 +4,7 @@
 #include "../light.inc.glsl"
 #include "../lighting_helper.inc.glsl"
 
-layout (set = 0, binding = 1) uniform sampler2DArray images;
+layout (set = 0, binding = 1) uniform sampler2DArray materials[];
 
 layout (set = 1, binding = 0) readonly buffer uniform_buffer2 {
     LightParams lights[];
@@ -20,8 +20,12 @@ layout (location = 0) in VS_OUT {
     vec3 L[MAX_LIGHT_DATA];
     vec3 L_world[MAX_LIGHT_DATA];
     vec4 shadow_coord[MAX_LIGHT_DATA];
+    flat uint material_index;
 } fs_in;
 
+// The images of the primitive being drawn, which can change inside a subgroup between the draws of a multi draw
+#define images materials[nonuniformEXT(fs_in.material_index)]
+
 layout (location = 0) out vec4 frag_color;
 layout (location = 1) out vec4 normal_g_image;
 
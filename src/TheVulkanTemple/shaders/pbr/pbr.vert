@@ -8,7 +8,7 @@ layout(location = 1) in vec2 tex_coord;
 layout(location = 2) in vec3 normal;
 layout(location = 3) in vec4 tangent;
 
-layout (set = 0, binding = 0) uniform uniform_buffer1 {
+struct ModelInstance {
 	mat4 model;
 	mat4 normal_model;
 };
@@ -24,6 +24,16 @@ layout (set = 2, binding = 0) uniform uniform_buffer3 {
 	vec4 camera_pos;
 };
 
+// Every draw selects the matrices of its model with firstInstance
+layout (set = 3, binding = 0) readonly buffer instance_buffer {
+	ModelInstance instances[];
+};
+
+// The draws of a multi draw have consecutive materials
+layout (push_constant) uniform push_constants {
+	uint first_material_index;
+};
+
 #define MAX_LIGHT_DATA 8
 layout (location = 0) out VS_OUT {
 	vec3 position;
@@ -33,9 +43,16 @@ layout (location = 0) out VS_OUT {
 	vec3 L[MAX_LIGHT_DATA];
 	vec3 L_world[MAX_LIGHT_DATA];
 	vec4 shadow_coord[MAX_LIGHT_DATA];
+	flat uint material_index;
 } vs_out;
 
+// Matches the depth written by depth_pre_pass.vert
+invariant gl_Position;
+
 void main() {
+	vs_out.material_index = first_material_index + gl_DrawID;
+	mat4 model = instances[gl_InstanceIndex].model;
+	mat4 normal_model = instances[gl_InstanceIndex].normal_model;
 	vs_out.tex_coord = tex_coord;
 	vs_out.position = vec3(model * vec4(position,1.0f));
 
@@ -6,11 +6,16 @@ layout(location = 1) in vec2 tex_coord;
 layout(location = 2) in vec3 normal;
 layout(location = 3) in vec4 tangent;
 
-layout (set = 0, binding = 0) uniform uniform_buffer {
+struct ModelInstance {
 	mat4 model;
 	mat4 normal_model;
 };
 
+// Every draw selects the matrices of its model with firstInstance
+layout (set = 0, binding = 0) readonly buffer instance_buffer {
+	ModelInstance instances[];
+};
+
 layout (set = 1, binding = 0) readonly buffer uniform_buffer2 {
 	LightParams lights[];
 };
@@ -24,6 +29,7 @@ layout (location = 0) out VS_OUT {
 } vs_out;
 
 void main() {
+	mat4 model = instances[gl_InstanceIndex].model;
 	vs_out.position = lights[light_index].view * model * vec4(position, 1.0f);
     gl_Position = lights[light_index].proj * vs_out.position;
 }
\ No newline at end of file
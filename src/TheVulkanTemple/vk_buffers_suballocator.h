@@ -2,20 +2,16 @@
 #define THEVULKANTEMPLE_VK_BUFFERS_SUBALLOCATOR_H
 
 #include <vector>
-#include <array>
-#include <map>
 #include <cstdint>
-#include <utility>
 #include <unordered_map>
-#include <cmath>
 #include "external/volk.h"
 #include "external/vk_mem_alloc.h"
+#include "buddy_block_allocator.h"
 
 class VkBuffersBuddySubAllocator {
 	public:
 		VkBuffersBuddySubAllocator(VmaAllocator vma_allocator, VkBufferUsageFlags buffer_usage_flags, VmaMemoryUsage vma_memory_usage,
 				uint64_t block_initial_size, uint64_t min_allocation_size = 32);
-		~VkBuffersBuddySubAllocator();
 
 		void vk_record_buffers_pipeline_barrier(VkCommandBuffer cb, VkAccessFlags srcAccessMask, VkAccessFlags dstAccessMask,
 				uint32_t srcQueueFamilyIndex, uint32_t dstQueueFamilyIndex, VkPipelineStageFlags srcStageMask, VkPipelineStageFlags dstStageMask);
@@ -27,35 +23,31 @@ class VkBuffersBuddySubAllocator {
 		};
 		sub_allocation_data suballocate(uint64_t size, uint64_t alignment = 1);
 		void free(const sub_allocation_data& to_free);
+
+		using allocator_stats = BuddyBlockAllocator::allocator_stats;
+		allocator_stats get_stats() const { return block_allocator.get_stats(); };
+
+		// Access to the block management, for recording and replaying allocation traces
+		BuddyBlockAllocator& get_block_allocator() { return block_allocator; };
 	private:
-		VmaAllocator vma_allocator;
-		VkBufferUsageFlags buffer_usage_flags;
-		VmaMemoryUsage vma_memory_usage;
-		uint64_t block_initial_size;
-		uint64_t min_allocation_size;
-
-		struct buffer_unit_data {
-			VmaAllocation allocation;
-			void *host_ptr;
-
-			// red-black binary tree to keep size|address
-			std::multimap<uint64_t, uint64_t> free_blocks;
-
-			struct used_block {
-				uint64_t size;
-				uint64_t po2_alignment_increment;
-			};
-			// hashmap to keep address|used_block
-			std::unordered_map<uint64_t, used_block> used_blocks;
+		// Every unit of the block allocator is a VkBuffer, whose handle is used as the unit id
+		class VmaBufferBackingStore : public BuddyBlockAllocator::BackingStore {
+			public:
+				VmaBufferBackingStore(VmaAllocator vma_allocator, VkBufferUsageFlags buffer_usage_flags, VmaMemoryUsage vma_memory_usage);
+				BuddyBlockAllocator::backing_unit create_unit(uint64_t size) override;
+				void destroy_unit(uint64_t unit_id) override;
+			private:
+				VmaAllocator vma_allocator;
+				VkBufferUsageFlags buffer_usage_flags;
+				VmaMemoryUsage vma_memory_usage;
+				std::unordered_map<uint64_t, VmaAllocation> allocations;
 		};
-		std::unordered_map<VkBuffer, buffer_unit_data> buffer_units;
-
-		decltype(VkBuffersBuddySubAllocator::buffer_units)::iterator request_next_buffer(uint64_t buffer_size = 0);
+		// The backing store is declared first so that it outlives the block allocator, which releases its units on destruction
+		VmaBufferBackingStore backing_store;
+		BuddyBlockAllocator block_allocator;
 
-		std::pair<uint64_t, uint64_t> split_block_recursive(std::multimap<uint64_t, uint64_t>& buffer_free_blocks,
-				std::multimap<uint64_t, uint64_t>::iterator block_insert_hint, uint64_t new_block_sizes,
-				uint64_t old_block_address, uint64_t requested_block_size);
-		void merge_blocks_recursive(std::multimap<uint64_t, uint64_t>& buffer_free_blocks, std::pair<uint64_t, uint64_t> address_size_source_block);
+		static uint64_t buffer_to_unit_id(VkBuffer buffer) { return (uint64_t)buffer; };
+		static VkBuffer unit_id_to_buffer(uint64_t unit_id) { return (VkBuffer)unit_id; };
 };
 
 #endif
@@ -33,14 +33,19 @@ uint64_t VkModel::get_all_primitives_total_size() const {
 uint64_t VkModel::get_all_primitives_mesh_and_indices_size() const {
 	uint64_t total_size = 0;
 	for (const auto& info : host_primitives_data_info) {
-		total_size += info.get_mesh_and_index_data_size();
+		total_size += (info.get_mesh_and_index_data_size() + vertex_size - 1) / vertex_size * vertex_size;
 	}
 	return total_size;
 }
 
 void VkModel::set_model_matrix(glm::mat4 model_matrix) {
+	// Setting the same matrix again is not counted as a change
+	if (this->model_matrix == model_matrix && version != 0) {
+		return;
+	}
 	this->model_matrix = model_matrix;
 	this->normal_matrix = glm::transpose(glm::inverse(model_matrix));
+	version++;
 }
 
 uint32_t VkModel::copy_uniform_data(uint8_t *dst_ptr) const {
@@ -48,7 +53,23 @@ uint32_t VkModel::copy_uniform_data(uint8_t *dst_ptr) const {
 		memcpy(dst_ptr, &model_matrix, sizeof(glm::mat4));
 		memcpy(dst_ptr + sizeof(glm::mat4), &normal_matrix, sizeof(glm::mat4));
 	}
-	return sizeof(glm::mat4)*2;
+	return uniform_data_size;
+}
+
+uint32_t VkModel::copy_cull_data(uint8_t *dst_ptr, uint32_t model_index) const {
+	if (dst_ptr != nullptr) {
+		for (uint32_t i = 0; i < host_primitives_data_info.size(); i++) {
+			primitive_cull_data cull_data = {
+					glm::vec4(host_primitives_data_info[i].b_sphere.center, host_primitives_data_info[i].b_sphere.radius),
+					model_index,
+					host_primitives_data_info[i].indices,
+					device_primitives_data_info[i].first_index,
+					device_primitives_data_info[i].vertex_offset
+			};
+			memcpy(dst_ptr + i * sizeof(primitive_cull_data), &cull_data, sizeof(primitive_cull_data));
+		}
+	}
+	return host_primitives_data_info.size() * sizeof(primitive_cull_data);
 }
 
 void VkModel::vk_create_images(float mip_bias, VmaAllocator vma_allocator) {
@@ -117,10 +138,13 @@ void VkModel::vk_record_buffer_copies_from_host_to_device(VkCommandBuffer cb, Vk
 		buffer_copy.srcOffset = host_buffer_offset;
 		host_buffer_offset += this->host_primitives_data_info[j].get_total_size();
 
-		device_buffer_offset = vulkan_helper::get_aligned_memory_size(device_buffer_offset, 12);
+		// The vertices start at a multiple of the vertex size, then the indices follow them. Since the vertices size is a multiple
+		// of 4 the indices are aligned to their size, so both can be addressed from the start of the buffer
+		device_buffer_offset = (device_buffer_offset + vertex_size - 1) / vertex_size * vertex_size;
 		buffer_copy.dstOffset = device_buffer_offset;
-		this->device_primitives_data_info[j].primitive_vertices_data_offset = device_buffer_offset;
-		this->device_primitives_data_info[j].index_data_offset = device_buffer_offset + this->host_primitives_data_info[j].interleaved_vertices_data_size;
+		uint32_t index_size = this->host_primitives_data_info[j].index_data_size / this->host_primitives_data_info[j].indices;
+		this->device_primitives_data_info[j].vertex_offset = device_buffer_offset / vertex_size;
+		this->device_primitives_data_info[j].first_index = (device_buffer_offset + this->host_primitives_data_info[j].interleaved_vertices_data_size) / index_size;
 		device_buffer_offset += this->host_primitives_data_info[j].get_mesh_and_index_data_size();
 
 		buffer_copy.size = this->host_primitives_data_info[j].get_mesh_and_index_data_size();
@@ -232,77 +256,95 @@ uint64_t VkModel::vk_init_images(VkCommandBuffer cb, VkBuffer host_image_transie
 	return image_data_offset;
 }
 
-std::vector<VkWriteDescriptorSet> VkModel::get_descriptor_writes(std::span<VkDescriptorSet> descriptor_sets, VkBuffer uniform_buffer, uint32_t uniform_buffer_offset) {
-	std::vector<VkWriteDescriptorSet> writes_descriptor_set(device_primitives_data_info.size()*2); // 2 descriptor write per descriptor
-
-	// Same uniform variables are shared for all primitives
-	VkDescriptorBufferInfo *descriptor_buffer_info = new VkDescriptorBufferInfo;
-	*descriptor_buffer_info = {
-			uniform_buffer,
-			uniform_buffer_offset,
-			this->copy_uniform_data(nullptr)
-	};
-
+std::vector<VkDescriptorImageInfo> VkModel::get_descriptor_image_infos() const {
 	// Each primitive has its own image
-	VkDescriptorImageInfo *descriptor_image_infos = new VkDescriptorImageInfo[device_primitives_data_info.size()];
-
+	std::vector<VkDescriptorImageInfo> descriptor_image_infos(device_primitives_data_info.size());
 	for (uint32_t i = 0; i < this->device_primitives_data_info.size(); i++) {
-		device_primitives_data_info[i].descriptor_set = descriptor_sets[i];
-
 		descriptor_image_infos[i] = {
 				this->device_primitives_data_info[i].sampler,
 				this->device_primitives_data_info[i].image_view,
 				VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL
 		};
+	}
+	return descriptor_image_infos;
+}
 
-		writes_descriptor_set[i*2] = {
-				VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
-				nullptr,
-				descriptor_sets[i],
-				0,
-				0,
-				1,
-				VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,
-				nullptr,
-				descriptor_buffer_info,
-				nullptr
-		};
-		writes_descriptor_set[i*2+1] = {
-				VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
-				nullptr,
-				descriptor_sets[i],
-				1,
-				0,
-				1,
-				VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
-				&descriptor_image_infos[i],
-				nullptr,
-				nullptr
-		};
+void VkModel::vk_record_primitive_draw(VkCommandBuffer command_buffer, uint32_t primitive_index, uint32_t instance_index, VkBuffer &bound_buffer,
+									   VkIndexType &bound_index_type, VkPipelineLayout pipeline_layout, uint32_t material_index) const {
+	const auto &device_data_info = device_primitives_data_info[primitive_index];
+	if (pipeline_layout != VK_NULL_HANDLE) {
+		vkCmdPushConstants(command_buffer, pipeline_layout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(uint32_t), &material_index);
+	}
+	if (bound_buffer != device_data_info.data_buffer) {
+		VkDeviceSize buffer_offset = 0;
+		vkCmdBindVertexBuffers(command_buffer, 0, 1, &device_data_info.data_buffer, &buffer_offset);
+	}
+	if (bound_buffer != device_data_info.data_buffer || bound_index_type != device_data_info.index_data_type) {
+		vkCmdBindIndexBuffer(command_buffer, device_data_info.data_buffer, 0, device_data_info.index_data_type);
+	}
+	bound_buffer = device_data_info.data_buffer;
+	bound_index_type = device_data_info.index_data_type;
+	vkCmdDrawIndexed(command_buffer, host_primitives_data_info[primitive_index].indices, 1, device_data_info.first_index,
+					 device_data_info.vertex_offset, instance_index);
+}
+
+bool VkModel::is_visible(const Frustum &frustum) const {
+	for (uint32_t i = 0; i < host_primitives_data_info.size(); i++) {
+		if (is_primitive_visible(i, frustum)) {
+			return true;
+		}
 	}
-	return writes_descriptor_set;
+	return false;
 }
 
-void VkModel::clean_descriptor_writes(std::span<VkWriteDescriptorSet> first_two_write_descriptor_set) {
-	delete first_two_write_descriptor_set[0].pBufferInfo;
-	delete[] first_two_write_descriptor_set[1].pImageInfo;
+glm::vec3 VkModel::get_primitive_center(uint32_t primitive_index) const {
+	return glm::vec3(model_matrix * glm::vec4(host_primitives_data_info[primitive_index].b_sphere.center, 1.0f));
 }
 
-void VkModel::vk_record_draw(VkCommandBuffer command_buffer, VkPipelineLayout pipeline_layout, uint32_t model_set_shader_index, const Camera *camera) const {
-	for (uint32_t i = 0; i < device_primitives_data_info.size(); i++) {
-        bool is_object_visible = true;
-        if (camera) {
-            glm::vec3 scale(glm::length2(glm::vec3(model_matrix[0])), glm::length2(glm::vec3(model_matrix[1])), glm::length2(glm::vec3(model_matrix[2])));
-            float max_scale = glm::sqrt(glm::compMax(scale));
-            is_object_visible = camera->is_sphere_visible(glm::vec3(model_matrix * glm::vec4(host_primitives_data_info[i].b_sphere.center, 1.0f)),
-                                                          max_scale * host_primitives_data_info[i].b_sphere.radius);
-        }
-
-        if (is_object_visible) {
-            vkCmdBindDescriptorSets(command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline_layout, model_set_shader_index, 1, &this->device_primitives_data_info[i].descriptor_set, 0, nullptr);
-            vkCmdBindVertexBuffers(command_buffer, 0, 1, &device_primitives_data_info[i].data_buffer, &device_primitives_data_info[i].primitive_vertices_data_offset);
-            vkCmdBindIndexBuffer(command_buffer, device_primitives_data_info[i].data_buffer, device_primitives_data_info[i].index_data_offset, device_primitives_data_info[i].index_data_type);
-            vkCmdDrawIndexed(command_buffer, host_primitives_data_info[i].indices, 1, 0, 0, 0);
-        }
+bool VkModel::is_primitive_visible(uint32_t primitive_index, const Frustum &frustum) const {
+	// The sphere is scaled by the biggest scale of the model, so that it still contains the primitive
+	glm::vec3 scale(glm::length2(glm::vec3(model_matrix[0])), glm::length2(glm::vec3(model_matrix[1])), glm::length2(glm::vec3(model_matrix[2])));
+	float max_scale = glm::sqrt(glm::compMax(scale));
+	return frustum.is_sphere_visible(get_primitive_center(primitive_index), max_scale * host_primitives_data_info[primitive_index].b_sphere.radius);
+}
+
+std::vector<VkModel::draw_batch> VkModel::get_draw_batches(std::span<const VkModel> vk_models) {
+	std::vector<draw_batch> batches;
+	uint32_t primitive_index = 0;
+	for (const auto &vk_model : vk_models) {
+		for (const auto &device_data_info : vk_model.device_primitives_data_info) {
+			if (batches.empty() || batches.back().data_buffer != device_data_info.data_buffer ||
+				batches.back().index_type != device_data_info.index_data_type) {
+				batches.push_back({device_data_info.data_buffer, device_data_info.index_data_type, primitive_index, 0});
+			}
+			batches.back().primitives_count++;
+			primitive_index++;
+		}
+	}
+	return batches;
+}
+
+void VkModel::vk_record_batched_indirect_draws(VkCommandBuffer command_buffer, std::span<const draw_batch> batches, VkBuffer draw_commands_buffer,
+											   uint64_t first_draw_command_offset, VkPipelineLayout pipeline_layout, uint32_t first_material_index) {
+	VkBuffer bound_buffer = VK_NULL_HANDLE;
+	VkIndexType bound_index_type = VK_INDEX_TYPE_MAX_ENUM;
+	for (const auto &batch : batches) {
+		if (bound_buffer != batch.data_buffer) {
+			VkDeviceSize buffer_offset = 0;
+			vkCmdBindVertexBuffers(command_buffer, 0, 1, &batch.data_buffer, &buffer_offset);
+		}
+		if (bound_buffer != batch.data_buffer || bound_index_type != batch.index_type) {
+			vkCmdBindIndexBuffer(command_buffer, batch.data_buffer, 0, batch.index_type);
+		}
+		bound_buffer = batch.data_buffer;
+		bound_index_type = batch.index_type;
+
+		if (pipeline_layout != VK_NULL_HANDLE) {
+			uint32_t material_index = first_material_index + batch.first_primitive;
+			vkCmdPushConstants(command_buffer, pipeline_layout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(uint32_t), &material_index);
+		}
+		// The commands of the culled primitives have 0 instances, so every primitive of the batch can be drawn without looking at the result
+		vkCmdDrawIndexedIndirect(command_buffer, draw_commands_buffer, first_draw_command_offset + batch.first_primitive * sizeof(VkDrawIndexedIndirectCommand),
+								 batch.primitives_count, sizeof(VkDrawIndexedIndirectCommand));
 	}
 }
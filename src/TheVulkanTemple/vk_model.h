@@ -3,7 +3,7 @@
 
 #include "vulkan_helper.h"
 #include <span>
-#include "camera.h"
+#include "frustum.h"
 #include "external/vk_mem_alloc.h"
 
 // Class that manages and acts on a model from a vulkan perspective,
@@ -12,6 +12,11 @@
 // TODO: implement a class to suballocate vertices data in a buffer
 class VkModel {
 	public:
+		// Size of the interleaved position, texcoord, normal and tangent of a vertex
+		static constexpr uint32_t vertex_size = 12 * sizeof(float);
+		// Size of the model and normal matrices written by copy_uniform_data
+		static constexpr uint32_t uniform_data_size = 2 * sizeof(glm::mat4);
+
 		struct primitive_host_data_info {
 			uint32_t interleaved_vertices_data_size;
 			uint32_t vertices;
@@ -48,21 +53,50 @@ class VkModel {
 			VkImageView image_view = VK_NULL_HANDLE;
 			VkSampler sampler =  VK_NULL_HANDLE;
 
+			// The vertices and indices are addressed from the start of the buffer, so that it is bound once for many primitives
 			VkBuffer data_buffer;
-			VkDescriptorSet descriptor_set;
-			uint64_t index_data_offset;
 			VkIndexType index_data_type;
-			uint64_t primitive_vertices_data_offset;
+			uint32_t first_index;
+			int32_t vertex_offset;
+		};
+
+		// Data read by the gpu culling for every primitive, the shader has the same layout
+		struct primitive_cull_data {
+			glm::vec4 bounding_sphere;
+			uint32_t model_index;
+			uint32_t index_count;
+			uint32_t first_index;
+			int32_t vertex_offset;
+		};
+
+		// Consecutive primitives of one or more models that can be drawn with a single indirect draw
+		struct draw_batch {
+			VkBuffer data_buffer;
+			VkIndexType index_type;
+			uint32_t first_primitive;
+			uint32_t primitives_count;
 		};
 
 		VkModel(VkDevice device, std::string model_file_path, std::vector<primitive_host_data_info> infos, glm::mat4 model_matrix = glm::mat4(1.0f));
 		~VkModel();
 
 		uint64_t get_all_primitives_total_size() const;
+		// The mesh data of every primitive is padded to a multiple of vertex_size, the allocation must be aligned to it as well
 		uint64_t get_all_primitives_mesh_and_indices_size() const;
+		uint32_t get_primitives_count() const { return host_primitives_data_info.size(); };
+		// True if the bounding sphere of at least one primitive touches the frustum
+		bool is_visible(const Frustum &frustum) const;
+		bool is_primitive_visible(uint32_t primitive_index, const Frustum &frustum) const;
+		// Center of the bounding sphere of the primitive in world space
+		glm::vec3 get_primitive_center(uint32_t primitive_index) const;
+		VkIndexType get_primitive_index_type(uint32_t primitive_index) const { return device_primitives_data_info[primitive_index].index_data_type; };
 
 		void set_model_matrix(glm::mat4 model_matrix);
+		// Incremented every time the model matrix changes
+		uint64_t get_version() const { return version; };
 		uint32_t copy_uniform_data(uint8_t *dst_ptr) const;
+		// Copies one primitive_cull_data for every primitive, model_index is the index of the model in the instance data
+		uint32_t copy_cull_data(uint8_t *dst_ptr, uint32_t model_index) const;
 
         // Creating the image, image view and sampler of each primitive in the model
         void vk_create_images(float mip_bias, VmaAllocator vma_allocator);
@@ -70,14 +104,22 @@ class VkModel {
         // copies mesh data from host buffer to device buffer and copies image data from host buffer to device image
         void vk_init_model(VkCommandBuffer cb, VkBuffer host_buffer, uint64_t host_buffer_offset, VkBuffer device_buffer, uint64_t device_buffer_offset);
 
-		// By giving the descriptor sets (with .size == primitives) it returns the structures to pass to vkWriteDescriptorSets
-		std::vector<VkWriteDescriptorSet> get_descriptor_writes(std::span<VkDescriptorSet> descriptor_sets, VkBuffer uniform_buffer, uint32_t uniform_buffer_offset);
-
-		// The vector returned by get_descriptor_writes has pointers inside to dynamically allocated memory, this function cleans them
-		void clean_descriptor_writes(std::span<VkWriteDescriptorSet> first_two_write_descriptor_set);
+		// One image info for every primitive, to be written in the materials array at the material index of the primitive
+		std::vector<VkDescriptorImageInfo> get_descriptor_image_infos() const;
 
 		// Before recording the draw, all fields of device_data_info needs to be set
-		void vk_record_draw(VkCommandBuffer command_buffer, VkPipelineLayout pipeline_layout, uint32_t model_set_shader_index, const Camera *camera = nullptr) const;
+		// The instance index is passed as firstInstance, so that the shaders find the matrices of the model in the instance data.
+		// The buffer is bound only if it is not the bound one, so that draws of different models can share the binds, and then
+		// bound_buffer and bound_index_type are updated. With a pipeline layout the material index is pushed as a vertex push constant
+		void vk_record_primitive_draw(VkCommandBuffer command_buffer, uint32_t primitive_index, uint32_t instance_index, VkBuffer &bound_buffer,
+									  VkIndexType &bound_index_type, VkPipelineLayout pipeline_layout = VK_NULL_HANDLE, uint32_t material_index = 0) const;
+
+		// Groups the primitives of the models in batches that share the buffer and index type
+		static std::vector<draw_batch> get_draw_batches(std::span<const VkModel> vk_models);
+		// Records one multi draw for every batch, the commands of the primitives are read from the buffer starting from first_draw_command_offset.
+		// With a pipeline layout the material index of the first primitive of the batch is pushed, and the shaders add gl_DrawID to it
+		static void vk_record_batched_indirect_draws(VkCommandBuffer command_buffer, std::span<const draw_batch> batches, VkBuffer draw_commands_buffer,
+													 uint64_t first_draw_command_offset, VkPipelineLayout pipeline_layout = VK_NULL_HANDLE, uint32_t first_material_index = 0);
 	private:
 
         // Copies data from a host buffer to the images and creates all mipmaps level from them
@@ -91,6 +133,7 @@ class VkModel {
 		VmaAllocator vma_allocator;
 		glm::mat4 model_matrix = glm::mat4(1.0f);
 		glm::mat4 normal_matrix = glm::mat4(1.0f);
+		uint64_t version = 0;
 
 		std::vector<primitive_host_data_info> host_primitives_data_info;
 		std::vector<primitive_device_data_info> device_primitives_data_info;
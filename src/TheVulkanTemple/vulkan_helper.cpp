@@ -11,14 +11,18 @@ namespace vulkan_helper
 {
 
     VkPresentModeKHR select_presentation_mode(const std::vector<VkPresentModeKHR> &presentation_modes, VkPresentModeKHR desired_presentation_mode) {
-        VkPresentModeKHR selected_present_mode;
-        if (std::find(presentation_modes.begin(), presentation_modes.end(), desired_presentation_mode) != presentation_modes.end()) {
-            selected_present_mode = VK_PRESENT_MODE_MAILBOX_KHR;
+        // If the desired mode is not available, IMMEDIATE falls back to MAILBOX which still does not wait for the vblank,
+        // then everything falls back to FIFO which is always supported
+        std::vector<VkPresentModeKHR> candidate_presentation_modes = {desired_presentation_mode};
+        if (desired_presentation_mode == VK_PRESENT_MODE_IMMEDIATE_KHR) {
+            candidate_presentation_modes.push_back(VK_PRESENT_MODE_MAILBOX_KHR);
         }
-        else {
-            selected_present_mode = VK_PRESENT_MODE_FIFO_KHR;
+        for (const auto& candidate : candidate_presentation_modes) {
+            if (std::find(presentation_modes.begin(), presentation_modes.end(), candidate) != presentation_modes.end()) {
+                return candidate;
+            }
         }
-        return selected_present_mode;
+        return VK_PRESENT_MODE_FIFO_KHR;
     }
 
     uint32_t select_number_of_images(const VkSurfaceCapabilitiesKHR &surface_capabilities) {
@@ -175,6 +179,8 @@ namespace vulkan_helper
                 CREATE_STRUCT_CASE(VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_1_FEATURES, VkPhysicalDeviceVulkan11Features)
                 CREATE_STRUCT_CASE(VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MULTIVIEW_FEATURES, VkPhysicalDeviceMultiviewFeatures)
                 CREATE_STRUCT_CASE(VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_16BIT_STORAGE_FEATURES, VkPhysicalDevice16BitStorageFeatures)
+                CREATE_STRUCT_CASE(VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_TIMELINE_SEMAPHORE_FEATURES_KHR, VkPhysicalDeviceTimelineSemaphoreFeaturesKHR)
+                CREATE_STRUCT_CASE(VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_SHADER_DRAW_PARAMETERS_FEATURES, VkPhysicalDeviceShaderDrawParametersFeatures)
                 default:
                 	return new_physical_device_struct_chain;
             }
@@ -208,6 +214,8 @@ namespace vulkan_helper
                 COMPARE_STRUCT_CASE(VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_1_FEATURES, VkPhysicalDeviceVulkan11Features)
                 COMPARE_STRUCT_CASE(VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MULTIVIEW_FEATURES, VkPhysicalDeviceMultiviewFeatures)
                 COMPARE_STRUCT_CASE(VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_16BIT_STORAGE_FEATURES, VkPhysicalDevice16BitStorageFeatures)
+                COMPARE_STRUCT_CASE(VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_TIMELINE_SEMAPHORE_FEATURES_KHR, VkPhysicalDeviceTimelineSemaphoreFeaturesKHR)
+                COMPARE_STRUCT_CASE(VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_SHADER_DRAW_PARAMETERS_FEATURES, VkPhysicalDeviceShaderDrawParametersFeatures)
             }
             p_next_base = reinterpret_cast<const VkPhysicalDeviceFeatures2*>(p_next_base)->pNext;
             p_next_requested = reinterpret_cast<const VkPhysicalDeviceFeatures2*>(p_next_requested)->pNext;
@@ -234,6 +242,8 @@ namespace vulkan_helper
             	FREE_STRUCT_CASE(VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_1_FEATURES, VkPhysicalDeviceVulkan11Features)
             	FREE_STRUCT_CASE(VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MULTIVIEW_FEATURES, VkPhysicalDeviceMultiviewFeatures)
             	FREE_STRUCT_CASE(VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_16BIT_STORAGE_FEATURES, VkPhysicalDevice16BitStorageFeatures)
+            	FREE_STRUCT_CASE(VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_TIMELINE_SEMAPHORE_FEATURES_KHR, VkPhysicalDeviceTimelineSemaphoreFeaturesKHR)
+            	FREE_STRUCT_CASE(VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_SHADER_DRAW_PARAMETERS_FEATURES, VkPhysicalDeviceShaderDrawParametersFeatures)
             }
         }
     }
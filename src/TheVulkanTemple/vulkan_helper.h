@@ -44,8 +44,10 @@ namespace vulkan_helper {
         RENDER_PASS_CREATION_FAILED,
         FRAMEBUFFER_CREATION_FAILED,
         SHADER_MODULE_CREATION_FAILED,
+        PIPELINE_CACHE_CREATION_FAILED,
         ACQUIRE_NEXT_IMAGE_FAILED,
-        QUEUE_PRESENT_FAILED
+        QUEUE_PRESENT_FAILED,
+        SEMAPHORE_CREATION_FAILED
     };
 
 	VkPresentModeKHR select_presentation_mode(const std::vector<VkPresentModeKHR>& presentation_modes, VkPresentModeKHR desired_presentation_mode);
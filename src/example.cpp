@@ -1,7 +1,10 @@
 #include <iostream>
 #include <utility>
 #include <vector>
+#include <fstream>
+#include <optional>
 #include "TheVulkanTemple/graphics_module_vulkan_app.h"
+#include "TheVulkanTemple/benchmark.h"
 #include <glm/glm.hpp>
 #include <glm/gtx/string_cast.hpp>
 #include <glm/gtc/constants.hpp>
@@ -72,14 +75,61 @@ void frame_start(GraphicsModuleVulkanApp *app, uint32_t delta_time) {
 		app->get_light_ptr(1)->set_color(glm::vec3(0.0f));
 	}
 
+	if (glfwGetKey(window, GLFW_KEY_F1) == GLFW_PRESS) {
+		std::cout << app->get_allocators_stats_json() << std::endl;
+	}
+	if (glfwGetKey(window, GLFW_KEY_F2) == GLFW_PRESS) {
+		std::cout << app->get_job_timings_json() << std::endl;
+	}
+	if (glfwGetKey(window, GLFW_KEY_F3) == GLFW_PRESS) {
+		GpuCullingContext::culling_stats stats = app->get_culling_stats();
+		std::cout << "Drawn primitives: " << stats.drawn_primitives << ", frustum culled: " << stats.frustum_culled_primitives
+				  << ", occlusion culled: " << stats.occlusion_culled_primitives << std::endl;
+	}
+	if (glfwGetKey(window, GLFW_KEY_F4) == GLFW_PRESS) {
+		std::cout << "Pbr gpu time: " << app->get_pbr_gpu_time() << " ms" << std::endl;
+	}
+
 	//std::cout << glm::to_string(app->get_camera_ptr()->pos) << std::endl;
 	//std::cout << glm::to_string(app->get_camera_ptr()->dir) << std::endl;
 }
 
-int main() {
+int main(int argc, char *argv[]) {
     EngineOptions options;
+    // --headless [frames] renders the scene without a window, for 600 frames by default. --benchmark [path file] plays the
+    // path of the file or a scripted one and writes benchmark_report.json. --record-path <file> saves the path of the session,
+    // --record-allocations <file> its suballocators traces
+    bool run_benchmark = false;
+    std::optional<std::string> benchmark_path_file, record_path_file, record_allocations_file;
+    for (int i = 1; i < argc; i++) {
+    	std::string arg = argv[i];
+    	bool has_value = i + 1 < argc && argv[i + 1][0] != '-';
+    	if (arg == "--headless") {
+    		options.headless = true;
+    		options.frames_to_render = has_value ? std::stoull(argv[++i]) : 600;
+    	}
+    	else if (arg == "--benchmark") {
+    		run_benchmark = true;
+    		if (has_value) {
+    			benchmark_path_file = argv[++i];
+    		}
+    	}
+    	else if (arg == "--record-path" && has_value) {
+    		record_path_file = argv[++i];
+    	}
+    	else if (arg == "--record-allocations" && has_value) {
+    		record_allocations_file = argv[++i];
+    	}
+    }
+    // The benchmark stops the frame loop once it has measured all its frames
+    if (run_benchmark) {
+    	options.frames_to_render = 0;
+    }
+    // The output of the benchmark and headless runs is only their report
+    options.print_frame_times = !run_benchmark && !options.headless;
     options.fsr_settings.preset = AmdFsr::Preset::ULTRA_QUALITY;
 	options.fsr_settings.precision = AmdFsr::Precision::FP16;
+	options.gpu_driven_rendering = true;
   
 	try {
 	    VkExtent2D screen_size = {800,800};
@@ -98,6 +148,8 @@ int main() {
 
         glm::mat4 rifle_m_matrix = glm::scale(glm::vec3(1.0f));
 
+		app.set_job_timing_recording(true);
+		app.set_allocation_trace_recording(record_allocations_file.has_value());
 		app.load_3d_objects({
 							{"resources/models/WaterBottle/WaterBottle.glb", water_bottle_m_matrix},
 							{"resources//models//Table//Table.glb", table_m_matrix},
@@ -120,7 +172,44 @@ int main() {
 
         app.init_renderer();
 
-        app.start_frame_loop(resize_callback, frame_start);
+        // 60 steps per second, both for the benchmark and for the recorded paths
+        Benchmark benchmark(1.0f / 60.0f, 120, 1000);
+        if (run_benchmark && benchmark_path_file) {
+        	benchmark.load_path(*benchmark_path_file);
+        }
+        else if (run_benchmark) {
+        	benchmark.add_camera_keyframe({0.0f, {-0.20, 0.30, -0.02}, {0.987121, -0.157343, 0.028908}});
+        	benchmark.add_camera_keyframe({5.0f, {1.50, 0.60, -0.50}, {-0.894427, -0.223607, 0.387298}});
+        	benchmark.add_camera_keyframe({10.0f, {0.50, 1.20, 1.50}, {-0.242536, -0.363803, -0.899438}});
+        	benchmark.add_camera_keyframe({17.0f, {-0.20, 0.30, -0.02}, {0.987121, -0.157343, 0.028908}});
+        	benchmark.add_light_keyframe(0, {0.0f, {-0.010837, 1.506811, -0.328537}, {-0.004270, -0.702568, 0.711604}});
+        	benchmark.add_light_keyframe(0, {17.0f, {0.8, 1.506811, 0.328537}, glm::normalize(glm::vec3(-0.5, -0.702568, -0.5))});
+        }
+
+        app.start_frame_loop(resize_callback, [&](GraphicsModuleVulkanApp *app, uint32_t delta_time) {
+        	if (run_benchmark) {
+        		benchmark.on_frame_start(app);
+        		return;
+        	}
+        	if (!options.headless) {
+        		frame_start(app, delta_time);
+        	}
+        	if (record_path_file) {
+        		benchmark.record_keyframe(app);
+        	}
+        });
+
+        if (run_benchmark) {
+        	std::string report = benchmark.get_report_json();
+        	std::cout << report << std::endl;
+        	std::ofstream("benchmark_report.json") << report;
+        }
+        if (record_path_file) {
+        	benchmark.save_path(*record_path_file);
+        }
+        if (record_allocations_file) {
+        	std::ofstream(*record_allocations_file) << app.get_allocation_traces_json();
+        }
 	}
 	catch (std::pair<int32_t,vulkan_helper::Error>& err) {
 		std::cout << "The application encounted the error: " << magic_enum::enum_name(err.second) << " with return value: " << err.first << std::endl;
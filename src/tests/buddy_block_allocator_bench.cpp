@@ -0,0 +1,43 @@
+// Times the buddy suballocator on random traces and on the traces of recorded sessions, run without a device
+// Usage: buddy_block_allocator_bench [session trace files...], the files are written by the sample with --record-allocations
+#include <chrono>
+#include <iostream>
+#include "buddy_block_allocator_test_utils.h"
+
+namespace {
+	// Replays the trace the given times, each on a fresh allocator, and prints the mean time per event
+	void bench_trace(const std::string &name, const std::vector<BuddyBlockAllocator::trace_event> &trace, uint64_t block_initial_size,
+			uint64_t min_allocation_size, uint32_t repetitions) {
+		uint64_t total_ns = 0;
+		BuddyBlockAllocator::allocator_stats stats;
+		for (uint32_t i = 0; i < repetitions; i++) {
+			NullBackingStore backing_store;
+			BuddyBlockAllocator allocator(backing_store, block_initial_size, min_allocation_size);
+			auto start_time = std::chrono::steady_clock::now();
+			allocator.replay_trace(trace);
+			total_ns += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start_time).count();
+			stats = allocator.get_stats();
+		}
+		std::cout << name << ": " << trace.size() << " events, " << static_cast<double>(total_ns) / (repetitions * trace.size())
+				  << " ns/event, " << stats.buffer_units << " units and " << stats.live_blocks << " live blocks at the end" << std::endl;
+	}
+}
+
+int main(int argc, char *argv[]) {
+	std::mt19937_64 random_engine(50);
+	bench_trace("random, small sizes, power of 2 alignments",
+				generate_random_trace(random_engine, 100000, 256, {1, 4, 16, 64, 256}), 1 << 20, 32, 10);
+	bench_trace("random, small sizes, odd alignments",
+				generate_random_trace(random_engine, 100000, 256, {1, 3, 24, 48, 96}), 1 << 20, 32, 10);
+	bench_trace("random, mesh sizes, power of 2 alignments",
+				generate_random_trace(random_engine, 100000, 1 << 20, {4, 16, 256}), 1 << 26, 32, 10);
+	bench_trace("random, mostly allocations",
+				generate_random_trace(random_engine, 100000, 4096, {1, 64, 256}, 4), 1 << 20, 32, 10);
+
+	for (int i = 1; i < argc; i++) {
+		for (const session_trace &trace : load_session_traces(argv[i])) {
+			bench_trace(std::string(argv[i]) + " " + trace.name, trace.trace, trace.block_initial_size, trace.min_allocation_size, 10);
+		}
+	}
+	return 0;
+}
@@ -0,0 +1,72 @@
+#ifndef THEVULKANTEMPLE_BUDDY_BLOCK_ALLOCATOR_TEST_UTILS_H
+#define THEVULKANTEMPLE_BUDDY_BLOCK_ALLOCATOR_TEST_UTILS_H
+
+#include <string>
+#include <vector>
+#include <random>
+#include <fstream>
+#include "../TheVulkanTemple/buddy_block_allocator.h"
+
+// Backing store that only hands out ids, for the traces whose units are too big to be backed by host memory
+class NullBackingStore : public BuddyBlockAllocator::BackingStore {
+	public:
+		BuddyBlockAllocator::backing_unit create_unit(uint64_t) override {
+			live_units++;
+			return { next_unit_id++, nullptr };
+		};
+		void destroy_unit(uint64_t) override { live_units--; };
+
+		uint64_t live_units = 0;
+	private:
+		uint64_t next_unit_id = 1;
+};
+
+// Trace of one suballocator of a session, as written by GraphicsModuleVulkanApp::get_allocation_traces_json()
+struct session_trace {
+	std::string name;
+	uint64_t block_initial_size;
+	uint64_t min_allocation_size;
+	std::vector<BuddyBlockAllocator::trace_event> trace;
+};
+
+inline std::vector<session_trace> load_session_traces(const std::string &file_path) {
+	std::ifstream file(file_path);
+	nlohmann::json traces_json = nlohmann::json::parse(file);
+	std::vector<session_trace> traces;
+	for (const auto& [name, allocator_json] : traces_json.items()) {
+		traces.push_back({
+			name,
+			allocator_json.at("block_initial_size").get<uint64_t>(),
+			allocator_json.at("min_allocation_size").get<uint64_t>(),
+			allocator_json.at("trace").get<std::vector<BuddyBlockAllocator::trace_event>>()
+		});
+	}
+	return traces;
+}
+
+// Random sequence of allocations and frees, the sizes and alignments are drawn from the given ones. A free picks a random
+// live allocation, and about one event in free_every is a free
+inline std::vector<BuddyBlockAllocator::trace_event> generate_random_trace(std::mt19937_64 &random_engine, uint64_t events_count,
+		uint64_t max_size, const std::vector<uint64_t> &alignments, uint32_t free_every = 2) {
+	std::vector<BuddyBlockAllocator::trace_event> trace;
+	std::vector<uint64_t> live_allocation_events;
+	std::uniform_int_distribution<uint64_t> size_distribution(1, max_size);
+	std::uniform_int_distribution<size_t> alignment_distribution(0, alignments.size() - 1);
+	std::uniform_int_distribution<uint32_t> free_distribution(0, free_every - 1);
+	for (uint64_t i = 0; i < events_count; i++) {
+		if (!live_allocation_events.empty() && free_distribution(random_engine) == 0) {
+			std::uniform_int_distribution<size_t> live_distribution(0, live_allocation_events.size() - 1);
+			size_t live_index = live_distribution(random_engine);
+			trace.push_back({ true, trace[live_allocation_events[live_index]].size, 0, live_allocation_events[live_index] });
+			live_allocation_events[live_index] = live_allocation_events.back();
+			live_allocation_events.pop_back();
+		}
+		else {
+			live_allocation_events.push_back(trace.size());
+			trace.push_back({ false, size_distribution(random_engine), alignments[alignment_distribution(random_engine)], 0 });
+		}
+	}
+	return trace;
+}
+
+#endif //THEVULKANTEMPLE_BUDDY_BLOCK_ALLOCATOR_TEST_UTILS_H
@@ -0,0 +1,216 @@
+// Tests of the block management of the buddy suballocator, run without a device
+// Usage: buddy_block_allocator_tests [session trace files...], the files are written by the sample with --record-allocations
+#include <map>
+#include <iostream>
+#include <algorithm>
+#include "buddy_block_allocator_test_utils.h"
+
+namespace {
+	int failures = 0;
+
+	void check(bool condition, const char *expression, int line) {
+		if (!condition) {
+			std::cerr << "Check failed at line " << line << ": " << expression << std::endl;
+			failures++;
+		}
+	}
+	#define CHECK(condition) check(condition, #condition, __LINE__)
+
+	bool same_trace(const std::vector<BuddyBlockAllocator::trace_event> &a, const std::vector<BuddyBlockAllocator::trace_event> &b) {
+		return std::equal(a.begin(), a.end(), b.begin(), b.end(), [](const auto &event_a, const auto &event_b) {
+			return event_a.is_free == event_b.is_free && event_a.size == event_b.size && event_a.alignment == event_b.alignment &&
+				   (!event_a.is_free || event_a.allocation_event_index == event_b.allocation_event_index);
+		});
+	}
+
+	bool same_state(const BuddyBlockAllocator::allocator_stats &a, const BuddyBlockAllocator::allocator_stats &b) {
+		return a.buffer_units == b.buffer_units && a.reserved_bytes == b.reserved_bytes && a.live_blocks == b.live_blocks &&
+			   a.requested_bytes == b.requested_bytes && a.allocated_bytes == b.allocated_bytes && a.largest_free_block == b.largest_free_block &&
+			   a.allocation_count == b.allocation_count && a.free_count == b.free_count;
+	}
+
+	void test_split_and_merge() {
+		BuddyBlockAllocator::HostMemoryBackingStore backing_store;
+		BuddyBlockAllocator allocator(backing_store, 1024, 32);
+
+		// The unit is split down to the requested size, the left halves are taken first
+		BuddyBlockAllocator::block_allocation a = allocator.allocate(32);
+		CHECK(a.unit_id != 0 && a.offset == 0 && a.host_ptr != nullptr);
+		CHECK(allocator.get_stats().largest_free_block == 512);
+		BuddyBlockAllocator::block_allocation b = allocator.allocate(32);
+		CHECK(b.unit_id == a.unit_id && b.offset == 32);
+		CHECK(static_cast<uint8_t*>(b.host_ptr) - static_cast<uint8_t*>(a.host_ptr) == 32);
+		BuddyBlockAllocator::block_allocation c = allocator.allocate(64);
+		CHECK(c.unit_id == a.unit_id && c.offset == 64);
+		// Sizes are rounded up to a power of 2
+		BuddyBlockAllocator::block_allocation d = allocator.allocate(100);
+		CHECK(d.offset == 128);
+		CHECK(allocator.get_stats().allocated_bytes == 32 + 32 + 64 + 128);
+		CHECK(allocator.get_stats().requested_bytes == 32 + 32 + 64 + 100);
+
+		// Two free buddies are merged, and the merged block is reused
+		allocator.free(a.unit_id, a.offset);
+		allocator.free(b.unit_id, b.offset);
+		BuddyBlockAllocator::block_allocation e = allocator.allocate(64);
+		CHECK(e.unit_id == a.unit_id && e.offset == 0);
+
+		// Freeing everything but one block merges back the rest of the unit
+		allocator.free(c.unit_id, c.offset);
+		allocator.free(d.unit_id, d.offset);
+		CHECK(allocator.get_stats().largest_free_block == 512);
+		BuddyBlockAllocator::block_allocation f = allocator.allocate(512);
+		CHECK(f.unit_id == a.unit_id && f.offset == 512);
+
+		// A request bigger than the unit gets a unit of its own
+		BuddyBlockAllocator::block_allocation g = allocator.allocate(3000);
+		CHECK(g.unit_id != 0 && g.unit_id != a.unit_id && g.offset == 0);
+		CHECK(allocator.get_stats().buffer_units == 2 && allocator.get_stats().reserved_bytes == 1024 + 4096);
+
+		// Units are released as soon as they are empty
+		allocator.free(g.unit_id, g.offset);
+		allocator.free(e.unit_id, e.offset);
+		allocator.free(f.unit_id, f.offset);
+		BuddyBlockAllocator::allocator_stats stats = allocator.get_stats();
+		CHECK(stats.buffer_units == 0 && stats.reserved_bytes == 0 && stats.live_blocks == 0);
+		CHECK(stats.requested_bytes == 0 && stats.allocated_bytes == 0);
+		CHECK(allocator.get_unit_ids().empty());
+	}
+
+	void test_random_trace_with_alignments() {
+		// Alignments that are not powers of 2 as well, like an odd minUniformBufferOffsetAlignment
+		std::vector<uint64_t> alignments = {1, 3, 7, 24, 48, 80, 96, 192, 64, 256};
+		std::mt19937_64 random_engine(27);
+		std::vector<BuddyBlockAllocator::trace_event> trace = generate_random_trace(random_engine, 20000, 3000, alignments, 3);
+
+		BuddyBlockAllocator::HostMemoryBackingStore backing_store;
+		BuddyBlockAllocator allocator(backing_store, 65536, 32);
+		// Live allocations of every unit by offset, with their end and the byte written in them
+		std::map<uint64_t, std::map<uint64_t, std::pair<uint64_t, uint8_t>>> live_ranges;
+		std::vector<BuddyBlockAllocator::block_allocation> allocations(trace.size());
+		uint64_t live_requested_bytes = 0;
+		for (uint64_t i = 0; i < trace.size(); i++) {
+			const BuddyBlockAllocator::trace_event &event = trace[i];
+			if (event.is_free) {
+				BuddyBlockAllocator::block_allocation &to_free = allocations[event.allocation_event_index];
+				// The memory of the block must not have been touched by the other allocations
+				uint8_t written_byte = live_ranges[to_free.unit_id][to_free.offset].second;
+				const uint8_t *data = static_cast<const uint8_t*>(to_free.host_ptr);
+				CHECK(std::all_of(data, data + event.size, [&](uint8_t byte) { return byte == written_byte; }));
+				live_ranges[to_free.unit_id].erase(to_free.offset);
+				allocator.free(to_free.unit_id, to_free.offset);
+				live_requested_bytes -= event.size;
+				continue;
+			}
+
+			BuddyBlockAllocator::block_allocation allocation = allocator.allocate(event.size, event.alignment);
+			allocations[i] = allocation;
+			CHECK(allocation.unit_id != 0);
+			CHECK(allocation.offset % event.alignment == 0);
+			// The allocation must not overlap its neighbours in the unit
+			auto &unit_ranges = live_ranges[allocation.unit_id];
+			auto next = unit_ranges.lower_bound(allocation.offset);
+			CHECK(next == unit_ranges.end() || allocation.offset + event.size <= next->first);
+			CHECK(next == unit_ranges.begin() || std::prev(next)->second.first <= allocation.offset);
+			uint8_t written_byte = static_cast<uint8_t>(i);
+			std::fill_n(static_cast<uint8_t*>(allocation.host_ptr), event.size, written_byte);
+			unit_ranges[allocation.offset] = {allocation.offset + event.size, written_byte};
+			live_requested_bytes += event.size;
+			CHECK(allocator.get_stats().requested_bytes == live_requested_bytes);
+		}
+
+		for (auto& [unit_id, unit_ranges] : live_ranges) {
+			for (auto& [offset, range] : unit_ranges) {
+				allocator.free(unit_id, offset);
+			}
+		}
+		BuddyBlockAllocator::allocator_stats stats = allocator.get_stats();
+		CHECK(stats.live_blocks == 0 && stats.requested_bytes == 0 && stats.allocated_bytes == 0 && stats.buffer_units == 0);
+		CHECK(stats.failed_allocation_count == 0);
+	}
+
+	// Replays the trace on a fresh allocator while recording it, the recorded trace and the final state must be the same at
+	// every replay
+	void check_replay_equivalence(const std::vector<BuddyBlockAllocator::trace_event> &trace, uint64_t block_initial_size, uint64_t min_allocation_size) {
+		NullBackingStore first_backing_store, second_backing_store;
+		BuddyBlockAllocator first_allocator(first_backing_store, block_initial_size, min_allocation_size);
+		BuddyBlockAllocator second_allocator(second_backing_store, block_initial_size, min_allocation_size);
+		first_allocator.set_trace_recording(true);
+		first_allocator.replay_trace(trace);
+		second_allocator.set_trace_recording(true);
+		second_allocator.replay_trace(first_allocator.get_trace());
+
+		CHECK(same_trace(first_allocator.get_trace(), trace));
+		CHECK(same_trace(second_allocator.get_trace(), trace));
+		CHECK(same_state(first_allocator.get_stats(), second_allocator.get_stats()));
+		CHECK(first_backing_store.live_units == first_allocator.get_stats().buffer_units);
+	}
+
+	void test_replay() {
+		std::mt19937_64 random_engine(46);
+		std::vector<BuddyBlockAllocator::trace_event> trace = generate_random_trace(random_engine, 10000, 100000, {1, 4, 16, 48, 256});
+
+		// The trace of direct calls is the trace that was played
+		NullBackingStore backing_store;
+		BuddyBlockAllocator allocator(backing_store, 1 << 20, 32);
+		allocator.set_trace_recording(true);
+		std::vector<BuddyBlockAllocator::block_allocation> allocations(trace.size());
+		for (uint64_t i = 0; i < trace.size(); i++) {
+			if (trace[i].is_free) {
+				allocator.free(allocations[trace[i].allocation_event_index].unit_id, allocations[trace[i].allocation_event_index].offset);
+			}
+			else {
+				allocations[i] = allocator.allocate(trace[i].size, trace[i].alignment);
+			}
+		}
+		CHECK(same_trace(allocator.get_trace(), trace));
+		check_replay_equivalence(trace, 1 << 20, 32);
+
+		// And it survives the json of the session files
+		nlohmann::json trace_json = allocator.get_trace();
+		CHECK(same_trace(trace_json.get<std::vector<BuddyBlockAllocator::trace_event>>(), trace));
+	}
+
+	void test_recording_started_late() {
+		NullBackingStore backing_store;
+		BuddyBlockAllocator allocator(backing_store, 1024, 32);
+		BuddyBlockAllocator::block_allocation before_recording = allocator.allocate(100);
+		allocator.set_trace_recording(true);
+		BuddyBlockAllocator::block_allocation during_recording = allocator.allocate(50);
+		allocator.free(before_recording.unit_id, before_recording.offset);
+		allocator.free(during_recording.unit_id, during_recording.offset);
+
+		// The block allocated before the recording is not in the trace, so its free is left out as well
+		const std::vector<BuddyBlockAllocator::trace_event> &trace = allocator.get_trace();
+		CHECK(trace.size() == 2);
+		CHECK(trace.size() == 2 && !trace[0].is_free && trace[0].size == 50);
+		CHECK(trace.size() == 2 && trace[1].is_free && trace[1].allocation_event_index == 0);
+		check_replay_equivalence(trace, 1024, 32);
+
+		// Frees that do not refer to an earlier allocation are skipped by the replay
+		NullBackingStore replay_backing_store;
+		BuddyBlockAllocator replay_allocator(replay_backing_store, 1024, 32);
+		replay_allocator.replay_trace({{false, 64, 1, 0}, {true, 64, 0, 5}, {true, 64, 0, 1}, {true, 64, 0, 0}, {true, 64, 0, 0}});
+		CHECK(replay_allocator.get_stats().live_blocks == 0 && replay_allocator.get_stats().free_count == 1);
+	}
+}
+
+int main(int argc, char *argv[]) {
+	test_split_and_merge();
+	test_random_trace_with_alignments();
+	test_replay();
+	test_recording_started_late();
+
+	for (int i = 1; i < argc; i++) {
+		for (const session_trace &trace : load_session_traces(argv[i])) {
+			std::cout << "Replaying " << trace.name << " of " << argv[i] << ": " << trace.trace.size() << " events" << std::endl;
+			check_replay_equivalence(trace.trace, trace.block_initial_size, trace.min_allocation_size);
+		}
+	}
+
+	if (failures != 0) {
+		std::cerr << failures << " checks failed" << std::endl;
+		return 1;
+	}
+	std::cout << "All checks passed" << std::endl;
+	return 0;
+}
@@ -0,0 +1,67 @@
+// Packs the compiled SPIR-V files in the archive read by ShaderArchive
+// Usage: shader_packer <archive path> <spv files...>
+#include <iostream>
+#include <fstream>
+#include <filesystem>
+#include <vector>
+#include <cstring>
+#include "../TheVulkanTemple/shader_archive.h"
+
+int main(int argc, char *argv[]) {
+    if (argc < 2) {
+        std::cerr << "Usage: shader_packer <archive path> <spv files...>" << std::endl;
+        return 1;
+    }
+
+    std::vector<ShaderArchive::entry> entries;
+    std::vector<std::vector<uint8_t>> codes;
+    uint64_t offset = sizeof(ShaderArchive::header) + (argc - 2) * sizeof(ShaderArchive::entry);
+    for (int i = 2; i < argc; i++) {
+        std::string name = std::filesystem::path(argv[i]).filename().string();
+        if (name.size() >= sizeof(ShaderArchive::entry::name)) {
+            std::cerr << "Shader name too long: " << name << std::endl;
+            return 1;
+        }
+        std::ifstream file(argv[i], std::ios::in | std::ios::binary);
+        if (!file.is_open()) {
+            std::cerr << "Could not open " << argv[i] << std::endl;
+            return 1;
+        }
+        std::vector<uint8_t> code(std::filesystem::file_size(argv[i]));
+        file.read(reinterpret_cast<char*>(code.data()), code.size());
+
+        ShaderArchive::entry entry = {};
+        strncpy(entry.name, name.c_str(), sizeof(entry.name) - 1);
+        offset += (ShaderArchive::code_alignment - offset % ShaderArchive::code_alignment) % ShaderArchive::code_alignment;
+        entry.offset = offset;
+        entry.size = code.size();
+        entry.hash = ShaderArchive::hash(code.data(), code.size());
+        offset += code.size();
+        entries.push_back(entry);
+        codes.push_back(std::move(code));
+    }
+
+    // Written to a temporary file first, so that a failed pack does not leave a truncated archive
+    std::string archive_path = argv[1];
+    std::string tmp_archive_path = archive_path + ".tmp";
+    std::ofstream archive(tmp_archive_path, std::ios::out | std::ios::binary | std::ios::trunc);
+    if (!archive.is_open()) {
+        std::cerr << "Could not create " << tmp_archive_path << std::endl;
+        return 1;
+    }
+    ShaderArchive::header header = {ShaderArchive::file_magic, ShaderArchive::file_version, static_cast<uint32_t>(entries.size()), 0};
+    archive.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    archive.write(reinterpret_cast<const char*>(entries.data()), entries.size() * sizeof(ShaderArchive::entry));
+    for (size_t i = 0; i < entries.size(); i++) {
+        const char padding[ShaderArchive::code_alignment] = {};
+        archive.write(padding, entries[i].offset - archive.tellp());
+        archive.write(reinterpret_cast<const char*>(codes[i].data()), codes[i].size());
+    }
+    archive.close();
+    if (!archive) {
+        std::cerr << "Could not write " << tmp_archive_path << std::endl;
+        return 1;
+    }
+    std::filesystem::rename(tmp_archive_path, archive_path);
+    return 0;
+}